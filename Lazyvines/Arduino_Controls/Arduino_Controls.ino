@@ -1,8 +1,12 @@
 /*  ECE496 Scanner Project: Phrase I
- *  Date: 12/31/2015 Rev. 3.1
+ *  Date: 12/31/2015 Rev. 4
  *  Author: S. Yang 
  *  
  *  This revision of the code is improved from Rev 2. to use Stepper motor opposed to the exisiting Servo motor.
+ *  Rev 4. keeps track of the disk position so that the PC can take the steps of a turn out of sequence: 
+ *    'H' <lo> <hi>   The disk stands at step hi * 256 + lo now. 
+ *    'P' <lo> <hi>   Turn to step hi * 256 + lo the shorter way round, acknowledged once there. 
+ *    A '1' still moves one step forward. 
  *    
  *  This Ardruino implementation is designed to be preloaded into the Arduino Hardware while using the main executable program.
  *  The code downloaded into the Arduino Nano chip will control the fine position of the motor. 
@@ -25,12 +29,18 @@
 #define OPTIC_SWT   3
 
 #define STEP_SIZE   40
+#define REV_STEPS   160
 #define WARM_UP_TM  5
 #define POLL_FREQ   100
 
 #define ACK_READY   '1'
 #define ACK_COMPL   '0'
 #define ACK_FAIL    '1'
+#define CMD_HOME    'H'
+#define CMD_GOTO    'P'
+
+// Disk position in steps, 0 to REV_STEPS - 1 
+int position = 0; 
 
 // Setup Code
 void setup() {        
@@ -51,6 +61,29 @@ void setup() {
   
 }
 
+// Step Motor by Motor Step, backward if reverse is set 
+void stepMotor(int reverse) {
+  digitalWrite(MOTOR_DIR, reverse ? HIGH : LOW);
+  int counter = 0; 
+  for (; counter < STEP_SIZE; counter++){
+    digitalWrite(MOTOR_STEP, HIGH); 
+    delay(5); 
+    digitalWrite(MOTOR_STEP, LOW); 
+    delay(5); 
+  }
+  position = (position + (reverse ? REV_STEPS - 1 : 1)) % REV_STEPS; 
+}
+
+// Reads a step sent as two bytes, low byte first 
+int readStep() {
+  while (Serial.available() < 2) {
+    delay (1); 
+  }
+  int lo = Serial.read(); 
+  int hi = Serial.read(); 
+  return (hi * 256 + lo) % REV_STEPS; 
+}
+
 // Hardware Execution Code 
 void loop() {
   
@@ -66,16 +99,27 @@ void loop() {
   if (inbyte == ACK_READY){
     
     digitalWrite(LED_STEP, HIGH);  
-
-    // Step Motor by Motor Step
-    int counter = 0; 
-    for (; counter < STEP_SIZE; counter++){
-      digitalWrite(MOTOR_STEP, HIGH); 
-      delay(5); 
-      digitalWrite(MOTOR_STEP, LOW); 
-      delay(5); 
+    stepMotor(0); 
+    digitalWrite(LED_STEP, LOW);  
+    
+    // Acknowledge Success
+    Serial.print(ACK_COMPL);
+  }
+  else if (inbyte == CMD_HOME){
+    position = readStep(); 
+    Serial.print(ACK_COMPL);
+  }
+  else if (inbyte == CMD_GOTO){
+    
+    // Forward unless backward is shorter 
+    int target = readStep(); 
+    int ahead = (target - position + REV_STEPS) % REV_STEPS; 
+    int reverse = ahead > REV_STEPS / 2; 
+    
+    digitalWrite(LED_STEP, HIGH);  
+    while (position != target){
+      stepMotor(reverse); 
     }
-
     digitalWrite(LED_STEP, LOW);  
     
     // Acknowledge Success
@@ -1,11 +1,455 @@
-// ConsoleApplication1.cpp : Defines the entry point for the console application.
-//
+/************************************************************************************************************************
+
+3D Rotational Scanner Batch Executable: SEG Scanner (Headless)
+
+Reprocesses recorded scans without a display, a serial port or any interactive prompt. Shares the camera array,
+extractor, mapper and point storage sources with the Scanner project.
+
+Usage: ConsoleApplication1 [-c calib.txt] [-s stages] [-n steps] [-o out_dir] [-f format] [-p bits] [-x ext] [-i ext] [-a calib.txt] [-m pixels] [-e normals] [-t pixels] [-d tris[,pixels]] [-l fixed|otsu|percentile] [-r runs] <scan> [<scan> ...]
+       ConsoleApplication1 [-c calib.txt] -k out_calib.txt <rig>
+* <scan>:		A scan directory holding one frame directory per camera (e.g. Images_A, Images_B), a .scan frame
+				archive or a .3dps / .3dpz file.
+* -c:			Calibration file overriding Calibrations.h (see loadCalibration), including PLANE blocks for cameras
+				seeing several laser lines.
+* -s:			Comma separated stages to run: extract, translate, save, archive, all. Default: all.
+				archive packs frame directories into <out_dir>\<scan name>.scan.
+* -n:			Number of steps per scan. Default: REV_STEPS.
+* -o:			Output directory for saved results. Default: current directory.
+* -f:			Format of saved points: 3dpz (compressed) or 3dps (text). Default: 3dpz.
+* -p:			Precision of 3dpz output in grid bits per axis (1..OCT_DEPTH_MAX). Default: OCT_DEPTH_DEFAULT.
+* -x:			Also export saved points for external tools: ply (binary) or obj. Default: none.
+* -i:			Also render a preview image of every scan to <out_dir>\<scan name>.<ext>: png or bmp. Default: none.
+* -a:			Align every camera to camera 1 by ICP (see Align.h) before saving, and save the refined calibration to
+				calib.txt after the batch. Later scans of the batch are translated with the refinement already applied.
+* -m:			Merge the cameras' clouds into one before saving, one point per cell of the given edge in image pixels
+				(see Merge.h). Default: none.
+* -e:			Estimate point normals before saving (see Normals.h), exported with ply: auto (from the scan lattice
+				where the points still pair with their pixels) or fitted (neighbourhood planes). Default: none.
+* -t:			Fuse every scan into a TSDF volume with voxels of the given edge in image pixels (see Tsdf.h) and save
+				its mesh to <out_dir>\<scan name>.stl. Translated steps are fused as the workers finish them, loaded
+				points with their normals (fitted unless -e gave them). Default: none.
+* -d:			Decimate the -t mesh before saving (see Decimate.h) to at most tris triangles (0 for no budget), or
+				until it would move by more than the given image pixels, whichever comes first. Needs -t; a mesh that cannot be
+				decimated is saved in full. Default: none.
+* -l:			Laser thresholds of every camera (see extractBody): fixed (the calibration's), otsu or percentile
+				(derived per frame from the previous frame's histograms). Default: THRESHOLD_AUTO of the calibration.
+* -r:			Laser runs kept per image row, best scored first (1..SEG_MAX_KEEP), to drop reflections before they are
+				translated; 0 keeps every run. Default: SEGMENTS of the calibration.
+* -k:			Calibrate instead: fit every camera's calibration to the laser images under <rig> (see Calibrate.h) and
+				save it to out_calib.txt. Values that cannot be measured are taken from -c or Calibrations.h.
+
+Buffers, frame prefetch pools and camera worker threads are created once and reused for every scan of the batch.
+
+*************************************************************************************************************************/
 
 #include "stdafx.h"
 
+#include "Config.h"
+#include "Calibrations.h"
+#include "Camera.h"
+#include "Calibrate.h"
+#include "Align.h"
+#include "Merge.h"
+#include "Normals.h"
+#include "Tsdf.h"
+#include "Decimate.h"
+#include "Export.h"
+#include "PointIO.h"
+#include "PointCodec.h"
+#include "ScanArchive.h"
+
+/********************************************** Global Variables **********************************************/
+
+// Batch Job Settings
+typedef struct {
+	const char* calib;
+	const char* out_dir;
+	int stages;
+	int steps;
+	int compressed;				// Save as .3dpz rather than .3dps
+	int depth;					// .3dpz precision
+	const char* export_ext;		// Extra export format, NULL if none
+	const char* preview_ext;	// Preview image format, NULL if none
+	const char* align_out;		// Align cameras and save the refined calibration here, NULL if not
+	float merge_cell;			// Merge cell edge in pixels, 0 to keep the cameras apart
+	int normals;				// NRM_* estimation method, UNINIT for none
+	float fuse_voxel;			// Fusion voxel edge in pixels, 0 for no mesh
+	int decimate_tris;			// Triangle budget of the mesh, 0 for none
+	float decimate_error;		// Decimation error bound in pixels, 0 for none
+	int thresh_mode;			// THRESH_* mode of every camera, UNINIT to keep the calibration's
+	int seg_keep;				// Laser runs kept per row by every camera, UNINIT to keep the calibration's
+	const char* calib_out;		// Calibrate from a rig directory into this file, NULL to process scans
+}JOB;
+
+static const struct {
+	const char* name;
+	int flag;
+} STAGE_NAMES[] = {
+	{ "extract", STAGE_EXTRACT },
+	{ "translate", STAGE_TRANSLATE },
+	{ "save", STAGE_SAVE },
+	{ "archive", STAGE_ARCHIVE },
+	{ "all", STAGE_EXTRACT | STAGE_TRANSLATE | STAGE_SAVE },
+};
+
+// Fusion volume shared by the camera workers, NULL unless -t is given.
+static TSDF* FUSION = NULL;
+
+/********************************************** Basic Functions **********************************************/
+
+// Exit Program in case of Error. Never waits on the console, the batch may run unattended.
+void errorExit(const char* prompt){
+	printf("Error occurred: %s. \nProgram completed with error. \n", prompt);
+	exit(ERR);
+}
+
+static void usage(){
+	printf("Usage: ConsoleApplication1 [-c calib.txt] [-s extract,translate,save,archive|all] [-n steps] [-o out_dir] [-f 3dpz|3dps] [-p bits] [-x ply|obj] [-i png|bmp] [-a calib.txt] [-m pixels] [-e auto|fitted] [-t pixels] [-d tris[,pixels]] [-l fixed|otsu|percentile] [-r runs] <scan> [<scan> ...]\n");
+	printf("       ConsoleApplication1 [-c calib.txt] -k out_calib.txt <rig>\n");
+}
+
+// Converts a comma separated stage list into STAGE_* flags. Returns 0 on unknown stage names.
+static int parseStages(const char* list){
+	int stages = 0;
+	char buffer[CMD_MAXLEN];
+	strcpy_s(buffer, list);
+
+	char* ctx = NULL;
+	char* tok = strtok_s(buffer, ",", &ctx);
+	while (tok){
+		int i, found = 0;
+		for (i = 0; i < (int)(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0])); i++){
+			if (!_stricmp(tok, STAGE_NAMES[i].name)){ stages |= STAGE_NAMES[i].flag; found = 1; }
+		}
+		if (!found){
+			printf("Unknown stage: %s\n", tok);
+			return 0;
+		}
+		tok = strtok_s(NULL, ",", &ctx);
+	}
+	return stages;
+}
+
+// Returns 1 if path names a file with the given extension.
+static int hasExtension(const char* path, const char* ext){
+	size_t pl = strlen(path);
+	size_t el = strlen(ext);
+	return pl > el && !_stricmp(path + pl - el, ext);
+}
+
+// Extracts the scan name (last path component, without extension) of an input.
+static void scanName(const char* path, char* name){
+	char buffer[CMD_MAXLEN];
+	strcpy_s(buffer, path);
+
+	size_t len = strlen(buffer);
+	while (len > 0 && (buffer[len - 1] == '\\' || buffer[len - 1] == '/')) buffer[--len] = '\0';
+
+	char* base = buffer;
+	char* p;
+	for (p = buffer; *p; p++){
+		if (*p == '\\' || *p == '/') base = p + 1;
+	}
+	char* dot = strrchr(base, '.');
+	if (dot && dot != base) *dot = '\0';
+	strcpy_s(name, CMD_MAXLEN, base);
+}
+
+// Returns OKAY if fname is a WIDTH x HEIGHT BMP holding its whole image body, ERR otherwise.
+static int checkFrame(const char* fname){
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "rb") || !fptr) return ERR;
+	unsigned char header[54];
+	int ok = fread(header, 1, 54, fptr) == 54 && *(int*)&header[18] == WIDTH && *(int*)&header[22] == HEIGHT;
+	if (ok){
+		long body = *(int*)&header[10] + (long)((WIDTH * 3 + 3) / 4 * 4) * HEIGHT;
+		ok = !fseek(fptr, 0, SEEK_END) && ftell(fptr) >= body;
+	}
+	fclose(fptr);
+	return ok ? OKAY : ERR;
+}
+
+/********************************************** BATCH PROCESSING **********************************************/
+
+// Runs the requested stages on one scan. Returns OKAY on success, ERR if the scan was skipped.
+static int processScan(const char* input, JOB* job){
+
+	char name[CMD_MAXLEN];
+	scanName(input, name);
+	printf("*** Processing scan: %s\n", input);
+	unsigned long st = GetTickCount();
+
+	resetCameras();
+	if (FUSION) resetTsdf(FUSION);
+
+	int fused = 0;				// Steps were fused by the workers as they were translated
+	if (hasExtension(input, ".3dps")){
+		// Previously translated points: nothing left to extract.
+		if (read3DPS(input) != OKAY) return ERR;
+	}
+	else if (hasExtension(input, ".3dpz")){
+		if (read3DPZ(input) != OKAY) return ERR;
+	}
+	else if (hasExtension(input, ".scan")){
+		// Archived frames: Workers decompress each frame straight into their frame buffer.
+		SCAN_ARCHIVE* arc = openScanArchive(input);
+		if (!arc) return ERR;
+		if (arc->hdr.cams != NUM_CAMS){
+			printf("Scan archive holds %d cameras, configured for %d. Scan skipped. \n", arc->hdr.cams, NUM_CAMS);
+			closeScanArchive(arc);
+			return ERR;
+		}
+
+		// Steps a scan stopped early never took are left out.
+		int cam, step, missing = 0;
+		for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].src = arc;
+		for (step = 0; step < job->steps && step < arc->hdr.steps; step++){
+			if (!archiveHasStep(arc, step)){
+				missing++;
+				continue;
+			}
+			dispatchCameras(step);
+		}
+		waitCameras();
+		if (missing) printf("Scan %s: %d steps are not in the archive. \n", name, missing);
+		fused = (CAM_STAGES & STAGE_TRANSLATE) != 0;
+		for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].src = NULL;
+		closeScanArchive(arc);
+	}
+	else if (job->stages & (STAGE_EXTRACT | STAGE_TRANSLATE | STAGE_ARCHIVE)){
+		// Frames: Make sure every frame of every camera is there and whole before handing steps over, the workers
+		// cannot skip a scan once they have started on it.
+		setFrameRoot(input);
+		int cam, step;
+		for (cam = 0; cam < NUM_CAMS; cam++){
+			for (step = 0; step < job->steps; step++){
+				char fname[CMD_MAXLEN];
+				sprintf_s(fname, "%s\\%d.bmp", CAMS[cam].img_dir, step);
+				if (checkFrame(fname) != OKAY){
+					printf("Missing or damaged frame for camera %d: %s. Scan skipped. \n", CAMS[cam].id, fname);
+					return ERR;
+				}
+			}
+		}
+
+		// Pack the frame directories into one archive while extracting.
+		SCAN_ARCHIVE* arc = NULL;
+		if (job->stages & STAGE_ARCHIVE){
+			char arcname[CMD_MAXLEN];
+			sprintf_s(arcname, "%s\\%s.scan", job->out_dir, name);
+			arc = createScanArchive(arcname, NUM_CAMS, job->steps);
+			if (!arc) return ERR;
+			for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].dst = arc;
+		}
+
+		// Keep a window of upcoming frames in flight per camera while the workers extract.
+		if (CAM_STAGES & STAGE_EXTRACT){
+			for (cam = 0; cam < NUM_CAMS; cam++) startPrefetch(&CAMS[cam], 0, job->steps);
+		}
+
+		for (step = 0; step < job->steps; step++){
+			dispatchCameras(step);
+		}
+		waitCameras();
+		fused = (CAM_STAGES & STAGE_TRANSLATE) != 0;
+
+		for (cam = 0; cam < NUM_CAMS; cam++){
+			stopPrefetch(&CAMS[cam]);
+			CAMS[cam].dst = NULL;
+		}
+		closeScanArchive(arc);
+	}
+
+	int cam;
+	for (cam = 0; cam < NUM_CAMS; cam++){
+		printf("Cam %d pts: %d \n", CAMS[cam].id, CAMS[cam].p3d.used);
+	}
+
+	// Merge: Bring the cameras into line, and optionally fuse them, before their points are written together.
+	if (job->align_out && alignCameras() != OKAY) printf("Scan %s: Some cameras could not be aligned. \n", name);
+	if (job->merge_cell > 0 && mergeCameras(job->merge_cell) != OKAY) return ERR;
+	if (job->normals != UNINIT && estimateNormals(job->normals) != OKAY) return ERR;
+
+	// Fusion: Loaded points were never seen by the workers and are fused whole, along their normals.
+	if (FUSION){
+		for (cam = 0; cam < NUM_CAMS && !fused; cam++){
+			PCLOUD* pc = &CAMS[cam].p3d;
+			if (!pc->used) continue;
+			if (!(pc->attrs & PC_NORMALS) && fittedNormals(pc) != OKAY) return ERR;
+			if (integrateCloud(FUSION, pc) != OKAY) return ERR;
+		}
+
+		char fsname[CMD_MAXLEN];
+		sprintf_s(fsname, "%s\\%s.stl", job->out_dir, name);
+		MESH mesh;
+		if (extractMesh(FUSION, &mesh) != OKAY) return ERR;
+		if (decimateMesh(&mesh, job->decimate_tris, job->decimate_error * 2 / WIDTH) != OKAY){
+			printf("Scan %s: Cannot decimate mesh, saved in full. \n", name);
+		}
+		int saved = exportMeshSTL(fsname, &mesh);
+		printf("Scan %s: %d triangles fused. \n", name, mesh.used);
+		freeMesh(&mesh);
+		if (saved != OKAY) return ERR;
+	}
+
+	if (job->stages & STAGE_SAVE){
+		char fsname[CMD_MAXLEN];
+		sprintf_s(fsname, "%s\\%s%s", job->out_dir, name, job->compressed ? ".3dpz" : ".3dps");
+		int saved = job->compressed ? write3DPZ(fsname, job->depth) : write3DPS(fsname);
+		if (saved != OKAY) return ERR;
+
+		if (job->export_ext){
+			sprintf_s(fsname, "%s\\%s.%s", job->out_dir, name, job->export_ext);
+			if (exportPoints(fsname) != OKAY) return ERR;
+		}
+	}
+
+	if (job->preview_ext){
+		char fsname[CMD_MAXLEN];
+		sprintf_s(fsname, "%s\\%s.%s", job->out_dir, name, job->preview_ext);
+		if (renderPreview(fsname) != OKAY) return ERR;
+	}
+
+	printf("Scan %s completed in %lu ms. \n", name, (unsigned long)(GetTickCount() - st));
+	return OKAY;
+}
 
 int _tmain(int argc, _TCHAR* argv[])
 {
-	return 0;
-}
 
+	/********************************************* Initialization *********************************************/
+	JOB job;
+	job.calib = NULL;
+	job.out_dir = ".";
+	job.stages = STAGE_EXTRACT | STAGE_TRANSLATE | STAGE_SAVE;
+	job.steps = REV_STEPS;
+	job.compressed = 1;
+	job.depth = OCT_DEPTH_DEFAULT;
+	job.export_ext = NULL;
+	job.preview_ext = NULL;
+	job.align_out = NULL;
+	job.merge_cell = 0;
+	job.normals = UNINIT;
+	job.fuse_voxel = 0;
+	job.decimate_tris = 0;
+	job.decimate_error = 0;
+	job.thresh_mode = UNINIT;
+	job.seg_keep = UNINIT;
+	job.calib_out = NULL;
+
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++){
+		if (arg + 1 >= argc){ usage(); return ERR; }
+		switch (argv[arg][1]){
+		case 'c': job.calib = argv[++arg]; break;
+		case 'a': job.align_out = argv[++arg]; break;
+		case 'm':
+			job.merge_cell = (float)atof(argv[++arg]);
+			if (job.merge_cell <= 0){ usage(); return ERR; }
+			break;
+		case 'e':
+			arg++;
+			if (!_stricmp(argv[arg], "auto")) job.normals = NRM_AUTO;
+			else if (!_stricmp(argv[arg], "fitted")) job.normals = NRM_FITTED;
+			else { usage(); return ERR; }
+			break;
+		case 't':
+			job.fuse_voxel = (float)atof(argv[++arg]);
+			if (job.fuse_voxel <= 0){ usage(); return ERR; }
+			break;
+		case 'd':
+			if (sscanf_s(argv[++arg], "%d,%f", &job.decimate_tris, &job.decimate_error) < 1 ||
+				job.decimate_tris < 0 || job.decimate_error < 0 || (!job.decimate_tris && !job.decimate_error)){ usage(); return ERR; }
+			break;
+		case 'l':
+			arg++;
+			if (!_stricmp(argv[arg], "fixed")) job.thresh_mode = THRESH_FIXED;
+			else if (!_stricmp(argv[arg], "otsu")) job.thresh_mode = THRESH_OTSU;
+			else if (!_stricmp(argv[arg], "percentile")) job.thresh_mode = THRESH_PERCENTILE;
+			else { usage(); return ERR; }
+			break;
+		case 'r':
+			job.seg_keep = atoi(argv[++arg]);
+			if (job.seg_keep < 0 || job.seg_keep > SEG_MAX_KEEP){ usage(); return ERR; }
+			break;
+		case 'k': job.calib_out = argv[++arg]; break;
+		case 'o': job.out_dir = argv[++arg]; break;
+		case 'n': job.steps = atoi(argv[++arg]); break;
+		case 'p': job.depth = atoi(argv[++arg]); break;
+		case 'x':
+			job.export_ext = argv[++arg];
+			if (_stricmp(job.export_ext, "ply") && _stricmp(job.export_ext, "obj")){ usage(); return ERR; }
+			break;
+		case 'i':
+			job.preview_ext = argv[++arg];
+			if (_stricmp(job.preview_ext, "png") && _stricmp(job.preview_ext, "bmp")){ usage(); return ERR; }
+			break;
+		case 'f':
+			arg++;
+			if (!_stricmp(argv[arg], "3dpz")) job.compressed = 1;
+			else if (!_stricmp(argv[arg], "3dps")) job.compressed = 0;
+			else { usage(); return ERR; }
+			break;
+		case 's':
+			job.stages = parseStages(argv[++arg]);
+			if (!job.stages){ usage(); return ERR; }
+			break;
+		default: usage(); return ERR;
+		}
+	}
+	if (arg >= argc || job.steps <= 0 || job.depth < 1 || job.depth > OCT_DEPTH_MAX){ usage(); return ERR; }
+	// Decimation only applies to the fused mesh.
+	if ((job.decimate_tris || job.decimate_error) && job.fuse_voxel <= 0){
+		printf("-d needs -t. \n");
+		usage();
+		return ERR;
+	}
+
+	// Camera Array: Buffers and workers live for the whole batch.
+	initCameras();
+	if (job.calib && loadCalibration(job.calib) != OKAY) errorExit("Cannot load calibration file");
+	int cam;
+	for (cam = 0; cam < NUM_CAMS; cam++){
+		if (job.thresh_mode != UNINIT) CAMS[cam].autothr.mode = job.thresh_mode;
+		if (job.seg_keep != UNINIT) CAMS[cam].seg_keep = job.seg_keep;
+	}
+
+	/********************************************* CALIBRATION *********************************************/
+	if (job.calib_out){
+		if (argc - arg != 1){ usage(); return ERR; }
+		int ok = calibrateCameras(argv[arg]) == OKAY && saveCalibration(job.calib_out) == OKAY;
+		freeCameras();
+		printf(ok ? "Calibration Completed: %s \n" : "Calibration Failed: %s \n", job.calib_out);
+		return ok ? OKAY : ERR;
+	}
+
+	CAM_STAGES = job.stages & (STAGE_EXTRACT | STAGE_TRANSLATE);
+	if (job.stages & STAGE_ARCHIVE) CAM_STAGES |= STAGE_EXTRACT;
+	if (job.fuse_voxel > 0){
+		FUSION = createTsdf(job.fuse_voxel * 2 / WIDTH);
+		if (!FUSION) errorExit("Cannot create fusion volume");
+		int cam;
+		for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].tsdf = FUSION;
+	}
+	startCameraWorkers();
+
+	/********************************************* BATCH *********************************************/
+	int failed = 0;
+	int scans = argc - arg;
+	for (; arg < argc; arg++){
+		if (processScan(argv[arg], &job) != OKAY) failed++;
+	}
+
+	/********************************************* EPILOGUE *********************************************/
+	stopCameraWorkers();
+	if (FUSION){
+		int cam;
+		for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].tsdf = NULL;
+		freeTsdf(FUSION);
+	}
+	if (job.align_out && saveCalibration(job.align_out) != OKAY) failed++;
+	freeCameras();
+
+	printf("Batch Completed: %d/%d scans processed. \n", scans - failed, scans);
+	return failed ? ERR : OKAY;
+}
@@ -8,7 +8,11 @@
 #include "targetver.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <tchar.h>
+#include <windows.h>
+#include <math.h>
 
 
 
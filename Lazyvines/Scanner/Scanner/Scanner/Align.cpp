@@ -0,0 +1,331 @@
+/************************************************************************************************************************
+
+Camera Alignment: Point-to-plane ICP between the clouds of two cameras.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "Align.h"
+#include "Camera.h"
+#include "KdTree.h"
+#include "Normals.h"
+#include "Parallel.h"
+
+// Structures
+typedef struct {
+	double ata[36];				// Normal equations of the linearized error, unknowns: rotation, translation
+	double atb[6];
+	double sq;					// Sum of squared residuals
+	int pairs;
+}ALIGN_SUM;
+
+typedef struct {
+	KDTREE tree;
+	float* ref;					// Reference sample, interleaved
+	float* normal;				// Interleaved per reference point, zero if not planar
+	int nref;
+	float* mov;					// Moving sample, interleaved
+	int nmov;
+	double R[9];				// Current estimate
+	double t[3];
+	float max_d2;
+	ALIGN_SUM* sums;			// Per pairing task
+}ALIGN_CTX;
+
+/*********** GEOMETRY ***********/
+
+static void identity(double* R, double* t){
+	memset(R, 0, 9 * sizeof(double));
+	R[0] = R[4] = R[8] = 1;
+	t[0] = t[1] = t[2] = 0;
+}
+
+// R = Rz(rz) * Ry(ry) * Rx(rx)
+static void eulerMatrix(double rx, double ry, double rz, double* R){
+	double ca = cos(rx), sa = sin(rx), cb = cos(ry), sb = sin(ry), cc = cos(rz), sc = sin(rz);
+	R[0] = cc * cb;	R[1] = cc * sb * sa - sc * ca;	R[2] = cc * sb * ca + sc * sa;
+	R[3] = sc * cb;	R[4] = sc * sb * sa + cc * ca;	R[5] = sc * sb * ca - cc * sa;
+	R[6] = -sb;		R[7] = cb * sa;					R[8] = cb * ca;
+}
+
+// Rotation by |w| radians about w.
+static void axisMatrix(const double* w, double* R){
+	double theta = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+	double t[3];
+	identity(R, t);
+	if (theta < 1e-12) return;
+	double k[3] = { w[0] / theta, w[1] / theta, w[2] / theta };
+	double c = cos(theta), s = sin(theta), v = 1 - c;
+	R[0] = c + k[0] * k[0] * v;			R[1] = k[0] * k[1] * v - k[2] * s;	R[2] = k[0] * k[2] * v + k[1] * s;
+	R[3] = k[1] * k[0] * v + k[2] * s;	R[4] = c + k[1] * k[1] * v;			R[5] = k[1] * k[2] * v - k[0] * s;
+	R[6] = k[2] * k[0] * v - k[1] * s;	R[7] = k[2] * k[1] * v + k[0] * s;	R[8] = c + k[2] * k[2] * v;
+}
+
+// (R1, t1) after (R2, t2): R = R1 * R2, t = R1 * t2 + t1. Outputs must not alias the inputs.
+static void compose(const double* R1, const double* t1, const double* R2, const double* t2, double* R, double* t){
+	int i, j;
+	for (i = 0; i < 3; i++){
+		for (j = 0; j < 3; j++) R[3 * i + j] = R1[3 * i] * R2[j] + R1[3 * i + 1] * R2[3 + j] + R1[3 * i + 2] * R2[6 + j];
+		t[i] = R1[3 * i] * t2[0] + R1[3 * i + 1] * t2[1] + R1[3 * i + 2] * t2[2] + t1[i];
+	}
+}
+
+static void applyTransform(const double* R, const double* t, const float* p, float* out){
+	out[0] = (float)(R[0] * p[0] + R[1] * p[1] + R[2] * p[2] + t[0]);
+	out[1] = (float)(R[3] * p[0] + R[4] * p[1] + R[5] * p[2] + t[1]);
+	out[2] = (float)(R[6] * p[0] + R[7] * p[1] + R[8] * p[2] + t[2]);
+}
+
+// Solves the 6x6 system a x = b by elimination with partial pivoting. Returns ERR if it is singular.
+static int solve6(double* a, double* b, double* x){
+	int i, j, k;
+	double scale = 0;
+	for (i = 0; i < 6; i++) scale = MAX(scale, fabs(a[7 * i]));
+	for (i = 0; i < 6; i++){
+		int piv = i;
+		for (j = i + 1; j < 6; j++){
+			if (fabs(a[6 * j + i]) > fabs(a[6 * piv + i])) piv = j;
+		}
+		if (fabs(a[6 * piv + i]) <= 1e-12 * scale) return ERR;
+		if (piv != i){
+			for (k = 0; k < 6; k++){
+				double s = a[6 * i + k];
+				a[6 * i + k] = a[6 * piv + k];
+				a[6 * piv + k] = s;
+			}
+			double s = b[i];
+			b[i] = b[piv];
+			b[piv] = s;
+		}
+		for (j = i + 1; j < 6; j++){
+			double f = a[6 * j + i] / a[6 * i + i];
+			for (k = i; k < 6; k++) a[6 * j + k] -= f * a[6 * i + k];
+			b[j] -= f * b[i];
+		}
+	}
+	for (i = 5; i >= 0; i--){
+		double s = b[i];
+		for (k = i + 1; k < 6; k++) s -= a[6 * i + k] * x[k];
+		x[i] = s / a[6 * i + i];
+	}
+	return OKAY;
+}
+
+/*********** ICP ***********/
+
+// Interleaved copy of about max evenly spaced points of pc, skipping those at the origin. Returns the count.
+static int samplePoints(const PCLOUD* pc, int max, float** out){
+	int stride = MAX(1, (pc->used + max - 1) / max);
+	*out = (float*)malloc(3 * (size_t)MAX(max, 1) * sizeof(float));
+	if (!*out) return 0;
+	int i, n = 0;
+	for (i = 0; i < pc->used && n < max; i += stride){
+		if (pc->x[i] == 0 && pc->y[i] == 0 && pc->z[i] == 0) continue;
+		(*out)[3 * n + 0] = pc->x[i];
+		(*out)[3 * n + 1] = pc->y[i];
+		(*out)[3 * n + 2] = pc->z[i];
+		n++;
+	}
+	return n;
+}
+
+static void normalTask(void* prm, int idx){
+	ALIGN_CTX* ctx = (ALIGN_CTX*)prm;
+	int first = idx * ALIGN_CHUNK;
+	int last = MIN(first + ALIGN_CHUNK, ctx->nref);
+	int nbr[ALIGN_NORMAL_K];
+	float d2[ALIGN_NORMAL_K];
+	int i;
+	for (i = first; i < last; i++){
+		int k = kdNearestK(&ctx->tree, ctx->ref + 3 * i, ALIGN_NORMAL_K, nbr, d2);
+		fitNormal(ctx->ref, nbr, k, ALIGN_PLANARITY, ctx->normal + 3 * i);
+	}
+}
+
+static void pairTask(void* prm, int idx){
+	ALIGN_CTX* ctx = (ALIGN_CTX*)prm;
+	ALIGN_SUM* sum = &ctx->sums[idx];
+	memset(sum, 0, sizeof(ALIGN_SUM));
+	int first = idx * ALIGN_CHUNK;
+	int last = MIN(first + ALIGN_CHUNK, ctx->nmov);
+	int i, r, c;
+	for (i = first; i < last; i++){
+		float p[3], d2;
+		applyTransform(ctx->R, ctx->t, ctx->mov + 3 * i, p);
+		int k = kdNearest(&ctx->tree, p, ctx->max_d2, &d2);
+		if (k == UNINIT) continue;
+		const float* n = ctx->normal + 3 * k;
+		if (n[0] == 0 && n[1] == 0 && n[2] == 0) continue;
+		const float* q = ctx->ref + 3 * k;
+
+		// Residual after a small rotation w and shift s: res + (p x n) . w + n . s
+		double res = (p[0] - q[0]) * n[0] + (p[1] - q[1]) * n[1] + (p[2] - q[2]) * n[2];
+		double row[6] = { p[1] * n[2] - p[2] * n[1], p[2] * n[0] - p[0] * n[2], p[0] * n[1] - p[1] * n[0], n[0], n[1], n[2] };
+		for (r = 0; r < 6; r++){
+			for (c = 0; c < 6; c++) sum->ata[6 * r + c] += row[r] * row[c];
+			sum->atb[r] -= row[r] * res;
+		}
+		sum->sq += res * res;
+		sum->pairs++;
+	}
+}
+
+// Pairs every sample under the current estimate. Fixed task order keeps the sums repeatable.
+static void pairSamples(ALIGN_CTX* ctx, ALIGN_SUM* total){
+	int tasks = (ctx->nmov + ALIGN_CHUNK - 1) / ALIGN_CHUNK;
+	parallelFor(tasks, pairTask, ctx);
+	memset(total, 0, sizeof(ALIGN_SUM));
+	int i, j;
+	for (i = 0; i < tasks; i++){
+		for (j = 0; j < 36; j++) total->ata[j] += ctx->sums[i].ata[j];
+		for (j = 0; j < 6; j++) total->atb[j] += ctx->sums[i].atb[j];
+		total->sq += ctx->sums[i].sq;
+		total->pairs += ctx->sums[i].pairs;
+	}
+}
+
+int alignClouds(const PCLOUD* ref, const PCLOUD* mov, ALIGN_FIT* fit){
+
+	memset(fit, 0, sizeof(ALIGN_FIT));
+	identity(fit->R, fit->t);
+
+	ALIGN_CTX ctx;
+	memset(&ctx, 0, sizeof(ALIGN_CTX));
+	ctx.nref = samplePoints(ref, ALIGN_REF_POINTS, &ctx.ref);
+	ctx.nmov = samplePoints(mov, ALIGN_SAMPLES, &ctx.mov);
+	ctx.normal = (float*)malloc(3 * (size_t)MAX(ctx.nref, 1) * sizeof(float));
+	ctx.sums = (ALIGN_SUM*)malloc(((ctx.nmov + ALIGN_CHUNK - 1) / ALIGN_CHUNK + 1) * sizeof(ALIGN_SUM));
+	int ok = ctx.ref && ctx.mov && ctx.normal && ctx.sums && ctx.nref >= ALIGN_NORMAL_K && ctx.nmov >= ALIGN_MIN_PAIRS;
+
+	// The tree indexes the interleaved sample, so its source indices address ref and normal directly.
+	float* axis[3] = { NULL, NULL, NULL };
+	int a, i;
+	for (a = 0; ok && a < 3; a++){
+		axis[a] = (float*)malloc(ctx.nref * sizeof(float));
+		ok = axis[a] != NULL;
+		for (i = 0; ok && i < ctx.nref; i++) axis[a][i] = ctx.ref[3 * i + a];
+	}
+	ok = ok && buildKdTree(&ctx.tree, axis[0], axis[1], axis[2], ctx.nref) == OKAY;
+	for (a = 0; a < 3; a++) free(axis[a]);
+	if (ok) parallelFor((ctx.nref + ALIGN_CHUNK - 1) / ALIGN_CHUNK, normalTask, &ctx);
+
+	identity(ctx.R, ctx.t);
+	double dist = ALIGN_MAX_DIST;
+	ALIGN_SUM sum;
+	int it;
+	for (it = 0; ok && it < ALIGN_ITERATIONS; it++){
+		ctx.max_d2 = (float)(dist * dist);
+		pairSamples(&ctx, &sum);
+		if (sum.pairs < ALIGN_MIN_PAIRS){
+			if (it == 0) ok = 0;
+			break;
+		}
+		double rms = sqrt(sum.sq / sum.pairs);
+		if (it == 0) fit->pairs_before = sum.pairs;
+
+		double x[6];
+		if (solve6(sum.ata, sum.atb, x) != OKAY) break;
+		double dR[9], R[9], t[3];
+		axisMatrix(x, dR);
+		compose(dR, x + 3, ctx.R, ctx.t, R, t);
+		memcpy(ctx.R, R, sizeof(R));
+		memcpy(ctx.t, t, sizeof(t));
+		fit->iterations = it + 1;
+
+		dist = MIN(dist, MAX(ALIGN_MIN_DIST, 3 * rms));
+		double step = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]) + sqrt(x[3] * x[3] + x[4] * x[4] + x[5] * x[5]);
+		if (step < ALIGN_CONVERGED) break;
+	}
+
+	// Residuals with and without the fit, both under the pairing distance the fit settled on. Without any pairs, the
+	// clouds as they were count as a gate apart.
+	if (ok){
+		ctx.max_d2 = (float)(dist * dist);
+		pairSamples(&ctx, &sum);
+		ok = sum.pairs >= ALIGN_MIN_PAIRS;
+	}
+	if (ok){
+		memcpy(fit->R, ctx.R, sizeof(ctx.R));
+		memcpy(fit->t, ctx.t, sizeof(ctx.t));
+		fit->pairs = sum.pairs;
+		fit->rms_after = sqrt(sum.sq / sum.pairs);
+
+		identity(ctx.R, ctx.t);
+		pairSamples(&ctx, &sum);
+		fit->rms_before = sum.pairs ? sqrt(sum.sq / sum.pairs) : dist;
+	}
+
+	freeKdTree(&ctx.tree);
+	free(ctx.ref);
+	free(ctx.mov);
+	free(ctx.normal);
+	free(ctx.sums);
+	return ok ? OKAY : ERR;
+}
+
+void transformCloud(PCLOUD* pc, const double* R, const double* t){
+	int i;
+	for (i = 0; i < pc->used; i++){
+		if (pc->x[i] == 0 && pc->y[i] == 0 && pc->z[i] == 0) continue;
+		float p[3] = { pc->x[i], pc->y[i], pc->z[i] }, q[3];
+		applyTransform(R, t, p, q);
+		pc->x[i] = q[0];
+		pc->y[i] = q[1];
+		pc->z[i] = q[2];
+	}
+}
+
+/*********** CALIBRATION ***********/
+
+int alignTransform(const CAM_CB* cb, double* R, double* t){
+	eulerMatrix(cb->ARX, cb->ARY, cb->ARZ, R);
+	t[0] = cb->ATX;
+	t[1] = cb->ATY;
+	t[2] = cb->ATZ;
+	return cb->ARX != 0 || cb->ARY != 0 || cb->ARZ != 0 || cb->ATX != 0 || cb->ATY != 0 || cb->ATZ != 0;
+}
+
+void composeAlignment(CAM_CB* cb, const double* R, const double* t){
+	double R0[9], t0[3], R1[9], t1[3];
+	alignTransform(cb, R0, t0);
+	compose(R, t, R0, t0, R1, t1);
+
+	double sy = MIN(1.0, MAX(-1.0, -R1[6]));
+	cb->ARY = asin(sy);
+	cb->ARX = atan2(R1[7], R1[8]);
+	cb->ARZ = atan2(R1[3], R1[0]);
+	cb->ATX = t1[0];
+	cb->ATY = t1[1];
+	cb->ATZ = t1[2];
+}
+
+int alignCameras(){
+	int c, failed = 0;
+	for (c = 1; c < NUM_CAMS; c++){
+		ALIGN_FIT fit;
+		if (alignClouds(&CAMS[0].p3d, &CAMS[c].p3d, &fit) != OKAY){
+			printf("Cam %d: No overlap with cam %d to align on. \n", CAMS[c].id, CAMS[0].id);
+			failed++;
+			continue;
+		}
+		if (fit.rms_after >= fit.rms_before || fit.pairs < ALIGN_KEEP_PAIRS * fit.pairs_before){
+			printf("Cam %d: Alignment to cam %d rejected: %d/%d pairs, residual %.5f -> %.5f. \n",
+				CAMS[c].id, CAMS[0].id, fit.pairs, fit.pairs_before, fit.rms_before, fit.rms_after);
+			failed++;
+			continue;
+		}
+		transformCloud(&CAMS[c].p3d, fit.R, fit.t);
+		composeAlignment(&CAMS[c].cb, fit.R, fit.t);
+
+		double angle = acos(MIN(1.0, MAX(-1.0, (fit.R[0] + fit.R[4] + fit.R[8] - 1) / 2))) * 180 / PI;
+		double shift = sqrt(fit.t[0] * fit.t[0] + fit.t[1] * fit.t[1] + fit.t[2] * fit.t[2]);
+		printf("Cam %d aligned to cam %d: %d pairs, residual %.5f -> %.5f in %d iterations (%.3f deg, shift %.5f). \n",
+			CAMS[c].id, CAMS[0].id, fit.pairs, fit.rms_before, fit.rms_after, fit.iterations, angle, shift);
+	}
+	return failed ? ERR : OKAY;
+}
@@ -0,0 +1,65 @@
+/************************************************************************************************************************
+
+Camera Alignment: Point-to-plane ICP between the clouds of two cameras.
+Errors in a camera's RAO or calibration show up as two offset shells. Over the part of the object both cameras see,
+alignClouds estimates the rigid transform taking the moving cloud onto the reference one:
+* The reference is subsampled into a k-d tree (KdTree.h) and every point gets the normal of its neighbourhood
+  plane (fitNormal, Normals.h). Neighbourhoods that are not planar (e.g. a lone laser profile) get no normal and
+  never pair.
+* Each iteration pairs evenly spaced samples of the moving cloud, under the current estimate, with their nearest
+  reference point within the pairing distance. The pairs are scored in parallel into the normal equations of the
+  linearized point-to-plane error, whose solution updates the estimate.
+* The pairing distance starts at ALIGN_MAX_DIST and follows three times the residual down to ALIGN_MIN_DIST, so the
+  surfaces pull together first and mismatched regions drop out as the fit settles.
+Points at the origin (pixels the mapper rejected) are ignored and left in place.
+
+Residuals are the RMS point-to-plane distances of the pairs, in point units (1 = WIDTH / 2 pixels).
+The result composes into the CAM_CB alignment (CB_N_ALIGN_*), which TranslatePoints applies to every new point.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "Calibrations.h"
+#include "PointCloud.h"
+
+#define ALIGN_SAMPLES			16384		// Moving points paired per iteration
+#define ALIGN_REF_POINTS		131072		// Reference points in the k-d tree at most
+#define ALIGN_NORMAL_K			16			// Neighbours fitted for each reference normal
+#define ALIGN_PLANARITY			0.05		// Second to largest spread ratio a neighbourhood needs to count as planar
+#define ALIGN_MAX_DIST			0.05		// Initial pairing distance (point units)
+#define ALIGN_MIN_DIST			0.002		// Smallest pairing distance
+#define ALIGN_ITERATIONS		30
+#define ALIGN_CONVERGED			1e-6		// Update size (rad plus point units) ending the iterations
+#define ALIGN_MIN_PAIRS			200
+#define ALIGN_KEEP_PAIRS		0.25		// Share of the first iteration's pairs a fit must still pair to be kept
+#define ALIGN_CHUNK				1024		// Points per parallel task
+
+// Structures
+typedef struct {
+	double R[9];				// Row major rotation, then translation t, taking the moving cloud onto the reference
+	double t[3];
+	int pairs_before;			// Pairs of the first iteration
+	int pairs;					// Pairs of the final estimate
+	int iterations;
+	double rms_before;			// Residuals without and with the fit, under its final pairing distance
+	double rms_after;
+}ALIGN_FIT;
+
+// Estimates the transform taking mov onto ref. Returns OKAY, ERR if the clouds do not overlap or out of memory.
+int alignClouds(const PCLOUD* ref, const PCLOUD* mov, ALIGN_FIT* fit);
+
+// Applies a rigid transform to every point of pc except those at the origin.
+void transformCloud(PCLOUD* pc, const double* R, const double* t);
+
+// Rigid correction of a calibration. Returns 0 if it is the identity.
+int alignTransform(const CAM_CB* cb, double* R, double* t);
+
+// Follows the calibration's correction with R, t.
+void composeAlignment(CAM_CB* cb, const double* R, const double* t);
+
+// Aligns every camera's cloud to camera 1's, moving its points and updating its calibration. Fits that do not lower
+// the residual, or pair less than ALIGN_KEEP_PAIRS of what they started with, are rejected.
+// Returns OKAY if every camera was aligned, ERR otherwise (unaligned cameras are left as they were).
+int alignCameras();
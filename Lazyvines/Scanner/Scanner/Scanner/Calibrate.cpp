@@ -0,0 +1,342 @@
+/************************************************************************************************************************
+
+Calibrate: Estimates the base line, vanishing points and wall edge of every camera from laser images of the rig.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "Calibrate.h"
+#include "Parallel.h"
+
+#define CAL_PI					3.14159265358979
+
+// Structures
+typedef struct {
+	double a, b, c;				// a*x + b*y + c = 0 with a*a + b*b = 1
+	double mx, my;				// Inlier centroid
+	int inliers;
+}CAL_LINE;
+
+typedef struct {
+	float* x;
+	float* y;
+	int n;
+}CAL_PIXELS;
+
+typedef struct {
+	const CAL_PIXELS* px;
+	CAL_LINE best[CAL_RANSAC_TASKS];
+}CAL_RANSAC;
+
+/*********** LINE FITTING ***********/
+
+static unsigned int nextRandom(unsigned int* seed){
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+static int countInliers(const CAL_PIXELS* px, float a, float b, float c){
+	int i, count = 0;
+	for (i = 0; i < px->n; i++){
+		if (fabsf(a * px->x[i] + b * px->y[i] + c) <= (float)CAL_INLIER_DIST) count++;
+	}
+	return count;
+}
+
+// One batch of two-pixel hypotheses. Seeds depend on the batch only, so fits are repeatable.
+static void ransacTask(void* prm, int idx){
+	CAL_RANSAC* r = (CAL_RANSAC*)prm;
+	const CAL_PIXELS* px = r->px;
+	CAL_LINE* best = &r->best[idx];
+	best->inliers = 0;
+
+	unsigned int seed = 2654435761u * (idx + 1);
+	int h;
+	for (h = 0; h < CAL_RANSAC_HYPOTHESES; h++){
+		int i = nextRandom(&seed) % px->n;
+		int j = nextRandom(&seed) % px->n;
+		double dx = px->x[j] - px->x[i];
+		double dy = px->y[j] - px->y[i];
+		double len = sqrt(dx * dx + dy * dy);
+		if (len < 1) continue;
+
+		double a = -dy / len, b = dx / len;
+		double c = -(a * px->x[i] + b * px->y[i]);
+		int count = countInliers(px, (float)a, (float)b, (float)c);
+		if (count > best->inliers){
+			best->a = a;
+			best->b = b;
+			best->c = c;
+			best->inliers = count;
+		}
+	}
+}
+
+// Total least squares on the inliers of a line: the line through their centroid along their principal axis.
+static void refineLine(const CAL_PIXELS* px, CAL_LINE* line){
+	int pass, i;
+	for (pass = 0; pass < 2; pass++){
+		double sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+		int n = 0;
+		for (i = 0; i < px->n; i++){
+			double x = px->x[i], y = px->y[i];
+			if (fabs(line->a * x + line->b * y + line->c) > CAL_INLIER_DIST) continue;
+			sx += x;
+			sy += y;
+			sxx += x * x;
+			sxy += x * y;
+			syy += y * y;
+			n++;
+		}
+		if (n < 2) return;
+
+		double mx = sx / n, my = sy / n;
+		double theta = 0.5 * atan2(2 * (sxy / n - mx * my), (sxx / n - mx * mx) - (syy / n - my * my));
+		line->a = -sin(theta);
+		line->b = cos(theta);
+		line->c = -(line->a * mx + line->b * my);
+		line->mx = mx;
+		line->my = my;
+		line->inliers = n;
+	}
+}
+
+// Sequential RANSAC: fits up to max_lines lines, strongest first, removing each line's inliers from px.
+// Returns the number of lines found.
+static int fitLines(CAL_PIXELS* px, CAL_LINE* out, int max_lines){
+
+	int found = 0;
+	while (found < max_lines && px->n >= CAL_MIN_INLIERS){
+		CAL_RANSAC r;
+		r.px = px;
+		parallelFor(CAL_RANSAC_TASKS, ransacTask, &r);
+
+		int t, pick = 0;
+		for (t = 1; t < CAL_RANSAC_TASKS; t++){
+			if (r.best[t].inliers > r.best[pick].inliers) pick = t;
+		}
+		CAL_LINE line = r.best[pick];
+		if (line.inliers < CAL_MIN_INLIERS) break;
+		refineLine(px, &line);
+		if (line.inliers < CAL_MIN_INLIERS) break;
+		out[found++] = line;
+
+		int i, kept = 0;
+		for (i = 0; i < px->n; i++){
+			if (fabs(line.a * px->x[i] + line.b * px->y[i] + line.c) <= CAL_INLIER_DIST) continue;
+			px->x[kept] = px->x[i];
+			px->y[kept] = px->y[i];
+			kept++;
+		}
+		px->n = kept;
+	}
+	return found;
+}
+
+/*********** VANISHING POINTS ***********/
+
+// Sine of the angle between two lines.
+static double lineSine(const CAL_LINE* l, const CAL_LINE* m){
+	return fabs(l->a * m->b - l->b * m->a);
+}
+
+// Least squares point on lines[0] closest to lines[1..n). Returns ERR if they all run parallel to it.
+static int pointOnLine(const CAL_LINE* lines, int n, double* x, double* y){
+	const CAL_LINE* on = &lines[0];
+	double dx = -on->b, dy = on->a;
+	double num = 0, den = 0;
+	int i;
+	for (i = 1; i < n; i++){
+		double nd = lines[i].a * dx + lines[i].b * dy;
+		double np = lines[i].a * on->mx + lines[i].b * on->my + lines[i].c;
+		num += nd * np;
+		den += nd * nd;
+	}
+	if (den < 1e-12) return ERR;
+	double t = -num / den;
+	*x = on->mx + t * dx;
+	*y = on->my + t * dy;
+	return OKAY;
+}
+
+// Least squares intersection of n lines. Returns ERR if they are (close to) parallel.
+static int intersectLines(const CAL_LINE* lines, int n, double* x, double* y){
+	double aa = 0, ab = 0, bb = 0, ac = 0, bc = 0;
+	int i;
+	for (i = 0; i < n; i++){
+		aa += lines[i].a * lines[i].a;
+		ab += lines[i].a * lines[i].b;
+		bb += lines[i].b * lines[i].b;
+		ac += lines[i].a * lines[i].c;
+		bc += lines[i].b * lines[i].c;
+	}
+	double det = aa * bb - ab * ab;
+	if (det < 1e-9 * (aa + bb) * (aa + bb)) return ERR;
+	*x = (-ac * bb + ab * bc) / det;
+	*y = (-aa * bc + ab * ac) / det;
+	return OKAY;
+}
+
+// Sine of the angle between a line and the direction from its centroid to (x, y).
+static double pointingSine(const CAL_LINE* l, double x, double y){
+	double vx = x - l->mx, vy = y - l->my;
+	double dist = sqrt(vx * vx + vy * vy);
+	return (dist > 0) ? fabs(-l->b * vy - l->a * vx) / dist : 0;
+}
+
+// Lines converging with lines[0]: every line's intersection with lines[0] is a candidate vanishing point, and the
+// one the most lines point at within CAL_VP_ANGLE wins. Its lines are moved up behind lines[0].
+// Returns their number, lines[0] included.
+static int convergingLines(CAL_LINE* lines, int n){
+	double max_sine = sin(CAL_VP_ANGLE * CAL_PI / 180);
+	double best_x = 0, best_y = 0;
+	int i, j, best = 0;
+	for (i = 1; i < n; i++){
+		CAL_LINE pair[2] = { lines[0], lines[i] };
+		double x, y;
+		if (intersectLines(pair, 2, &x, &y) != OKAY) continue;
+		int count = 0;
+		for (j = 1; j < n; j++) count += pointingSine(&lines[j], x, y) <= max_sine;
+		if (count > best){
+			best = count;
+			best_x = x;
+			best_y = y;
+		}
+	}
+
+	int kept = 1;
+	for (i = 1; best && i < n; i++){
+		if (pointingSine(&lines[i], best_x, best_y) > max_sine) continue;
+		CAL_LINE swap = lines[kept];
+		lines[kept++] = lines[i];
+		lines[i] = swap;
+	}
+	return kept;
+}
+
+/*********** CALIBRATION ***********/
+
+// Collects the laser lit pixels of the frame in cam's buffer. With cb, only those on the object side of the wall
+// edge and above the base line.
+static void litPixels(const CAMERA* cam, const CAM_CB* cb, CAL_PIXELS* px){
+	px->n = 0;
+	double norm = cb ? sqrt(1 + cb->BM * cb->BM) : 1;
+	int rc, cc;
+	for (rc = 0; rc < HEIGHT; rc++){
+		const unsigned char* row = cam->frame + rc * 3 * WIDTH;
+		for (cc = 0; cc < WIDTH; cc++){
+			if (row[3 * cc] <= cam->thresh[2] || row[3 * cc + 1] <= cam->thresh[1] || row[3 * cc + 2] <= cam->thresh[0]) continue;
+			if (cb){
+				if (cb->ORIENT > 0 ? cc >= cb->WALL_EDGE - CAL_STRIPE_MARGIN : cc <= cb->WALL_EDGE + CAL_STRIPE_MARGIN) continue;
+				if ((rc - cb->BM * cc - cb->BB) / norm <= CAL_STRIPE_MARGIN) continue;
+			}
+			px->x[px->n] = (float)cc;
+			px->y[px->n] = (float)rc;
+			px->n++;
+		}
+	}
+}
+
+static int inRange(double x, double y){
+	return fabs(x) < CAL_VP_RANGE && fabs(y) < CAL_VP_RANGE;
+}
+
+// Calibrates one camera into cb, starting from its current calibration. Returns OKAY on success, ERR otherwise.
+static int calibrateCamera(CAMERA* cam, CAM_CB* cb, CAL_PIXELS* px, CAL_LINE* treads, CAL_LINE* risers){
+
+	*cb = cam->cb;
+
+	// Empty Rig: The base stripe lies on the object side of the wall stripe.
+	if (loadFrame(0, cam) != OKAY){
+		printf("Cam %d: Missing empty rig frame %s\\0.bmp. \n", cam->id, cam->img_dir);
+		return ERR;
+	}
+	litPixels(cam, NULL, px);
+	CAL_LINE stripe[2];
+	if (fitLines(px, stripe, 2) < 2){
+		printf("Cam %d: Cannot find the base and wall stripes in the empty rig frame. \n", cam->id);
+		return ERR;
+	}
+	int base_first = (stripe[0].mx < stripe[1].mx) == (cb->ORIENT > 0);
+	CAL_LINE base = stripe[base_first ? 0 : 1];
+	CAL_LINE wall = stripe[base_first ? 1 : 0];
+	if (fabs(base.b) < 1e-3 || lineSine(&base, &wall) < 0.1){
+		printf("Cam %d: Base and wall stripes do not form a corner. \n", cam->id);
+		return ERR;
+	}
+
+	double det = base.a * wall.b - wall.a * base.b;
+	cb->BM = -base.a / base.b;
+	cb->BB = -base.c / base.b;
+	cb->WALL_EDGE = (int)floor((base.b * wall.c - wall.b * base.c) / det + 0.5);
+	cb->BY = (int)floor(cb->BM * cb->BX + cb->BB + 0.5);
+
+	// Targets: Treads are the lines converging with the base stripe, risers those left converging with the wall's.
+	int nt = 0, nr = 0, frames;
+	treads[nt++] = base;
+	for (frames = 1; frames < CAL_MAX_FRAMES && loadFrame(frames, cam) == OKAY; frames++){
+		litPixels(cam, cb, px);
+		nt += fitLines(px, treads + nt, CAL_MAX_LINES);
+	}
+	int lines = nt;
+	nt = convergingLines(treads, lines);
+
+	double x, y;
+	if (nt < 2 || pointOnLine(treads, nt, &x, &y) != OKAY || !inRange(x, y)){
+		printf("Cam %d: No vanishing point from %d lines in %d target frames. \n", cam->id, lines - 1, frames - 1);
+		return ERR;
+	}
+	cb->VP_X = (int)floor(x + 0.5);
+	cb->VP_Y = (int)floor(y + 0.5);
+
+	// VVP is optional: without risers it keeps its current value.
+	risers[nr++] = wall;
+	int i;
+	for (i = nt; i < lines; i++) risers[nr++] = treads[i];
+	nr = convergingLines(risers, nr);
+	int vvp = nr >= 2 && intersectLines(risers, nr, &x, &y) == OKAY && inRange(x, y);
+	if (vvp){
+		cb->VVP_X = (int)floor(x + 0.5);
+		cb->VVP_Y = (int)floor(y + 0.5);
+	}
+
+	printf("Cam %d: base y = %.4f x + %.2f, wall edge %d, VP (%d, %d) from %d treads", cam->id, cb->BM, cb->BB,
+		cb->WALL_EDGE, cb->VP_X, cb->VP_Y, nt - 1);
+	if (vvp) printf(", VVP (%d, %d) from %d risers", cb->VVP_X, cb->VVP_Y, nr - 1);
+	printf(" in %d target frames. \n", frames - 1);
+	return OKAY;
+}
+
+int calibrateCameras(const char* rig){
+
+	setFrameRoot(rig);
+
+	CAL_PIXELS px;
+	px.x = (float*)malloc(WIDTH * HEIGHT * sizeof(float));
+	px.y = (float*)malloc(WIDTH * HEIGHT * sizeof(float));
+	CAL_LINE* treads = (CAL_LINE*)malloc((CAL_MAX_FRAMES * CAL_MAX_LINES + 1) * sizeof(CAL_LINE));
+	CAL_LINE* risers = (CAL_LINE*)malloc((CAL_MAX_FRAMES * CAL_MAX_LINES + 1) * sizeof(CAL_LINE));
+	int ok = px.x && px.y && treads && risers;
+
+	CAM_CB cb[NUM_CAMS];
+	int c;
+	for (c = 0; ok && c < NUM_CAMS; c++) ok = calibrateCamera(&CAMS[c], &cb[c], &px, treads, risers) == OKAY;
+
+	free(px.x);
+	free(px.y);
+	free(treads);
+	free(risers);
+	if (!ok) return ERR;
+
+	// All or nothing: Cameras only change once every one of them is calibrated.
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMS[c].cb = cb[c];
+		buildROI(&CAMS[c]);
+	}
+	return OKAY;
+}
@@ -0,0 +1,38 @@
+/************************************************************************************************************************
+
+Calibrate: Estimates the base line, vanishing points and wall edge of every camera from laser images of the rig.
+Replaces the hand measured CB_N_* constants. Each camera's frame directory under the rig directory holds:
+* 0.bmp:		The empty rig with the laser on. The laser draws two stripes: across the base and up the back wall.
+* 1.bmp ...:	A stepped block standing on the base, in any number of positions. Its treads are horizontal lines of
+				the laser plane and converge on the vanishing point VP, its risers are vertical and converge on VVP.
+
+Lit pixels are fitted with lines by sequential RANSAC: the best line of many random two-pixel hypotheses (scored in
+parallel) is refined by total least squares on its inliers, its inliers removed, and the search repeated.
+The two stripes of the empty rig give the base line (BASE_M, BASE_B) and, where they meet, WALL_EDGE. Treads are
+the target lines converging with the base line: each one's intersection with it is a candidate, and the candidate
+most lines point at wins. VP is then the point on the base line closest to all of them in the least squares sense.
+The remaining lines converging with the wall stripe are risers, and their least squares intersection gives VVP.
+
+ORIENTATION, SCALE_BASE, RAO and CENTER_X (the turntable axis does not show in laser images) are kept as loaded.
+CENTER_Y is set to the base line's height at CENTER_X, so the base itself maps to zero height.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "Camera.h"
+
+#define CAL_MAX_FRAMES			64			// Frames read per camera at most
+#define CAL_MAX_LINES			8			// Lines extracted per frame at most
+#define CAL_MIN_INLIERS			40			// Pixels a line needs to be kept
+#define CAL_INLIER_DIST			1.5			// Pixel distance from a line counting as support
+#define CAL_RANSAC_TASKS		16			// Parallel hypothesis batches per fit
+#define CAL_RANSAC_HYPOTHESES	64			// Hypotheses per batch
+#define CAL_STRIPE_MARGIN		4			// Pixels kept clear of the base stripe and wall edge in target frames
+#define CAL_VP_ANGLE			1.0			// Degrees a tread may point away from VP before it is dropped
+#define CAL_VP_RANGE			100000		// Vanishing points further out (pixels) are not representable
+
+// Calibrates every camera from the frames under rig. On success each camera's calibration and ROI are updated
+// and OKAY is returned; if any camera fails, ERR is returned and no calibration is changed.
+int calibrateCameras(const char* rig);
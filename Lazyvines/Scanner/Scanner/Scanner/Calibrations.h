@@ -1,3 +1,5 @@
+#pragma once
+
 // *** PROCESSING CONFIGURATIONS ***
 
 // Image Processing Settings (P3 Settings)
@@ -7,6 +9,8 @@
 #define LASER_THRESHOLD_R       150
 #define LASER_THRESHOLD_G       75
 #define LASER_THRESHOLD_B       75
+#define LASER_THRESHOLD_AUTO	0			// THRESH_* mode (Camera.h): 0 fixed, 1 Otsu, 2 percentile, per frame
+#define LASER_SEGMENTS			0			// Laser runs kept per row, best scored (up to SEG_MAX_KEEP); 0 keeps every run
 #define BASE_SAFE_HEIGHT		1
 
 // 3D Filtering Definitions
@@ -14,6 +18,9 @@
 
 // *** HARDWARE CONFIGURATIONS ***
 
+// Camera Array: Each camera N needs a CB_N_* block below and an entry in Camera.cpp (initCameras). 
+#define NUM_CAMS				  2
+
 // CALIBRATION CONSTANTS CAM1 (P3 Settings)
 #define CB_1_VP_X                 224.75
 #define CB_1_VP_Y                 465.05
@@ -26,6 +33,15 @@
 #define CB_1_VVP_Y				  0
 #define CB_1_WALL_EDGE			  261
 #define CB_1_ORIENTATION		  -1
+#define CB_1_RAO				  0.0
+#define CB_1_ALIGN_RX			  0.0
+#define CB_1_ALIGN_RY			  0.0
+#define CB_1_ALIGN_RZ			  0.0
+#define CB_1_ALIGN_TX			  0.0
+#define CB_1_ALIGN_TY			  0.0
+#define CB_1_ALIGN_TZ			  0.0
+#define CB_1_DEVNUM				  1
+#define CB_1_IMG_DIR			  "Images_A"
 
 // CALIBRATION CONSTANTS CAM2 (P3 Settings)
 #define CB_2_VP_X                 813
@@ -39,9 +55,23 @@
 #define CB_2_VVP_Y				  0
 #define CB_2_WALL_EDGE			  400
 #define CB_2_ORIENTATION		  1
+#define CB_2_RAO				  1.57
+#define CB_2_ALIGN_RX			  0.0
+#define CB_2_ALIGN_RY			  0.0
+#define CB_2_ALIGN_RZ			  0.0
+#define CB_2_ALIGN_TX			  0.0
+#define CB_2_ALIGN_TY			  0.0
+#define CB_2_ALIGN_TZ			  0.0
+#define CB_2_DEVNUM				  2
+#define CB_2_IMG_DIR			  "Images_B"
 
 // COMPARAMETRIC PARAMETERS 
-#define CB_RAO					  1.57
+// CB_N_RAO: Angular offset (rad) of camera N's laser plane relative to camera 1. Cameras seeing several parallel
+// laser lines take the geometry and RAO of the others from PLANE blocks of a calibration file (see loadCalibration).
+// K lines profile the object K times per step, so REV_STEPS can drop by K for the same density when their offsets
+// are not multiples of the step angle.
+// CB_N_ALIGN_*: Rigid correction of camera N's points, refined by ICP against camera 1 (Align.h): rotations (rad)
+// about x, then y, then z, followed by a translation in point units. Zero for camera 1. 
 
 // Arduino Settings 
 #define ARDUINO_PORT            "COM3"
@@ -64,4 +94,11 @@ typedef struct {
 	double BM; 
 	double BB; 
 	double Scale; 
+	double RAO; 
+	double ARX; 
+	double ARY; 
+	double ARZ; 
+	double ATX; 
+	double ATY; 
+	double ATZ; 
 }CAM_CB;
\ No newline at end of file
@@ -0,0 +1,1007 @@
+/************************************************************************************************************************
+
+Camera Array: Per-camera calibration, point buffers and worker threads.
+Includes the EXTRACTOR (2D laser point extraction) and MAPPER (2D to 3D translation) stages.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <math.h>
+#include <process.h>
+
+#include "Camera.h"
+#include "Codec.h"
+#include "Align.h"
+
+/********************************************** Global Variables **********************************************/
+CAMERA CAMS[NUM_CAMS];
+
+int CAM_STAGES = STAGE_EXTRACT | STAGE_TRANSLATE;
+CAM_NOTIFY CAM_PUBLISHED = NULL;
+
+static int CAMS_PENDING = 0;
+
+// Copies calibration block CB_<n>_* into a camera.
+#define SET_CAMERA(cam, n)	do {							\
+	(cam)->id = CB_##n##_DEVNUM;							\
+	strcpy_s((cam)->img_name, CB_##n##_IMG_DIR);			\
+	strcpy_s((cam)->img_dir, CB_##n##_IMG_DIR);				\
+	(cam)->cb.BB = CB_##n##_BASE_B;							\
+	(cam)->cb.BM = CB_##n##_BASE_M;							\
+	(cam)->cb.BX = CB_##n##_CENTER_X;						\
+	(cam)->cb.BY = CB_##n##_CENTER_Y;						\
+	(cam)->cb.VP_X = CB_##n##_VP_X;							\
+	(cam)->cb.VP_Y = CB_##n##_VP_Y;							\
+	(cam)->cb.VVP_X = CB_##n##_VVP_X;						\
+	(cam)->cb.VVP_Y = CB_##n##_VVP_Y;						\
+	(cam)->cb.Scale = CB_##n##_SCALE_BASE;					\
+	(cam)->cb.WALL_EDGE = CB_##n##_WALL_EDGE;				\
+	(cam)->cb.ORIENT = CB_##n##_ORIENTATION;				\
+	(cam)->cb.RAO = CB_##n##_RAO;							\
+	(cam)->cb.ARX = CB_##n##_ALIGN_RX;						\
+	(cam)->cb.ARY = CB_##n##_ALIGN_RY;						\
+	(cam)->cb.ARZ = CB_##n##_ALIGN_RZ;						\
+	(cam)->cb.ATX = CB_##n##_ALIGN_TX;						\
+	(cam)->cb.ATY = CB_##n##_ALIGN_TY;						\
+	(cam)->cb.ATZ = CB_##n##_ALIGN_TZ;						\
+} while (0)
+
+// Illustrator colours, cycled by camera index.
+static const float CAM_COLORS[][3] = {
+	{ 0.0f, 1.0f, 1.0f },
+	{ 1.0f, 0.0f, 1.0f },
+	{ 1.0f, 1.0f, 0.0f },
+	{ 0.0f, 1.0f, 0.0f },
+};
+
+/********************************************** Camera Array **********************************************/
+
+// Initializes calibration data and buffers of every camera.
+void initCameras(){
+
+	memset(CAMS, 0, sizeof(CAMS));
+
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMERA* cam = &CAMS[c];
+
+		// Initialize Hardware Calibration Data
+		switch (c){
+		case 0: SET_CAMERA(cam, 1); break;
+		case 1: SET_CAMERA(cam, 2); break;
+		default: errorExit("Missing calibration block for camera - CONFIG: 'NUM_CAMS'");
+		}
+		cam->planes = 1;
+
+		// Initialize 2D & 3D Scanner Data Structures
+		cam->px.used = 0;
+		cam->px.max = MAX_POINTS;
+		cam->px.pl = (PIXEL*)malloc(MAX_POINTS*sizeof(PIXEL));
+
+		if (allocCloud(&cam->p3d, MAX_POINTS, 0) != OKAY){ errorExit("Cannot allocate camera buffers"); }
+
+		cam->frame = (unsigned char*)malloc(3 * WIDTH*HEIGHT*sizeof(unsigned char));
+		cam->zbuf = (unsigned char*)malloc(ARCHIVE_SCRATCH_BYTES);
+		if (!cam->px.pl || !cam->frame || !cam->zbuf){ errorExit("Cannot allocate camera buffers"); }
+
+		buildROI(cam);
+		cam->thresh[0] = LASER_THRESHOLD_R;
+		cam->thresh[1] = LASER_THRESHOLD_G;
+		cam->thresh[2] = LASER_THRESHOLD_B;
+		cam->autothr.mode = LASER_THRESHOLD_AUTO;
+		cam->seg_keep = LASER_SEGMENTS;
+		int r;
+		for (r = 0; r < HEIGHT; r++) cam->seg_x[r] = UNINIT;
+		cam->seg_step = UNINIT;
+		cam->disp = 1;
+		memcpy(cam->color, CAM_COLORS[c % (sizeof(CAM_COLORS) / sizeof(CAM_COLORS[0]))], sizeof(cam->color));
+	}
+}
+
+// Clears all points of every camera so that buffers can be reused for the next scan. Normals and camera masks belong
+// to the points they were derived for and go with them.
+void resetCameras(){
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMS[c].px.used = 0;
+		CAMS[c].p3d.used = 0;
+		dropStreams(&CAMS[c].p3d, PC_NORMALS | PC_ORIGIN);
+		CAMS[c].autothr.valid = 0;
+		int r;
+		for (r = 0; r < HEIGHT; r++) CAMS[c].seg_x[r] = UNINIT;
+		CAMS[c].seg_step = UNINIT;
+	}
+}
+
+// Points every camera at <root>\<img_name> for its frames. NULL restores the working directory.
+void setFrameRoot(const char* root){
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		if (root) sprintf_s(CAMS[c].img_dir, "%s\\%s", root, CAMS[c].img_name);
+		else strcpy_s(CAMS[c].img_dir, CAMS[c].img_name);
+	}
+}
+
+// Releases the buffers of every camera.
+void freeCameras(){
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		free(CAMS[c].px.pl);
+		freeCloud(&CAMS[c].p3d);
+		free(CAMS[c].frame);
+		free(CAMS[c].zbuf);
+		freeFrameLoader(&CAMS[c].loader);
+	}
+}
+
+/********************************************** CALIBRATION FILES **********************************************/
+
+// Loads calibration overrides from a file. Cameras not mentioned keep their Calibrations.h values.
+int loadCalibration(const char* fname){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "r") || !fptr){
+		printf("Calibration file %s does not exist. \n", fname);
+		return ERR;
+	}
+
+	char line[CMD_MAXLEN];
+	char key[CMD_MAXLEN];
+	char val[CMD_MAXLEN];
+	CAMERA* cam = NULL;
+	CAM_CB* cb = NULL;
+	int ln = 0;
+
+	while (fgets(line, CMD_MAXLEN, fptr)){
+		ln++;
+		if (line[0] == '#' || sscanf_s(line, "%s %s", key, CMD_MAXLEN, val, CMD_MAXLEN) != 2) continue;
+		double v = atof(val);
+
+		if (!strcmp(key, "CAM")){
+			int idx = atoi(val) - 1;
+			if (idx < 0 || idx >= NUM_CAMS){
+				printf("%s:%d: Camera %s exceeds NUM_CAMS. \n", fname, ln, val);
+				fclose(fptr);
+				return ERR;
+			}
+			cam = &CAMS[idx];
+			cb = &cam->cb;
+			continue;
+		}
+		if (!cam){
+			printf("%s:%d: %s given before any CAM entry. \n", fname, ln, key);
+			fclose(fptr);
+			return ERR;
+		}
+
+		if (!strcmp(key, "PLANE")){
+			int k = atoi(val);
+			if (k < 1 || k > MAX_PLANES){
+				printf("%s:%d: Plane %s exceeds MAX_PLANES. \n", fname, ln, val);
+				fclose(fptr);
+				return ERR;
+			}
+			for (; cam->planes < k; cam->planes++) cam->plane[cam->planes - 1] = cam->cb;
+			cb = (k == 1) ? &cam->cb : &cam->plane[k - 2];
+		}
+		else if (!strcmp(key, "DEVNUM")) cam->id = (int)v;
+		else if (!strcmp(key, "IMG_DIR")){ strcpy_s(cam->img_name, val); strcpy_s(cam->img_dir, val); }
+		else if (!strcmp(key, "VP_X")) cb->VP_X = (int)v;
+		else if (!strcmp(key, "VP_Y")) cb->VP_Y = (int)v;
+		else if (!strcmp(key, "VVP_X")) cb->VVP_X = (int)v;
+		else if (!strcmp(key, "VVP_Y")) cb->VVP_Y = (int)v;
+		else if (!strcmp(key, "CENTER_X")) cb->BX = (int)v;
+		else if (!strcmp(key, "CENTER_Y")) cb->BY = (int)v;
+		else if (!strcmp(key, "BASE_M")) cb->BM = v;
+		else if (!strcmp(key, "BASE_B")) cb->BB = v;
+		else if (!strcmp(key, "SCALE_BASE")) cb->Scale = v;
+		else if (!strcmp(key, "WALL_EDGE")) cb->WALL_EDGE = (int)v;
+		else if (!strcmp(key, "ORIENTATION")) cb->ORIENT = (int)v;
+		else if (!strcmp(key, "RAO")) cb->RAO = v;
+		else if (!strcmp(key, "ALIGN_RX")) cam->cb.ARX = v;
+		else if (!strcmp(key, "ALIGN_RY")) cam->cb.ARY = v;
+		else if (!strcmp(key, "ALIGN_RZ")) cam->cb.ARZ = v;
+		else if (!strcmp(key, "ALIGN_TX")) cam->cb.ATX = v;
+		else if (!strcmp(key, "ALIGN_TY")) cam->cb.ATY = v;
+		else if (!strcmp(key, "ALIGN_TZ")) cam->cb.ATZ = v;
+		else if (!strcmp(key, "THRESHOLD_R")) cam->thresh[0] = (int)v;
+		else if (!strcmp(key, "THRESHOLD_G")) cam->thresh[1] = (int)v;
+		else if (!strcmp(key, "THRESHOLD_B")) cam->thresh[2] = (int)v;
+		else if (!strcmp(key, "THRESHOLD_AUTO")) cam->autothr.mode = (int)v;
+		else if (!strcmp(key, "SEGMENTS")) cam->seg_keep = MIN(MAX((int)v, 0), SEG_MAX_KEEP);
+		else printf("%s:%d: Unknown calibration key %s ignored. \n", fname, ln, key);
+	}
+
+	fclose(fptr);
+	int c;
+	for (c = 0; c < NUM_CAMS; c++) buildROI(&CAMS[c]);
+	if (DBG_LOG) printf("Calibration Load Completed: %s \n", fname);
+	return OKAY;
+}
+
+// Writes the keys of one laser plane's geometry.
+static void saveGeometry(FILE* fptr, const CAM_CB* cb){
+	fprintf(fptr, "VP_X %d\nVP_Y %d\n", cb->VP_X, cb->VP_Y);
+	fprintf(fptr, "VVP_X %d\nVVP_Y %d\n", cb->VVP_X, cb->VVP_Y);
+	fprintf(fptr, "CENTER_X %d\nCENTER_Y %d\n", cb->BX, cb->BY);
+	fprintf(fptr, "BASE_M %.6f\nBASE_B %.6f\n", cb->BM, cb->BB);
+	fprintf(fptr, "SCALE_BASE %.6f\n", cb->Scale);
+	fprintf(fptr, "WALL_EDGE %d\n", cb->WALL_EDGE);
+	fprintf(fptr, "ORIENTATION %d\n", cb->ORIENT);
+	fprintf(fptr, "RAO %.6f\n", cb->RAO);
+}
+
+// Saves the calibration of every camera in the format read by loadCalibration.
+int saveCalibration(const char* fname){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "w") || !fptr){
+		printf("Cannot open %s for writing. \n", fname);
+		return ERR;
+	}
+
+	fprintf(fptr, "# SEG Scanner Calibration\n");
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMERA* cam = &CAMS[c];
+		fprintf(fptr, "\nCAM %d\n", c + 1);
+		fprintf(fptr, "DEVNUM %d\n", cam->id);
+		fprintf(fptr, "IMG_DIR %s\n", cam->img_name);
+		saveGeometry(fptr, &cam->cb);
+		fprintf(fptr, "ALIGN_RX %.8f\nALIGN_RY %.8f\nALIGN_RZ %.8f\n", cam->cb.ARX, cam->cb.ARY, cam->cb.ARZ);
+		fprintf(fptr, "ALIGN_TX %.8f\nALIGN_TY %.8f\nALIGN_TZ %.8f\n", cam->cb.ATX, cam->cb.ATY, cam->cb.ATZ);
+		fprintf(fptr, "THRESHOLD_R %d\nTHRESHOLD_G %d\nTHRESHOLD_B %d\n", cam->thresh[0], cam->thresh[1], cam->thresh[2]);
+		fprintf(fptr, "THRESHOLD_AUTO %d\nSEGMENTS %d\n", cam->autothr.mode, cam->seg_keep);
+		int k;
+		for (k = 1; k < cam->planes; k++){
+			fprintf(fptr, "PLANE %d\n", k + 1);
+			saveGeometry(fptr, &cam->plane[k - 1]);
+		}
+	}
+
+	fclose(fptr);
+	if (DBG_LOG) printf("Calibration Save Completed: %s \n", fname);
+	return OKAY;
+}
+
+unsigned int calibrationCRC(){
+	unsigned int crc = 0;
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		crc = crc32(crc, &CAMS[c].cb, sizeof(CAM_CB));
+		if (CAMS[c].planes > 1) crc = crc32(crc, CAMS[c].plane, (CAMS[c].planes - 1) * sizeof(CAM_CB));
+	}
+	return crc;
+}
+
+/********************************************** EXTRACTOR **********************************************/
+
+// Loads rows row_lo..row_hi of a BMP frame (image body without row padding) into the camera's frame buffer. 
+static void readFrame(const char* fname, CAMERA* cam, int row_lo, int row_hi){
+
+	// Extract Image Corresponding to this Camera
+	if (DBG_LOG)printf("Extracting Points from: %s...\n", fname);
+	FILE* fptr;
+	fopen_s(&fptr, fname, "rb");
+	if (!fptr){ errorExit("Error occured while opening image file."); }
+
+	// Access File +BMP Headers
+	unsigned char header[54];
+	fread(header, sizeof(unsigned char), 54, fptr);
+
+	// Object image object's width, height, and image body offset value.
+	int w = *(int*)&header[18];
+	int h = *(int*)&header[22];
+	if (w != WIDTH || h != HEIGHT){ errorExit("Image dimensions inconsistent with calibration settings."); }
+
+	int data_offset = *(int*)&header[10];
+	unsigned char* data = cam->frame;
+
+	// Advance to image body and load image, close file when done.
+	// Create temporary buffer to ignore data padding when loading.
+	int rc;
+	double wd = w;
+	int row_padding = ceil(wd * 3 / 4) * 4 - w * 3;
+	fseek(fptr, data_offset + row_lo * (w * 3 + row_padding), 0);
+
+	unsigned char buffer[4];
+	for (rc = row_lo; rc <= row_hi; rc++){
+		fread(data + rc * 3 * w, sizeof(unsigned char), w * 3, fptr);
+		fread(buffer, sizeof(unsigned char), row_padding, fptr);
+	}
+	fclose(fptr);
+}
+
+// Reads the whole frame of a step from the camera's frame directory into its frame buffer.
+// Returns ERR if the frame does not exist.
+int loadFrame(int step, CAMERA* cam){
+	char fname[CMD_MAXLEN];
+	FILE* fptr = NULL;
+	sprintf_s(fname, "%s\\%d.bmp", cam->img_dir, step);
+	if (fopen_s(&fptr, fname, "rb") || !fptr) return ERR;
+	fclose(fptr);
+	readFrame(fname, cam, 0, HEIGHT - 1);
+	return OKAY;
+}
+
+// Pixel Layouts: Bytes per pixel and the byte offset of each channel, all compile-time constants. 
+template <int BYTES, int R, int G, int B>
+struct PixelLayout {
+	enum { bytes = BYTES };
+	static inline int r(const unsigned char* p){ return p[R]; }
+	static inline int g(const unsigned char* p){ return p[G]; }
+	static inline int b(const unsigned char* p){ return p[B]; }
+};
+typedef PixelLayout<3, 2, 1, 0> BGR24;
+typedef PixelLayout<3, 0, 1, 2> RGB24;
+typedef PixelLayout<4, 2, 1, 0> BGRA32;
+typedef PixelLayout<1, 0, 0, 0> GRAY8;
+
+// Threshold Policies: A pixel is lit if every channel exceeds its threshold. Fixed thresholds fold into the
+// comparisons, camera thresholds (set by calibration files) are read once per frame. row() is called as the
+// kernel enters a row, see() for every pixel of the ROI, both vanish where a policy has nothing to do. 
+template <int R, int G, int B>
+struct FixedThreshold {
+	FixedThreshold(CAMERA* cam){}
+	inline void row(int rc){}
+	inline void see(int cc, int r, int g, int b){}
+	inline int lit(int r, int g, int b) const { return r > R && g > G && b > B; }
+};
+
+struct CameraThreshold {
+	int R, G, B;
+	CameraThreshold(CAMERA* cam) : R(cam->thresh[0]), G(cam->thresh[1]), B(cam->thresh[2]) {}
+	inline void row(int rc){}
+	inline void see(int cc, int r, int g, int b){}
+	inline int lit(int r, int g, int b) const { return r > R && g > G && b > B; }
+};
+
+// Adaptive: Each band's thresholds, while its histograms are counted for the next frame in the same pass. Even and
+// odd columns count into separate tables, so neighbouring pixels of one colour do not wait on each other's stores.
+struct BandThreshold {
+	AUTO_THRESH* at;
+	int R, G, B;
+	unsigned int* h[2];
+	BandThreshold(CAMERA* cam) : at(&cam->autothr) { row(0); }
+	inline void row(int rc){
+		int band = rc * AUTO_BANDS / HEIGHT;
+		R = at->thresh[band][0];
+		G = at->thresh[band][1];
+		B = at->thresh[band][2];
+		h[0] = at->hist[0][band][0];
+		h[1] = at->hist[1][band][0];
+	}
+	inline void see(int cc, int r, int g, int b){
+		unsigned int* t = h[cc & 1];
+		t[r]++;
+		t[256 + g]++;
+		t[512 + b]++;
+	}
+	inline int lit(int r, int g, int b) const { return r > R && g > G && b > B; }
+};
+
+typedef FixedThreshold<LASER_THRESHOLD_R, LASER_THRESHOLD_G, LASER_THRESHOLD_B> DefaultThreshold;
+
+// Segment Selection: Runs of a row competing to become its points. scoreRun rates a run, higher is better;
+// ref_row and ref_step are the points kept on the row before and on this row in the step before, UNINIT if none.
+typedef struct {
+	int x;
+	float score;
+}SEG_RUN;
+
+static float scoreRun(int width, int peak, int x, int ref_row, int ref_step){
+	float s = SEG_W_WIDTH * MIN(width, SEG_WIDTH_FULL) / SEG_WIDTH_FULL + SEG_W_PEAK * peak / 255.0f;
+	int refs[2] = { ref_row, ref_step };
+	int i;
+	for (i = 0; i < 2; i++){
+		if (refs[i] == UNINIT) continue;
+		int d = abs(x - refs[i]);
+		s += 0.5f * SEG_W_CONT * (1.0f - (float)MIN(d, SEG_JUMP) / SEG_JUMP);
+	}
+	return s;
+}
+
+// Keeps the keep best runs in sel, best first.
+static inline void selectRun(SEG_RUN* sel, int* n, int keep, int x, float score){
+	int i = *n;
+	if (i == keep){
+		if (score <= sel[keep - 1].score) return;
+		i--;
+	}
+	else (*n)++;
+	for (; i > 0 && sel[i - 1].score < score; i--) sel[i] = sel[i - 1];
+	sel[i].x = x;
+	sel[i].score = score;
+}
+
+// Extraction of 2D Points from an image body of WIDTH x HEIGHT pixels in layout PX, rows stride bytes apart. 
+// Every ROWS-th row is scanned (the rows buildROI kept).
+template <typename PX, typename TH, int ROWS>
+static void extractRows(CAMERA* cam, const unsigned char* data, int stride){
+
+	// Goes through each ROWS rows and get the average of the EVERY laser segment spotted.
+	// The generated result is then written back to results array.
+
+	TH th(cam);
+	int rc, cc;
+	int w = WIDTH;
+	PIXEL* pxl_ptr = cam->px.pl + cam->px.used;
+	const ROI* roi = &cam->roi;
+	const int keep = cam->seg_keep;
+	SEG_RUN sel[SEG_MAX_KEEP];
+	int last_x = UNINIT, last_rc = UNINIT;
+
+	// Only rows and columns inside the ROI can map onto the object. Runs crossing the span edges are still
+	// tracked to their true ends, so every run that can survive translation keeps its original centre.
+	for (rc = roi->row_lo; rc <= roi->row_hi; rc += ROWS){
+		const unsigned char* row = data + rc*stride;
+		int lo = roi->col_lo[rc];
+		int hi = roi->col_hi[rc];
+		if (lo > hi){
+			cam->seg_x[rc] = UNINIT;
+			continue;
+		}
+		th.row(rc);
+		int nsel = 0;
+		int ref_row = (last_rc != UNINIT && rc - last_rc <= SEG_ROW_REACH) ? last_x : UNINIT;
+		int ref_step = cam->seg_x[rc];
+
+		cc = lo;
+		const unsigned char* p = row + PX::bytes * cc;
+		if (th.lit(PX::r(p), PX::g(p), PX::b(p))){
+			while (cc > 0){
+				p = row + PX::bytes * (cc - 1);
+				if (!th.lit(PX::r(p), PX::g(p), PX::b(p))) break;
+				cc--;
+			}
+		}
+
+		int begin_track_idx = UNINIT;
+		int end_track_idx = UNINIT;
+		int peak = 0;
+		for (; cc<w; cc++){
+			// Look at each pixel whether they satisfy colour intensity requirements.
+			p = row + PX::bytes * cc;
+			int r = PX::r(p), g = PX::g(p), b = PX::b(p);
+			if (cc >= lo && cc <= hi) th.see(cc, r, g, b);
+			int lit = th.lit(r, g, b);
+
+			if (begin_track_idx == UNINIT){
+				if (cc > hi) break;
+				if (lit){ begin_track_idx = cc; peak = r; }
+			}
+			else if (!lit) {
+				end_track_idx = cc;
+				int avg_pxl = (begin_track_idx + end_track_idx) / 2;
+
+				// Reflections: Only the best keep runs of the row are written out once the row is done.
+				if (keep){
+					selectRun(sel, &nsel, keep, avg_pxl, scoreRun(end_track_idx - begin_track_idx, peak, avg_pxl, ref_row, ref_step));
+					begin_track_idx = UNINIT;
+					end_track_idx = UNINIT;
+					continue;
+				}
+
+				// Dynamic Heap Management (Simple Implementation)
+				if (cam->px.used == cam->px.max){
+					errorExit("Point Quantity Overloaded - CONFIG: \'MAX_POINTS\'\n");
+				}
+
+				// Add this point into dataset
+				pxl_ptr->x = avg_pxl;
+				pxl_ptr->y = rc;
+				pxl_ptr->plane = 0;
+				if (DBG_VIGOROUS)printf("Adding 2D Point: %d, %d\n", pxl_ptr->x, pxl_ptr->y);
+				pxl_ptr++;
+				cam->px.used++;
+
+				// Ready next segment
+				begin_track_idx = UNINIT;
+				end_track_idx = UNINIT;
+			}
+			else if (r > peak) peak = r;
+		}
+
+		if (!keep) continue;
+		cam->seg_x[rc] = nsel ? sel[0].x : UNINIT;
+		if (nsel){ last_x = sel[0].x; last_rc = rc; }
+
+		// Kept runs go out left to right, as they would without selection.
+		int i, j;
+		for (i = 1; i < nsel; i++){
+			SEG_RUN t = sel[i];
+			for (j = i; j > 0 && sel[j - 1].x > t.x; j--) sel[j] = sel[j - 1];
+			sel[j] = t;
+		}
+		if (cam->px.used + nsel > cam->px.max){
+			errorExit("Point Quantity Overloaded - CONFIG: \'MAX_POINTS\'\n");
+		}
+		for (i = 0; i < nsel; i++){
+			pxl_ptr->x = sel[i].x;
+			pxl_ptr->y = rc;
+			pxl_ptr->plane = 0;
+			if (DBG_VIGOROUS)printf("Adding 2D Point: %d, %d\n", pxl_ptr->x, pxl_ptr->y);
+			pxl_ptr++;
+		}
+		cam->px.used += nsel;
+	}
+}
+
+typedef void(*EXTRACT_KERNEL)(CAMERA* cam, const unsigned char* data, int stride);
+
+// Kernel for the camera's frame format, with its thresholds folded in where they are the Calibrations.h ones.
+template <typename PX>
+static EXTRACT_KERNEL pickThreshold(const CAMERA* cam){
+	if (cam->autothr.mode != THRESH_FIXED) return extractRows<PX, BandThreshold, ROW_PIXEL_STRD>;
+	if (cam->thresh[0] == LASER_THRESHOLD_R && cam->thresh[1] == LASER_THRESHOLD_G && cam->thresh[2] == LASER_THRESHOLD_B){
+		return extractRows<PX, DefaultThreshold, ROW_PIXEL_STRD>;
+	}
+	return extractRows<PX, CameraThreshold, ROW_PIXEL_STRD>;
+}
+
+// Per band and channel: Otsu's split of the pixels above the median, or the AUTO_PERCENTILE value, but at least
+// AUTO_MIN_CONTRAST above the median so that a band the laser missed does not light up its own noise. Bands
+// without pixels keep the camera's fixed thresholds.
+static void deriveThresholds(CAMERA* cam){
+	AUTO_THRESH* at = &cam->autothr;
+	int band, ch, v;
+	for (band = 0; band < AUTO_BANDS; band++){
+		for (ch = 0; ch < 3; ch++){
+			double hist[256], n = 0;
+			for (v = 0; v < 256; v++){
+				hist[v] = (double)at->hist[0][band][ch][v] + at->hist[1][band][ch][v];
+				n += hist[v];
+			}
+			if (n == 0){
+				at->thresh[band][ch] = cam->thresh[ch];
+				continue;
+			}
+
+			int median = 0;
+			double below = hist[0];
+			while (below < 0.5 * n){ median++; below += hist[median]; }
+
+			int t = 255;
+			if (at->mode == THRESH_OTSU){
+				// Between-class variance w0 w1 (m0 - m1)^2 over the bins above the median.
+				double total = 0, sum = 0, w0 = 0, s0 = 0, best = UNINIT;
+				for (v = median + 1; v < 256; v++){ total += hist[v]; sum += v * hist[v]; }
+				for (v = median + 1; v < 255 && total > 0; v++){
+					w0 += hist[v];
+					s0 += v * hist[v];
+					double w1 = total - w0;
+					if (w0 == 0 || w1 == 0) continue;
+					double d = s0 / w0 - (sum - s0) / w1;
+					if (w0 * w1 * d * d > best){ best = w0 * w1 * d * d; t = v; }
+				}
+			}
+			else {
+				double count = 0;
+				for (t = 0; t < 255; t++){
+					count += hist[t];
+					if (count >= AUTO_PERCENTILE * n) break;
+				}
+			}
+			at->thresh[band][ch] = MIN(MAX(t, median + AUTO_MIN_CONTRAST), 254);
+		}
+	}
+	at->valid = 1;
+	if (DBG_VIGOROUS) printf("Cam %d thresholds, first band: %d %d %d \n", cam->id, at->thresh[0][0], at->thresh[0][1], at->thresh[0][2]);
+}
+
+static void extractRuns(CAMERA* cam, const unsigned char* body, int stride, int fmt){
+	EXTRACT_KERNEL kernel = NULL;
+	switch (fmt){
+	case FMT_BGR24: kernel = pickThreshold<BGR24>(cam); break;
+	case FMT_RGB24: kernel = pickThreshold<RGB24>(cam); break;
+	case FMT_BGRA32: kernel = pickThreshold<BGRA32>(cam); break;
+	case FMT_GRAY8: kernel = pickThreshold<GRAY8>(cam); break;
+	default: errorExit("Unknown frame pixel format.");
+	}
+	if (cam->autothr.mode == THRESH_FIXED){
+		kernel(cam, body, stride);
+		return;
+	}
+
+	// Each frame is thresholded by the histograms of the one before. The first frame of a scan has none, so it is
+	// counted once up front and its points dropped.
+	AUTO_THRESH* at = &cam->autothr;
+	if (!at->valid){
+		int used = cam->px.used;
+		short seg_x[HEIGHT];
+		memcpy(seg_x, cam->seg_x, sizeof(seg_x));
+		int band;
+		for (band = 0; band < AUTO_BANDS; band++) memcpy(at->thresh[band], cam->thresh, sizeof(cam->thresh));
+		memset(at->hist, 0, sizeof(at->hist));
+		kernel(cam, body, stride);
+		cam->px.used = used;
+		memcpy(cam->seg_x, seg_x, sizeof(seg_x));
+		deriveThresholds(cam);
+	}
+	memset(at->hist, 0, sizeof(at->hist));
+	kernel(cam, body, stride);
+	deriveThresholds(cam);
+}
+
+// Matches the runs of every row extracted since first to the camera's laser planes. Runs and planes (by wall edge)
+// are both taken left to right and matched in order: as many runs as possible onto planes they can map through,
+// and among those matchings the one whose runs lie nearest to their plane's line on the rows above, or to its wall
+// edge where the line has not been seen yet. Runs without a plane are dropped.
+static void assignPlanes(CAMERA* cam, int first){
+	int order[MAX_PLANES], last_x[MAX_PLANES], last_y[MAX_PLANES];
+	int np = cam->planes, i, j, k;
+	for (k = 0; k < np; k++){
+		for (j = k; j > 0 && planeCalib(cam, order[j - 1])->WALL_EDGE > planeCalib(cam, k)->WALL_EDGE; j--) order[j] = order[j - 1];
+		order[j] = k;
+		last_y[k] = UNINIT;
+	}
+
+	PIXEL* px = cam->px.pl;
+	int out = first, a = first;
+	while (a < cam->px.used){
+		int y = px[a].y, b = a;
+		while (b < cam->px.used && px[b].y == y) b++;
+		int n = MIN(b - a, PLANE_MAX_RUNS);
+
+		// gain[i][j]: Matching run i to the j-th plane from the left, negative if it cannot map through it. Every
+		// match gains more than any difference in distance, so more matches always win.
+		float gain[PLANE_MAX_RUNS][MAX_PLANES];
+		float best[PLANE_MAX_RUNS + 1][MAX_PLANES + 1];
+		for (j = 0; j < np; j++){
+			int p = order[j];
+			const CAM_CB* cb = planeCalib(cam, p);
+			int ref = (last_y[p] != UNINIT && y - last_y[p] <= PLANE_ROW_REACH) ? last_x[p] : cb->WALL_EDGE;
+			for (i = 0; i < n; i++){
+				float Z_INT;
+				gain[i][j] = isMappable(cb, (float)px[a + i].x, (float)y, &Z_INT) ? 2.0f * WIDTH - abs(px[a + i].x - ref) : -1;
+			}
+		}
+		for (i = 0; i <= n; i++){
+			for (j = 0; j <= np; j++){
+				if (!i || !j){ best[i][j] = 0; continue; }
+				best[i][j] = MAX(best[i - 1][j], best[i][j - 1]);
+				if (gain[i - 1][j - 1] >= 0) best[i][j] = MAX(best[i][j], best[i - 1][j - 1] + gain[i - 1][j - 1]);
+			}
+		}
+
+		int match[PLANE_MAX_RUNS];
+		for (i = n, j = np; i > 0;){
+			if (j > 0 && gain[i - 1][j - 1] >= 0 && best[i][j] == best[i - 1][j - 1] + gain[i - 1][j - 1]){
+				match[--i] = order[--j];
+			}
+			else if (j == 0 || best[i][j] == best[i - 1][j]) match[--i] = UNINIT;
+			else j--;
+		}
+
+		// Kept runs move down over the dropped ones, still in row order.
+		for (i = 0; i < n; i++){
+			if (match[i] == UNINIT) continue;
+			px[out] = px[a + i];
+			px[out].plane = match[i];
+			last_x[match[i]] = px[out].x;
+			last_y[match[i]] = y;
+			out++;
+		}
+		a = b;
+	}
+	if (DBG_VIGOROUS) printf("Cam %d: %d of %d runs matched to planes. \n", cam->id, out - first, cam->px.used - first);
+	cam->px.used = out;
+}
+
+void extractBody(CAMERA* cam, const unsigned char* body, int stride, int fmt){
+	int first = cam->px.used;
+	extractRuns(cam, body, stride, fmt);
+	if (cam->planes > 1) assignPlanes(cam, first);
+}
+
+// Packs a raw frame into the camera's destination scan archive.
+static void archiveFrame(CAMERA* cam, int step, const unsigned char* body, int stride){
+	if (stride != 3 * WIDTH){
+		int rc;
+		for (rc = 0; rc < HEIGHT; rc++) memcpy(cam->frame + rc * 3 * WIDTH, body + rc*stride, 3 * WIDTH);
+		body = cam->frame;
+	}
+	if (appendArchiveFrame(cam->dst, (int)(cam - CAMS), step, body, cam->zbuf) != OKAY){
+		errorExit("Error occured while archiving frame.");
+	}
+}
+
+// Extraction of 2D Points from BMP Images (Frames)
+void ExtractPoints(int step, CAMERA* cam){
+
+	// Runs kept in a step that is not this one's neighbour say nothing about where the line is now.
+	if (step != cam->seg_step + 1){
+		int r;
+		for (r = 0; r < HEIGHT; r++) cam->seg_x[r] = UNINIT;
+	}
+	cam->seg_step = step;
+
+	// Archived Frames: Decompress straight into the frame buffer.
+	if (cam->src){
+		if (DBG_LOG)printf("Extracting Points from archive: Cam %d, step %d...\n", cam->id, step);
+		if (readArchiveFrame(cam->src, (int)(cam - CAMS), step, cam->frame, cam->zbuf) != OKAY){
+			errorExit("Error occured while reading archived frame.");
+		}
+		extractBody(cam, cam->frame, 3 * WIDTH, FMT_BGR24);
+		return;
+	}
+
+	const unsigned char* body;
+	int stride;
+	if (cam->prefetch){
+		// Prefetched Frames: Consume the next completed read straight from the loader's buffer.
+		int fstep;
+		body = nextFrame(&cam->loader, &fstep, &stride);
+		if (fstep != step){ errorExit("Prefetched frame does not match the requested step"); }
+	}
+	else {
+		// Open image file and access images
+		char fname[CMD_MAXLEN];
+		sprintf_s(fname, "%s\\%d.bmp", cam->img_dir, step);
+		// Archiving needs the whole frame, extraction only the ROI rows.
+		if (cam->dst) readFrame(fname, cam, 0, HEIGHT - 1);
+		else readFrame(fname, cam, cam->roi.row_lo, cam->roi.row_hi);
+		body = cam->frame;
+		stride = 3 * WIDTH;
+	}
+
+	extractBody(cam, body, stride, FMT_BGR24);
+	if (cam->dst) archiveFrame(cam, step, body, stride);
+	if (cam->prefetch) releaseFrame(&cam->loader);
+}
+
+// Prefetches this camera's frames first..first+count-1 from its frame directory. 
+void startPrefetch(CAMERA* cam, int first, int count){
+	startFrameLoader(&cam->loader, cam->img_dir, first, count);
+	cam->prefetch = 1;
+}
+
+// Returns the camera to synchronous frame reads. 
+void stopPrefetch(CAMERA* cam){
+	if (!cam->prefetch) return;
+	stopFrameLoader(&cam->loader);
+	cam->prefetch = 0;
+}
+
+// Sanity Function: Dumps the scanned coordinates onto the screen
+void dump2D(CAMERA* cam){
+	int counter = 0;
+	PIXEL* curr = cam->px.pl;
+	printf("\nCam %d has %d coord. \n", cam->id, cam->px.used);
+	for (; counter < cam->px.used; counter++){
+		printf("\tX: %d, Y: %d\n", curr->x, curr->y);
+		curr++;
+	}
+}
+
+/********************************************** MAPPER **********************************************/
+
+// Returns 1 if an image pixel lies on the object side of the calibrated base and wall. Z_INT receives its height.
+int isMappable(const CAM_CB* calib, float IMG_X, float IMG_Y, float* Z_INT){
+
+	// Compute Z: Applying VP (Vanishing Point) Assumption
+	float slope = (float)(calib->VP_Y - IMG_Y) / (calib->VP_X - IMG_X);
+	float IMG_INT = (float)(calib->VP_Y - calib->VP_X *slope);
+	*Z_INT = (float)(calib->BX *slope + IMG_INT);
+
+	// Out of bounds: below the base, behind the wall, or on a vanishing point column.
+	if ((*Z_INT <= calib->BY + BASE_SAFE_HEIGHT) || ((IMG_X >= calib->WALL_EDGE) && calib->ORIENT > 0) ||
+		((IMG_X <= calib->WALL_EDGE) && calib->ORIENT < 0) || calib->VP_X == IMG_X || calib->VVP_X == IMG_X){
+		return 0;
+	}
+	return 1;
+}
+
+// Geometry of laser plane k of a camera, cb for the first.
+const CAM_CB* planeCalib(const CAMERA* cam, int k){
+	return k ? &cam->plane[k - 1] : &cam->cb;
+}
+
+// Returns 1 if an image pixel can map onto the object through any laser plane of the camera.
+static int planeMappable(const CAMERA* cam, float IMG_X, float IMG_Y){
+	int k;
+	for (k = 0; k < cam->planes; k++){
+		float Z_INT;
+		if (isMappable(planeCalib(cam, k), IMG_X, IMG_Y, &Z_INT)) return 1;
+	}
+	return 0;
+}
+
+// Computes the camera's region of interest: per extracted row, the column span of pixels that can map onto the
+// object through any of its planes. Everything outside is discarded by TranslatePoints anyway. With USE_ROI 0 the
+// whole frame is kept.
+void buildROI(CAMERA* cam){
+
+	ROI* roi = &cam->roi;
+	roi->row_lo = HEIGHT;
+	roi->row_hi = UNINIT;
+
+	int rc, cc;
+	for (rc = 0; rc < HEIGHT; rc++){
+		roi->col_lo[rc] = WIDTH;
+		roi->col_hi[rc] = UNINIT;
+		if (rc % ROW_PIXEL_STRD) continue;
+
+		for (cc = 0; cc < WIDTH; cc++){
+			if (USE_ROI && !planeMappable(cam, (float)cc, (float)rc)) continue;
+			if (roi->col_lo[rc] > cc) roi->col_lo[rc] = cc;
+			roi->col_hi[rc] = cc;
+		}
+
+		if (roi->col_lo[rc] <= roi->col_hi[rc]){
+			if (roi->row_lo > rc) roi->row_lo = rc;
+			roi->row_hi = rc;
+		}
+	}
+
+	if (DBG_LOG){
+		int area = 0;
+		for (rc = roi->row_lo; rc <= roi->row_hi; rc++){
+			if (roi->col_lo[rc] <= roi->col_hi[rc]) area += roi->col_hi[rc] - roi->col_lo[rc] + 1;
+		}
+		printf("Cam %d ROI: rows %d..%d, %.1f%% of pixels. \n", cam->id, roi->row_lo, roi->row_hi, 100.0 * area / (WIDTH * HEIGHT));
+	}
+}
+
+// Translation of 2D Image Pixels to 3D Coordinates using planar anti-projection algorithm
+void TranslatePoints(int step, CAMERA* cam){
+
+	// Assigning Parameters
+	int* used2d = &cam->px.used;
+	int* parsed3d = &cam->p3d.used;
+	PIXEL* ptr_2d = cam->px.pl + *parsed3d;
+	float* out_x = cam->p3d.x + *parsed3d;
+	float* out_y = cam->p3d.y + *parsed3d;
+	float* out_z = cam->p3d.z + *parsed3d;
+	int* out_s = cam->p3d.s + *parsed3d;
+
+	// Angular Arithmetics: Each laser plane adds its own offset.
+	float step_angle = 2 * PI * step / (REV_STEPS);
+
+	// Camera Alignment: Rigid correction refined by ICP, skipped while it is the identity.
+	double R[9], T[3];
+	int aligned = alignTransform(&cam->cb, R, T);
+
+	// Data Conversion
+	int counter = 0;
+	for (; counter < *used2d - *parsed3d; counter++){
+		float IMG_X = (float)ptr_2d->x;
+		float IMG_Y = (float)ptr_2d->y;
+		const CAM_CB* calib = planeCalib(cam, ptr_2d->plane);
+		float angle = step_angle;
+		angle += calib->RAO;
+
+		// Set Default Values for Error Exceptions
+		out_x[counter] = 0;
+		out_y[counter] = 0;
+		out_z[counter] = 0;
+
+		// Compute Z, Skip Computation if point is out of bounds
+		float Z_INT;
+		if (!isMappable(calib, IMG_X, IMG_Y, &Z_INT)){
+			ptr_2d++;
+			continue;
+		}
+
+		// Compute Drop Point: Do NOT Apply Vertical VP Assumption
+		float y_dropped = (float)(calib->BM*IMG_X + calib->BB);
+		float hyp = (float)(sqrt(pow((float)(calib->BX - IMG_X), 2) + pow((calib->BY - y_dropped), 2)));
+		float XNA = (IMG_X>calib->BX) ? hyp*sin(angle)*-1 : hyp*sin(angle);
+		float YNA = (IMG_X>calib->BX) ? hyp*cos(angle)*-1 : hyp*cos(angle);
+
+		// Scale X & Y: Applying Geometric Scaling Assumption
+		// Note: LOGb(x) = LOGc(x) / LOGc(b)
+		// For now we don't scale, see how it looks like.
+
+		// Before writing to the memory the list of points, we need to normalize the points from 0..1 for OPGL.
+		float px = XNA / (WIDTH / 2);
+		float py = YNA / (WIDTH / 2);
+		float pz = (Z_INT - calib->BY) / (WIDTH / 2);
+		if (aligned){
+			float ax = (float)(R[0] * px + R[1] * py + R[2] * pz + T[0]);
+			float ay = (float)(R[3] * px + R[4] * py + R[5] * pz + T[1]);
+			float az = (float)(R[6] * px + R[7] * py + R[8] * pz + T[2]);
+			px = ax;
+			py = ay;
+			pz = az;
+		}
+
+		out_x[counter] = checkFloatSanity(px);
+		out_y[counter] = checkFloatSanity(py);
+		out_z[counter] = checkFloatSanity(pz);
+		out_s[counter] = step;
+
+		// Advance element counters
+		ptr_2d++;
+	}
+
+	// Epilogue
+	*parsed3d = *used2d;
+
+}
+
+// Sanity Function: Dumps the calculated results onto the screen.
+void dump3D(CAMERA* cam){
+	int counter = 0;
+	PCVIEW v = cloudView(&cam->p3d, 0, cam->p3d.used);
+	printf("\nCam %d has %d points. \n", cam->id, v.n);
+	for (; counter < v.n; counter++){
+		printf("X: %f, Y: %f, Z:%f\n", v.x[counter], v.y[counter], v.z[counter]);
+	}
+}
+
+/********************************************** WORKER THREADS **********************************************/
+
+// Camera Worker: Waits for a step, extracts and translates its frame, then reports completion.
+static unsigned __stdcall cameraWorker(void* prm_data){
+	CAMERA* cam = (CAMERA*)prm_data;
+	for (;;){
+		WaitForSingleObject(cam->go_evt, INFINITE);
+		if (cam->quit) break;
+		if (CAM_STAGES & STAGE_EXTRACT) ExtractPoints(cam->step, cam);
+		if (CAM_STAGES & STAGE_TRANSLATE){
+			int first = cam->p3d.used;
+			TranslatePoints(cam->step, cam);
+			if (cam->jrn && journalPoints(cam->jrn, cam - CAMS, cam->step, &cam->p3d, first, cam->p3d.used - first) != OKAY){
+				printf("Cannot journal step %d of camera %d. \n", cam->step, cam->id);
+			}
+			if (cam->tsdf && integrateSteps(cam->tsdf, &cam->p3d, first, cam->p3d.used) != OKAY){
+				printf("Cannot fuse step %d of camera %d. \n", cam->step, cam->id);
+			}
+			if (CAM_PUBLISHED) CAM_PUBLISHED(cam - CAMS);
+		}
+		SetEvent(cam->done_evt);
+	}
+	return 0;
+}
+
+// Spawns one worker thread per camera.
+void startCameraWorkers(){
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMERA* cam = &CAMS[c];
+		cam->quit = 0;
+		cam->go_evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+		cam->done_evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+		cam->worker = (HANDLE)_beginthreadex(NULL, 0, cameraWorker, cam, 0, NULL);
+		if (!cam->go_evt || !cam->done_evt || !cam->worker){ errorExit("Cannot start camera worker threads"); }
+	}
+}
+
+// Hands a step over to every camera worker. Returns immediately.
+void dispatchCameras(int step){
+	waitCameras();
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMS[c].step = step;
+		SetEvent(CAMS[c].go_evt);
+	}
+	CAMS_PENDING = 1;
+}
+
+// Blocks until every camera worker has finished its dispatched step.
+void waitCameras(){
+	if (!CAMS_PENDING) return;
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		WaitForSingleObject(CAMS[c].done_evt, INFINITE);
+	}
+	CAMS_PENDING = 0;
+}
+
+// Finishes outstanding work and joins every camera worker.
+void stopCameraWorkers(){
+	waitCameras();
+	int c;
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMS[c].quit = 1;
+		SetEvent(CAMS[c].go_evt);
+		WaitForSingleObject(CAMS[c].worker, INFINITE);
+		CloseHandle(CAMS[c].worker);
+		CloseHandle(CAMS[c].go_evt);
+		CloseHandle(CAMS[c].done_evt);
+	}
+}
@@ -0,0 +1,149 @@
+/************************************************************************************************************************
+
+Camera Array: Per-camera calibration, point buffers and worker threads.
+Each camera owns its own state so that extraction and translation of one step runs concurrently across cameras.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include <windows.h>
+
+#include "Config.h"
+#include "Calibrations.h"
+#include "FrameLoader.h"
+#include "ScanArchive.h"
+#include "PointCloud.h"
+#include "Journal.h"
+#include "Tsdf.h"
+
+// Frame Pixel Formats: Layouts the extractor has a kernel for (see extractBody). Frame files and archives are BGR24.
+#define FMT_BGR24				0
+#define FMT_RGB24				1
+#define FMT_BGRA32				2
+#define FMT_GRAY8				3			// All three laser thresholds apply to the one channel
+
+// Laser Threshold Modes (THRESHOLD_AUTO): The fixed thresh of the camera, or thresholds derived per band of rows from
+// the channel histograms of the previous frame, which the extractor gathers while it thresholds (see extractBody).
+#define THRESH_FIXED			0
+#define THRESH_OTSU				1			// Otsu's split of the brighter half of each band's histogram
+#define THRESH_PERCENTILE		2			// Pixels brighter than AUTO_PERCENTILE of their band are lit
+#define AUTO_BANDS				4			// Bands of rows with thresholds of their own
+#define AUTO_PERCENTILE			0.95		// Share of a band's pixels taken as background, the laser must cover less
+#define AUTO_MIN_CONTRAST		32			// Thresholds stay at least this far above their band's median
+
+// Segment Selection (SEGMENTS): Rows crossed by reflections hold several laser runs. Each run scores by its width
+// (up to SEG_WIDTH_FULL), its peak red and how close it lies to the point kept on the row before (within
+// SEG_ROW_REACH rows) and on this row in the step before, if that was the neighbouring step; only the best seg_keep
+// runs of a row become points.
+#define SEG_MAX_KEEP			4
+#define SEG_WIDTH_FULL			8			// Run width in pixels earning the full width score
+#define SEG_JUMP				32			// Offset in pixels from a neighbouring point losing the full continuity score
+#define SEG_ROW_REACH			(4 * ROW_PIXEL_STRD)
+#define SEG_W_WIDTH				1.0f
+#define SEG_W_PEAK				1.0f
+#define SEG_W_CONT				2.0f
+
+// Laser Planes (PLANE blocks): A camera may see up to MAX_PLANES parallel laser lines, each with the geometry and
+// RAO of its own CAM_CB. The runs of a row are matched to the planes, both left to right, near where each plane's
+// line was on the rows above (see assignPlanes); runs left without a plane are dropped. Segment selection should
+// keep at least as many runs as there are planes, or all of them.
+#define MAX_PLANES				4
+#define PLANE_MAX_RUNS			32			// Runs of a row matched to planes, the rest are dropped
+#define PLANE_ROW_REACH			(4 * ROW_PIXEL_STRD)
+
+// Structures
+typedef struct {
+	int mode;					// THRESH_*
+	int valid;					// thresh holds the thresholds of an earlier frame of this scan
+	int thresh[AUTO_BANDS][3];	// Per band: R, G, B
+	unsigned int hist[2][AUTO_BANDS][3][256];	// Per band and channel, even and odd columns counted apart
+}AUTO_THRESH;
+
+typedef struct {
+	int row_lo;					// First and last image rows holding mappable pixels
+	int row_hi;
+	short col_lo[HEIGHT];		// Per-row mappable column span, col_lo > col_hi if none
+	short col_hi[HEIGHT];
+}ROI;
+
+typedef struct {
+	int id;						// CommCam device number
+	char img_name[CMD_MAXLEN];	// Frame directory name of this camera
+	char img_dir[CMD_MAXLEN];	// Frame directory path (img_name under the current frame root)
+	CAM_CB cb;					// Hardware calibration of this camera, and geometry of its first laser plane
+	int planes;					// Laser planes seen, 1..MAX_PLANES
+	CAM_CB plane[MAX_PLANES - 1];	// Geometry and RAO of the planes after the first (ALIGN_* are cb's)
+	ROI roi;					// Pixels that can map onto the object through any plane (see buildROI)
+	int thresh[3];				// Laser thresholds: R, G, B
+	AUTO_THRESH autothr;		// Per-frame thresholds, unless in THRESH_FIXED mode
+	int seg_keep;				// Laser runs kept per row, 0 for all
+	short seg_x[HEIGHT];		// Per row, the best run kept in the last extracted step, UNINIT if none
+	int seg_step;				// Step seg_x was kept in, UNINIT before the first
+	PIXELS px;					// Extracted 2D laser points
+	PCLOUD p3d;					// Translated 3D points
+	unsigned char* frame;		// Reusable image body buffer (WIDTH*HEIGHT*3)
+	FRAME_LOADER loader;		// Frame prefetcher for recorded scans
+	int prefetch;				// Extract from loader instead of reading frames synchronously
+	SCAN_ARCHIVE* src;			// Extract frames from this archive instead of the frame directory
+	SCAN_ARCHIVE* dst;			// Archive every extracted frame here
+	unsigned char* zbuf;		// Archive compression scratch (ARCHIVE_SCRATCH_BYTES)
+	JOURNAL* jrn;				// Journal every translated step here
+	TSDF* tsdf;					// Fuse every translated step into this volume
+	int disp;					// Illustrator display toggle
+	float color[3];				// Illustrator point colour
+
+	// Worker Thread Controls
+	HANDLE worker;
+	HANDLE go_evt;
+	HANDLE done_evt;
+	int step;
+	volatile int quit;
+}CAMERA;
+
+extern CAMERA CAMS[NUM_CAMS];
+extern int CAM_STAGES;
+
+// Called by a worker thread after it has appended the points of a step to its cloud (may be NULL).
+typedef void(*CAM_NOTIFY)(int cam);
+extern CAM_NOTIFY CAM_PUBLISHED;
+
+// Camera Array Management
+void initCameras();
+void freeCameras();
+void resetCameras();
+void setFrameRoot(const char* root);
+
+// Calibration Files: "CAM <n>" selects a camera, followed by "<KEY> <VALUE>" lines named after the CB_N_* constants
+// and, for the laser thresholds, THRESHOLD_R/G/B and THRESHOLD_AUTO (THRESH_* mode), SEGMENTS for seg_keep.
+// "PLANE <k>" (2..MAX_PLANES) turns the geometry keys that follow to laser plane k of the camera, which starts out
+// as a copy of cb; "PLANE 1" turns them back to cb.
+// Both return OKAY on success, ERR otherwise.
+int loadCalibration(const char* fname);
+int saveCalibration(const char* fname);
+
+// Checksum of every camera's calibration, identifying the setup a journal was recorded with.
+unsigned int calibrationCRC();
+
+// Per-Camera Processing
+int isMappable(const CAM_CB* calib, float IMG_X, float IMG_Y, float* Z_INT);
+const CAM_CB* planeCalib(const CAMERA* cam, int k);
+void buildROI(CAMERA* cam);
+int loadFrame(int step, CAMERA* cam);
+void ExtractPoints(int step, CAMERA* cam);
+
+// Appends the laser points of one WIDTH x HEIGHT image body in FMT_* layout fmt, rows stride bytes apart, e.g. a
+// capture driver's buffer. Each layout has its own kernel with the pixel offsets and row step compiled in.
+void extractBody(CAMERA* cam, const unsigned char* body, int stride, int fmt);
+void TranslatePoints(int step, CAMERA* cam);
+void dump2D(CAMERA* cam);
+void startPrefetch(CAMERA* cam, int first, int count);
+void stopPrefetch(CAMERA* cam);
+void dump3D(CAMERA* cam);
+
+// Worker Threads: Dispatch a step to every camera, then wait for all of them to finish.
+// Workers run the CAM_STAGES subset of STAGE_EXTRACT and STAGE_TRANSLATE.
+void startCameraWorkers();
+void dispatchCameras(int step);
+void waitCameras();
+void stopCameraWorkers();
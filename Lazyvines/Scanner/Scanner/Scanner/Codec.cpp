@@ -0,0 +1,179 @@
+/************************************************************************************************************************
+
+Codec: Lossless byte-stream compression and checksums shared by the storage formats.
+
+*************************************************************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Codec.h"
+
+// LZ Block Format Limits
+#define LZ_HASH_LOG				14
+#define LZ_MIN_MATCH			4
+#define LZ_LAST_LITERALS		5
+#define LZ_MF_LIMIT				12
+#define LZ_MAX_OFFSET			65535
+#define LZ_SKIP_TRIGGER			6
+
+static unsigned int read32(const unsigned char* p){
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static unsigned int lzHash(unsigned int v){
+	return (v * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+// Writes the 255-continued remainder of a literal or match length.
+static unsigned char* writeLength(unsigned char* op, int len){
+	while (len >= 255){
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+// Emits one sequence: literals [anchor, anchor+lit) followed by an optional match (mlen 0 = none).
+static unsigned char* writeSequence(unsigned char* op, const unsigned char* anchor, int lit, int off, int mlen){
+	unsigned char* token = op++;
+	*token = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+	if (lit >= 15) op = writeLength(op, lit - 15);
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	if (mlen){
+		*op++ = (unsigned char)(off & 0xFF);
+		*op++ = (unsigned char)(off >> 8);
+		int ml = mlen - LZ_MIN_MATCH;
+		*token |= (unsigned char)(ml >= 15 ? 15 : ml);
+		if (ml >= 15) op = writeLength(op, ml - 15);
+	}
+	return op;
+}
+
+// Greedy single-probe hash matcher. Skips ahead faster through incompressible regions.
+int lzCompress(const unsigned char* src, int n, unsigned char* dst){
+
+	unsigned char* op = dst;
+	const unsigned char* anchor = src;
+	const unsigned char* end = src + n;
+
+	if (n > LZ_MF_LIMIT){
+		int* table = (int*)calloc(1 << LZ_HASH_LOG, sizeof(int));
+		const unsigned char* ip = src;
+		const unsigned char* mflimit = end - LZ_MF_LIMIT;
+		const unsigned char* matchlimit = end - LZ_LAST_LITERALS;
+
+		while (ip < mflimit){
+			unsigned int h = lzHash(read32(ip));
+			int ref = table[h] - 1;
+			table[h] = (int)(ip - src) + 1;
+
+			if (ref < 0 || (ip - src) - ref > LZ_MAX_OFFSET || read32(src + ref) != read32(ip)){
+				ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+				continue;
+			}
+
+			// Extend the match backwards into pending literals, then forwards.
+			const unsigned char* match = src + ref;
+			while (ip > anchor && match > src && ip[-1] == match[-1]){ ip--; match--; }
+			const unsigned char* mp = ip + LZ_MIN_MATCH;
+			const unsigned char* mm = match + LZ_MIN_MATCH;
+			while (mp < matchlimit && *mp == *mm){ mp++; mm++; }
+
+			op = writeSequence(op, anchor, (int)(ip - anchor), (int)(ip - match), (int)(mp - ip));
+			ip = mp;
+			anchor = ip;
+			if (ip < mflimit) table[lzHash(read32(ip - 2))] = (int)(ip - 2 - src) + 1;
+		}
+		free(table);
+	}
+
+	// Last Literals
+	op = writeSequence(op, anchor, (int)(end - anchor), 0, 0);
+	return (int)(op - dst);
+}
+
+// Bounds-checked decoder: never reads past src+csize nor writes past dst+n.
+int lzDecompress(const unsigned char* src, int csize, unsigned char* dst, int n){
+
+	const unsigned char* ip = src;
+	const unsigned char* iend = src + csize;
+	unsigned char* op = dst;
+	unsigned char* oend = dst + n;
+
+	while (ip < iend){
+		unsigned int token = *ip++;
+
+		// Literals
+		int lit = token >> 4;
+		if (lit == 15){
+			unsigned char b;
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				lit += b;
+			} while (b == 255);
+		}
+		if (lit > oend - op || lit > iend - ip) return -1;
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip >= iend) break;
+
+		// Match
+		if (iend - ip < 2) return -1;
+		int off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (off == 0 || off > op - dst) return -1;
+
+		int ml = token & 15;
+		if (ml == 15){
+			unsigned char b;
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				ml += b;
+			} while (b == 255);
+		}
+		ml += LZ_MIN_MATCH;
+		if (ml > oend - op) return -1;
+
+		const unsigned char* m = op - off;
+		if (off >= ml){
+			memcpy(op, m, ml);
+			op += ml;
+		}
+		else {
+			while (ml--) *op++ = *m++;
+		}
+	}
+
+	return (op == oend) ? n : -1;
+}
+
+// Table for the reflected polynomial 0xEDB88320. Filled once; concurrent first calls compute identical entries.
+static unsigned int CRC_TABLE[256];
+static volatile int CRC_READY = 0;
+
+unsigned int crc32(unsigned int crc, const void* data, int n){
+
+	if (!CRC_READY){
+		unsigned int i, k;
+		for (i = 0; i < 256; i++){
+			unsigned int c = i;
+			for (k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+			CRC_TABLE[i] = c;
+		}
+		CRC_READY = 1;
+	}
+
+	const unsigned char* p = (const unsigned char*)data;
+	crc = ~crc;
+	while (n--) crc = CRC_TABLE[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
@@ -0,0 +1,21 @@
+/************************************************************************************************************************
+
+Codec: Lossless byte-stream compression and checksums shared by the storage formats.
+lzCompress/lzDecompress produce and consume the LZ4 block format (byte-aligned literal runs and 64 KB back
+references), trading ratio for speed so that frames can be packed while the scan runs.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+// Worst-case compressed size of n input bytes.
+#define LZ_BOUND(n)				((n) + (n) / 255 + 16)
+
+// Compresses n bytes of src into dst (at least LZ_BOUND(n) bytes). Returns the compressed size.
+int lzCompress(const unsigned char* src, int n, unsigned char* dst);
+
+// Decompresses a block of csize bytes into exactly n bytes of dst. Returns n, or -1 on corrupt input.
+int lzDecompress(const unsigned char* src, int csize, unsigned char* dst, int n);
+
+// CRC-32 (IEEE) of n bytes, continuing from crc (0 for a new checksum).
+unsigned int crc32(unsigned int crc, const void* data, int n);
@@ -1,9 +1,59 @@
+#pragma once
+
 // *** APPLICATION LEVEL CONFIGURATIONS ***
 
 // Debug Settings: Recommend File Redirection for DBG_V. 
 #define DBG_LOG                 1
 #define DBG_VIGOROUS			0
 
+// Frame Archive Settings: Pack raw frames into Data\<timestamp>.scan, optionally dropping the BMPs afterwards. 
+#define ARCHIVE_FRAMES			1
+#define KEEP_RAW_FRAMES			0
+
+// Frame Prefetch: Reads of recorded frames kept in flight per camera while the workers extract (FrameLoader.h). 
+#define PREFETCH_WINDOW			8
+
+// Region of Interest: Only search the pixels that can map onto the object for the laser (buildROI, Camera.h). 
+#define USE_ROI					1
+
+// Scan Journal: Record every translated step so that an interrupted scan can resume where it stopped (Journal.h). 
+#define JOURNAL_SCANS			1
+#define JOURNAL_FILE			"Data\\scan.journal"
+
+// Acquisition Order: Steps of a turn are taken in ORDER_* order (StepOrder.h). Progressive orders show the whole object
+// coarsely early on, so a scan may stop at STEP_TARGET steps, or on Esc once the preview looks wrong or good enough.
+// Out of sequence the disk turns by absolute moves, the shorter way round, which needs MOTOR_ABSOLUTE (Arduino_Controls
+// rev. 4). Without it the disk only turns forward, which is enough to resume a sequential scan.
+#define STEP_ORDER				0
+#define STEP_TARGET				REV_STEPS	// Steps taken before the scan stops
+#define MOTOR_ABSOLUTE			0
+#define MOTOR_TIMEOUT_MS		60000		// Longest wait for the Arduino to acknowledge a move
+#if STEP_ORDER != 0 && !MOTOR_ABSOLUTE
+#error Progressive step orders need absolute motor moves (MOTOR_ABSOLUTE).
+#endif
+
+// Camera Alignment: Refine the cameras' relative pose by ICP before saving (Align.h). A refinement kept in
+// CALIB_FILE overrides Calibrations.h in later sessions. 
+#define ALIGN_SCANS				1
+#define CALIB_FILE				"Data\\calibration.txt"
+
+// Cloud Merge: Fuse the cameras' clouds into one, one point per pixel-sized cell, before saving (Merge.h). 
+#define MERGE_SCANS				1
+
+// Normals: Estimate per point normals before saving, exported with the points (Normals.h). 
+#define NORMAL_SCANS			1
+
+// Volumetric Fusion: Fuse every translated step into one TSDF volume and save its mesh as Data\<name>.stl (Tsdf.h). 
+#define FUSE_SCANS				0
+#define FUSE_PREVIEW_STEPS		20		// Steps between mesh previews written to FUSE_PREVIEW_FILE, 0 for none
+#define FUSE_PREVIEW_FILE		"Data\\preview.stl"
+#define FUSE_DECIMATE_TRIS		0		// Triangles the saved mesh is decimated to (Decimate.h), 0 for no budget
+#define FUSE_DECIMATE_PIXELS	0.25	// Surface error in image pixels decimation may add, 0 for no bound
+
+// Point Storage Settings: Save sessions as compressed .3dpz (PointCodec.h) instead of .3dps text. 
+#define SAVE_COMPRESSED			1
+#define EXPORT_PLY				1		// Also write Data\<name>.ply for external tools
+
 // Illustrator Settings 
 #define HOR_ANGLE_DELTA			2.0
 #define VERT_ANGLE_DELTA		2.0
@@ -12,6 +62,18 @@
 #define SCALE_BASE				1.5
 #define ZOOM_DELTA				0.05
 #define MOUSE_DRAG_SENSITIVITY	25
+#define QUANTIZE_DISPLAY		1		// Draw from 16-bit quantized copies of the clouds, less vertex data per frame (Quantize.h)
+#define LOD_DISPLAY				1		// Draw through level-of-detail octrees built in the background (LodOctree.h)
+#define LOD_BUDGET				(1 << 20)	// Points drawn per frame while the view moves
+#define LOD_BUDGET_MAX			(1 << 24)	// Budget the view refines up to while it stays still
+#define LOD_REBUILD_SECONDS		2.0		// Minimum interval between rebuilds of a growing cloud
+#define IDLE_POLL_MS			20		// Event polling interval while a tree build is outstanding
+#define FRAME_STATS_FRAMES		120		// Redraws per frame time report
+
+// Preview Images: Software rendered with the illustrator's default view (Raster.h). 
+#define PREVIEW_WIDTH			640
+#define PREVIEW_HEIGHT			480
+#define PREVIEW_POINT_SIZE		2
 
 // *** CONSTANTS ***
 
@@ -22,6 +84,9 @@
 #define ERR						1
 #define OKAY					0
 
+// Gracefully exits the program. Each executable provides its own definition. 
+void errorExit(const char* prompt);
+
 // Datasize Definitions
 #define MAX_POINTS				524288
 #define CMD_MAXLEN              128
@@ -32,6 +97,12 @@
 #define DWORD               short int
 #define LONG                int 
 
+// Processing Stages 
+#define STAGE_EXTRACT			0x01
+#define STAGE_TRANSLATE			0x02
+#define STAGE_SAVE				0x04
+#define STAGE_ARCHIVE			0x08
+
 // *** SYNTHETICS ***
 #define MIN(x,y)            ((x<y)?(x):(y))
 #define MAX(x,y)            ((x<y)?(y):(x))
@@ -42,6 +113,7 @@
 typedef struct {
 	int x; 
 	int y;
+	int plane;					// Laser plane of the camera this point lies on (see CAMERA.planes)
 }PIXEL;
 
 typedef struct {
@@ -0,0 +1,673 @@
+/************************************************************************************************************************
+
+Decimate: Quadric error mesh simplification, slab parallel.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "Decimate.h"
+#include "Parallel.h"
+
+#define DEC_MAX_SLABS			(DEC_SLABS_PER_WORKER * PAR_MAX_THREADS)
+#define DEC_SINGULAR			1e-10		// Quadrics with a smaller determinant (relative) have no single minimum
+
+// Structures
+typedef struct {
+	double cost;
+	float p[3];					// Where the kept vertex moves
+	int keep;
+	int drop;
+	int keep_ver;
+	int drop_ver;
+}DEC_EDGE;
+
+typedef struct {
+	int nv;
+	int nt;
+	int live;					// Triangles left
+	float* xyz;
+	int* src;					// Input vertex each vertex stands for
+	unsigned char* fixed;		// Neither moved nor removed
+	int* tri;					// 3 vertices per triangle, the first UNINIT once collapsed
+	double* q;					// Per vertex quadric: a2 ab ac ad b2 bc bd c2 cd d2 of its planes
+	double* w;					// Area the quadric was summed over
+	int* ver;					// Bumped whenever the vertex moves, UNINIT once removed
+	int* head;					// First triangle reference per vertex
+	int* ref_tri;				// Triangle references, chained per vertex
+	int* ref_next;
+	int* mark;					// Ring scratch per vertex: stamps, shared triangles and one of them
+	int* mark2;
+	int* cnt;
+	int* etri;
+	int* nbr;
+	int stamp;
+	DEC_EDGE* heap;
+	int heap_used;
+	int heap_max;
+	int status;
+}DEC_MESH;
+
+typedef struct {
+	const MESH* mesh;
+	int target;
+	double max_cost;
+	int* slab;					// Per input vertex
+	unsigned char* fixed;		// Per input vertex: on a triangle crossing slabs
+	int* loc;					// Per input vertex: index within its slab, later within the whole
+	int vfirst[DEC_MAX_SLABS + 1];
+	int* vorder;				// Input vertices grouped by slab
+	int tfirst[DEC_MAX_SLABS + 1];
+	int* torder;				// Triangles within one slab, grouped by slab
+	DEC_MESH part[DEC_MAX_SLABS];
+}DEC_CTX;
+
+/*********** WORKING MESH ***********/
+
+static void freeDecMesh(DEC_MESH* m){
+	free(m->xyz);
+	free(m->src);
+	free(m->fixed);
+	free(m->tri);
+	free(m->q);
+	free(m->w);
+	free(m->ver);
+	free(m->head);
+	free(m->ref_tri);
+	free(m->ref_next);
+	free(m->mark);
+	free(m->mark2);
+	free(m->cnt);
+	free(m->etri);
+	free(m->nbr);
+	free(m->heap);
+	memset(m, 0, sizeof(DEC_MESH));
+}
+
+// Room for nv vertices and nt triangles, whose xyz, src, fixed and tri are filled in by the caller.
+static int allocDecMesh(DEC_MESH* m, int nv, int nt){
+	memset(m, 0, sizeof(DEC_MESH));
+	size_t v = MAX(nv, 1), t = MAX(nt, 1);
+	m->nv = nv;
+	m->nt = nt;
+	m->xyz = (float*)malloc(3 * v * sizeof(float));
+	m->src = (int*)malloc(v * sizeof(int));
+	m->fixed = (unsigned char*)calloc(v, 1);
+	m->tri = (int*)malloc(3 * t * sizeof(int));
+	m->q = (double*)malloc(10 * v * sizeof(double));
+	m->w = (double*)malloc(v * sizeof(double));
+	m->ver = (int*)malloc(v * sizeof(int));
+	m->head = (int*)malloc(v * sizeof(int));
+	m->ref_tri = (int*)malloc(3 * t * sizeof(int));
+	m->ref_next = (int*)malloc(3 * t * sizeof(int));
+	m->mark = (int*)calloc(v, sizeof(int));
+	m->mark2 = (int*)calloc(v, sizeof(int));
+	m->cnt = (int*)malloc(v * sizeof(int));
+	m->etri = (int*)malloc(v * sizeof(int));
+	m->nbr = (int*)malloc(v * sizeof(int));
+	m->heap_max = 3 * (int)v + 16;
+	m->heap = (DEC_EDGE*)malloc(m->heap_max * sizeof(DEC_EDGE));
+	m->status = (m->xyz && m->src && m->fixed && m->tri && m->q && m->w && m->ver && m->head && m->ref_tri &&
+		m->ref_next && m->mark && m->mark2 && m->cnt && m->etri && m->nbr && m->heap) ? OKAY : ERR;
+	if (m->status == OKAY) return OKAY;
+	freeDecMesh(m);
+	m->status = ERR;
+	return ERR;
+}
+
+// Unique neighbours of v into nbr, with the number of live triangles each shares with v (cnt) and one of them
+// (etri). References to collapsed triangles are unlinked on the way. Returns the neighbour count.
+static int ring(DEC_MESH* m, int v){
+	int stamp = ++m->stamp;
+	int n = 0;
+	int* link = &m->head[v];
+	while (*link != UNINIT){
+		int r = *link;
+		int t = m->ref_tri[r];
+		if (m->tri[3 * t] == UNINIT){
+			*link = m->ref_next[r];
+			continue;
+		}
+		int k;
+		for (k = 0; k < 3; k++){
+			int u = m->tri[3 * t + k];
+			if (u == v) continue;
+			if (m->mark[u] != stamp){
+				m->mark[u] = stamp;
+				m->cnt[u] = 0;
+				m->nbr[n++] = u;
+			}
+			m->cnt[u]++;
+			m->etri[u] = t;
+		}
+		link = &m->ref_next[r];
+	}
+	return n;
+}
+
+/*********** QUADRICS ***********/
+
+static void addPlane(double* q, const double* n, double d, double w){
+	q[0] += w * n[0] * n[0];
+	q[1] += w * n[0] * n[1];
+	q[2] += w * n[0] * n[2];
+	q[3] += w * n[0] * d;
+	q[4] += w * n[1] * n[1];
+	q[5] += w * n[1] * n[2];
+	q[6] += w * n[1] * d;
+	q[7] += w * n[2] * n[2];
+	q[8] += w * n[2] * d;
+	q[9] += w * d * d;
+}
+
+static double evalQuadric(const double* q, const double* p){
+	return q[0] * p[0] * p[0] + 2 * q[1] * p[0] * p[1] + 2 * q[2] * p[0] * p[2] + 2 * q[3] * p[0]
+		+ q[4] * p[1] * p[1] + 2 * q[5] * p[1] * p[2] + 2 * q[6] * p[1]
+		+ q[7] * p[2] * p[2] + 2 * q[8] * p[2] + q[9];
+}
+
+// Cross product of the triangle's edges into n. Returns its length, twice the area.
+static double triNormal(const float* a, const float* b, const float* c, double* n){
+	double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	double v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	n[0] = u[1] * v[2] - u[2] * v[1];
+	n[1] = u[2] * v[0] - u[0] * v[2];
+	n[2] = u[0] * v[1] - u[1] * v[0];
+	return sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+}
+
+// Collapse of edge (a, b) into e: a fixed end is kept where it is, otherwise the kept end moves to the minimum of
+// the summed quadric, or the best of both ends and the middle where there is no single minimum near the edge.
+// Returns 0 if both ends are fixed.
+static int edgeCost(const DEC_MESH* m, int a, int b, DEC_EDGE* e){
+	if (m->fixed[b]){ int t = a; a = b; b = t; }
+	if (m->fixed[b]) return 0;
+
+	double q[10];
+	int i;
+	for (i = 0; i < 10; i++) q[i] = m->q[10 * a + i] + m->q[10 * b + i];
+	const float* pa = m->xyz + 3 * a;
+	const float* pb = m->xyz + 3 * b;
+	double p[3] = { pa[0], pa[1], pa[2] };
+
+	if (!m->fixed[a]){
+		double mid[3] = { 0.5 * (pa[0] + pb[0]), 0.5 * (pa[1] + pb[1]), 0.5 * (pa[2] + pb[2]) };
+		double len2 = (pb[0] - pa[0]) * (pb[0] - pa[0]) + (pb[1] - pa[1]) * (pb[1] - pa[1]) + (pb[2] - pa[2]) * (pb[2] - pa[2]);
+		double c00 = q[4] * q[7] - q[5] * q[5], c01 = q[2] * q[5] - q[1] * q[7], c02 = q[1] * q[5] - q[2] * q[4];
+		double c11 = q[0] * q[7] - q[2] * q[2], c12 = q[1] * q[2] - q[0] * q[5], c22 = q[0] * q[4] - q[1] * q[1];
+		double det = q[0] * c00 + q[1] * c01 + q[2] * c02;
+		double scale = q[0] + q[4] + q[7];
+		int solved = 0;
+		if (fabs(det) > DEC_SINGULAR * scale * scale * scale){
+			p[0] = -(c00 * q[3] + c01 * q[6] + c02 * q[8]) / det;
+			p[1] = -(c01 * q[3] + c11 * q[6] + c12 * q[8]) / det;
+			p[2] = -(c02 * q[3] + c12 * q[6] + c22 * q[8]) / det;
+			double off = (p[0] - mid[0]) * (p[0] - mid[0]) + (p[1] - mid[1]) * (p[1] - mid[1]) + (p[2] - mid[2]) * (p[2] - mid[2]);
+			solved = off <= len2;
+		}
+		if (!solved){
+			double cand[3][3] = { { pa[0], pa[1], pa[2] }, { pb[0], pb[1], pb[2] }, { mid[0], mid[1], mid[2] } };
+			double best = 0;
+			int c;
+			for (c = 0; c < 3; c++){
+				double err = evalQuadric(q, cand[c]);
+				if (c == 0 || err < best){
+					best = err;
+					memcpy(p, cand[c], sizeof(p));
+				}
+			}
+		}
+	}
+
+	double w = m->w[a] + m->w[b];
+	double err = evalQuadric(q, p);
+	e->cost = (w > 0 && err > 0) ? err / w : 0;
+	e->p[0] = (float)p[0];
+	e->p[1] = (float)p[1];
+	e->p[2] = (float)p[2];
+	e->keep = a;
+	e->drop = b;
+	e->keep_ver = m->ver[a];
+	e->drop_ver = m->ver[b];
+	return 1;
+}
+
+/*********** HEAP ***********/
+
+static void pushEdge(DEC_MESH* m, int a, int b){
+	DEC_EDGE e;
+	if (!edgeCost(m, a, b, &e)) return;
+	if (m->heap_used == m->heap_max){
+		DEC_EDGE* grown = (DEC_EDGE*)realloc(m->heap, 2 * (size_t)m->heap_max * sizeof(DEC_EDGE));
+		if (!grown){
+			m->status = ERR;
+			return;
+		}
+		m->heap = grown;
+		m->heap_max *= 2;
+	}
+	int i = m->heap_used++;
+	while (i > 0 && m->heap[(i - 1) / 2].cost > e.cost){
+		m->heap[i] = m->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	m->heap[i] = e;
+}
+
+static DEC_EDGE popEdge(DEC_MESH* m){
+	DEC_EDGE top = m->heap[0];
+	DEC_EDGE last = m->heap[--m->heap_used];
+	int n = m->heap_used, i = 0;
+	while (2 * i + 1 < n){
+		int c = 2 * i + 1;
+		if (c + 1 < n && m->heap[c + 1].cost < m->heap[c].cost) c++;
+		if (m->heap[c].cost >= last.cost) break;
+		m->heap[i] = m->heap[c];
+		i = c;
+	}
+	if (n > 0) m->heap[i] = last;
+	return top;
+}
+
+/*********** COLLAPSE ***********/
+
+// Quadrics, triangle references and every edge once in the heap.
+static void prepareMesh(DEC_MESH* m){
+	int v, t, i, k;
+	memset(m->q, 0, 10 * (size_t)MAX(m->nv, 1) * sizeof(double));
+	memset(m->w, 0, (size_t)MAX(m->nv, 1) * sizeof(double));
+	memset(m->ver, 0, (size_t)MAX(m->nv, 1) * sizeof(int));
+	for (v = 0; v < m->nv; v++) m->head[v] = UNINIT;
+
+	m->live = 0;
+	for (t = 0; t < m->nt; t++){
+		const int* tv = m->tri + 3 * t;
+		if (tv[0] == UNINIT) continue;
+		for (k = 0; k < 3; k++){
+			m->ref_tri[3 * t + k] = t;
+			m->ref_next[3 * t + k] = m->head[tv[k]];
+			m->head[tv[k]] = 3 * t + k;
+		}
+		m->live++;
+
+		double n[3];
+		const float* p0 = m->xyz + 3 * tv[0];
+		double len = triNormal(p0, m->xyz + 3 * tv[1], m->xyz + 3 * tv[2], n);
+		if (len == 0) continue;
+		n[0] /= len; n[1] /= len; n[2] /= len;
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		for (k = 0; k < 3; k++){
+			addPlane(m->q + 10 * tv[k], n, d, 0.5 * len);
+			m->w[tv[k]] += 0.5 * len;
+		}
+	}
+
+	// Open borders: a plane through every border edge, upright on its triangle, holds the outline in place.
+	for (v = 0; v < m->nv; v++){
+		int nn = ring(m, v);
+		for (i = 0; i < nn; i++){
+			int u = m->nbr[i];
+			if (u < v || m->cnt[u] != 1) continue;
+			const int* tv = m->tri + 3 * m->etri[u];
+			const float* pv = m->xyz + 3 * v;
+			const float* pu = m->xyz + 3 * u;
+			double tn[3], bn[3];
+			double e[3] = { pu[0] - pv[0], pu[1] - pv[1], pu[2] - pv[2] };
+			triNormal(m->xyz + 3 * tv[0], m->xyz + 3 * tv[1], m->xyz + 3 * tv[2], tn);
+			bn[0] = e[1] * tn[2] - e[2] * tn[1];
+			bn[1] = e[2] * tn[0] - e[0] * tn[2];
+			bn[2] = e[0] * tn[1] - e[1] * tn[0];
+			double len = sqrt(bn[0] * bn[0] + bn[1] * bn[1] + bn[2] * bn[2]);
+			if (len == 0) continue;
+			bn[0] /= len; bn[1] /= len; bn[2] /= len;
+			double d = -(bn[0] * pv[0] + bn[1] * pv[1] + bn[2] * pv[2]);
+			double w = DEC_BORDER_WEIGHT * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+			addPlane(m->q + 10 * v, bn, d, w);
+			addPlane(m->q + 10 * u, bn, d, w);
+		}
+	}
+
+	for (v = 0; v < m->nv; v++){
+		int nn = ring(m, v);
+		for (i = 0; i < nn; i++){
+			if (m->nbr[i] > v) pushEdge(m, v, m->nbr[i]);
+		}
+	}
+}
+
+// Whether no triangle of v other than those on edge (keep, drop) folds over once v sits at p.
+static int keepsOrientation(DEC_MESH* m, int v, const DEC_EDGE* e){
+	int r;
+	for (r = m->head[v]; r != UNINIT; r = m->ref_next[r]){
+		const int* tv = m->tri + 3 * m->ref_tri[r];
+		if (tv[0] == UNINIT) continue;
+		int on = 0, k;
+		for (k = 0; k < 3; k++) on += (tv[k] == e->keep || tv[k] == e->drop);
+		if (on == 2) continue;
+
+		const float* p[3];
+		double n0[3], n1[3];
+		for (k = 0; k < 3; k++) p[k] = m->xyz + 3 * tv[k];
+		double l0 = triNormal(p[0], p[1], p[2], n0);
+		for (k = 0; k < 3; k++) if (tv[k] == v) p[k] = e->p;
+		double l1 = triNormal(p[0], p[1], p[2], n1);
+		if (l1 == 0 || n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= DEC_FLIP_COS * l0 * l1) return 0;
+	}
+	return 1;
+}
+
+static int canCollapse(DEC_MESH* m, const DEC_EDGE* e){
+	int a = e->keep, b = e->drop;
+	int i, r, k;
+
+	int nb = ring(m, b);
+	int border_b = 0;
+	for (i = 0; i < nb; i++) border_b |= m->cnt[m->nbr[i]] == 1;
+
+	int na = ring(m, a);
+	int stamp_a = m->stamp;
+	int border_a = 0, shared = 0;
+	for (i = 0; i < na; i++){
+		border_a |= m->cnt[m->nbr[i]] == 1;
+		if (m->nbr[i] == b) shared = m->cnt[b];
+	}
+
+	// An inner edge between two border vertices would pinch the surface into a bow tie.
+	if (shared < 1 || shared > 2) return 0;
+	if (shared == 2 && border_a && border_b) return 0;
+
+	// Link condition: the ends may only share the vertices opposite their edge.
+	int stamp = ++m->stamp, common = 0;
+	for (r = m->head[b]; r != UNINIT; r = m->ref_next[r]){
+		const int* tv = m->tri + 3 * m->ref_tri[r];
+		if (tv[0] == UNINIT) continue;
+		for (k = 0; k < 3; k++){
+			int u = tv[k];
+			if (u == a || u == b || m->mark[u] != stamp_a || m->mark2[u] == stamp) continue;
+			m->mark2[u] = stamp;
+			common++;
+		}
+	}
+	if (common != shared) return 0;
+
+	return keepsOrientation(m, a, e) && keepsOrientation(m, b, e);
+}
+
+static void collapse(DEC_MESH* m, const DEC_EDGE* e){
+	int a = e->keep, b = e->drop;
+	int r = m->head[b], i, k;
+	while (r != UNINIT){
+		int next = m->ref_next[r];
+		int* tv = m->tri + 3 * m->ref_tri[r];
+		if (tv[0] != UNINIT){
+			if (tv[0] == a || tv[1] == a || tv[2] == a){
+				tv[0] = UNINIT;
+				m->live--;
+			}
+			else {
+				for (k = 0; k < 3; k++) if (tv[k] == b) tv[k] = a;
+				m->ref_next[r] = m->head[a];
+				m->head[a] = r;
+			}
+		}
+		r = next;
+	}
+	m->head[b] = UNINIT;
+
+	for (k = 0; k < 3; k++) m->xyz[3 * a + k] = e->p[k];
+	for (k = 0; k < 10; k++) m->q[10 * a + k] += m->q[10 * b + k];
+	m->w[a] += m->w[b];
+	m->ver[b] = UNINIT;
+	m->ver[a]++;
+
+	int n = ring(m, a);
+	for (i = 0; i < n; i++) pushEdge(m, a, m->nbr[i]);
+}
+
+static void simplify(DEC_MESH* m, int target, double max_cost){
+	while (m->heap_used && m->status == OKAY){
+		if (target > 0 && m->live <= target) break;
+		DEC_EDGE e = popEdge(m);
+		if (max_cost > 0 && e.cost > max_cost) break;
+		if (m->ver[e.keep] != e.keep_ver || m->ver[e.drop] != e.drop_ver) continue;
+		if (canCollapse(m, &e)) collapse(m, &e);
+	}
+}
+
+/*********** SLABS ***********/
+
+static void slabTask(void* prm, int idx){
+	DEC_CTX* ctx = (DEC_CTX*)prm;
+	const MESH* mesh = ctx->mesh;
+	DEC_MESH* m = &ctx->part[idx];
+	int v0 = ctx->vfirst[idx], nv = ctx->vfirst[idx + 1] - v0;
+	int t0 = ctx->tfirst[idx], nt = ctx->tfirst[idx + 1] - t0;
+	int i, k;
+	if (allocDecMesh(m, nv, nt) != OKAY) return;
+
+	// Slabs own disjoint vertices, so each writes its own entries of loc.
+	for (i = 0; i < nv; i++){
+		int g = ctx->vorder[v0 + i];
+		ctx->loc[g] = i;
+		m->xyz[3 * i + 0] = mesh->v.x[g];
+		m->xyz[3 * i + 1] = mesh->v.y[g];
+		m->xyz[3 * i + 2] = mesh->v.z[g];
+		m->src[i] = g;
+		m->fixed[i] = ctx->fixed[g];
+	}
+	for (i = 0; i < nt; i++){
+		int t = ctx->torder[t0 + i];
+		for (k = 0; k < 3; k++) m->tri[3 * i + k] = ctx->loc[mesh->tri[3 * t + k]];
+	}
+
+	prepareMesh(m);
+	int target = ctx->target > 0 ? MAX(1, (int)(DEC_SLAB_SLACK * ctx->target * nt / mesh->used)) : 0;
+	simplify(m, target, ctx->max_cost);
+}
+
+// Simplifies the slabs of mesh in parallel and gathers what is left, seams included, into whole.
+static int slabPass(const MESH* mesh, int slabs, int target, double max_cost, DEC_MESH* whole){
+
+	DEC_CTX* ctx = (DEC_CTX*)calloc(1, sizeof(DEC_CTX));
+	if (!ctx) return ERR;
+	int nv = mesh->v.used, nt = mesh->used;
+	ctx->mesh = mesh;
+	ctx->target = target;
+	ctx->max_cost = max_cost;
+	ctx->slab = (int*)malloc(MAX(nv, 1) * sizeof(int));
+	ctx->fixed = (unsigned char*)calloc(MAX(nv, 1), 1);
+	ctx->loc = (int*)malloc(MAX(nv, 1) * sizeof(int));
+	ctx->vorder = (int*)malloc(MAX(nv, 1) * sizeof(int));
+	ctx->torder = (int*)malloc(MAX(nt, 1) * sizeof(int));
+	int* cross = (int*)malloc(MAX(nt, 1) * sizeof(int));
+	int ok = ctx->slab && ctx->fixed && ctx->loc && ctx->vorder && ctx->torder && cross;
+	int v, t, s, k, i;
+
+	if (ok){
+		// Cuts across the longest axis at quantiles of the vertices, placed by histogram.
+		const float* axes[3] = { mesh->v.x, mesh->v.y, mesh->v.z };
+		float lo[3], hi[3];
+		for (k = 0; k < 3; k++) lo[k] = hi[k] = nv ? axes[k][0] : 0;
+		for (v = 1; v < nv; v++){
+			for (k = 0; k < 3; k++){
+				lo[k] = MIN(lo[k], axes[k][v]);
+				hi[k] = MAX(hi[k], axes[k][v]);
+			}
+		}
+		int axis = 0;
+		for (k = 1; k < 3; k++) if (hi[k] - lo[k] > hi[axis] - lo[axis]) axis = k;
+		const float* coord = axes[axis];
+		float scale = (hi[axis] > lo[axis]) ? (DEC_BINS - 1) / (hi[axis] - lo[axis]) : 0;
+
+		int hist[DEC_BINS], bin_slab[DEC_BINS];
+		memset(hist, 0, sizeof(hist));
+		for (v = 0; v < nv; v++) hist[(int)((coord[v] - lo[axis]) * scale)]++;
+		int below = 0;
+		for (i = 0; i < DEC_BINS; i++){
+			bin_slab[i] = MIN((int)((double)below * slabs / MAX(nv, 1)), slabs - 1);
+			below += hist[i];
+		}
+
+		for (v = 0; v < nv; v++){
+			ctx->slab[v] = bin_slab[(int)((coord[v] - lo[axis]) * scale)];
+			ctx->vfirst[ctx->slab[v] + 1]++;
+		}
+		for (s = 0; s < slabs; s++) ctx->vfirst[s + 1] += ctx->vfirst[s];
+		for (v = 0; v < nv; v++) ctx->vorder[ctx->vfirst[ctx->slab[v]]++] = v;
+		for (s = slabs; s > 0; s--) ctx->vfirst[s] = ctx->vfirst[s - 1];
+		ctx->vfirst[0] = 0;
+
+		// Triangles crossing slabs stay as they are, their vertices fixed.
+		int ncross = 0;
+		for (t = 0; t < nt; t++){
+			const int* tv = mesh->tri + 3 * t;
+			s = ctx->slab[tv[0]];
+			if (ctx->slab[tv[1]] == s && ctx->slab[tv[2]] == s){
+				ctx->tfirst[s + 1]++;
+				continue;
+			}
+			cross[ncross++] = t;
+			for (k = 0; k < 3; k++) ctx->fixed[tv[k]] = 1;
+		}
+		for (s = 0; s < slabs; s++) ctx->tfirst[s + 1] += ctx->tfirst[s];
+		int cursor[DEC_MAX_SLABS];
+		memcpy(cursor, ctx->tfirst, slabs * sizeof(int));
+		for (t = 0; t < nt; t++){
+			const int* tv = mesh->tri + 3 * t;
+			s = ctx->slab[tv[0]];
+			if (ctx->slab[tv[1]] == s && ctx->slab[tv[2]] == s) ctx->torder[cursor[s]++] = t;
+		}
+
+		parallelFor(slabs, slabTask, ctx);
+
+		int verts = 0, tris = ncross;
+		for (s = 0; s < slabs; s++){
+			const DEC_MESH* m = &ctx->part[s];
+			ok = ok && m->status == OKAY;
+			for (v = 0; ok && v < m->nv; v++) verts += m->ver[v] != UNINIT;
+			tris += m->live;
+		}
+		ok = ok && allocDecMesh(whole, verts, tris) == OKAY;
+
+		// Survivors in slab order; loc now maps input vertices to the whole, cnt slab vertices.
+		int nw = 0, tw = 0;
+		for (s = 0; ok && s < slabs; s++){
+			DEC_MESH* m = &ctx->part[s];
+			for (v = 0; v < m->nv; v++){
+				if (m->ver[v] == UNINIT) continue;
+				memcpy(whole->xyz + 3 * nw, m->xyz + 3 * v, 3 * sizeof(float));
+				whole->src[nw] = m->src[v];
+				ctx->loc[m->src[v]] = m->cnt[v] = nw++;
+			}
+			for (t = 0; t < m->nt; t++){
+				const int* tv = m->tri + 3 * t;
+				if (tv[0] == UNINIT) continue;
+				for (k = 0; k < 3; k++) whole->tri[3 * tw + k] = m->cnt[tv[k]];
+				tw++;
+			}
+		}
+		for (i = 0; ok && i < ncross; i++){
+			for (k = 0; k < 3; k++) whole->tri[3 * tw + k] = ctx->loc[mesh->tri[3 * cross[i] + k]];
+			tw++;
+		}
+	}
+
+	for (s = 0; s < slabs; s++) freeDecMesh(&ctx->part[s]);
+	free(ctx->slab);
+	free(ctx->fixed);
+	free(ctx->loc);
+	free(ctx->vorder);
+	free(ctx->torder);
+	free(ctx);
+	free(cross);
+	return ok ? OKAY : ERR;
+}
+
+/*********** DECIMATION ***********/
+
+// Replaces mesh by the triangles left in m and the vertices they use.
+static int writeBack(DEC_MESH* m, MESH* mesh){
+	int* id = m->cnt;
+	int v, t, k, nv = 0, nt = 0;
+	for (v = 0; v < m->nv; v++) id[v] = UNINIT;
+	for (t = 0; t < m->nt; t++){
+		if (m->tri[3 * t] == UNINIT) continue;
+		for (k = 0; k < 3; k++) id[m->tri[3 * t + k]] = 0;
+		nt++;
+	}
+	for (v = 0; v < m->nv; v++) if (id[v] != UNINIT) id[v] = nv++;
+
+	MESH out;
+	const PCLOUD* in = &mesh->v;
+	if (allocMesh(&out, MAX(nv, 1), MAX(nt, 1), in->attrs) != OKAY) return ERR;
+	for (v = 0; v < m->nv; v++){
+		if (id[v] == UNINIT) continue;
+		int o = id[v], g = m->src[v];
+		out.v.x[o] = m->xyz[3 * v + 0];
+		out.v.y[o] = m->xyz[3 * v + 1];
+		out.v.z[o] = m->xyz[3 * v + 2];
+		out.v.s[o] = in->s[g];
+		if (in->i) out.v.i[o] = in->i[g];
+		if (in->nx){
+			out.v.nx[o] = in->nx[g];
+			out.v.ny[o] = in->ny[g];
+			out.v.nz[o] = in->nz[g];
+		}
+		if (in->cam) out.v.cam[o] = in->cam[g];
+	}
+	out.v.used = nv;
+	for (t = 0, nt = 0; t < m->nt; t++){
+		if (m->tri[3 * t] == UNINIT) continue;
+		for (k = 0; k < 3; k++) out.tri[3 * nt + k] = id[m->tri[3 * t + k]];
+		nt++;
+	}
+	out.used = nt;
+
+	freeMesh(mesh);
+	*mesh = out;
+	return OKAY;
+}
+
+int decimateMesh(MESH* mesh, int target, float max_error){
+
+	if (target <= 0 && max_error <= 0) return OKAY;
+	if (target > 0 && mesh->used <= target) return OKAY;
+	int before = mesh->used;
+	double max_cost = (double)max_error * max_error;
+	unsigned long st = GetTickCount();
+
+	// Small meshes go straight to the whole-mesh pass.
+	DEC_MESH whole;
+	memset(&whole, 0, sizeof(DEC_MESH));
+	int slabs = MIN(numWorkers() * DEC_SLABS_PER_WORKER, mesh->used / DEC_MIN_SLAB_TRIS);
+	slabs = MIN(slabs, DEC_MAX_SLABS);
+	int ok;
+	if (slabs > 1){
+		ok = slabPass(mesh, slabs, target, max_cost, &whole) == OKAY;
+	}
+	else {
+		int v;
+		ok = allocDecMesh(&whole, mesh->v.used, mesh->used) == OKAY;
+		for (v = 0; ok && v < mesh->v.used; v++){
+			whole.xyz[3 * v + 0] = mesh->v.x[v];
+			whole.xyz[3 * v + 1] = mesh->v.y[v];
+			whole.xyz[3 * v + 2] = mesh->v.z[v];
+			whole.src[v] = v;
+		}
+		if (ok) memcpy(whole.tri, mesh->tri, 3 * (size_t)mesh->used * sizeof(int));
+	}
+
+	if (ok){
+		prepareMesh(&whole);
+		simplify(&whole, target, max_cost);
+		ok = whole.status == OKAY && writeBack(&whole, mesh) == OKAY;
+	}
+	freeDecMesh(&whole);
+
+	if (ok && DBG_LOG) printf("Decimated %d triangles to %d in %lu ms (%d slabs). \n", before, mesh->used, (unsigned long)(GetTickCount() - st), MAX(slabs, 1));
+	return ok ? OKAY : ERR;
+}
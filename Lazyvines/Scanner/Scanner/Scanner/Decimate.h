@@ -0,0 +1,33 @@
+/************************************************************************************************************************
+
+Decimate: Quadric error simplification of meshes, down to a triangle budget or an error bound.
+Every vertex carries the quadric of its triangles' planes, weighted by area, plus stiff planes standing upright on
+open borders so the outline stays in place. Edges are collapsed cheapest first from a binary heap: the kept vertex
+moves to where the summed quadric is least, and the cost is the mean squared distance from there to the planes.
+Heap entries are invalidated lazily by per-vertex versions. A collapse is skipped if it would pinch the surface
+(the ends share more neighbours than the triangles on the edge) or fold any triangle over.
+
+Parallel: Large meshes are cut into slabs of equal vertex count along their longest axis. Every slab is simplified
+on its own thread to a multiple of its share of the budget, with the vertices of the triangles that cross slabs held
+fixed, so no two slabs touch one vertex. A last pass over the whole, by then much smaller, mesh collapses across the
+seams and spends the rest of the budget where it costs least, so slabs crowded by their seams are not overdone.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "Mesh.h"
+
+#define DEC_SLABS_PER_WORKER	2			// Slabs per worker thread, to even out uneven slabs
+#define DEC_MIN_SLAB_TRIS		20000		// Triangles a slab is worth cutting for
+#define DEC_SLAB_SLACK			2.0			// Slabs stop at this multiple of their share of the budget
+#define DEC_BINS				1024		// Histogram bins slab cuts are placed by
+#define DEC_BORDER_WEIGHT		10.0		// Weight of the planes on open borders, per squared edge length
+#define DEC_FLIP_COS			0.2			// Cosine a triangle's normal must keep with its old one
+
+// Simplifies mesh in place until it has at most target triangles (0 for no budget) or the next collapse would
+// move the surface by more than max_error (point units, root mean square; 0 for no bound), whichever comes first.
+// Vertices keep the attributes of the input vertex they stand for.
+// Returns OKAY on success, ERR if out of memory (mesh is left untouched).
+int decimateMesh(MESH* mesh, int target, float max_error);
@@ -0,0 +1,317 @@
+/************************************************************************************************************************
+
+Export: Writers for standard point cloud and mesh formats read by external tools.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Export.h"
+#include "Parallel.h"
+
+/*********** BLOCK WRITER ***********/
+
+typedef struct {
+	FILE* fptr;
+	unsigned char* buf;
+	int n;
+	int failed;
+}BLOCK_WRITER;
+
+// Opens fname unbuffered: the writer's own blocks replace the CRT buffer.
+static int openWriter(BLOCK_WRITER* w, const char* fname){
+	memset(w, 0, sizeof(BLOCK_WRITER));
+	if (fopen_s(&w->fptr, fname, "wb") || !w->fptr){
+		printf("Cannot open %s for writing. \n", fname);
+		return ERR;
+	}
+	setvbuf(w->fptr, NULL, _IONBF, 0);
+	w->buf = (unsigned char*)malloc(EXPORT_BLOCK);
+	if (!w->buf){
+		fclose(w->fptr);
+		return ERR;
+	}
+	return OKAY;
+}
+
+static void flushWriter(BLOCK_WRITER* w){
+	if (w->n && fwrite(w->buf, 1, w->n, w->fptr) != (size_t)w->n) w->failed = 1;
+	w->n = 0;
+}
+
+static void put(BLOCK_WRITER* w, const void* data, int n){
+	const unsigned char* p = (const unsigned char*)data;
+	while (n > 0){
+		int k = MIN(n, EXPORT_BLOCK - w->n);
+		memcpy(w->buf + w->n, p, k);
+		w->n += k;
+		p += k;
+		n -= k;
+		if (w->n == EXPORT_BLOCK) flushWriter(w);
+	}
+}
+
+static int closeWriter(BLOCK_WRITER* w, const char* fname){
+	flushWriter(w);
+	if (fclose(w->fptr)) w->failed = 1;
+	free(w->buf);
+	if (w->failed){
+		printf("Error occured while writing %s. \n", fname);
+		return ERR;
+	}
+	if (DBG_LOG) printf("Export Completed: %s \n", fname);
+	return OKAY;
+}
+
+/*********** PARALLEL TEXT ***********/
+
+typedef struct {
+	EXPORT_FMT fmt;
+	void* ctx;
+	int n;
+	int max_len;
+	int first_chunk;
+	char** text;				// One buffer per chunk of the round
+	int* len;
+}TEXT_JOB;
+
+static void formatChunk(void* prm, int idx){
+	TEXT_JOB* job = (TEXT_JOB*)prm;
+	int first = (job->first_chunk + idx) * EXPORT_CHUNK;
+	int last = MIN(first + EXPORT_CHUNK, job->n);
+	char* out = job->text[idx];
+	int i;
+	for (i = first; i < last; i++) out += job->fmt(job->ctx, i, out);
+	job->len[idx] = (int)(out - job->text[idx]);
+}
+
+// Each round formats one chunk per worker in parallel, then writes the chunks in order.
+int writeText(FILE* fptr, int n, int max_len, EXPORT_FMT fmt, void* ctx){
+
+	TEXT_JOB job;
+	job.fmt = fmt;
+	job.ctx = ctx;
+	job.n = n;
+	job.max_len = max_len;
+
+	int workers = numWorkers();
+	int chunks = (n + EXPORT_CHUNK - 1) / EXPORT_CHUNK;
+	job.text = (char**)calloc(workers, sizeof(char*));
+	job.len = (int*)calloc(workers, sizeof(int));
+	int ok = job.text && job.len;
+	int c;
+	for (c = 0; ok && c < workers; c++){
+		job.text[c] = (char*)malloc((size_t)EXPORT_CHUNK * max_len + 1);
+		ok = job.text[c] != NULL;
+	}
+
+	for (job.first_chunk = 0; ok && job.first_chunk < chunks; job.first_chunk += workers){
+		int round = MIN(workers, chunks - job.first_chunk);
+		parallelFor(round, formatChunk, &job);
+		for (c = 0; ok && c < round; c++){
+			ok = fwrite(job.text[c], 1, job.len[c], fptr) == (size_t)job.len[c];
+		}
+	}
+
+	for (c = 0; job.text && c < workers; c++) free(job.text[c]);
+	free(job.text);
+	free(job.len);
+	return ok ? OKAY : ERR;
+}
+
+/*********** POINTS ***********/
+
+// PLY vertex record: x, y, z, [nx, ny, nz,] step, camera, cameras (18 or 30 bytes, packed).
+#define PLY_POINT_BYTES			18
+#define PLY_NORMAL_BYTES		12
+
+typedef struct {
+	PCLOUD* const* clouds;
+	int nclouds;
+	int* first;					// First global index of each cloud (nclouds + 1 entries)
+}POINT_SET;
+
+static int countPoints(POINT_SET* set, PCLOUD* const* clouds, int nclouds){
+	set->clouds = clouds;
+	set->nclouds = nclouds;
+	set->first = (int*)malloc((nclouds + 1) * sizeof(int));
+	if (!set->first) return UNINIT;
+	int c;
+	set->first[0] = 0;
+	for (c = 0; c < nclouds; c++) set->first[c + 1] = set->first[c] + clouds[c]->used;
+	return set->first[nclouds];
+}
+
+int exportPointsPLY(const char* fname, PCLOUD* const* clouds, int nclouds){
+
+	POINT_SET set;
+	int total = countPoints(&set, clouds, nclouds);
+	if (total < 0) return ERR;
+	free(set.first);
+
+	BLOCK_WRITER w;
+	if (openWriter(&w, fname) != OKAY) return ERR;
+
+	// Normals are written if any cloud has them, as zero for the others.
+	int c, i, normals = 0;
+	for (c = 0; c < nclouds; c++) normals = normals || clouds[c]->nx;
+	int bytes = PLY_POINT_BYTES + (normals ? PLY_NORMAL_BYTES : 0);
+
+	char header[512];
+	int len = sprintf_s(header, "ply\nformat binary_little_endian 1.0\ncomment SEG 3D Scanner\n"
+		"element vertex %d\nproperty float x\nproperty float y\nproperty float z\n%s"
+		"property int step\nproperty uchar camera\nproperty uchar cameras\nend_header\n", total,
+		normals ? "property float nx\nproperty float ny\nproperty float nz\n" : "");
+	put(&w, header, len);
+
+	// Records are packed straight into the block; every supported target is little-endian.
+	const float zero = 0;
+	for (c = 0; c < nclouds; c++){
+		PCVIEW v = cloudView(clouds[c], 0, clouds[c]->used);
+		unsigned char cam = (unsigned char)c;
+		for (i = 0; i < v.n; i++){
+			if (w.n > EXPORT_BLOCK - bytes) flushWriter(&w);
+			unsigned char* rec = w.buf + w.n;
+			memcpy(rec + 0, &v.x[i], 4);
+			memcpy(rec + 4, &v.y[i], 4);
+			memcpy(rec + 8, &v.z[i], 4);
+			if (normals){
+				memcpy(rec + 12, v.nx ? &v.nx[i] : &zero, 4);
+				memcpy(rec + 16, v.ny ? &v.ny[i] : &zero, 4);
+				memcpy(rec + 20, v.nz ? &v.nz[i] : &zero, 4);
+				rec += PLY_NORMAL_BYTES;
+			}
+			memcpy(rec + 12, &v.s[i], 4);
+			rec[16] = cam;
+			rec[17] = v.cam ? v.cam[i] : (unsigned char)(1 << c);
+			w.n += bytes;
+		}
+	}
+	return closeWriter(&w, fname);
+}
+
+#define OBJ_VERTEX_MAX			160		// "v " and three %f of any float
+
+static int formatPointOBJ(void* prm, int idx, char* out){
+	POINT_SET* set = (POINT_SET*)prm;
+	int c = 0;
+	while (idx >= set->first[c + 1]) c++;
+	const PCLOUD* pc = set->clouds[c];
+	int i = idx - set->first[c];
+	return sprintf_s(out, OBJ_VERTEX_MAX, "v %f %f %f\n", pc->x[i], pc->y[i], pc->z[i]);
+}
+
+int exportPointsOBJ(const char* fname, PCLOUD* const* clouds, int nclouds){
+
+	POINT_SET set;
+	int total = countPoints(&set, clouds, nclouds);
+	if (total < 0) return ERR;
+
+	BLOCK_WRITER w;
+	if (openWriter(&w, fname) != OKAY){
+		free(set.first);
+		return ERR;
+	}
+	fprintf(w.fptr, "# SEG 3D Scanner: %d points\n", total);
+	if (writeText(w.fptr, total, OBJ_VERTEX_MAX, formatPointOBJ, &set) != OKAY) w.failed = 1;
+	free(set.first);
+	return closeWriter(&w, fname);
+}
+
+/*********** MESHES ***********/
+
+int exportMeshPLY(const char* fname, const MESH* mesh){
+
+	BLOCK_WRITER w;
+	if (openWriter(&w, fname) != OKAY) return ERR;
+
+	char header[512];
+	int len = sprintf_s(header, "ply\nformat binary_little_endian 1.0\ncomment SEG 3D Scanner\n"
+		"element vertex %d\nproperty float x\nproperty float y\nproperty float z\n"
+		"element face %d\nproperty list uchar int vertex_indices\nend_header\n", mesh->v.used, mesh->used);
+	put(&w, header, len);
+
+	int i;
+	for (i = 0; i < mesh->v.used; i++){
+		float xyz[3] = { mesh->v.x[i], mesh->v.y[i], mesh->v.z[i] };
+		put(&w, xyz, sizeof(xyz));
+	}
+	unsigned char corners = 3;
+	for (i = 0; i < mesh->used; i++){
+		put(&w, &corners, 1);
+		put(&w, mesh->tri + 3 * i, 3 * sizeof(int));
+	}
+	return closeWriter(&w, fname);
+}
+
+#define OBJ_FACE_MAX			48
+
+static int formatVertexOBJ(void* prm, int idx, char* out){
+	const MESH* mesh = (const MESH*)prm;
+	return sprintf_s(out, OBJ_VERTEX_MAX, "v %f %f %f\n", mesh->v.x[idx], mesh->v.y[idx], mesh->v.z[idx]);
+}
+
+static int formatFaceOBJ(void* prm, int idx, char* out){
+	const int* t = ((const MESH*)prm)->tri + 3 * idx;
+	return sprintf_s(out, OBJ_FACE_MAX, "f %d %d %d\n", t[0] + 1, t[1] + 1, t[2] + 1);
+}
+
+int exportMeshOBJ(const char* fname, const MESH* mesh){
+
+	BLOCK_WRITER w;
+	if (openWriter(&w, fname) != OKAY) return ERR;
+	fprintf(w.fptr, "# SEG 3D Scanner: %d vertices, %d triangles\n", mesh->v.used, mesh->used);
+	if (writeText(w.fptr, mesh->v.used, OBJ_VERTEX_MAX, formatVertexOBJ, (void*)mesh) != OKAY ||
+		writeText(w.fptr, mesh->used, OBJ_FACE_MAX, formatFaceOBJ, (void*)mesh) != OKAY) w.failed = 1;
+	return closeWriter(&w, fname);
+}
+
+// STL facet record: normal, 3 corners, attribute byte count (50 bytes, packed).
+#define STL_FACET_BYTES			50
+
+int exportMeshSTL(const char* fname, const MESH* mesh){
+
+	BLOCK_WRITER w;
+	if (openWriter(&w, fname) != OKAY) return ERR;
+
+	char header[80];
+	memset(header, 0, sizeof(header));
+	strcpy_s(header, "SEG 3D Scanner");
+	put(&w, header, sizeof(header));
+	unsigned int facets = mesh->used;
+	put(&w, &facets, 4);
+
+	const PCLOUD* v = &mesh->v;
+	int i, k;
+	for (i = 0; i < mesh->used; i++){
+		float f[12];
+		const int* t = mesh->tri + 3 * i;
+		for (k = 0; k < 3; k++){
+			f[3 + 3 * k] = v->x[t[k]];
+			f[4 + 3 * k] = v->y[t[k]];
+			f[5 + 3 * k] = v->z[t[k]];
+		}
+
+		// Facet normal from the winding: (b - a) x (c - a)
+		float ux = f[6] - f[3], uy = f[7] - f[4], uz = f[8] - f[5];
+		float vx = f[9] - f[3], vy = f[10] - f[4], vz = f[11] - f[5];
+		f[0] = uy * vz - uz * vy;
+		f[1] = uz * vx - ux * vz;
+		f[2] = ux * vy - uy * vx;
+		float norm = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+		if (norm > 0){
+			f[0] /= norm;
+			f[1] /= norm;
+			f[2] /= norm;
+		}
+
+		if (w.n > EXPORT_BLOCK - STL_FACET_BYTES) flushWriter(&w);
+		memcpy(w.buf + w.n, f, sizeof(f));
+		memset(w.buf + w.n + sizeof(f), 0, 2);
+		w.n += STL_FACET_BYTES;
+	}
+	return closeWriter(&w, fname);
+}
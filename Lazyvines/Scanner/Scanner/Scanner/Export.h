@@ -0,0 +1,33 @@
+/************************************************************************************************************************
+
+Export: Writers for standard point cloud and mesh formats read by external tools.
+* PLY:	Binary little-endian. Points carry their normal (if estimated, see Normals.h), step, camera and the mask
+		of cameras that saw them (see mergeClouds), meshes their vertices and triangles.
+* OBJ:	ASCII. Vertices (and faces for meshes), formatted in parallel.
+* STL:	Binary. Meshes only, facet normals computed on the fly.
+
+Output goes through large blocks written straight to the file, so exports are bound by the disk, not formatting.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "PointCloud.h"
+#include "Mesh.h"
+
+#define EXPORT_BLOCK			(1 << 20)		// Bytes per file write
+#define EXPORT_CHUNK			16384			// Lines formatted per parallel task
+
+// Points of several clouds (e.g. one per camera) into one file. Cloud c is tagged as camera c.
+// All return OKAY on success, ERR otherwise.
+int exportPointsPLY(const char* fname, PCLOUD* const* clouds, int nclouds);
+int exportPointsOBJ(const char* fname, PCLOUD* const* clouds, int nclouds);
+
+int exportMeshPLY(const char* fname, const MESH* mesh);
+int exportMeshOBJ(const char* fname, const MESH* mesh);
+int exportMeshSTL(const char* fname, const MESH* mesh);
+
+// Formats items 0..n-1 in parallel, fmt writing at most max_len bytes per item, and writes them in order.
+typedef int(*EXPORT_FMT)(void* ctx, int idx, char* out);
+int writeText(FILE* fptr, int n, int max_len, EXPORT_FMT fmt, void* ctx);
@@ -0,0 +1,139 @@
+/************************************************************************************************************************
+
+Frame Loader: Prefetches recorded frames with overlapped (asynchronous) reads.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <malloc.h>
+
+#include "FrameLoader.h"
+
+// Upper bound of a WIDTH x HEIGHT 24-bit BMP file: headers, optional palette and 4-byte aligned rows.
+#define BMP_HEADER_MAX			1078
+#define BMP_ROW_BYTES			((WIDTH * 3 + 3) / 4 * 4)
+#define BMP_FILE_MAX			(BMP_HEADER_MAX + BMP_ROW_BYTES * HEIGHT)
+#define SECTOR_SIZE				4096
+
+// Opens a frame and issues one overlapped read for the whole file.
+static void submitFrame(FRAME_LOADER* fl, FRAME_SLOT* slot, int step){
+
+	char fname[CMD_MAXLEN];
+	sprintf_s(fname, "%s\\%d.bmp", fl->dir, step);
+
+	slot->step = step;
+	slot->file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (slot->file == INVALID_HANDLE_VALUE){
+		printf("Cannot open %s\n", fname);
+		errorExit("Error occured while opening image file.");
+	}
+
+	HANDLE evt = slot->ov.hEvent;
+	memset(&slot->ov, 0, sizeof(slot->ov));
+	slot->ov.hEvent = evt;
+	ResetEvent(evt);
+
+	if (!ReadFile(slot->file, slot->buf, fl->buf_size, NULL, &slot->ov) && GetLastError() != ERROR_IO_PENDING){
+		errorExit("Error occured while reading image file.");
+	}
+}
+
+// Starts reading a scan's frames, keeping up to PREFETCH_WINDOW reads in flight.
+void startFrameLoader(FRAME_LOADER* fl, const char* dir, int first, int count){
+
+	int i;
+	if (!fl->buf_size){
+		fl->buf_size = (BMP_FILE_MAX + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+		for (i = 0; i < PREFETCH_WINDOW; i++){
+			fl->slots[i].buf = (unsigned char*)_aligned_malloc(fl->buf_size, SECTOR_SIZE);
+			fl->slots[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+			if (!fl->slots[i].buf || !fl->slots[i].ov.hEvent){ errorExit("Cannot allocate frame prefetch buffers"); }
+		}
+	}
+
+	strcpy_s(fl->dir, dir);
+	fl->first = first;
+	fl->next_submit = first;
+	fl->next_consume = first;
+	fl->last = first + count;
+
+	for (i = 0; i < PREFETCH_WINDOW; i++){
+		fl->slots[i].step = UNINIT;
+		if (fl->next_submit < fl->last){
+			submitFrame(fl, &fl->slots[i], fl->next_submit);
+			fl->next_submit++;
+		}
+	}
+}
+
+// Waits for the next step's read to complete and validates its BMP headers.
+const unsigned char* nextFrame(FRAME_LOADER* fl, int* step, int* stride){
+
+	if (fl->next_consume >= fl->last){ errorExit("Frame requested beyond the end of the scan"); }
+	FRAME_SLOT* slot = &fl->slots[(fl->next_consume - fl->first) % PREFETCH_WINDOW];
+	if (slot->step != fl->next_consume){ errorExit("Frame prefetch window out of order"); }
+
+	unsigned long bytes = 0;
+	if (!GetOverlappedResult(slot->file, &slot->ov, &bytes, TRUE) && GetLastError() != ERROR_HANDLE_EOF){
+		errorExit("Error occured while reading image file.");
+	}
+
+	// Access File +BMP Headers
+	const unsigned char* header = slot->buf;
+	if (bytes < 54){ errorExit("Image file is truncated."); }
+	int w = *(int*)&header[18];
+	int h = *(int*)&header[22];
+	if (w != WIDTH || h != HEIGHT){ errorExit("Image dimensions inconsistent with calibration settings."); }
+
+	int data_offset = *(int*)&header[10];
+	if (data_offset < 54 || (unsigned long)data_offset + BMP_ROW_BYTES * HEIGHT > bytes){ errorExit("Image file is truncated."); }
+
+	if (DBG_LOG)printf("Extracting Points from: %s\\%d.bmp (prefetched)...\n", fl->dir, slot->step);
+	*step = slot->step;
+	*stride = BMP_ROW_BYTES;
+	return slot->buf + data_offset;
+}
+
+// Recycles the consumed slot for the next step not yet in flight.
+void releaseFrame(FRAME_LOADER* fl){
+
+	FRAME_SLOT* slot = &fl->slots[(fl->next_consume - fl->first) % PREFETCH_WINDOW];
+	CloseHandle(slot->file);
+	slot->step = UNINIT;
+	fl->next_consume++;
+
+	if (fl->next_submit < fl->last){
+		submitFrame(fl, slot, fl->next_submit);
+		fl->next_submit++;
+	}
+}
+
+// Cancels and drains any reads still in flight, e.g. when a scan is abandoned.
+void stopFrameLoader(FRAME_LOADER* fl){
+	int i;
+	for (i = 0; i < PREFETCH_WINDOW; i++){
+		FRAME_SLOT* slot = &fl->slots[i];
+		if (slot->step == UNINIT) continue;
+		unsigned long bytes;
+		CancelIo(slot->file);
+		GetOverlappedResult(slot->file, &slot->ov, &bytes, TRUE);
+		CloseHandle(slot->file);
+		slot->step = UNINIT;
+	}
+	fl->next_submit = fl->next_consume = fl->last;
+}
+
+void freeFrameLoader(FRAME_LOADER* fl){
+	if (!fl->buf_size) return;
+	stopFrameLoader(fl);
+	int i;
+	for (i = 0; i < PREFETCH_WINDOW; i++){
+		_aligned_free(fl->slots[i].buf);
+		CloseHandle(fl->slots[i].ov.hEvent);
+	}
+	fl->buf_size = 0;
+}
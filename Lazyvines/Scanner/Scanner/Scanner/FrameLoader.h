@@ -0,0 +1,45 @@
+/************************************************************************************************************************
+
+Frame Loader: Prefetches recorded frames with overlapped (asynchronous) reads.
+Keeps reads for a window of upcoming steps in flight into a fixed pool of aligned buffers, so that the extractor
+never waits on the open/read of the next frame during offline reprocessing.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include <windows.h>
+
+#include "Config.h"
+#include "Calibrations.h"
+
+// Structures
+typedef struct {
+	HANDLE file;
+	OVERLAPPED ov;
+	unsigned char* buf;			// Whole BMP file (headers + body)
+	int step;					// Step held by this slot, UNINIT if free
+}FRAME_SLOT;
+
+typedef struct {
+	char dir[CMD_MAXLEN];
+	int first;					// First step of the scan; step s lives in slot (s - first) % PREFETCH_WINDOW
+	int next_submit;			// Next step to issue a read for
+	int next_consume;			// Next step handed to the extractor
+	int last;					// One past the last step of the scan
+	unsigned long buf_size;
+	FRAME_SLOT slots[PREFETCH_WINDOW];
+}FRAME_LOADER;
+
+// Starts reading <dir>\<first>.bmp .. <dir>\<first+count-1>.bmp. Buffers are allocated on first use and kept.
+void startFrameLoader(FRAME_LOADER* fl, const char* dir, int first, int count);
+
+// Blocks until the next step's frame has arrived. Returns the image body; stride receives the padded row size.
+const unsigned char* nextFrame(FRAME_LOADER* fl, int* step, int* stride);
+
+// Returns the frame obtained by nextFrame to the pool and issues the read for the next step in the window.
+void releaseFrame(FRAME_LOADER* fl);
+
+// Cancels outstanding reads and releases the buffer pool.
+void stopFrameLoader(FRAME_LOADER* fl);
+void freeFrameLoader(FRAME_LOADER* fl);
@@ -0,0 +1,279 @@
+/************************************************************************************************************************
+
+Scan Journal: Append-only, checksummed record of an acquisition in progress.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io.h>
+#include <windows.h>
+
+#include "Journal.h"
+#include "Codec.h"
+#include "StepOrder.h"
+
+#define JRN_VERSION				2
+#define JRN_RECORD_MAGIC		0x50455453		// "STEP"
+
+static unsigned int recordCRC(const JRN_RECORD* rec, const void* payload, int bytes){
+	unsigned int crc = crc32(0, rec, (int)offsetof(JRN_RECORD, crc));
+	return crc32(crc, payload, bytes);
+}
+
+// Writes one record and forces it to disk. Called with the lock held.
+static int writeRecord(JOURNAL* jrn, JRN_RECORD* rec, const void* payload, int bytes){
+	rec->magic = JRN_RECORD_MAGIC;
+	rec->crc = recordCRC(rec, payload, bytes);
+	int ok = fwrite(rec, sizeof(JRN_RECORD), 1, jrn->fptr) == 1 &&
+		(!bytes || fwrite(payload, 1, bytes, jrn->fptr) == (size_t)bytes) &&
+		!fflush(jrn->fptr) && !_commit(_fileno(jrn->fptr));
+	return ok ? OKAY : ERR;
+}
+
+// Wraps an open journal file; with write_header, the file is new and gets its header first.
+static JOURNAL* wrapJournal(FILE* fptr, int cams, int steps, int order, unsigned int calib_crc, int write_header){
+
+	JOURNAL* jrn = (JOURNAL*)calloc(1, sizeof(JOURNAL));
+	if (!jrn){
+		fclose(fptr);
+		return NULL;
+	}
+	jrn->fptr = fptr;
+	memcpy(jrn->hdr.magic, "SEGJ", 4);
+	jrn->hdr.version = JRN_VERSION;
+	jrn->hdr.cams = cams;
+	jrn->hdr.steps = steps;
+	jrn->hdr.order = order;
+	jrn->hdr.calib_crc = calib_crc;
+	InitializeCriticalSection(&jrn->lock);
+
+	if (write_header && (fwrite(&jrn->hdr, sizeof(JRN_HEADER), 1, fptr) != 1 || fflush(fptr))){
+		closeJournal(jrn);
+		return NULL;
+	}
+	return jrn;
+}
+
+JOURNAL* createJournal(const char* fname, int cams, int steps, int order, unsigned int calib_crc){
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "wb") || !fptr){
+		printf("Cannot create scan journal %s. \n", fname);
+		return NULL;
+	}
+	return wrapJournal(fptr, cams, steps, order, calib_crc, 1);
+}
+
+int journalPoints(JOURNAL* jrn, int cam, int step, const PCLOUD* pc, int first, int count){
+
+	// Interleave outside the lock; steps are implied by the record.
+	float* xyz = (float*)malloc(3 * MAX(count, 1) * sizeof(float));
+	if (!xyz) return ERR;
+	int i;
+	for (i = 0; i < count; i++){
+		xyz[3 * i + 0] = pc->x[first + i];
+		xyz[3 * i + 1] = pc->y[first + i];
+		xyz[3 * i + 2] = pc->z[first + i];
+	}
+
+	JRN_RECORD rec;
+	memset(&rec, 0, sizeof(JRN_RECORD));
+	rec.type = JRN_STEP;
+	rec.cam = (short)cam;
+	rec.step = (short)step;
+	rec.count = count;
+
+	EnterCriticalSection(&jrn->lock);
+	int ok = writeRecord(jrn, &rec, xyz, 3 * count * sizeof(float));
+	LeaveCriticalSection(&jrn->lock);
+	free(xyz);
+	return ok;
+}
+
+int journalMoves(JOURNAL* jrn, int moves){
+	JRN_RECORD rec;
+	memset(&rec, 0, sizeof(JRN_RECORD));
+	rec.type = JRN_MOVE;
+	rec.count = moves;
+
+	EnterCriticalSection(&jrn->lock);
+	int ok = writeRecord(jrn, &rec, NULL, 0);
+	LeaveCriticalSection(&jrn->lock);
+	return ok;
+}
+
+void closeJournal(JOURNAL* jrn){
+	if (!jrn) return;
+	fclose(jrn->fptr);
+	DeleteCriticalSection(&jrn->lock);
+	free(jrn);
+}
+
+/*********** RECOVERY ***********/
+
+typedef struct {
+	int cams;
+	int steps;
+	int* seq;					// Steps in acquisition order
+	int* done;					// Steps completed per camera, in acquisition order
+	int* step_first;			// Cloud index where the s-th acquired step of camera c starts: [c * (steps + 1) + s]
+	int moves;
+}JRN_SCAN;
+
+// Walks every intact record. With clouds, appends the points of each camera's next expected step.
+static int scanJournal(FILE* fptr, const JRN_HEADER* want, PCLOUD* const* clouds, JRN_SCAN* scan){
+
+	JRN_HEADER hdr;
+	if (fread(&hdr, sizeof(JRN_HEADER), 1, fptr) != 1 || memcmp(hdr.magic, "SEGJ", 4) || hdr.version != JRN_VERSION ||
+		hdr.cams != want->cams || hdr.steps != want->steps || hdr.order != want->order || hdr.calib_crc != want->calib_crc) return ERR;
+
+	memset(scan, 0, sizeof(JRN_SCAN));
+	scan->cams = hdr.cams;
+	scan->steps = hdr.steps;
+	scan->seq = (int*)malloc(hdr.steps * sizeof(int));
+	scan->done = (int*)calloc(hdr.cams, sizeof(int));
+	scan->step_first = (int*)calloc(hdr.cams * (hdr.steps + 1), sizeof(int));
+	if (!scan->seq || !scan->done || !scan->step_first || stepOrder(hdr.order, hdr.steps, scan->seq) != OKAY) return ERR;
+
+	int c;
+	if (clouds) for (c = 0; c < hdr.cams; c++) clouds[c]->used = 0;
+
+	JRN_RECORD rec;
+	float* xyz = NULL;
+	int cap = 0;
+	while (fread(&rec, sizeof(JRN_RECORD), 1, fptr) == 1 && rec.magic == JRN_RECORD_MAGIC){
+
+		if (rec.type == JRN_MOVE){
+			if (recordCRC(&rec, NULL, 0) != rec.crc) break;
+			scan->moves = rec.count;
+			continue;
+		}
+		if (rec.type != JRN_STEP || rec.cam < 0 || rec.cam >= hdr.cams || rec.step < 0 || rec.step >= hdr.steps ||
+			rec.count < 0 || rec.count > 0x7FFFFFFF / 12) break;
+
+		if (rec.count > cap){
+			float* grown = (float*)realloc(xyz, 3 * rec.count * sizeof(float));
+			if (!grown) break;
+			xyz = grown;
+			cap = rec.count;
+		}
+		int bytes = 3 * rec.count * sizeof(float);
+		if ((bytes && fread(xyz, 1, bytes, fptr) != (size_t)bytes) || recordCRC(&rec, xyz, bytes) != rec.crc) break;
+
+		// Cameras complete steps in order; anything but the next step of a camera is ignored.
+		c = rec.cam;
+		if (scan->done[c] >= hdr.steps || rec.step != scan->seq[scan->done[c]]) continue;
+		if (clouds){
+			PCLOUD* pc = clouds[c];
+			if (growCloud(pc, pc->used + rec.count) != OKAY) break;
+			int i;
+			for (i = 0; i < rec.count; i++){
+				pc->x[pc->used] = xyz[3 * i + 0];
+				pc->y[pc->used] = xyz[3 * i + 1];
+				pc->z[pc->used] = xyz[3 * i + 2];
+				pc->s[pc->used] = rec.step;
+				pc->used++;
+			}
+			scan->step_first[c * (hdr.steps + 1) + scan->done[c] + 1] = pc->used;
+		}
+		scan->done[c]++;
+	}
+	free(xyz);
+	return OKAY;
+}
+
+static void freeScan(JRN_SCAN* scan){
+	free(scan->seq);
+	free(scan->done);
+	free(scan->step_first);
+}
+
+static int completedSteps(const JRN_SCAN* scan){
+	int c, next = scan->steps;
+	for (c = 0; c < scan->cams; c++) next = MIN(next, scan->done[c]);
+	return next;
+}
+
+int journalProgress(const char* fname, int cams, int steps, int order, unsigned int calib_crc){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "rb") || !fptr) return UNINIT;
+
+	JRN_HEADER want;
+	want.cams = cams;
+	want.steps = steps;
+	want.order = order;
+	want.calib_crc = calib_crc;
+	JRN_SCAN scan;
+	memset(&scan, 0, sizeof(JRN_SCAN));
+	int next = (scanJournal(fptr, &want, NULL, &scan) == OKAY) ? completedSteps(&scan) : UNINIT;
+	freeScan(&scan);
+	fclose(fptr);
+	return next;
+}
+
+JOURNAL* resumeJournal(const char* fname, PCLOUD* const* clouds, int cams, int steps, int order, unsigned int calib_crc, int* next_step, int* moves){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "rb") || !fptr){
+		printf("Scan journal %s does not exist. \n", fname);
+		return NULL;
+	}
+
+	JRN_HEADER want;
+	want.cams = cams;
+	want.steps = steps;
+	want.order = order;
+	want.calib_crc = calib_crc;
+	JRN_SCAN scan;
+	memset(&scan, 0, sizeof(JRN_SCAN));
+	int ok = scanJournal(fptr, &want, clouds, &scan) == OKAY;
+	fclose(fptr);
+	if (!ok){
+		printf("Scan journal %s does not match the current setup. \n", fname);
+		freeScan(&scan);
+		return NULL;
+	}
+
+	// Keep the steps every camera has completed and rewrite the journal with just those, so that appending
+	// continues from a clean tail. The old journal is only replaced once the new one is complete.
+	int next = completedSteps(&scan);
+	int c, s;
+	for (c = 0; c < cams; c++) clouds[c]->used = scan.step_first[c * (steps + 1) + next];
+
+	char tmpname[CMD_MAXLEN];
+	sprintf_s(tmpname, "%s.tmp", fname);
+	JOURNAL* jrn = createJournal(tmpname, cams, steps, order, calib_crc);
+	ok = jrn != NULL;
+	for (c = 0; ok && c < cams; c++){
+		for (s = 0; ok && s < next; s++){
+			int first = scan.step_first[c * (steps + 1) + s];
+			int last = scan.step_first[c * (steps + 1) + s + 1];
+			ok = journalPoints(jrn, c, scan.seq[s], clouds[c], first, last - first) == OKAY;
+		}
+	}
+	ok = ok && journalMoves(jrn, scan.moves) == OKAY;
+	closeJournal(jrn);
+	freeScan(&scan);
+
+	if (ok) ok = MoveFileExA(tmpname, fname, MOVEFILE_REPLACE_EXISTING) != 0;
+	if (!ok){
+		printf("Cannot rewrite scan journal %s. \n", fname);
+		return NULL;
+	}
+
+	// Reopen for appending after the rewritten records.
+	if (fopen_s(&fptr, fname, "ab") || !fptr){
+		printf("Cannot reopen scan journal %s. \n", fname);
+		return NULL;
+	}
+	jrn = wrapJournal(fptr, cams, steps, order, calib_crc, 0);
+	if (!jrn) return NULL;
+
+	*next_step = next;
+	*moves = scan.moves;
+	if (DBG_LOG) printf("Scan journal %s: resuming after %d steps and %d motor moves. \n", fname, next, scan.moves);
+	return jrn;
+}
@@ -0,0 +1,67 @@
+/************************************************************************************************************************
+
+Scan Journal: Append-only, checksummed record of an acquisition in progress.
+Every camera appends the points of a step as soon as it has translated them, and the framer logs every motor move,
+each record flushed to disk on its own. After a crash the journal restores the clouds up to the first step some
+camera is missing and tells how far the disk has turned, so the scan can resume from there. Steps are expected in
+the acquisition order the journal was started with (StepOrder.h).
+
+File Layout:	JRN_HEADER | JRN_RECORD + payload (in arrival order)
+A torn or corrupt record ends the journal; everything before it is kept.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "Config.h"
+#include "PointCloud.h"
+
+// Record Types
+#define JRN_STEP				1		// Payload: count x (x, y, z) floats of one camera and step
+#define JRN_MOVE				2		// count: Motor moves sent since the scan started
+
+// Structures
+typedef struct {
+	char magic[4];				// "SEGJ"
+	int version;
+	int cams;
+	int steps;
+	int order;					// ORDER_* the steps are acquired in
+	unsigned int calib_crc;		// Calibration the points were translated with
+}JRN_HEADER;
+
+typedef struct {
+	unsigned int magic;			// JRN_RECORD_MAGIC
+	int type;
+	short cam;
+	short step;
+	int count;
+	unsigned int crc;			// CRC-32 of the fields above and the payload
+}JRN_RECORD;
+
+typedef struct {
+	FILE* fptr;
+	JRN_HEADER hdr;
+	CRITICAL_SECTION lock;
+}JOURNAL;
+
+// Starts an empty journal, replacing any previous one. Returns NULL if the file cannot be created.
+JOURNAL* createJournal(const char* fname, int cams, int steps, int order, unsigned int calib_crc);
+
+// Safe to call concurrently from the camera workers. Both return OKAY once the record is on disk, ERR otherwise.
+int journalPoints(JOURNAL* jrn, int cam, int step, const PCLOUD* pc, int first, int count);
+int journalMoves(JOURNAL* jrn, int moves);
+
+// Number of steps, in acquisition order, every camera has completed, or UNINIT if there is no usable journal for
+// this setup.
+int journalProgress(const char* fname, int cams, int steps, int order, unsigned int calib_crc);
+
+// Restores clouds[0..cams) from the journal and reopens it for appending, keeping only the complete steps.
+// next_step receives the position in acquisition order to continue at, moves the motor moves sent so far.
+// Returns NULL on failure.
+JOURNAL* resumeJournal(const char* fname, PCLOUD* const* clouds, int cams, int steps, int order, unsigned int calib_crc, int* next_step, int* moves);
+
+void closeJournal(JOURNAL* jrn);
@@ -0,0 +1,200 @@
+/************************************************************************************************************************
+
+K-d Tree: Nearest neighbour searches over a fixed set of 3D points.
+
+*************************************************************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "KdTree.h"
+#include "Parallel.h"
+
+typedef struct {
+	int lo;
+	int hi;
+}KD_RANGE;
+
+typedef struct {
+	KDTREE* tree;
+	KD_RANGE range[1 << KD_PAR_LEVELS];
+	int ranges;
+}KD_BUILD;
+
+// Search state: the count closest points so far, sorted, out of at most k within max_d2.
+typedef struct {
+	int k;
+	int count;
+	float max_d2;
+	int* pos;					// Tree positions
+	float* d2;
+}KD_SEARCH;
+
+/*********** BUILD ***********/
+
+static void swapPoints(KDTREE* t, int i, int j){
+	float* a = t->xyz + 3 * i;
+	float* b = t->xyz + 3 * j;
+	float f;
+	f = a[0]; a[0] = b[0]; b[0] = f;
+	f = a[1]; a[1] = b[1]; b[1] = f;
+	f = a[2]; a[2] = b[2]; b[2] = f;
+	int s = t->idx[i];
+	t->idx[i] = t->idx[j];
+	t->idx[j] = s;
+}
+
+// Quickselect: moves the median of [lo, hi) along axis a to mid, smaller values before it, larger after it.
+static void selectMedian(KDTREE* t, int lo, int hi, int mid, int a){
+	const float* p = t->xyz;
+	hi--;
+	while (hi > lo){
+		float pivot = p[3 * ((lo + hi) / 2) + a];
+		int i = lo, j = hi;
+		while (i <= j){
+			while (p[3 * i + a] < pivot) i++;
+			while (p[3 * j + a] > pivot) j--;
+			if (i <= j) swapPoints(t, i++, j--);
+		}
+		if (mid <= j) hi = j;
+		else if (mid >= i) lo = i;
+		else break;
+	}
+}
+
+// Splits [lo, hi) and its subranges. Ranges at depth stop are handed to build->range instead, if build is given.
+static void splitRange(KDTREE* t, int lo, int hi, int depth, int stop, KD_BUILD* build){
+	while (hi - lo > 1){
+		if (build && depth == stop){
+			build->range[build->ranges].lo = lo;
+			build->range[build->ranges].hi = hi;
+			build->ranges++;
+			return;
+		}
+
+		float lo_b[3], hi_b[3];
+		int i, a;
+		for (a = 0; a < 3; a++) lo_b[a] = hi_b[a] = t->xyz[3 * lo + a];
+		for (i = lo + 1; i < hi; i++){
+			for (a = 0; a < 3; a++){
+				float v = t->xyz[3 * i + a];
+				if (v < lo_b[a]) lo_b[a] = v;
+				if (v > hi_b[a]) hi_b[a] = v;
+			}
+		}
+		int axis = 0;
+		for (a = 1; a < 3; a++){
+			if (hi_b[a] - lo_b[a] > hi_b[axis] - lo_b[axis]) axis = a;
+		}
+
+		int mid = (lo + hi) / 2;
+		selectMedian(t, lo, hi, mid, axis);
+		t->axis[mid] = (unsigned char)axis;
+		splitRange(t, lo, mid, depth + 1, stop, build);
+		lo = mid + 1;
+		depth++;
+	}
+	if (hi - lo == 1) t->axis[lo] = 0;
+}
+
+static void buildSubtree(void* prm, int idx){
+	KD_BUILD* build = (KD_BUILD*)prm;
+	splitRange(build->tree, build->range[idx].lo, build->range[idx].hi, 0, 0, NULL);
+}
+
+int buildKdTree(KDTREE* tree, const float* x, const float* y, const float* z, int n){
+
+	memset(tree, 0, sizeof(KDTREE));
+	tree->xyz = (float*)malloc(3 * (size_t)MAX(n, 1) * sizeof(float));
+	tree->idx = (int*)malloc(MAX(n, 1) * sizeof(int));
+	tree->axis = (unsigned char*)malloc(MAX(n, 1));
+	if (!tree->xyz || !tree->idx || !tree->axis){
+		freeKdTree(tree);
+		return ERR;
+	}
+	tree->n = n;
+
+	int i;
+	for (i = 0; i < n; i++){
+		tree->xyz[3 * i + 0] = x[i];
+		tree->xyz[3 * i + 1] = y[i];
+		tree->xyz[3 * i + 2] = z[i];
+		tree->idx[i] = i;
+	}
+
+	KD_BUILD build;
+	build.tree = tree;
+	build.ranges = 0;
+	splitRange(tree, 0, n, 0, KD_PAR_LEVELS, &build);
+	parallelFor(build.ranges, buildSubtree, &build);
+	return OKAY;
+}
+
+void freeKdTree(KDTREE* tree){
+	free(tree->xyz);
+	free(tree->idx);
+	free(tree->axis);
+	memset(tree, 0, sizeof(KDTREE));
+}
+
+/*********** SEARCH ***********/
+
+static float searchBound(const KD_SEARCH* s){
+	return (s->count < s->k) ? s->max_d2 : s->d2[s->count - 1];
+}
+
+static void offerPoint(KD_SEARCH* s, int pos, float d2){
+	if (d2 >= searchBound(s)) return;
+	int i = (s->count < s->k) ? s->count++ : s->count - 1;
+	while (i > 0 && s->d2[i - 1] > d2){
+		s->d2[i] = s->d2[i - 1];
+		s->pos[i] = s->pos[i - 1];
+		i--;
+	}
+	s->d2[i] = d2;
+	s->pos[i] = pos;
+}
+
+// Nearer half first; the far half only while the split plane is closer than the current bound.
+static void searchRange(const KDTREE* t, int lo, int hi, const float* q, KD_SEARCH* s){
+	while (hi > lo){
+		int mid = (lo + hi) / 2;
+		const float* p = t->xyz + 3 * mid;
+		float dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+		offerPoint(s, mid, dx * dx + dy * dy + dz * dz);
+
+		float diff = q[t->axis[mid]] - p[t->axis[mid]];
+		int near_lo = (diff < 0) ? lo : mid + 1;
+		int near_hi = (diff < 0) ? mid : hi;
+		searchRange(t, near_lo, near_hi, q, s);
+		if (diff * diff >= searchBound(s)) return;
+		lo = (diff < 0) ? mid + 1 : lo;
+		hi = (diff < 0) ? hi : mid;
+	}
+}
+
+int kdNearest(const KDTREE* tree, const float* q, float max_d2, float* d2){
+	int pos;
+	KD_SEARCH s;
+	s.k = 1;
+	s.count = 0;
+	s.max_d2 = max_d2;
+	s.pos = &pos;
+	s.d2 = d2;
+	searchRange(tree, 0, tree->n, q, &s);
+	return s.count ? tree->idx[pos] : UNINIT;
+}
+
+int kdNearestK(const KDTREE* tree, const float* q, int k, int* out, float* d2){
+	KD_SEARCH s;
+	s.k = k;
+	s.count = 0;
+	s.max_d2 = FLT_MAX;
+	s.pos = out;
+	s.d2 = d2;
+	searchRange(tree, 0, tree->n, q, &s);
+	int i;
+	for (i = 0; i < s.count; i++) out[i] = tree->idx[out[i]];
+	return s.count;
+}
@@ -0,0 +1,35 @@
+/************************************************************************************************************************
+
+K-d Tree: Nearest neighbour searches over a fixed set of 3D points.
+The tree is implicit: points are reordered so that every range [lo, hi) holds its median at (lo + hi) / 2, split
+on the axis of the range's widest extent, with the lower half before it and the upper half after it. The reordered
+points are kept interleaved in the tree, so searches walk contiguous memory and never touch the source cloud.
+The top KD_PAR_LEVELS levels are split on the calling thread, the subtrees below them are built in parallel.
+
+Searches only read the tree and may run on any number of threads at once.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+
+#define KD_PAR_LEVELS			4			// Levels split before the subtrees are built in parallel
+
+// Structures
+typedef struct {
+	int n;
+	float* xyz;					// Points in tree order, interleaved
+	int* idx;					// Source index of every point in tree order
+	unsigned char* axis;		// Split axis of the range whose median sits here
+}KDTREE;
+
+// Builds a tree over n points given as separate coordinate streams. Returns OKAY, ERR if out of memory.
+int buildKdTree(KDTREE* tree, const float* x, const float* y, const float* z, int n);
+void freeKdTree(KDTREE* tree);
+
+// Source index of the point nearest q within squared distance max_d2 (d2 receives it), UNINIT if none.
+int kdNearest(const KDTREE* tree, const float* q, float max_d2, float* d2);
+
+// The k points nearest q, closest first: source indices in out and squared distances in d2. Returns their number.
+int kdNearestK(const KDTREE* tree, const float* q, int k, int* out, float* d2);
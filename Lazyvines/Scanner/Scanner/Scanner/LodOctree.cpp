@@ -0,0 +1,290 @@
+/************************************************************************************************************************
+
+Level-of-Detail Octree: Interactive display of clouds far larger than the per-frame point budget.
+
+*************************************************************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <process.h>
+
+#include "LodOctree.h"
+#include "Parallel.h"
+
+#define LOD_KEY_CHUNK			65536		// Points per parallel key task
+#define LOD_RADIX_BITS			10
+
+typedef struct {
+	unsigned int key;
+	int idx;
+}LOD_KEY;
+
+typedef struct {
+	const PCLOUD* pc;
+	int n;
+	float lo[3];				// Bounding cube corner
+	float scale;				// Grid cells per world unit
+	LOD_KEY* keys;
+	LOD_TREE* tree;
+}LOD_CTX;
+
+/*********** MORTON ORDER ***********/
+
+// Spreads the low 10 bits of v to every third bit.
+static unsigned int spreadBits(unsigned int v){
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static void computeKeys(void* prm, int idx){
+	LOD_CTX* ctx = (LOD_CTX*)prm;
+	int first = idx * LOD_KEY_CHUNK;
+	int last = MIN(first + LOD_KEY_CHUNK, ctx->n);
+	const int cells = 1 << LOD_MAX_DEPTH;
+	int i, a;
+	for (i = first; i < last; i++){
+		float p[3] = { ctx->pc->x[i], ctx->pc->y[i], ctx->pc->z[i] };
+		unsigned int key = 0;
+		for (a = 0; a < 3; a++){
+			int cell = (int)((p[a] - ctx->lo[a]) * ctx->scale);
+			cell = MIN(MAX(cell, 0), cells - 1);
+			key |= spreadBits(cell) << a;
+		}
+		ctx->keys[i].key = key;
+		ctx->keys[i].idx = i;
+	}
+}
+
+// LSD radix sort on the 3 * LOD_MAX_DEPTH key bits. tmp holds n keys.
+static void sortKeys(LOD_KEY* keys, LOD_KEY* tmp, int n){
+	const int buckets = 1 << LOD_RADIX_BITS;
+	int* count = (int*)malloc(buckets * sizeof(int));
+	int shift, i;
+	for (shift = 0; shift < 3 * LOD_MAX_DEPTH; shift += LOD_RADIX_BITS){
+		memset(count, 0, buckets * sizeof(int));
+		for (i = 0; i < n; i++) count[(keys[i].key >> shift) & (buckets - 1)]++;
+		int sum = 0, b;
+		for (b = 0; b < buckets; b++){
+			int c = count[b];
+			count[b] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; i++) tmp[count[(keys[i].key >> shift) & (buckets - 1)]++] = keys[i];
+		LOD_KEY* swap = keys;
+		keys = tmp;
+		tmp = swap;
+	}
+	free(count);
+
+	// An odd number of passes leaves the result in the scratch buffer.
+	if ((3 * LOD_MAX_DEPTH + LOD_RADIX_BITS - 1) / LOD_RADIX_BITS % 2) memcpy(tmp, keys, n * sizeof(LOD_KEY));
+}
+
+/*********** BUILD ***********/
+
+static int reserveTree(LOD_TREE* tree, int nodes, int verts){
+	if (nodes > tree->max_nodes){
+		int max = MAX(nodes, 2 * tree->max_nodes);
+		LOD_NODE* grown = (LOD_NODE*)realloc(tree->node, max * sizeof(LOD_NODE));
+		if (!grown) return ERR;
+		tree->node = grown;
+		tree->max_nodes = max;
+	}
+	if (verts > tree->max_verts){
+		int max = MAX(verts, tree->max_verts + tree->max_verts / 4);
+		float* grown = (float*)realloc(tree->xyz, 3 * (size_t)max * sizeof(float));
+		if (!grown) return ERR;
+		tree->xyz = grown;
+		tree->max_verts = max;
+	}
+	return OKAY;
+}
+
+// Builds the node for sorted keys [lo, hi), which share their top 3 * level key bits. Returns its index or UNINIT.
+static int buildNode(LOD_CTX* ctx, int lo, int hi, int level, const float* center, float half){
+
+	LOD_TREE* tree = ctx->tree;
+	int count = hi - lo;
+	int leaf = count <= LOD_NODE_POINTS || level == LOD_MAX_DEPTH;
+	int sample = leaf ? count : MIN(LOD_NODE_POINTS, count / 4);
+	if (reserveTree(tree, tree->nodes + 1, tree->verts + sample) != OKAY) return UNINIT;
+
+	int id = tree->nodes++;
+	LOD_NODE* node = &tree->node[id];
+	memcpy(node->center, center, sizeof(node->center));
+	node->half = half;
+	node->first = tree->verts;
+	node->count = sample;
+	node->leaf = leaf;
+
+	// Evenly spaced along the curve, the sample covers the whole node.
+	const PCLOUD* pc = ctx->pc;
+	float* out = tree->xyz + 3 * tree->verts;
+	int i;
+	for (i = 0; i < sample; i++){
+		int k = ctx->keys[lo + (int)((long long)i * count / sample)].idx;
+		out[3 * i + 0] = pc->x[k];
+		out[3 * i + 1] = pc->y[k];
+		out[3 * i + 2] = pc->z[k];
+	}
+	tree->verts += sample;
+
+	int o;
+	for (o = 0; o < 8; o++) node->child[o] = UNINIT;
+	if (leaf) return id;
+
+	// Children: runs of equal octant bits below this level. The node array may move while they are built.
+	int shift = 3 * (LOD_MAX_DEPTH - 1 - level);
+	int a = lo;
+	for (o = 0; o < 8 && a < hi; o++){
+		int b = a;
+		while (b < hi && (int)((ctx->keys[b].key >> shift) & 7) == o) b++;
+		if (b == a) continue;
+
+		float sub[3];
+		int axis;
+		for (axis = 0; axis < 3; axis++) sub[axis] = center[axis] + (((o >> axis) & 1) ? half : -half) / 2;
+		int child = buildNode(ctx, a, b, level + 1, sub, half / 2);
+		if (child == UNINIT) return UNINIT;
+		tree->node[id].child[o] = child;
+		a = b;
+	}
+	return id;
+}
+
+int buildLodTree(LOD_TREE* tree, const PCLOUD* pc, int n){
+
+	memset(tree, 0, sizeof(LOD_TREE));
+	if (n <= 0) return ERR;
+
+	// Bounding Cube
+	float lo[3], hi[3];
+	int i, a;
+	for (a = 0; a < 3; a++) lo[a] = hi[a] = (a == 0) ? pc->x[0] : (a == 1) ? pc->y[0] : pc->z[0];
+	for (i = 1; i < n; i++){
+		lo[0] = MIN(lo[0], pc->x[i]);
+		hi[0] = MAX(hi[0], pc->x[i]);
+		lo[1] = MIN(lo[1], pc->y[i]);
+		hi[1] = MAX(hi[1], pc->y[i]);
+		lo[2] = MIN(lo[2], pc->z[i]);
+		hi[2] = MAX(hi[2], pc->z[i]);
+	}
+	float center[3], half = 0;
+	for (a = 0; a < 3; a++){
+		center[a] = (lo[a] + hi[a]) / 2;
+		half = MAX(half, (hi[a] - lo[a]) / 2);
+	}
+	half = (half > 0) ? half * 1.001f : 1.0f;
+
+	LOD_CTX ctx;
+	ctx.pc = pc;
+	ctx.n = n;
+	for (a = 0; a < 3; a++) ctx.lo[a] = center[a] - half;
+	ctx.scale = (1 << LOD_MAX_DEPTH) / (2 * half);
+	ctx.tree = tree;
+	ctx.keys = (LOD_KEY*)malloc(n * sizeof(LOD_KEY));
+	LOD_KEY* tmp = (LOD_KEY*)malloc(n * sizeof(LOD_KEY));
+	int ok = ctx.keys && tmp;
+	if (ok){
+		parallelFor((n + LOD_KEY_CHUNK - 1) / LOD_KEY_CHUNK, computeKeys, &ctx);
+		sortKeys(ctx.keys, tmp, n);
+	}
+	free(tmp);
+
+	// Leaves hold every point once. Interior samples take at most a quarter of their points, adding a third on top.
+	ok = ok && reserveTree(tree, 64, n + n / 3) == OKAY;
+	ok = ok && buildNode(&ctx, 0, n, 0, center, half) == 0;
+	free(ctx.keys);
+	if (!ok){
+		freeLodTree(tree);
+		return ERR;
+	}
+	tree->points = n;
+	if (DBG_LOG) printf("LOD Tree: %d points, %d nodes, %d samples. \n", n, tree->nodes, tree->verts);
+	return OKAY;
+}
+
+void freeLodTree(LOD_TREE* tree){
+	free(tree->node);
+	free(tree->xyz);
+	memset(tree, 0, sizeof(LOD_TREE));
+}
+
+static unsigned __stdcall lodBuilder(void* prm){
+	LOD_BUILD* b = (LOD_BUILD*)prm;
+	b->status = buildLodTree(&b->tree, b->pc, b->n);
+	return 0;
+}
+
+int startLodBuild(LOD_BUILD* b, const PCLOUD* pc, int n){
+	b->pc = pc;
+	b->n = n;
+	b->status = ERR;
+	b->thread = (HANDLE)_beginthreadex(NULL, 0, lodBuilder, b, 0, NULL);
+	return b->thread ? OKAY : ERR;
+}
+
+int lodBuildDone(LOD_BUILD* b){
+	if (!b->thread) return 1;
+	if (WaitForSingleObject(b->thread, 0) != WAIT_OBJECT_0) return 0;
+	CloseHandle(b->thread);
+	b->thread = NULL;
+	return 1;
+}
+
+/*********** SELECTION ***********/
+
+// Bounding sphere of the node against the clip cube.
+static int nodeVisible(const LOD_NODE* n, const float* mv, float scale){
+	float r = n->half * 1.7320508f * scale;
+	float cx = mv[0] * n->center[0] + mv[4] * n->center[1] + mv[8] * n->center[2] + mv[12];
+	float cy = mv[1] * n->center[0] + mv[5] * n->center[1] + mv[9] * n->center[2] + mv[13];
+	float cz = mv[2] * n->center[0] + mv[6] * n->center[1] + mv[10] * n->center[2] + mv[14];
+	return fabsf(cx) <= 1 + r && fabsf(cy) <= 1 + r && fabsf(cz) <= 1 + r;
+}
+
+int selectLodNodes(const LOD_TREE* tree, const float* mv, int view_h, int budget, LOD_DRAW* out, int max_out){
+
+	float scale = sqrtf(mv[0] * mv[0] + mv[1] * mv[1] + mv[2] * mv[2]);
+	if (!tree->nodes || !nodeVisible(&tree->node[0], mv, scale)) return 0;
+	float px_per_unit = scale * view_h / 2;
+
+	int* queue = (int*)malloc(tree->nodes * sizeof(int));
+	if (!queue) return 0;
+
+	// Breadth first: the budget goes to the coarse levels of the whole view before any detail.
+	int head = 0, tail = 0, drawn = 0;
+	int used = tree->node[0].count;
+	queue[tail++] = 0;
+	while (head < tail && drawn < max_out){
+		int id = queue[head++];
+		const LOD_NODE* n = &tree->node[id];
+		float spacing = 2 * n->half * px_per_unit / sqrtf((float)n->count);
+
+		// Refine: The visible children replace the node's sample if they fit the budget.
+		if (!n->leaf && spacing > LOD_MIN_SPACING){
+			int vis[8], nvis = 0, add = 0, o;
+			for (o = 0; o < 8; o++){
+				if (n->child[o] == UNINIT || !nodeVisible(&tree->node[n->child[o]], mv, scale)) continue;
+				vis[nvis++] = n->child[o];
+				add += tree->node[n->child[o]].count;
+			}
+			if (used - n->count + add <= budget){
+				for (o = 0; o < nvis; o++) queue[tail++] = vis[o];
+				used += add - n->count;
+				continue;
+			}
+		}
+
+		out[drawn].node = id;
+		out[drawn].size = MIN(MAX(spacing, 1.0f), LOD_POINT_SIZE_MAX);
+		drawn++;
+	}
+	free(queue);
+	return drawn;
+}
@@ -0,0 +1,73 @@
+/************************************************************************************************************************
+
+Level-of-Detail Octree: Interactive display of clouds far larger than the per-frame point budget.
+Points are sorted along a Morton curve inside the cloud's bounding cube and cut into an octree. Every node holds a
+representative sample of its points (evenly spaced along the curve, hence spread over the node); leaves hold
+all of theirs. Drawing a node's children in place of the node refines its region.
+
+Each frame, selectLodNodes walks the tree breadth first, skipping nodes outside the view, and refines while the
+points stay within the budget and the sample spacing is still wider than LOD_MIN_SPACING pixels. The spacing also
+sets the point size, so zoomed out clouds are drawn with fine points and sparse regions with wide ones.
+The sample positions of a tree form one vertex array (xyz), meant to be uploaded to the GPU once per build.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include <windows.h>
+
+#include "Config.h"
+#include "PointCloud.h"
+
+#define LOD_NODE_POINTS			8192		// Sample size of interior nodes (at most a quarter of their points); smaller nodes become leaves
+#define LOD_MAX_DEPTH			10			// Morton bits per axis
+#define LOD_MIN_SPACING			1.0f		// Pixels between sample points below which refining adds nothing
+#define LOD_POINT_SIZE_MAX		3.0f
+
+// Structures
+typedef struct {
+	float center[3];
+	float half;					// Half edge length of the node cube
+	int child[8];				// Node indices, UNINIT if the octant is empty
+	int first;					// Sample: points [first, first+count) of the vertex array
+	int count;
+	int leaf;
+}LOD_NODE;
+
+typedef struct {
+	int points;					// Cloud points [0, points) the tree was built from
+	int nodes;
+	int max_nodes;
+	LOD_NODE* node;				// Root first
+	int verts;
+	int max_verts;
+	float* xyz;					// Interleaved sample positions of every node
+}LOD_TREE;
+
+typedef struct {
+	int node;
+	float size;					// Point size in pixels
+}LOD_DRAW;
+
+// Background Build: startLodBuild snapshots points [0, n) of pc, which must not move or change meanwhile.
+typedef struct {
+	HANDLE thread;
+	const PCLOUD* pc;
+	int n;
+	int status;
+	LOD_TREE tree;
+}LOD_BUILD;
+
+// Builds a tree over points [0, n) of pc. Returns OKAY on success, ERR otherwise (nothing is left allocated).
+int buildLodTree(LOD_TREE* tree, const PCLOUD* pc, int n);
+void freeLodTree(LOD_TREE* tree);
+
+// Returns ERR if the build thread cannot be started.
+int startLodBuild(LOD_BUILD* b, const PCLOUD* pc, int n);
+
+// Non-blocking. Returns 1 once the build has finished; b->status then tells whether b->tree is valid.
+int lodBuildDone(LOD_BUILD* b);
+
+// Chooses the nodes to draw for a column-major modelview matrix mv under an orthographic [-1,1] projection
+// onto a viewport view_h pixels high, drawing at most budget points. Returns the number of entries in out.
+int selectLodNodes(const LOD_TREE* tree, const float* mv, int view_h, int budget, LOD_DRAW* out, int max_out);
@@ -0,0 +1,293 @@
+/************************************************************************************************************************
+
+Merge: Fuses the clouds of every camera into one.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "Merge.h"
+#include "Camera.h"
+#include "Parallel.h"
+
+#define MERGE_PARTS				(1 << MERGE_PART_BITS)
+#define MERGE_SKIP				0xFFFFFFFFFFFFFFFFull	// Key of points left out
+#define MERGE_AXIS_BITS			21
+
+// Structures
+typedef struct {
+	int cloud;
+	int first;
+	int last;
+}MERGE_TASK;
+
+typedef struct {
+	int cells;
+	unsigned long long* key;
+	float* acc;					// Per cell and cloud: x, y, z sums and point count
+	int* step;
+	unsigned char* mask;
+	int out_first;
+	int status;
+}MERGE_PART;
+
+typedef struct {
+	PCLOUD* const* clouds;
+	int n;
+	int first[MERGE_MAX_CLOUDS + 1];	// Global index of each cloud's first point
+	float inv_cell;
+	MERGE_TASK* tasks;
+	int ntasks;
+	unsigned long long* keys;	// Per global point
+	int* count;					// Per task and partition: points, then scatter cursors
+	int* order;					// Global points grouped by partition
+	int part_first[MERGE_PARTS + 1];
+	MERGE_PART part[MERGE_PARTS];
+	PCLOUD* out;
+}MERGE_CTX;
+
+/*********** KEYS ***********/
+
+static unsigned long long cellKey(float x, float y, float z, float inv_cell){
+	const int bias = 1 << (MERGE_AXIS_BITS - 1);
+	const int top = (1 << MERGE_AXIS_BITS) - 1;
+	float p[3] = { x, y, z };
+	unsigned long long key = 0;
+	int a;
+	for (a = 0; a < 3; a++){
+		int cell = (int)floorf(p[a] * inv_cell) + bias;
+		cell = MIN(MAX(cell, 0), top);
+		key = (key << MERGE_AXIS_BITS) | (unsigned long long)cell;
+	}
+	return key;
+}
+
+static unsigned long long mixKey(unsigned long long key){
+	return key * 0x9E3779B97F4A7C15ull;
+}
+
+static int partOf(unsigned long long key){
+	return (int)(mixKey(key) >> (64 - MERGE_PART_BITS));
+}
+
+static void keyTask(void* prm, int idx){
+	MERGE_CTX* ctx = (MERGE_CTX*)prm;
+	const MERGE_TASK* task = &ctx->tasks[idx];
+	const PCLOUD* pc = ctx->clouds[task->cloud];
+	int* count = ctx->count + idx * MERGE_PARTS;
+	unsigned long long* keys = ctx->keys + ctx->first[task->cloud];
+	int i;
+	for (i = task->first; i < task->last; i++){
+		if (pc->x[i] == 0 && pc->y[i] == 0 && pc->z[i] == 0){
+			keys[i] = MERGE_SKIP;
+			continue;
+		}
+		keys[i] = cellKey(pc->x[i], pc->y[i], pc->z[i], ctx->inv_cell);
+		count[partOf(keys[i])]++;
+	}
+}
+
+// Chunks scatter in task order and in point order within a chunk, so every partition lists its points in order.
+static void scatterTask(void* prm, int idx){
+	MERGE_CTX* ctx = (MERGE_CTX*)prm;
+	const MERGE_TASK* task = &ctx->tasks[idx];
+	int* cursor = ctx->count + idx * MERGE_PARTS;
+	int base = ctx->first[task->cloud];
+	int i;
+	for (i = task->first; i < task->last; i++){
+		unsigned long long key = ctx->keys[base + i];
+		if (key != MERGE_SKIP) ctx->order[cursor[partOf(key)]++] = base + i;
+	}
+}
+
+/*********** FUSION ***********/
+
+static void freePart(MERGE_PART* part){
+	free(part->key);
+	free(part->acc);
+	free(part->step);
+	free(part->mask);
+}
+
+static void fuseTask(void* prm, int idx){
+	MERGE_CTX* ctx = (MERGE_CTX*)prm;
+	MERGE_PART* part = &ctx->part[idx];
+	int lo = ctx->part_first[idx];
+	int m = ctx->part_first[idx + 1] - lo;
+	int n = ctx->n;
+
+	int size = 1;
+	while (size < 2 * m) size <<= 1;
+	int* table = (int*)malloc(size * sizeof(int));
+	part->key = (unsigned long long*)malloc(MAX(m, 1) * sizeof(unsigned long long));
+	part->acc = (float*)calloc(MAX(m, 1) * 4 * n, sizeof(float));
+	part->step = (int*)malloc(MAX(m, 1) * sizeof(int));
+	part->mask = (unsigned char*)malloc(MAX(m, 1));
+	part->cells = 0;
+	part->status = (table && part->key && part->acc && part->step && part->mask) ? OKAY : ERR;
+	if (part->status != OKAY){
+		free(table);
+		return;
+	}
+	memset(table, 0xFF, size * sizeof(int));
+
+	int j;
+	for (j = 0; j < m; j++){
+		int g = ctx->order[lo + j];
+		unsigned long long key = ctx->keys[g];
+
+		// Linear probing on the mixed key's low bits (its top bits select the partition).
+		int slot = (int)((mixKey(key) >> 16) & (size - 1));
+		while (table[slot] != UNINIT && part->key[table[slot]] != key) slot = (slot + 1) & (size - 1);
+		int cell = table[slot];
+		if (cell == UNINIT){
+			cell = table[slot] = part->cells++;
+			part->key[cell] = key;
+			part->step[cell] = 0x7FFFFFFF;
+			part->mask[cell] = 0;
+		}
+
+		int c = 0;
+		while (g >= ctx->first[c + 1]) c++;
+		const PCLOUD* pc = ctx->clouds[c];
+		int i = g - ctx->first[c];
+		float* acc = part->acc + (cell * n + c) * 4;
+		acc[0] += pc->x[i];
+		acc[1] += pc->y[i];
+		acc[2] += pc->z[i];
+		acc[3] += 1;
+		part->step[cell] = MIN(part->step[cell], pc->s[i]);
+		part->mask[cell] |= (unsigned char)(1 << c);
+	}
+	free(table);
+}
+
+static void writeTask(void* prm, int idx){
+	MERGE_CTX* ctx = (MERGE_CTX*)prm;
+	const MERGE_PART* part = &ctx->part[idx];
+	PCLOUD* out = ctx->out;
+	int n = ctx->n;
+	int cell, c;
+	for (cell = 0; cell < part->cells; cell++){
+		float sum[3] = { 0, 0, 0 };
+		int views = 0;
+		for (c = 0; c < n; c++){
+			const float* acc = part->acc + (cell * n + c) * 4;
+			if (acc[3] == 0) continue;
+			sum[0] += acc[0] / acc[3];
+			sum[1] += acc[1] / acc[3];
+			sum[2] += acc[2] / acc[3];
+			views++;
+		}
+		int o = part->out_first + cell;
+		out->x[o] = sum[0] / views;
+		out->y[o] = sum[1] / views;
+		out->z[o] = sum[2] / views;
+		out->s[o] = part->step[cell];
+		out->cam[o] = part->mask[cell];
+	}
+}
+
+int mergeClouds(PCLOUD* const* clouds, int n, float cell, PCLOUD* out){
+
+	memset(out, 0, sizeof(PCLOUD));
+	if (n < 1 || n > MERGE_MAX_CLOUDS || cell <= 0) return ERR;
+
+	MERGE_CTX ctx;
+	memset(&ctx, 0, sizeof(MERGE_CTX));
+	ctx.clouds = clouds;
+	ctx.n = n;
+	ctx.inv_cell = 1 / cell;
+	ctx.out = out;
+
+	int c, t, p;
+	ctx.first[0] = 0;
+	for (c = 0; c < n; c++){
+		ctx.first[c + 1] = ctx.first[c] + clouds[c]->used;
+		ctx.ntasks += (clouds[c]->used + MERGE_CHUNK - 1) / MERGE_CHUNK;
+	}
+	int total = ctx.first[n];
+
+	ctx.tasks = (MERGE_TASK*)malloc(MAX(ctx.ntasks, 1) * sizeof(MERGE_TASK));
+	ctx.count = (int*)calloc(MAX(ctx.ntasks, 1) * MERGE_PARTS, sizeof(int));
+	ctx.keys = (unsigned long long*)malloc(MAX(total, 1) * sizeof(unsigned long long));
+	ctx.order = (int*)malloc(MAX(total, 1) * sizeof(int));
+	int ok = ctx.tasks && ctx.count && ctx.keys && ctx.order;
+
+	if (ok){
+		for (c = 0, t = 0; c < n; c++){
+			int i;
+			for (i = 0; i < clouds[c]->used; i += MERGE_CHUNK, t++){
+				ctx.tasks[t].cloud = c;
+				ctx.tasks[t].first = i;
+				ctx.tasks[t].last = MIN(i + MERGE_CHUNK, clouds[c]->used);
+			}
+		}
+		parallelFor(ctx.ntasks, keyTask, &ctx);
+
+		// Counts become scatter cursors: partition by partition, chunk by chunk.
+		int at = 0;
+		for (p = 0; p < MERGE_PARTS; p++){
+			ctx.part_first[p] = at;
+			for (t = 0; t < ctx.ntasks; t++){
+				int k = ctx.count[t * MERGE_PARTS + p];
+				ctx.count[t * MERGE_PARTS + p] = at;
+				at += k;
+			}
+		}
+		ctx.part_first[MERGE_PARTS] = at;
+		parallelFor(ctx.ntasks, scatterTask, &ctx);
+		parallelFor(MERGE_PARTS, fuseTask, &ctx);
+
+		int cells = 0;
+		for (p = 0; p < MERGE_PARTS; p++){
+			ok = ok && ctx.part[p].status == OKAY;
+			ctx.part[p].out_first = cells;
+			cells += ctx.part[p].cells;
+		}
+		ok = ok && allocCloud(out, MAX(cells, 1), PC_ORIGIN) == OKAY;
+		if (ok){
+			parallelFor(MERGE_PARTS, writeTask, &ctx);
+			out->used = cells;
+		}
+	}
+
+	for (p = 0; p < MERGE_PARTS; p++) freePart(&ctx.part[p]);
+	free(ctx.tasks);
+	free(ctx.count);
+	free(ctx.keys);
+	free(ctx.order);
+	return ok ? OKAY : ERR;
+}
+
+int mergeCameras(float cell_pixels){
+
+	PCLOUD* clouds[NUM_CAMS];
+	int c, before = 0;
+	for (c = 0; c < NUM_CAMS; c++){
+		clouds[c] = &CAMS[c].p3d;
+		before += CAMS[c].p3d.used;
+	}
+
+	// The merged cloud takes over camera 1's buffer, which later scans of a batch translate straight into.
+	PCLOUD merged;
+	int ok = mergeClouds(clouds, NUM_CAMS, cell_pixels * 2 / WIDTH, &merged) == OKAY;
+	if (!ok || growCloud(&merged, CAMS[0].p3d.max) != OKAY){
+		if (ok) freeCloud(&merged);
+		printf("Cannot merge camera clouds. \n");
+		return ERR;
+	}
+
+	freeCloud(&CAMS[0].p3d);
+	CAMS[0].p3d = merged;
+	for (c = 1; c < NUM_CAMS; c++){
+		CAMS[c].p3d.used = 0;
+		CAMS[c].px.used = 0;
+	}
+	if (DBG_LOG) printf("Merged %d points of %d cameras into %d (%.1f%%). \n", before, NUM_CAMS, merged.used, 100.0 * merged.used / MAX(before, 1));
+	return OKAY;
+}
@@ -0,0 +1,33 @@
+/************************************************************************************************************************
+
+Merge: Fuses the clouds of every camera into one.
+Regions seen by several cameras come out of translation twice. Points are bucketed into cubic cells of a spatial
+hash, cell by default one image pixel wide (the scanner's resolution), and every occupied cell becomes one point:
+* Position: the average of each camera's points in the cell, averaged over the cameras with equal weight, so a
+  camera seeing the surface at a grazing angle (and hence densely) does not pull the fused point its way.
+* Step: the earliest step of its points.
+* Origin: the bit mask of the cameras that contributed (PC_ORIGIN).
+Points at the origin (pixels the mapper rejected) are dropped.
+
+The pass is linear and parallel: points are keyed and counted by hash partition in chunks, scattered into their
+partitions, and every partition is fused through its own hash table on its own thread.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "PointCloud.h"
+
+#define MERGE_CELL_PIXELS		1.0			// Default cell edge in image pixels
+#define MERGE_PART_BITS			6			// 2^MERGE_PART_BITS hash partitions
+#define MERGE_CHUNK				65536		// Points per parallel keying task
+#define MERGE_MAX_CLOUDS		8			// Clouds fit the origin mask
+
+// Fuses clouds[0..n) into out, which is allocated here with PC_ORIGIN. cell is the cell edge in point units.
+// Returns OKAY on success, ERR otherwise (out is left empty).
+int mergeClouds(PCLOUD* const* clouds, int n, float cell, PCLOUD* out);
+
+// Merges every camera's cloud into camera 1's with cells of cell_pixels image pixels, emptying the others.
+// Meant for finished scans: the cameras' 2D points no longer match their clouds afterwards.
+int mergeCameras(float cell_pixels);
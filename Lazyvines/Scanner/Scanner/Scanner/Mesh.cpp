@@ -0,0 +1,28 @@
+/************************************************************************************************************************
+
+Mesh: Indexed triangle meshes built from scanned points.
+
+*************************************************************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Mesh.h"
+
+int allocMesh(MESH* mesh, int max_verts, int max_tris, int attrs){
+	memset(mesh, 0, sizeof(MESH));
+	if (allocCloud(&mesh->v, max_verts, attrs) != OKAY) return ERR;
+	mesh->max = max_tris;
+	mesh->tri = (int*)malloc(3 * max_tris * sizeof(int));
+	if (!mesh->tri){
+		freeMesh(mesh);
+		return ERR;
+	}
+	return OKAY;
+}
+
+void freeMesh(MESH* mesh){
+	freeCloud(&mesh->v);
+	free(mesh->tri);
+	memset(mesh, 0, sizeof(MESH));
+}
@@ -0,0 +1,22 @@
+/************************************************************************************************************************
+
+Mesh: Indexed triangle meshes built from scanned points.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "PointCloud.h"
+
+// Structures
+typedef struct {
+	PCLOUD v;					// Vertices; s holds the step a vertex came from, UNINIT if none
+	int used;					// Triangles
+	int max;
+	int* tri;					// 3 vertex indices per triangle, counter-clockwise seen from outside
+}MESH;
+
+// Returns OKAY on success, ERR otherwise (nothing is left allocated).
+int allocMesh(MESH* mesh, int max_verts, int max_tris, int attrs);
+void freeMesh(MESH* mesh);
@@ -0,0 +1,355 @@
+/************************************************************************************************************************
+
+Normals: Per point surface normals from the scan lattice or fitted planes.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "Normals.h"
+#include "Camera.h"
+#include "KdTree.h"
+#include "Parallel.h"
+
+// Structures
+typedef struct {
+	PCLOUD* pc;
+	const PIXEL* px;
+	int* valid;					// Source index of every point off the origin, in cloud order
+	int nvalid;
+	int* first;					// Per step: first entry of valid, nsteps + 1 entries
+	int nsteps;
+	int wrap;					// The steps make a full revolution, the last one neighbours the first
+	float max_d2;
+}LATTICE_CTX;
+
+typedef struct {
+	PCLOUD* pc;
+	KDTREE tree;
+	float* xyz;					// Points off the origin, interleaved
+	int* valid;					// Their source index
+	int nvalid;
+}FIT_CTX;
+
+/*********** GEOMETRY ***********/
+
+// Eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix (cyclic Jacobi). ev receives the eigenvalues.
+static void smallestEigen(const double* m, double* vec, double* ev){
+	double a[9], v[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	memcpy(a, m, sizeof(a));
+	int sweep, p, q, k;
+	for (sweep = 0; sweep < 16; sweep++){
+		double off = a[1] * a[1] + a[2] * a[2] + a[5] * a[5];
+		if (off < 1e-30) break;
+		for (p = 0; p < 2; p++){
+			for (q = p + 1; q < 3; q++){
+				double apq = a[3 * p + q];
+				if (fabs(apq) < 1e-30) continue;
+				double theta = (a[3 * q + q] - a[3 * p + p]) / (2 * apq);
+				double tn = ((theta >= 0) ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+				double c = 1 / sqrt(tn * tn + 1), s = tn * c;
+				for (k = 0; k < 3; k++){
+					double akp = a[3 * k + p], akq = a[3 * k + q];
+					a[3 * k + p] = c * akp - s * akq;
+					a[3 * k + q] = s * akp + c * akq;
+				}
+				for (k = 0; k < 3; k++){
+					double apk = a[3 * p + k], aqk = a[3 * q + k];
+					a[3 * p + k] = c * apk - s * aqk;
+					a[3 * q + k] = s * apk + c * aqk;
+				}
+				for (k = 0; k < 3; k++){
+					double vkp = v[3 * k + p], vkq = v[3 * k + q];
+					v[3 * k + p] = c * vkp - s * vkq;
+					v[3 * k + q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+	int lo = 0;
+	for (k = 0; k < 3; k++){
+		ev[k] = a[4 * k];
+		if (ev[k] < ev[lo]) lo = k;
+	}
+	for (k = 0; k < 3; k++) vec[k] = v[3 * k + lo];
+}
+
+int fitNormal(const float* xyz, const int* idx, int k, double planarity, float* n){
+
+	n[0] = n[1] = n[2] = 0;
+	if (k < 3) return 0;
+
+	double m[3] = { 0, 0, 0 }, cov[9];
+	int j, r, c;
+	for (j = 0; j < k; j++){
+		const float* p = xyz + 3 * idx[j];
+		m[0] += p[0];
+		m[1] += p[1];
+		m[2] += p[2];
+	}
+	m[0] /= k;
+	m[1] /= k;
+	m[2] /= k;
+	memset(cov, 0, sizeof(cov));
+	for (j = 0; j < k; j++){
+		const float* p = xyz + 3 * idx[j];
+		double d[3] = { p[0] - m[0], p[1] - m[1], p[2] - m[2] };
+		for (r = 0; r < 3; r++){
+			for (c = 0; c < 3; c++) cov[3 * r + c] += d[r] * d[c];
+		}
+	}
+
+	double vec[3], ev[3];
+	smallestEigen(cov, vec, ev);
+	double top = MAX(ev[0], MAX(ev[1], ev[2]));
+	double mid = ev[0] + ev[1] + ev[2] - top - MIN(ev[0], MIN(ev[1], ev[2]));
+	if (top <= 0 || mid < planarity * top) return 0;
+	n[0] = (float)vec[0];
+	n[1] = (float)vec[1];
+	n[2] = (float)vec[2];
+	return 1;
+}
+
+// Turns n away from the turntable axis, or up where the point's horizontal direction says nothing.
+void orientNormal(const float* p, float* n){
+	float out = n[0] * p[0] + n[1] * p[1];
+	float reach = 1e-3f * sqrtf(p[0] * p[0] + p[1] * p[1]);
+	int flip = (fabsf(out) > reach) ? out < 0 : n[2] < 0;
+	if (flip){
+		n[0] = -n[0];
+		n[1] = -n[1];
+		n[2] = -n[2];
+	}
+}
+
+static void storeNormal(PCLOUD* pc, int i, const float* n){
+	pc->nx[i] = n[0];
+	pc->ny[i] = n[1];
+	pc->nz[i] = n[2];
+}
+
+static void clearNormals(PCLOUD* pc){
+	memset(pc->nx, 0, pc->used * sizeof(float));
+	memset(pc->ny, 0, pc->used * sizeof(float));
+	memset(pc->nz, 0, pc->used * sizeof(float));
+}
+
+// Indices of the points off the origin. Returns their count, UNINIT if out of memory.
+static int validPoints(const PCLOUD* pc, int** out){
+	*out = (int*)malloc(MAX(pc->used, 1) * sizeof(int));
+	if (!*out) return UNINIT;
+	int i, n = 0;
+	for (i = 0; i < pc->used; i++){
+		if (pc->x[i] != 0 || pc->y[i] != 0 || pc->z[i] != 0) (*out)[n++] = i;
+	}
+	return n;
+}
+
+/*********** LATTICE ***********/
+
+// Point of valid[lo..hi) on rows rlo..rhi nearest to pixel at in the image and within the gap of p, UNINIT if none.
+static int latticeNeighbour(const LATTICE_CTX* ctx, int lo, int hi, int rlo, int rhi, const PIXEL* at, const float* p){
+	const PCLOUD* pc = ctx->pc;
+	int a = lo, b = hi;
+	while (a < b){
+		int mid = (a + b) / 2;
+		if (ctx->px[ctx->valid[mid]].y < rlo) a = mid + 1;
+		else b = mid;
+	}
+
+	int best = UNINIT, best_score = 0x7FFFFFFF, k;
+	for (k = a; k < hi; k++){
+		int j = ctx->valid[k];
+		const PIXEL* q = &ctx->px[j];
+		if (q->y > rhi) break;
+		if (q->plane != at->plane) continue;
+		int dr = q->y - at->y, dc = q->x - at->x;
+		int score = dr * dr + dc * dc;
+		if (score >= best_score) continue;
+		float dx = pc->x[j] - p[0], dy = pc->y[j] - p[1], dz = pc->z[j] - p[2];
+		if (dx * dx + dy * dy + dz * dz > ctx->max_d2) continue;
+		best = j;
+		best_score = score;
+	}
+	return best;
+}
+
+// Difference of the points at a and b, either falling back to the point at i. Returns 0 if both are missing.
+static int tangent(const PCLOUD* pc, int i, int a, int b, float* t){
+	if (a == UNINIT && b == UNINIT) return 0;
+	if (a == UNINIT) a = i;
+	if (b == UNINIT) b = i;
+	t[0] = pc->x[b] - pc->x[a];
+	t[1] = pc->y[b] - pc->y[a];
+	t[2] = pc->z[b] - pc->z[a];
+	return 1;
+}
+
+static void latticeTask(void* prm, int idx){
+	LATTICE_CTX* ctx = (LATTICE_CTX*)prm;
+	PCLOUD* pc = ctx->pc;
+	int first = idx * NRM_CHUNK;
+	int last = MIN(first + NRM_CHUNK, ctx->nvalid);
+	int k;
+	for (k = first; k < last; k++){
+		int i = ctx->valid[k];
+		int s = pc->s[i];
+		const PIXEL* at = &ctx->px[i];
+		float p[3] = { pc->x[i], pc->y[i], pc->z[i] };
+
+		// Along the laser line: rows above and below in this step.
+		int lo = ctx->first[s], hi = ctx->first[s + 1];
+		int below = latticeNeighbour(ctx, lo, hi, at->y - NRM_ROW_REACH, at->y - 1, at, p);
+		int above = latticeNeighbour(ctx, lo, hi, at->y + 1, at->y + NRM_ROW_REACH, at, p);
+
+		// Across the scan: the same row in the neighbouring steps.
+		int prev = UNINIT, next = UNINIT;
+		int sp = (s > 0) ? s - 1 : (ctx->wrap ? ctx->nsteps - 1 : UNINIT);
+		int sn = (s < ctx->nsteps - 1) ? s + 1 : (ctx->wrap ? 0 : UNINIT);
+		if (sp != UNINIT) prev = latticeNeighbour(ctx, ctx->first[sp], ctx->first[sp + 1], at->y - NRM_ROW_REACH, at->y + NRM_ROW_REACH, at, p);
+		if (sn != UNINIT) next = latticeNeighbour(ctx, ctx->first[sn], ctx->first[sn + 1], at->y - NRM_ROW_REACH, at->y + NRM_ROW_REACH, at, p);
+
+		float u[3], v[3], n[3] = { 0, 0, 0 };
+		if (tangent(pc, i, below, above, u) && tangent(pc, i, prev, next, v)){
+			n[0] = u[1] * v[2] - u[2] * v[1];
+			n[1] = u[2] * v[0] - u[0] * v[2];
+			n[2] = u[0] * v[1] - u[1] * v[0];
+			float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (len > 0){
+				n[0] /= len;
+				n[1] /= len;
+				n[2] /= len;
+				orientNormal(p, n);
+			}
+		}
+		storeNormal(pc, i, n);
+	}
+}
+
+int latticeNormals(PCLOUD* pc, const PIXEL* px){
+
+	LATTICE_CTX ctx;
+	memset(&ctx, 0, sizeof(LATTICE_CTX));
+	ctx.pc = pc;
+	ctx.px = px;
+	ctx.max_d2 = (float)(NRM_MAX_GAP * NRM_MAX_GAP);
+	ctx.nvalid = validPoints(pc, &ctx.valid);
+	if (ctx.nvalid < 0) return ERR;
+
+	// Extraction order: rows ascending within a step. Steps come in acquisition order (StepOrder.h), so the points
+	// are bucketed by step, each bucket keeping its order.
+	int ok = 1, k;
+	for (k = 0; ok && k < ctx.nvalid; k++){
+		int i = ctx.valid[k];
+		ok = pc->s[i] >= 0 && px[i].y >= 0;
+		if (ok) ctx.nsteps = MAX(ctx.nsteps, pc->s[i] + 1);
+	}
+	ctx.wrap = ctx.nsteps == REV_STEPS;
+	ctx.first = ok ? (int*)calloc(ctx.nsteps + 1, sizeof(int)) : NULL;
+	int* bucketed = ctx.first ? (int*)malloc(MAX(ctx.nvalid, 1) * sizeof(int)) : NULL;
+	ok = bucketed != NULL;
+
+	if (ok){
+		for (k = 0; k < ctx.nvalid; k++) ctx.first[pc->s[ctx.valid[k]] + 1]++;
+		for (k = 0; k < ctx.nsteps; k++) ctx.first[k + 1] += ctx.first[k];
+		for (k = 0; k < ctx.nvalid; k++) bucketed[ctx.first[pc->s[ctx.valid[k]]]++] = ctx.valid[k];
+		for (k = ctx.nsteps; k > 0; k--) ctx.first[k] = ctx.first[k - 1];
+		ctx.first[0] = 0;
+		free(ctx.valid);
+		ctx.valid = bucketed;
+
+		for (k = 1; ok && k < ctx.nvalid; k++){
+			int i = ctx.valid[k], j = ctx.valid[k - 1];
+			ok = pc->s[i] != pc->s[j] || px[i].y >= px[j].y;
+		}
+	}
+	ok = ok && addStreams(pc, PC_NORMALS) == OKAY;
+
+	if (ok){
+		clearNormals(pc);
+		parallelFor((ctx.nvalid + NRM_CHUNK - 1) / NRM_CHUNK, latticeTask, &ctx);
+	}
+
+	free(ctx.valid);
+	free(ctx.first);
+	return ok ? OKAY : ERR;
+}
+
+/*********** FITTED ***********/
+
+static void fitTask(void* prm, int idx){
+	FIT_CTX* ctx = (FIT_CTX*)prm;
+	int first = idx * NRM_CHUNK;
+	int last = MIN(first + NRM_CHUNK, ctx->nvalid);
+	int nbr[NRM_PCA_K];
+	float d2[NRM_PCA_K];
+	int k;
+	for (k = first; k < last; k++){
+		const float* p = ctx->xyz + 3 * k;
+		float n[3];
+		int found = kdNearestK(&ctx->tree, p, NRM_PCA_K, nbr, d2);
+		if (fitNormal(ctx->xyz, nbr, found, NRM_PLANARITY, n)) orientNormal(p, n);
+		storeNormal(ctx->pc, ctx->valid[k], n);
+	}
+}
+
+int fittedNormals(PCLOUD* pc){
+
+	FIT_CTX ctx;
+	memset(&ctx, 0, sizeof(FIT_CTX));
+	ctx.pc = pc;
+	ctx.nvalid = validPoints(pc, &ctx.valid);
+	if (ctx.nvalid < 0) return ERR;
+
+	// The tree indexes the compacted points, so its source indices address xyz and valid directly.
+	float* axis[3];
+	int a, k;
+	ctx.xyz = (float*)malloc(3 * (size_t)MAX(ctx.nvalid, 1) * sizeof(float));
+	for (a = 0; a < 3; a++) axis[a] = (float*)malloc(MAX(ctx.nvalid, 1) * sizeof(float));
+	int ok = ctx.xyz && axis[0] && axis[1] && axis[2] && addStreams(pc, PC_NORMALS) == OKAY;
+	for (k = 0; ok && k < ctx.nvalid; k++){
+		int i = ctx.valid[k];
+		ctx.xyz[3 * k + 0] = axis[0][k] = pc->x[i];
+		ctx.xyz[3 * k + 1] = axis[1][k] = pc->y[i];
+		ctx.xyz[3 * k + 2] = axis[2][k] = pc->z[i];
+	}
+	ok = ok && buildKdTree(&ctx.tree, axis[0], axis[1], axis[2], ctx.nvalid) == OKAY;
+	for (a = 0; a < 3; a++) free(axis[a]);
+
+	if (ok){
+		clearNormals(pc);
+		parallelFor((ctx.nvalid + NRM_CHUNK - 1) / NRM_CHUNK, fitTask, &ctx);
+		freeKdTree(&ctx.tree);
+	}
+
+	free(ctx.xyz);
+	free(ctx.valid);
+	return ok ? OKAY : ERR;
+}
+
+/*********** CAMERAS ***********/
+
+int estimateNormals(int method){
+
+	int c, failed = 0;
+	for (c = 0; c < NUM_CAMS; c++){
+		CAMERA* cam = &CAMS[c];
+		if (!cam->p3d.used) continue;
+
+		// Merged clouds keep their count in px but no longer pair with it.
+		int paired = cam->px.used == cam->p3d.used && !(cam->p3d.attrs & PC_ORIGIN);
+		unsigned long st = GetTickCount();
+		int lattice = method == NRM_AUTO && paired && latticeNormals(&cam->p3d, cam->px.pl) == OKAY;
+		if (!lattice && fittedNormals(&cam->p3d) != OKAY){
+			printf("Cannot estimate the normals of camera %d. \n", cam->id);
+			failed++;
+			continue;
+		}
+		if (DBG_LOG) printf("Cam %d: %s normals of %d points in %lu ms. \n", cam->id, lattice ? "Lattice" : "Fitted", cam->p3d.used, (unsigned long)(GetTickCount() - st));
+	}
+	return failed ? ERR : OKAY;
+}
@@ -0,0 +1,47 @@
+/************************************************************************************************************************
+
+Normals: Per point surface normals, estimated in parallel into the cloud's PC_NORMALS stream.
+* Lattice: A camera's points come out of extraction step by step and, within a step, row by row, each paired with its
+  pixel. The step and row of the pixels form a grid over the surface: the tangent along the laser line joins the
+  nearest points of the rows above and below, the tangent across the scan joins the nearest points of the same row
+  in the previous and next steps, and their cross product is the normal. Needs no search structure at all.
+* Fitted: For clouds without pixels (merged, loaded or resumed), the normal of the plane fitted to a point's
+  NRM_PCA_K nearest neighbours (KdTree.h), as used by Align.h.
+Normals point away from the turntable axis, or up on the axis itself. Points whose neighbourhood gives no normal
+(too few neighbours, gaps wider than NRM_MAX_GAP, not planar) and points at the origin get a zero normal.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "Calibrations.h"
+#include "PointCloud.h"
+
+#define NRM_PCA_K				16			// Neighbours fitted per point
+#define NRM_PLANARITY			0.05		// Second to largest spread ratio a neighbourhood needs to count as planar
+#define NRM_MAX_GAP				0.05		// Lattice neighbours farther than this (point units) are not joined
+#define NRM_ROW_REACH			(3 * ROW_PIXEL_STRD)	// Rows searched for a lattice neighbour, either way
+#define NRM_CHUNK				4096		// Points per parallel task
+
+// Estimation Methods
+#define NRM_AUTO				0			// Lattice where possible, fitted otherwise
+#define NRM_FITTED				1
+
+// Turns n at point p away from the turntable axis (up on the axis).
+void orientNormal(const float* p, float* n);
+
+// Unit normal of the plane fitted to points idx[0..k) of the interleaved xyz. Returns 0 (n zeroed) if there are
+// fewer than three points or the second largest spread is under planarity times the largest.
+int fitNormal(const float* xyz, const int* idx, int k, double planarity, float* n);
+
+// Lattice normals of pc, whose point i was extracted at pixel px[i]. Returns ERR, leaving pc untouched, if the
+// points are not in extraction order or some pixel is unknown (negative row), and if out of memory.
+int latticeNormals(PCLOUD* pc, const PIXEL* px);
+
+// Fitted normals of pc. Returns OKAY, ERR if out of memory.
+int fittedNormals(PCLOUD* pc);
+
+// Normals of every camera's cloud. NRM_AUTO takes the lattice while a cloud still pairs with its camera's pixels.
+// Returns OKAY if every cloud got its normals, ERR otherwise.
+int estimateNormals(int method);
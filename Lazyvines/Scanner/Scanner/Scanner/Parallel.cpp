@@ -0,0 +1,63 @@
+/************************************************************************************************************************
+
+Parallel: Runs independent tasks on all processors.
+
+*************************************************************************************************************************/
+
+#include <windows.h>
+#include <process.h>
+
+#include "Config.h"
+#include "Parallel.h"
+
+typedef struct {
+	PAR_TASK task;
+	void* ctx;
+	int n;
+	volatile long next;
+}PAR_JOB;
+
+int numWorkers(){
+	static int workers = 0;
+	if (!workers){
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		workers = MAX(1, MIN((int)si.dwNumberOfProcessors, PAR_MAX_THREADS));
+	}
+	return workers;
+}
+
+// Each worker claims the next unclaimed index until none are left.
+static unsigned __stdcall parWorker(void* prm_data){
+	PAR_JOB* job = (PAR_JOB*)prm_data;
+	for (;;){
+		long idx = InterlockedIncrement(&job->next) - 1;
+		if (idx >= job->n) break;
+		job->task(job->ctx, (int)idx);
+	}
+	return 0;
+}
+
+void parallelFor(int n, PAR_TASK task, void* ctx){
+
+	PAR_JOB job;
+	job.task = task;
+	job.ctx = ctx;
+	job.n = n;
+	job.next = 0;
+
+	int threads = MIN(n, numWorkers());
+	HANDLE hdl[PAR_MAX_THREADS];
+	int t, started = 0;
+	for (t = 1; t < threads; t++){
+		hdl[started] = (HANDLE)_beginthreadex(NULL, 0, parWorker, &job, 0, NULL);
+		if (hdl[started]) started++;
+	}
+
+	// The calling thread works too, so tasks still complete if no thread could be started.
+	parWorker(&job);
+	if (started){
+		WaitForMultipleObjects(started, hdl, TRUE, INFINITE);
+		for (t = 0; t < started; t++) CloseHandle(hdl[t]);
+	}
+}
@@ -0,0 +1,18 @@
+/************************************************************************************************************************
+
+Parallel: Runs independent tasks on all processors.
+parallelFor hands out task indices 0..n-1 to a set of worker threads (the calling thread included) and returns
+once every task has completed. Tasks must not depend on each other's order.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#define PAR_MAX_THREADS			64
+
+typedef void(*PAR_TASK)(void* ctx, int idx);
+
+// Number of worker threads parallelFor uses at most.
+int numWorkers();
+
+void parallelFor(int n, PAR_TASK task, void* ctx);
@@ -0,0 +1,193 @@
+/************************************************************************************************************************
+
+Point Cloud: Structure-of-arrays storage for 3D points.
+
+*************************************************************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "PointCloud.h"
+
+static void* allocStream(int max, size_t elem){
+	return _aligned_malloc(max * elem, PC_ALIGN);
+}
+
+int allocCloud(PCLOUD* pc, int max, int attrs){
+
+	memset(pc, 0, sizeof(PCLOUD));
+	pc->max = max;
+
+	pc->x = (float*)allocStream(max, sizeof(float));
+	pc->y = (float*)allocStream(max, sizeof(float));
+	pc->z = (float*)allocStream(max, sizeof(float));
+	pc->s = (int*)allocStream(max, sizeof(int));
+	int ok = pc->x && pc->y && pc->z && pc->s;
+
+	if (!ok || addStreams(pc, attrs) != OKAY){
+		freeCloud(pc);
+		return ERR;
+	}
+	return OKAY;
+}
+
+// Streams are only added once all of them are allocated, so a failed attempt leaves the cloud as it was.
+int addStreams(PCLOUD* pc, int attrs){
+
+	attrs &= ~pc->attrs;
+	float* i = NULL;
+	float* n[3] = { NULL, NULL, NULL };
+	unsigned char* cam = NULL;
+	int ok = 1;
+
+	if (attrs & PC_INTENSITY){
+		i = (float*)allocStream(pc->max, sizeof(float));
+		ok = ok && i;
+	}
+	if (attrs & PC_NORMALS){
+		n[0] = (float*)allocStream(pc->max, sizeof(float));
+		n[1] = (float*)allocStream(pc->max, sizeof(float));
+		n[2] = (float*)allocStream(pc->max, sizeof(float));
+		ok = ok && n[0] && n[1] && n[2];
+	}
+	if (attrs & PC_ORIGIN){
+		cam = (unsigned char*)allocStream(pc->max, sizeof(unsigned char));
+		ok = ok && cam;
+	}
+
+	if (!ok){
+		_aligned_free(i);
+		_aligned_free(n[0]);
+		_aligned_free(n[1]);
+		_aligned_free(n[2]);
+		_aligned_free(cam);
+		return ERR;
+	}
+	if (i) pc->i = i;
+	if (n[0]){
+		pc->nx = n[0];
+		pc->ny = n[1];
+		pc->nz = n[2];
+	}
+	if (cam) pc->cam = cam;
+	pc->attrs |= attrs;
+	return OKAY;
+}
+
+void dropStreams(PCLOUD* pc, int attrs){
+	attrs &= pc->attrs;
+	if (attrs & PC_INTENSITY){
+		_aligned_free(pc->i);
+		pc->i = NULL;
+	}
+	if (attrs & PC_NORMALS){
+		_aligned_free(pc->nx);
+		_aligned_free(pc->ny);
+		_aligned_free(pc->nz);
+		pc->nx = pc->ny = pc->nz = NULL;
+	}
+	if (attrs & PC_ORIGIN){
+		_aligned_free(pc->cam);
+		pc->cam = NULL;
+	}
+	pc->attrs &= ~attrs;
+}
+
+void freeCloud(PCLOUD* pc){
+	_aligned_free(pc->x);
+	_aligned_free(pc->y);
+	_aligned_free(pc->z);
+	_aligned_free(pc->s);
+	_aligned_free(pc->i);
+	_aligned_free(pc->nx);
+	_aligned_free(pc->ny);
+	_aligned_free(pc->nz);
+	_aligned_free(pc->cam);
+	memset(pc, 0, sizeof(PCLOUD));
+}
+
+static int growStream(void** stream, int max, size_t elem){
+	if (!*stream) return OKAY;
+	void* p = _aligned_realloc(*stream, max * elem, PC_ALIGN);
+	if (!p) return ERR;
+	*stream = p;
+	return OKAY;
+}
+
+// max only changes once every stream has grown; a failed attempt leaves a valid cloud behind.
+int growCloud(PCLOUD* pc, int max){
+	if (max <= pc->max) return OKAY;
+	if (growStream((void**)&pc->x, max, sizeof(float)) != OKAY ||
+		growStream((void**)&pc->y, max, sizeof(float)) != OKAY ||
+		growStream((void**)&pc->z, max, sizeof(float)) != OKAY ||
+		growStream((void**)&pc->s, max, sizeof(int)) != OKAY ||
+		growStream((void**)&pc->i, max, sizeof(float)) != OKAY ||
+		growStream((void**)&pc->nx, max, sizeof(float)) != OKAY ||
+		growStream((void**)&pc->ny, max, sizeof(float)) != OKAY ||
+		growStream((void**)&pc->nz, max, sizeof(float)) != OKAY ||
+		growStream((void**)&pc->cam, max, sizeof(unsigned char)) != OKAY) return ERR;
+	pc->max = max;
+	return OKAY;
+}
+
+PCVIEW cloudView(const PCLOUD* pc, int first, int count){
+
+	PCVIEW v;
+	memset(&v, 0, sizeof(PCVIEW));
+	if (first < 0) first = 0;
+	if (count > pc->used - first) count = pc->used - first;
+	if (count <= 0) return v;
+
+	v.n = count;
+	v.x = pc->x + first;
+	v.y = pc->y + first;
+	v.z = pc->z + first;
+	v.s = pc->s + first;
+	if (pc->i) v.i = pc->i + first;
+	if (pc->nx){
+		v.nx = pc->nx + first;
+		v.ny = pc->ny + first;
+		v.nz = pc->nz + first;
+	}
+	if (pc->cam) v.cam = pc->cam + first;
+	return v;
+}
+
+void getPoint(const PCLOUD* pc, int idx, PT3D* pt){
+	pt->x = pc->x[idx];
+	pt->y = pc->y[idx];
+	pt->z = pc->z[idx];
+	pt->s = pc->s[idx];
+}
+
+void setPoint(PCLOUD* pc, int idx, const PT3D* pt){
+	pc->x[idx] = pt->x;
+	pc->y[idx] = pt->y;
+	pc->z[idx] = pt->z;
+	pc->s[idx] = pt->s;
+}
+
+// Returns ERR if the cloud is full.
+int appendPoint(PCLOUD* pc, const PT3D* pt){
+	if (pc->used == pc->max) return ERR;
+	setPoint(pc, pc->used++, pt);
+	return OKAY;
+}
+
+// Both copy as many points as fit and return ERR if any had to be dropped.
+int cloudFromPT3DS(PCLOUD* pc, const PT3DS* src){
+	int n = MIN(src->used, pc->max);
+	int c;
+	for (c = 0; c < n; c++) setPoint(pc, c, &src->pl[c]);
+	pc->used = n;
+	return (n == src->used) ? OKAY : ERR;
+}
+
+int cloudToPT3DS(const PCLOUD* pc, PT3DS* dst){
+	int n = MIN(pc->used, dst->max);
+	int c;
+	for (c = 0; c < n; c++) getPoint(pc, c, &dst->pl[c]);
+	dst->used = n;
+	return (n == pc->used) ? OKAY : ERR;
+}
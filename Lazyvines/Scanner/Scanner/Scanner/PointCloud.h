@@ -0,0 +1,72 @@
+/************************************************************************************************************************
+
+Point Cloud: Structure-of-arrays storage for 3D points.
+Every attribute lives in its own aligned stream, so consumers that only need coordinates (renderer, filters,
+exporters, neighbour searches) walk tightly packed floats instead of striding over the step tags.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+
+// Stream Alignment (bytes): One cache line, also enough for any SIMD width in use.
+#define PC_ALIGN				64
+
+// Optional Attributes
+#define PC_INTENSITY			0x01
+#define PC_NORMALS				0x02
+#define PC_ORIGIN				0x04
+
+// Structures
+typedef struct {
+	int used;
+	int max;
+	int attrs;					// PC_* streams allocated besides x, y, z, s
+	float* x;
+	float* y;
+	float* z;
+	int* s;						// Step the point was captured at
+	float* i;					// Laser intensity (PC_INTENSITY)
+	float* nx;					// Unit normal (PC_NORMALS)
+	float* ny;
+	float* nz;
+	unsigned char* cam;			// Bit mask of the cameras that saw the point (PC_ORIGIN)
+}PCLOUD;
+
+// Read-only window onto a range of a cloud's streams. Shares the cloud's memory, valid until it is freed.
+typedef struct {
+	int n;
+	const float* x;
+	const float* y;
+	const float* z;
+	const int* s;
+	const float* i;				// NULL if the cloud has no such stream
+	const float* nx;
+	const float* ny;
+	const float* nz;
+	const unsigned char* cam;
+}PCVIEW;
+
+// Allocates streams for max points. Returns OKAY on success, ERR otherwise (nothing is left allocated).
+int allocCloud(PCLOUD* pc, int max, int attrs);
+void freeCloud(PCLOUD* pc);
+
+// Allocates the attrs streams pc does not have yet, for pc->max points (contents undefined). Returns OKAY or ERR.
+int addStreams(PCLOUD* pc, int attrs);
+
+// Releases the attrs streams pc has, e.g. attributes of a previous scan before the cloud is refilled.
+void dropStreams(PCLOUD* pc, int attrs);
+
+// Enlarges every stream to hold at least max points, keeping the current ones. Returns OKAY or ERR.
+int growCloud(PCLOUD* pc, int max);
+
+// Zero-copy view of points [first, first+count), clipped to the used range.
+PCVIEW cloudView(const PCLOUD* pc, int first, int count);
+
+// Adapters for code written against PT3D / PT3DS.
+void getPoint(const PCLOUD* pc, int idx, PT3D* pt);
+void setPoint(PCLOUD* pc, int idx, const PT3D* pt);
+int appendPoint(PCLOUD* pc, const PT3D* pt);
+int cloudFromPT3DS(PCLOUD* pc, const PT3DS* src);
+int cloudToPT3DS(const PCLOUD* pc, PT3DS* dst);
@@ -0,0 +1,603 @@
+/************************************************************************************************************************
+
+Point Codec: Compressed point cloud storage (.3dpz).
+
+Cloud Layout:	PZ_CLOUD | sub_count[subtrees] | sub_size[subtrees] | top stream | subtree streams
+The top stream holds the occupancy of levels 0..OCT_SPLIT_LEVEL-1; subtrees follow in depth-first order.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "PointCodec.h"
+#include "Parallel.h"
+
+/*********** RANGE CODER ***********/
+
+#define RC_TOP					(1U << 24)
+#define RC_PROB_BITS			11
+#define RC_PROB_INIT			(1 << (RC_PROB_BITS - 1))
+#define RC_MOVE_BITS			5
+
+typedef unsigned short PROB;
+
+typedef struct {
+	unsigned char* buf;
+	int n;
+	int cap;
+	unsigned long long low;
+	unsigned int range;
+	unsigned char cache;
+	int cache_size;
+	int failed;
+}RC_ENC;
+
+typedef struct {
+	const unsigned char* ip;
+	const unsigned char* end;
+	unsigned int range;
+	unsigned int code;
+}RC_DEC;
+
+static void putByte(RC_ENC* rc, unsigned char b){
+	if (rc->n == rc->cap){
+		int cap = rc->cap ? 2 * rc->cap : 4096;
+		unsigned char* buf = (unsigned char*)realloc(rc->buf, cap);
+		if (!buf){ rc->failed = 1; return; }
+		rc->buf = buf;
+		rc->cap = cap;
+	}
+	rc->buf[rc->n++] = b;
+}
+
+static void shiftLow(RC_ENC* rc){
+	if ((unsigned int)rc->low < 0xFF000000U || (rc->low >> 32)){
+		unsigned char carry = (unsigned char)(rc->low >> 32);
+		unsigned char temp = rc->cache;
+		do {
+			putByte(rc, (unsigned char)(temp + carry));
+			temp = 0xFF;
+		} while (--rc->cache_size);
+		rc->cache = (unsigned char)(rc->low >> 24);
+	}
+	rc->cache_size++;
+	rc->low = (rc->low & 0x00FFFFFF) << 8;
+}
+
+static void initEncoder(RC_ENC* rc){
+	memset(rc, 0, sizeof(RC_ENC));
+	rc->range = 0xFFFFFFFFU;
+	rc->cache_size = 1;
+}
+
+static void flushEncoder(RC_ENC* rc){
+	int i;
+	for (i = 0; i < 5; i++) shiftLow(rc);
+}
+
+static void encodeBit(RC_ENC* rc, PROB* p, int bit){
+	unsigned int bound = (rc->range >> RC_PROB_BITS) * *p;
+	if (!bit){
+		rc->range = bound;
+		*p += ((1 << RC_PROB_BITS) - *p) >> RC_MOVE_BITS;
+	}
+	else {
+		rc->low += bound;
+		rc->range -= bound;
+		*p -= *p >> RC_MOVE_BITS;
+	}
+	while (rc->range < RC_TOP){
+		rc->range <<= 8;
+		shiftLow(rc);
+	}
+}
+
+// Reads past the end of a stream yield zeros; corrupt streams are caught by the point count checks.
+static unsigned char getByte(RC_DEC* rc){
+	return (rc->ip < rc->end) ? *rc->ip++ : 0;
+}
+
+static void initDecoder(RC_DEC* rc, const unsigned char* src, int n){
+	rc->ip = src;
+	rc->end = src + n;
+	rc->range = 0xFFFFFFFFU;
+	rc->code = 0;
+	int i;
+	for (i = 0; i < 5; i++) rc->code = (rc->code << 8) | getByte(rc);
+}
+
+static int decodeBit(RC_DEC* rc, PROB* p){
+	int bit;
+	unsigned int bound = (rc->range >> RC_PROB_BITS) * *p;
+	if (rc->code < bound){
+		rc->range = bound;
+		*p += ((1 << RC_PROB_BITS) - *p) >> RC_MOVE_BITS;
+		bit = 0;
+	}
+	else {
+		rc->code -= bound;
+		rc->range -= bound;
+		*p -= *p >> RC_MOVE_BITS;
+		bit = 1;
+	}
+	while (rc->range < RC_TOP){
+		rc->range <<= 8;
+		rc->code = (rc->code << 8) | getByte(rc);
+	}
+	return bit;
+}
+
+/*********** SYMBOL MODELS ***********/
+
+// Occupancy contexts: tree level x number of occupied siblings of the parent (1, 2-4, 5-8).
+#define OCC_CLASSES				3
+
+// Unsigned integers: Exp-Golomb, bit length in unary, then the bits below the leading one.
+#define UINT_BITS				32
+
+typedef struct {
+	PROB len[UINT_BITS];
+	PROB bits[UINT_BITS + 1][UINT_BITS];
+}UINT_MODEL;
+
+typedef struct {
+	PROB occ[OCT_DEPTH_MAX][OCC_CLASSES][256];
+	UINT_MODEL count;			// Points per leaf - 1
+	UINT_MODEL step;			// Zigzag step delta
+}OCT_MODEL;
+
+static void initProbs(PROB* p, int n){
+	int i;
+	for (i = 0; i < n; i++) p[i] = RC_PROB_INIT;
+}
+
+static void initModel(OCT_MODEL* m){
+	initProbs(&m->occ[0][0][0], sizeof(m->occ) / sizeof(PROB));
+	initProbs(m->count.len, sizeof(UINT_MODEL) / sizeof(PROB));
+	initProbs(m->step.len, sizeof(UINT_MODEL) / sizeof(PROB));
+}
+
+static int occClass(int siblings){
+	return (siblings <= 1) ? 0 : (siblings <= 4) ? 1 : 2;
+}
+
+static int popCount(int occ){
+	int n = 0;
+	for (; occ; occ >>= 1) n += occ & 1;
+	return n;
+}
+
+// Occupancy bytes are coded MSB first down a binary tree of 255 contexts.
+static void encodeOcc(RC_ENC* rc, PROB* probs, int occ){
+	int node = 1, i;
+	for (i = 7; i >= 0; i--){
+		int bit = (occ >> i) & 1;
+		encodeBit(rc, &probs[node], bit);
+		node = (node << 1) | bit;
+	}
+}
+
+static int decodeOcc(RC_DEC* rc, PROB* probs){
+	int node = 1, i;
+	for (i = 0; i < 8; i++) node = (node << 1) | decodeBit(rc, &probs[node]);
+	return node & 0xFF;
+}
+
+static void encodeUInt(RC_ENC* rc, UINT_MODEL* m, unsigned int v){
+	unsigned long long w = (unsigned long long)v + 1;
+	int n = 0, i;
+	while ((w >> (n + 1)) != 0) n++;
+	for (i = 0; i < n; i++) encodeBit(rc, &m->len[i], 1);
+	if (n < UINT_BITS) encodeBit(rc, &m->len[n], 0);
+	for (i = n - 1; i >= 0; i--) encodeBit(rc, &m->bits[n][i], (int)((w >> i) & 1));
+}
+
+static unsigned int decodeUInt(RC_DEC* rc, UINT_MODEL* m){
+	int n = 0, i;
+	while (n < UINT_BITS && decodeBit(rc, &m->len[n])) n++;
+	unsigned long long w = 1;
+	for (i = n - 1; i >= 0; i--) w = (w << 1) | decodeBit(rc, &m->bits[n][i]);
+	return (unsigned int)(w - 1);
+}
+
+static unsigned int zigzag(int v){
+	return (v < 0) ? (((unsigned int)(-(v + 1)) << 1) | 1) : ((unsigned int)v << 1);
+}
+
+static int unzigzag(unsigned int v){
+	return (v & 1) ? -(int)(v >> 1) - 1 : (int)(v >> 1);
+}
+
+/*********** OCTREE ***********/
+
+typedef struct {
+	unsigned long long key;		// Morton code of the point's grid cell
+	int s;
+}OCT_POINT;
+
+typedef struct {
+	int count;
+	float lo[3];				// Grid origin
+	float cell;					// Grid spacing, equal on all axes
+	int depth;
+	int split;					// Level at which subtrees become independent streams
+	int top_size;
+	int subtrees;
+}PZ_CLOUD;
+
+// Spreads the low 21 bits of v to every third bit.
+static unsigned long long spreadBits(unsigned long long v){
+	v &= 0x1FFFFF;
+	v = (v | (v << 32)) & 0x001F00000000FFFFULL;
+	v = (v | (v << 16)) & 0x001F0000FF0000FFULL;
+	v = (v | (v << 8)) & 0x100F00F00F00F00FULL;
+	v = (v | (v << 4)) & 0x10C30C30C30C30C3ULL;
+	v = (v | (v << 2)) & 0x1249249249249249ULL;
+	return v;
+}
+
+static int compactBits(unsigned long long v){
+	v &= 0x1249249249249249ULL;
+	v = (v | (v >> 2)) & 0x10C30C30C30C30C3ULL;
+	v = (v | (v >> 4)) & 0x100F00F00F00F00FULL;
+	v = (v | (v >> 8)) & 0x001F0000FF0000FFULL;
+	v = (v | (v >> 16)) & 0x001F00000000FFFFULL;
+	v = (v | (v >> 32)) & 0x1FFFFF;
+	return (int)v;
+}
+
+static int cmpOctPoint(const void* a, const void* b){
+	const OCT_POINT* pa = (const OCT_POINT*)a;
+	const OCT_POINT* pb = (const OCT_POINT*)b;
+	if (pa->key != pb->key) return (pa->key < pb->key) ? -1 : 1;
+	return (pa->s > pb->s) - (pa->s < pb->s);
+}
+
+// Child octant of a key at a given level.
+static int childOf(unsigned long long key, int level, int depth){
+	return (int)((key >> (3 * (depth - level - 1))) & 7);
+}
+
+// Occupancy of the node holding pts[0..n), which all share their key down to level.
+static int occupancyOf(const OCT_POINT* pts, int n, int level, int depth){
+	int occ = 0, i;
+	for (i = 0; i < n; i++) occ |= 1 << childOf(pts[i].key, level, depth);
+	return occ;
+}
+
+/*********** ENCODER ***********/
+
+typedef struct {
+	const OCT_POINT* pts;
+	int depth;
+	int split;
+	int* sub_first;				// First point of each subtree (subtrees + 1 entries)
+	RC_ENC* enc;				// One encoder per subtree
+}ENC_JOB;
+
+static void encodeNode(RC_ENC* rc, OCT_MODEL* m, const OCT_POINT* pts, int n, int level, int depth, int siblings, int* prev_s){
+
+	if (level == depth){
+		encodeUInt(rc, &m->count, n - 1);
+		int i;
+		for (i = 0; i < n; i++){
+			encodeUInt(rc, &m->step, zigzag((int)((unsigned int)pts[i].s - (unsigned int)*prev_s)));
+			*prev_s = pts[i].s;
+		}
+		return;
+	}
+
+	int occ = occupancyOf(pts, n, level, depth);
+	encodeOcc(rc, m->occ[level][occClass(siblings)], occ);
+
+	// Points are sorted, so each child's points are a contiguous run.
+	int children = popCount(occ);
+	int i = 0;
+	while (i < n){
+		int c = childOf(pts[i].key, level, depth);
+		int j = i + 1;
+		while (j < n && childOf(pts[j].key, level, depth) == c) j++;
+		encodeNode(rc, m, pts + i, j - i, level + 1, depth, children, prev_s);
+		i = j;
+	}
+}
+
+static void encodeSubtree(void* ctx, int idx){
+	ENC_JOB* job = (ENC_JOB*)ctx;
+	OCT_MODEL* m = (OCT_MODEL*)malloc(sizeof(OCT_MODEL));
+	RC_ENC* rc = &job->enc[idx];
+	initEncoder(rc);
+	if (!m){ rc->failed = 1; return; }
+	initModel(m);
+
+	int first = job->sub_first[idx];
+	int n = job->sub_first[idx + 1] - first;
+	int prev_s = 0;
+
+	// Siblings of the subtree root are not known here; the first occupancy byte starts from the middle class.
+	encodeNode(rc, m, job->pts + first, n, job->split, job->depth, 2, &prev_s);
+	flushEncoder(rc);
+	free(m);
+}
+
+// Codes levels [level, split) into the top stream and records where each subtree starts.
+static void encodeTop(RC_ENC* rc, OCT_MODEL* m, const OCT_POINT* pts, int n, int base, int level, int split, int depth, int siblings, int* sub_first, int* subtrees){
+
+	if (level == split){
+		sub_first[(*subtrees)++] = base;
+		return;
+	}
+
+	int occ = occupancyOf(pts, n, level, depth);
+	encodeOcc(rc, m->occ[level][occClass(siblings)], occ);
+
+	int children = popCount(occ);
+	int i = 0;
+	while (i < n){
+		int c = childOf(pts[i].key, level, depth);
+		int j = i + 1;
+		while (j < n && childOf(pts[j].key, level, depth) == c) j++;
+		encodeTop(rc, m, pts + i, j - i, base + i, level + 1, split, depth, children, sub_first, subtrees);
+		i = j;
+	}
+}
+
+int encodeCloud(FILE* fptr, const PCLOUD* pc, int depth){
+
+	PZ_CLOUD hdr;
+	memset(&hdr, 0, sizeof(PZ_CLOUD));
+	hdr.count = pc->used;
+	hdr.depth = MAX(1, MIN(depth, OCT_DEPTH_MAX));
+	hdr.split = MIN(OCT_SPLIT_LEVEL, hdr.depth);
+	if (!hdr.count) return (fwrite(&hdr, sizeof(PZ_CLOUD), 1, fptr) == 1) ? OKAY : ERR;
+
+	// Grid: Cubic cells spanning the largest extent of the bounding box.
+	float hi[3];
+	int a, i;
+	const float* src[3] = { pc->x, pc->y, pc->z };
+	for (a = 0; a < 3; a++){
+		hdr.lo[a] = hi[a] = src[a][0];
+		for (i = 1; i < pc->used; i++){
+			hdr.lo[a] = MIN(hdr.lo[a], src[a][i]);
+			hi[a] = MAX(hi[a], src[a][i]);
+		}
+	}
+	int cells = 1 << hdr.depth;
+	float extent = MAX(hi[0] - hdr.lo[0], MAX(hi[1] - hdr.lo[1], hi[2] - hdr.lo[2]));
+	hdr.cell = (extent > 0) ? extent / (cells - 1) : 1.0f;
+
+	OCT_POINT* pts = (OCT_POINT*)malloc(pc->used * sizeof(OCT_POINT));
+	if (!pts) return ERR;
+	for (i = 0; i < pc->used; i++){
+		unsigned long long key = 0;
+		for (a = 0; a < 3; a++){
+			float d = (src[a][i] - hdr.lo[a]) / hdr.cell + 0.5f;
+			int q = (d >= 0) ? (int)MIN(d, (float)(cells - 1)) : 0;
+			key |= spreadBits(q) << (2 - a);
+		}
+		pts[i].key = key;
+		pts[i].s = pc->s[i];
+	}
+	qsort(pts, pc->used, sizeof(OCT_POINT), cmpOctPoint);
+
+	// Top levels (sequential), then every subtree on its own stream.
+	int max_sub = 1 << (3 * hdr.split);
+	int* sub_first = (int*)malloc((max_sub + 1) * sizeof(int));
+	int* sub_size = (int*)malloc(max_sub * sizeof(int));
+	int* sub_count = (int*)malloc(max_sub * sizeof(int));
+	RC_ENC top;
+	OCT_MODEL* m = (OCT_MODEL*)malloc(sizeof(OCT_MODEL));
+	RC_ENC* enc = (RC_ENC*)calloc(max_sub, sizeof(RC_ENC));
+	int ok = sub_first && sub_size && sub_count && m && enc;
+
+	if (ok){
+		initEncoder(&top);
+		initModel(m);
+		encodeTop(&top, m, pts, pc->used, 0, 0, hdr.split, hdr.depth, 2, sub_first, &hdr.subtrees);
+		flushEncoder(&top);
+		sub_first[hdr.subtrees] = pc->used;
+		hdr.top_size = top.n;
+
+		ENC_JOB job;
+		job.pts = pts;
+		job.depth = hdr.depth;
+		job.split = hdr.split;
+		job.sub_first = sub_first;
+		job.enc = enc;
+		parallelFor(hdr.subtrees, encodeSubtree, &job);
+
+		ok = !top.failed;
+		for (i = 0; i < hdr.subtrees; i++){
+			sub_count[i] = sub_first[i + 1] - sub_first[i];
+			sub_size[i] = enc[i].n;
+			ok = ok && !enc[i].failed;
+		}
+
+		ok = ok && fwrite(&hdr, sizeof(PZ_CLOUD), 1, fptr) == 1 &&
+			fwrite(sub_count, sizeof(int), hdr.subtrees, fptr) == (size_t)hdr.subtrees &&
+			fwrite(sub_size, sizeof(int), hdr.subtrees, fptr) == (size_t)hdr.subtrees &&
+			fwrite(top.buf, 1, top.n, fptr) == (size_t)top.n;
+		for (i = 0; ok && i < hdr.subtrees; i++){
+			ok = fwrite(enc[i].buf, 1, enc[i].n, fptr) == (size_t)enc[i].n;
+		}
+		free(top.buf);
+		for (i = 0; i < hdr.subtrees; i++) free(enc[i].buf);
+	}
+
+	free(enc);
+	free(m);
+	free(sub_count);
+	free(sub_size);
+	free(sub_first);
+	free(pts);
+	return ok ? OKAY : ERR;
+}
+
+/*********** DECODER ***********/
+
+typedef struct {
+	PZ_CLOUD hdr;
+	PCLOUD* pc;
+	const unsigned char** src;	// Stream of each subtree
+	int* sub_size;
+	int* sub_count;
+	int* sub_first;				// First output point of each subtree
+	unsigned long long* sub_key;
+	volatile long failed;
+}DEC_JOB;
+
+typedef struct {
+	RC_DEC rc;
+	OCT_MODEL* m;
+	PCLOUD* pc;
+	const PZ_CLOUD* hdr;
+	int out;					// Next output point
+	int end;					// One past the last output point of this subtree
+	int prev_s;
+}DEC_STATE;
+
+// Returns ERR as soon as the stream claims more points than the subtree holds.
+static int decodeNode(DEC_STATE* st, unsigned long long key, int level, int siblings){
+
+	const PZ_CLOUD* hdr = st->hdr;
+	if (level == hdr->depth){
+		unsigned int n = decodeUInt(&st->rc, &st->m->count) + 1;
+		if (n == 0 || n > (unsigned int)(st->end - st->out)) return ERR;
+
+		float pos[3];
+		int a;
+		for (a = 0; a < 3; a++) pos[a] = hdr->lo[a] + compactBits(key >> (2 - a)) * hdr->cell;
+
+		unsigned int i;
+		for (i = 0; i < n; i++){
+			st->prev_s = (int)((unsigned int)st->prev_s + (unsigned int)unzigzag(decodeUInt(&st->rc, &st->m->step)));
+			st->pc->x[st->out] = pos[0];
+			st->pc->y[st->out] = pos[1];
+			st->pc->z[st->out] = pos[2];
+			st->pc->s[st->out] = st->prev_s;
+			st->out++;
+		}
+		return OKAY;
+	}
+
+	int occ = decodeOcc(&st->rc, st->m->occ[level][occClass(siblings)]);
+	if (!occ) return ERR;
+	int children = popCount(occ);
+	int c;
+	for (c = 0; c < 8; c++){
+		if (!(occ & (1 << c))) continue;
+		if (decodeNode(st, (key << 3) | c, level + 1, children) != OKAY) return ERR;
+	}
+	return OKAY;
+}
+
+static void decodeSubtree(void* ctx, int idx){
+	DEC_JOB* job = (DEC_JOB*)ctx;
+	DEC_STATE st;
+	st.m = (OCT_MODEL*)malloc(sizeof(OCT_MODEL));
+	if (!st.m){ job->failed = 1; return; }
+	initModel(st.m);
+	initDecoder(&st.rc, job->src[idx], job->sub_size[idx]);
+	st.pc = job->pc;
+	st.hdr = &job->hdr;
+	st.out = job->sub_first[idx];
+	st.end = st.out + job->sub_count[idx];
+	st.prev_s = 0;
+
+	if (decodeNode(&st, job->sub_key[idx], job->hdr.split, 2) != OKAY || st.out != st.end) job->failed = 1;
+	free(st.m);
+}
+
+// Walks the top levels, collecting the key of every subtree root in depth-first order.
+static int decodeTop(RC_DEC* rc, OCT_MODEL* m, unsigned long long key, int level, int split, int siblings, unsigned long long* sub_key, int* found, int max_sub){
+	if (level == split){
+		if (*found == max_sub) return ERR;
+		sub_key[(*found)++] = key;
+		return OKAY;
+	}
+	int occ = decodeOcc(rc, m->occ[level][occClass(siblings)]);
+	if (!occ) return ERR;
+	int children = popCount(occ);
+	int c;
+	for (c = 0; c < 8; c++){
+		if (!(occ & (1 << c))) continue;
+		if (decodeTop(rc, m, (key << 3) | c, level + 1, split, children, sub_key, found, max_sub) != OKAY) return ERR;
+	}
+	return OKAY;
+}
+
+int decodeCloud(FILE* fptr, PCLOUD* pc){
+
+	DEC_JOB job;
+	memset(&job, 0, sizeof(DEC_JOB));
+	PZ_CLOUD* hdr = &job.hdr;
+	if (fread(hdr, sizeof(PZ_CLOUD), 1, fptr) != 1) return ERR;
+	if (hdr->count < 0 || growCloud(pc, hdr->count) != OKAY || hdr->depth < 1 || hdr->depth > OCT_DEPTH_MAX ||
+		hdr->split < 0 || hdr->split > hdr->depth || hdr->split > OCT_SPLIT_LEVEL) return ERR;
+	pc->used = 0;
+	if (!hdr->count) return OKAY;
+
+	int max_sub = 1 << (3 * hdr->split);
+	if (hdr->subtrees < 1 || hdr->subtrees > max_sub || hdr->top_size < 0) return ERR;
+
+	int n = hdr->subtrees;
+	job.pc = pc;
+	job.sub_count = (int*)malloc(n * sizeof(int));
+	job.sub_size = (int*)malloc(n * sizeof(int));
+	job.sub_first = (int*)malloc(n * sizeof(int));
+	job.sub_key = (unsigned long long*)malloc(n * sizeof(unsigned long long));
+	job.src = (const unsigned char**)malloc(n * sizeof(unsigned char*));
+	OCT_MODEL* m = (OCT_MODEL*)malloc(sizeof(OCT_MODEL));
+	unsigned char* data = NULL;
+	int ok = job.sub_count && job.sub_size && job.sub_first && job.sub_key && job.src && m;
+
+	ok = ok && fread(job.sub_count, sizeof(int), n, fptr) == (size_t)n && fread(job.sub_size, sizeof(int), n, fptr) == (size_t)n;
+
+	// Stream sizes and point counts must add up before any stream is touched.
+	long long bytes = hdr->top_size, points = 0;
+	int i;
+	for (i = 0; ok && i < n; i++){
+		ok = job.sub_count[i] > 0 && job.sub_size[i] >= 0;
+		job.sub_first[i] = (int)points;
+		points += job.sub_count[i];
+		bytes += job.sub_size[i];
+	}
+	ok = ok && points == hdr->count && bytes < 0x7FFFFFFF;
+
+	if (ok){
+		data = (unsigned char*)malloc((size_t)bytes + 1);
+		ok = data && fread(data, 1, (size_t)bytes, fptr) == (size_t)bytes;
+	}
+
+	if (ok){
+		RC_DEC top;
+		initDecoder(&top, data, hdr->top_size);
+		initModel(m);
+		int found = 0;
+		ok = decodeTop(&top, m, 0, 0, hdr->split, 2, job.sub_key, &found, n) == OKAY && found == n;
+
+		const unsigned char* p = data + hdr->top_size;
+		for (i = 0; i < n; i++){
+			job.src[i] = p;
+			p += job.sub_size[i];
+		}
+	}
+
+	if (ok){
+		parallelFor(n, decodeSubtree, &job);
+		ok = !job.failed;
+	}
+	pc->used = ok ? hdr->count : 0;
+
+	free(data);
+	free(m);
+	free(job.src);
+	free(job.sub_key);
+	free(job.sub_first);
+	free(job.sub_size);
+	free(job.sub_count);
+	return ok ? OKAY : ERR;
+}
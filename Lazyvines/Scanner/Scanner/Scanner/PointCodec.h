@@ -0,0 +1,30 @@
+/************************************************************************************************************************
+
+Point Codec: Compressed point cloud storage (.3dpz).
+Points are snapped to a cubic grid of 2^depth cells per axis over the cloud's bounding box and stored as an octree:
+one occupancy byte per node, a point count per leaf and the step of every point, delta coded in octree order.
+All symbols go through an adaptive binary range coder. Below OCT_SPLIT_LEVEL each subtree is coded as an
+independent stream, so both encoding and decoding run in parallel over subtrees.
+
+Coordinates come back within half a cell of their original value, and in octree order rather than scan order.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+
+#include "Config.h"
+#include "PointCloud.h"
+
+// Precision: Grid bits per axis. 12 bits keep a [-1,1] cloud within 0.0003 of the translated values.
+#define OCT_DEPTH_DEFAULT		12
+#define OCT_DEPTH_MAX			21
+#define OCT_SPLIT_LEVEL			2		// Up to 8^OCT_SPLIT_LEVEL independent subtree streams per cloud
+
+// Appends one cloud to an open binary file. Returns OKAY on success, ERR otherwise.
+int encodeCloud(FILE* fptr, const PCLOUD* pc, int depth);
+
+// Reads one cloud written by encodeCloud into pc, replacing its points and growing pc as needed.
+// Returns ERR on corrupt input.
+int decodeCloud(FILE* fptr, PCLOUD* pc);
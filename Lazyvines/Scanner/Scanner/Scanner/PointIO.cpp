@@ -0,0 +1,400 @@
+/************************************************************************************************************************
+
+Point Storage: Non-interactive readers and writers for scanned data.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "Camera.h"
+#include "PointIO.h"
+#include "PointCodec.h"
+#include "Export.h"
+#include "Raster.h"
+#include "Parallel.h"
+
+#define PS_POINT_MAX			160		// Three %f of any float and a step, one per line
+
+#define PZ_VERSION				1
+
+typedef struct {
+	char magic[4];				// "SEGZ"
+	int version;
+	int cams;
+}PZ_HEADER;
+
+static int formatPoint3DPS(void* ctx, int idx, char* out){
+	const PCLOUD* pc = (const PCLOUD*)ctx;
+	return sprintf_s(out, PS_POINT_MAX, "%f\n%f\n%f\n%d\n", pc->x[idx], pc->y[idx], pc->z[idx], pc->s[idx]);
+}
+
+// Saves the 3D points of every camera into a .3dps file.
+int write3DPS(const char* fname){
+
+	FILE* dfile = NULL;
+	if (fopen_s(&dfile, fname, "w") || !dfile){
+		printf("Cannot open %s for writing. \n", fname);
+		return ERR;
+	}
+
+	int cam;
+	for (cam = 0; cam < NUM_CAMS; cam++){
+		fprintf(dfile, "%d\n", CAMS[cam].p3d.used);
+	}
+	fflush(dfile);
+
+	// Points are formatted in parallel and written in large blocks.
+	int ok = 1;
+	for (cam = 0; ok && cam < NUM_CAMS; cam++){
+		ok = writeText(dfile, CAMS[cam].p3d.used, PS_POINT_MAX, formatPoint3DPS, &CAMS[cam].p3d) == OKAY;
+	}
+
+	if (fclose(dfile) || !ok){
+		printf("Error occured while writing %s. \n", fname);
+		return ERR;
+	}
+	if (DBG_LOG) printf("Data Save Completed: %s \n", fname);
+	return OKAY;
+}
+
+/*********** TEXT PARSER ***********/
+
+#define PS_CHUNK_MIN			(1 << 20)		// Bytes
+#define PS_FIELDS				4				// x, y, z, step
+
+typedef struct {
+	const char* base;
+	long long size;
+	int chunks;
+	long long* bound;			// Chunk boundaries (chunks + 1), each at the start of a line
+	long long* first;			// Tokens per chunk, then index of each chunk's first token
+	long long points;			// Points announced by the header
+	int cam_first[NUM_CAMS + 1];
+	volatile long failed;
+}PS_JOB;
+
+static int isSpace(char c){
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// Parses a decimal float token. Up to 19 significant digits are kept and scaled once by an exact power of ten,
+// which reads the "%f" values written by write3DPS exactly as fscanf does. Returns NULL if malformed.
+static const char* parseFloat(const char* p, const char* end, float* out){
+
+	int neg = 0;
+	if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+	unsigned long long mant = 0;
+	int exp10 = 0, digits = 0, sig = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+		if (sig < 19){
+			mant = mant * 10 + (*p - '0');
+			if (mant) sig++;
+		}
+		else exp10++;
+	}
+	if (p < end && *p == '.'){
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+			if (sig < 19){
+				mant = mant * 10 + (*p - '0');
+				if (mant) sig++;
+				exp10--;
+			}
+		}
+	}
+	if (!digits) return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E')){
+		p++;
+		int eneg = 0, e = 0;
+		if (p < end && (*p == '-' || *p == '+')) eneg = (*p++ == '-');
+		if (p == end || *p < '0' || *p > '9') return NULL;
+		for (; p < end && *p >= '0' && *p <= '9'; p++) e = MIN(e * 10 + (*p - '0'), 9999);
+		exp10 += eneg ? -e : e;
+	}
+
+	// The VS runtime prints non-finite values as 1.#INF00 or -1.#IND00: load them as 0.
+	if (p < end && *p == '#'){
+		while (p < end && !isSpace(*p)) p++;
+		*out = 0;
+		return p;
+	}
+
+	double v = (double)mant;
+	if (exp10 < 0) v = (-exp10 <= 22) ? v / POW10[-exp10] : v * pow(10.0, exp10);
+	else if (exp10 > 0) v = (exp10 <= 22) ? v * POW10[exp10] : v * pow(10.0, exp10);
+	*out = (float)(neg ? -v : v);
+	return p;
+}
+
+static const char* parseInt(const char* p, const char* end, int* out){
+	int neg = 0;
+	if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+	if (p == end || *p < '0' || *p > '9') return NULL;
+	long long v = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++){
+		v = v * 10 + (*p - '0');
+		if (v > 0x80000000LL) return NULL;
+	}
+	v = neg ? -v : v;
+	if (v > 0x7FFFFFFFLL) return NULL;
+	*out = (int)v;
+	return p;
+}
+
+static void countTokens(void* ctx, int idx){
+	PS_JOB* job = (PS_JOB*)ctx;
+	const char* p = job->base + job->bound[idx];
+	const char* end = job->base + job->bound[idx + 1];
+	long long n = 0;
+	int in_token = 0;
+	for (; p < end; p++){
+		int space = isSpace(*p);
+		if (!space && !in_token) n++;
+		in_token = !space;
+	}
+	job->first[idx] = n;
+}
+
+// Token t holds field t % PS_FIELDS of point t / PS_FIELDS, counted across all cameras.
+static void parseTokens(void* ctx, int idx){
+	PS_JOB* job = (PS_JOB*)ctx;
+	const char* p = job->base + job->bound[idx];
+	const char* end = job->base + job->bound[idx + 1];
+	long long t = job->first[idx];
+	int cam = 0;
+
+	for (;;){
+		while (p < end && isSpace(*p)) p++;
+		if (p == end) break;
+		if (job->failed) return;
+
+		long long pt = t / PS_FIELDS;
+		if (pt >= job->points){ job->failed = 1; return; }
+		while (pt >= job->cam_first[cam + 1]) cam++;
+		PCLOUD* pc = &CAMS[cam].p3d;
+		int i = (int)(pt - job->cam_first[cam]);
+
+		const char* q;
+		switch (t % PS_FIELDS){
+		case 0: q = parseFloat(p, end, &pc->x[i]); break;
+		case 1: q = parseFloat(p, end, &pc->y[i]); break;
+		case 2: q = parseFloat(p, end, &pc->z[i]); break;
+		default: q = parseInt(p, end, &pc->s[i]); break;
+		}
+		if (!q || (q < end && !isSpace(*q))){ job->failed = 1; return; }
+		p = q;
+		t++;
+	}
+}
+
+// Loads the 3D points of every camera from a .3dps file. The file is mapped into memory, cut into chunks at
+// line starts and parsed in parallel; cameras grow past MAX_POINTS when the header asks for more.
+int read3DPS(const char* fname){
+
+	HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE){
+		printf("File %s does not exist. \n", fname);
+		return ERR;
+	}
+
+	PS_JOB job;
+	memset(&job, 0, sizeof(PS_JOB));
+	LARGE_INTEGER size;
+	HANDLE map = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0){
+		job.size = size.QuadPart;
+		map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map) job.base = (const char*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (!job.base){
+		printf("Cannot map %s into memory. \n", fname);
+		if (map) CloseHandle(map);
+		CloseHandle(file);
+		return ERR;
+	}
+
+	// Header: One point count per camera.
+	const char* p = job.base;
+	const char* end = job.base + job.size;
+	int cam, ok = 1;
+	for (cam = 0; ok && cam < NUM_CAMS; cam++){
+		int used = 0;
+		while (p < end && isSpace(*p)) p++;
+		p = parseInt(p, end, &used);
+		if (!p || used < 0 || job.points + used > 0x7FFFFFFFLL / PS_FIELDS || growCloud(&CAMS[cam].p3d, used) != OKAY){
+			printf("Invalid point count in %s. \n", fname);
+			ok = 0;
+			break;
+		}
+		job.cam_first[cam] = (int)job.points;
+		job.points += used;
+	}
+	job.cam_first[NUM_CAMS] = (int)job.points;
+
+	// Body: Chunks of at least PS_CHUNK_MIN bytes, a few per worker to even out the load.
+	long long body = ok ? p - job.base : 0;
+	job.chunks = (int)MAX(1, MIN((long long)numWorkers() * 4, (job.size - body) / PS_CHUNK_MIN));
+	job.bound = (long long*)malloc((job.chunks + 1) * sizeof(long long));
+	job.first = (long long*)malloc(job.chunks * sizeof(long long));
+	ok = ok && job.bound && job.first;
+
+	if (ok){
+		int c;
+		job.bound[0] = body;
+		job.bound[job.chunks] = job.size;
+		for (c = 1; c < job.chunks; c++){
+			long long b = MAX(job.bound[c - 1], body + (job.size - body) * c / job.chunks);
+			while (b < job.size && job.base[b - 1] != '\n') b++;
+			job.bound[c] = b;
+		}
+
+		parallelFor(job.chunks, countTokens, &job);
+		long long tokens = 0;
+		for (c = 0; c < job.chunks; c++){
+			long long n = job.first[c];
+			job.first[c] = tokens;
+			tokens += n;
+		}
+
+		if (tokens != job.points * PS_FIELDS){
+			printf("File %s holds %lld values, its header announces %lld. \n", fname, tokens, job.points * PS_FIELDS);
+			ok = 0;
+		}
+	}
+
+	if (ok){
+		parallelFor(job.chunks, parseTokens, &job);
+		if (job.failed){
+			printf("File %s holds malformed values. \n", fname);
+			ok = 0;
+		}
+	}
+
+	// The file holds coordinates and steps only, attributes of the points it replaces are dropped.
+	for (cam = 0; cam < NUM_CAMS; cam++){
+		CAMS[cam].p3d.used = ok ? job.cam_first[cam + 1] - job.cam_first[cam] : 0;
+		dropStreams(&CAMS[cam].p3d, PC_NORMALS | PC_ORIGIN);
+	}
+
+	free(job.bound);
+	free(job.first);
+	UnmapViewOfFile(job.base);
+	CloseHandle(map);
+	CloseHandle(file);
+	if (!ok) return ERR;
+	if (DBG_LOG) printf("File Load Completed: %s \n", fname);
+	return OKAY;
+}
+
+// Saves the 3D points of every camera into a compressed .3dpz file.
+int write3DPZ(const char* fname, int depth){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "wb") || !fptr){
+		printf("Cannot open %s for writing. \n", fname);
+		return ERR;
+	}
+
+	PZ_HEADER hdr;
+	memcpy(hdr.magic, "SEGZ", 4);
+	hdr.version = PZ_VERSION;
+	hdr.cams = NUM_CAMS;
+	int ok = fwrite(&hdr, sizeof(PZ_HEADER), 1, fptr) == 1;
+
+	int cam;
+	for (cam = 0; ok && cam < NUM_CAMS; cam++){
+		ok = encodeCloud(fptr, &CAMS[cam].p3d, depth) == OKAY;
+	}
+
+	fclose(fptr);
+	if (!ok){
+		printf("Error occured while writing %s. \n", fname);
+		return ERR;
+	}
+	if (DBG_LOG) printf("Data Save Completed: %s \n", fname);
+	return OKAY;
+}
+
+// Loads the 3D points of every camera from a compressed .3dpz file.
+int read3DPZ(const char* fname){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "rb") || !fptr){
+		printf("File %s does not exist. \n", fname);
+		return ERR;
+	}
+
+	PZ_HEADER hdr;
+	if (fread(&hdr, sizeof(PZ_HEADER), 1, fptr) != 1 || memcmp(hdr.magic, "SEGZ", 4) || hdr.version != PZ_VERSION){
+		printf("%s is not a compressed point file. \n", fname);
+		fclose(fptr);
+		return ERR;
+	}
+	if (hdr.cams != NUM_CAMS){
+		printf("%s holds %d cameras, configured for %d. \n", fname, hdr.cams, NUM_CAMS);
+		fclose(fptr);
+		return ERR;
+	}
+
+	int cam;
+	for (cam = 0; cam < NUM_CAMS; cam++){
+		dropStreams(&CAMS[cam].p3d, PC_NORMALS | PC_ORIGIN);
+		if (decodeCloud(fptr, &CAMS[cam].p3d) != OKAY){
+			printf("File %s is corrupt or exceeds CONFIG: \'MAX_POINTS\' \n", fname);
+			fclose(fptr);
+			return ERR;
+		}
+	}
+
+	fclose(fptr);
+	if (DBG_LOG) printf("File Load Completed: %s \n", fname);
+	return OKAY;
+}
+
+// Exports the 3D points of every camera to a standard format chosen by extension: .ply or .obj.
+int exportPoints(const char* fname){
+
+	PCLOUD* clouds[NUM_CAMS];
+	int cam;
+	for (cam = 0; cam < NUM_CAMS; cam++) clouds[cam] = &CAMS[cam].p3d;
+
+	size_t len = strlen(fname);
+	if (len > 4 && !_stricmp(fname + len - 4, ".ply")) return exportPointsPLY(fname, clouds, NUM_CAMS);
+	if (len > 4 && !_stricmp(fname + len - 4, ".obj")) return exportPointsOBJ(fname, clouds, NUM_CAMS);
+	printf("Unknown export format: %s \n", fname);
+	return ERR;
+}
+
+int renderPreview(const char* fname){
+
+	size_t len = strlen(fname);
+	int png = len > 4 && !_stricmp(fname + len - 4, ".png");
+	if (!png && !(len > 4 && !_stricmp(fname + len - 4, ".bmp"))){
+		printf("Unknown preview format: %s \n", fname);
+		return ERR;
+	}
+
+	RASTER r;
+	if (allocRaster(&r, PREVIEW_WIDTH, PREVIEW_HEIGHT) != OKAY) return ERR;
+	float bg[3] = { 0, 0, 0 };
+	float mv[16];
+	clearRaster(&r, bg);
+	viewMatrix(mv, TIP_DEFAULT, VIEW_DEFAULT, SCALE_BASE);
+
+	int cam, ok = 1;
+	for (cam = 0; ok && cam < NUM_CAMS; cam++){
+		ok = rasterPoints(&r, mv, &CAMS[cam].p3d, CAMS[cam].color, PREVIEW_POINT_SIZE) == OKAY;
+	}
+	if (ok) ok = (png ? writePNG(fname, &r) : writeBMP(fname, &r)) == OKAY;
+	freeRaster(&r);
+	if (ok && DBG_LOG) printf("Preview Completed: %s \n", fname);
+	return ok ? OKAY : ERR;
+}
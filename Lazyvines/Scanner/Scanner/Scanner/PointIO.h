@@ -0,0 +1,27 @@
+/************************************************************************************************************************
+
+Point Storage: Non-interactive readers and writers for scanned data.
+Used by the interactive Scanner prompts and the headless batch executable alike.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+
+// .3dps Text Format: One point count per camera, followed by x, y, z, step of every point (one value per line).
+// Both return OKAY on success, ERR otherwise. read3DPS validates the counts and grows the clouds as needed.
+int write3DPS(const char* fname);
+int read3DPS(const char* fname);
+
+// .3dpz Compressed Format: Header, then one octree-coded cloud per camera (see PointCodec.h). depth sets the
+// precision in grid bits per axis. Both return OKAY on success, ERR otherwise.
+int write3DPZ(const char* fname, int depth);
+int read3DPZ(const char* fname);
+
+// Exports every camera's points for external tools, format by extension: .ply (binary) or .obj (see Export.h).
+int exportPoints(const char* fname);
+
+// Renders every camera's points in its display colour with the illustrator's default view into a PREVIEW_WIDTH x
+// PREVIEW_HEIGHT image, format by extension: .png or .bmp (see Raster.h). Needs no display.
+int renderPreview(const char* fname);
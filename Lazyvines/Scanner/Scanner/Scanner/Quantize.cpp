@@ -0,0 +1,105 @@
+/************************************************************************************************************************
+
+Quantized Point Blocks: Compact copies of point clouds for drawing.
+
+*************************************************************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Quantize.h"
+
+int allocQCloud(QCLOUD* qc, int max){
+	memset(qc, 0, sizeof(QCLOUD));
+	qc->max = max;
+	qc->q = (short*)malloc(3 * max * sizeof(short));
+	qc->s = (QSTEP*)malloc(max * sizeof(QSTEP));
+	qc->bl = (QBLOCK*)malloc(((max + QBLOCK_POINTS - 1) / QBLOCK_POINTS) * sizeof(QBLOCK));
+	if (!qc->q || !qc->s || !qc->bl){
+		freeQCloud(qc);
+		return ERR;
+	}
+	return OKAY;
+}
+
+void freeQCloud(QCLOUD* qc){
+	free(qc->q);
+	free(qc->s);
+	free(qc->bl);
+	memset(qc, 0, sizeof(QCLOUD));
+}
+
+int quantizeBlock(QCLOUD* qc, const PCLOUD* pc, int allow_partial){
+
+	int first = qc->used;
+	int count = MIN(pc->used - first, QBLOCK_POINTS);
+	if (count <= 0 || (count < QBLOCK_POINTS && !allow_partial) || first + count > qc->max) return 0;
+
+	// Bounding Box
+	const float* src[3] = { pc->x + first, pc->y + first, pc->z + first };
+	float lo[3], hi[3];
+	int c, a;
+	for (a = 0; a < 3; a++){
+		lo[a] = hi[a] = src[a][0];
+		for (c = 1; c < count; c++){
+			lo[a] = MIN(lo[a], src[a][c]);
+			hi[a] = MAX(hi[a], src[a][c]);
+		}
+	}
+
+	QBLOCK* b = &qc->bl[qc->blocks];
+	b->first = first;
+	b->count = count;
+	for (a = 0; a < 3; a++){
+		b->center[a] = (lo[a] + hi[a]) / 2;
+		b->unit[a] = (hi[a] - lo[a]) / 2 / QRANGE;
+		if (b->unit[a] <= 0) b->unit[a] = 1.0f / QRANGE;
+	}
+
+	// Offsets from the centre, rounded to the nearest step
+	short* q = qc->q + 3 * first;
+	for (c = 0; c < count; c++){
+		for (a = 0; a < 3; a++){
+			float v = (src[a][c] - b->center[a]) / b->unit[a];
+			v = floorf(v + 0.5f);
+			*q++ = (short)MAX(-QRANGE, MIN(QRANGE, v));
+		}
+		qc->s[first + c] = (QSTEP)pc->s[first + c];
+	}
+
+	qc->blocks++;
+	qc->used += count;
+	return count;
+}
+
+// Block holding point idx: blocks are full except possibly the last one.
+static const QBLOCK* findBlock(const QCLOUD* qc, int idx){
+	return &qc->bl[idx / QBLOCK_POINTS];
+}
+
+void decodeQPoint(const QCLOUD* qc, int idx, PT3D* pt){
+	const QBLOCK* b = findBlock(qc, idx);
+	const short* q = qc->q + 3 * idx;
+	pt->x = b->center[0] + q[0] * b->unit[0];
+	pt->y = b->center[1] + q[1] * b->unit[1];
+	pt->z = b->center[2] + q[2] * b->unit[2];
+	pt->s = qc->s[idx];
+}
+
+int decodeQPoints(const QCLOUD* qc, int first, int count, PCLOUD* out){
+
+	if (first < 0 || count < 0 || first + count > qc->used || out->used + count > out->max) return ERR;
+
+	int c;
+	for (c = first; c < first + count; c++){
+		const QBLOCK* b = findBlock(qc, c);
+		const short* q = qc->q + 3 * c;
+		int o = out->used++;
+		out->x[o] = b->center[0] + q[0] * b->unit[0];
+		out->y[o] = b->center[1] + q[1] * b->unit[1];
+		out->z[o] = b->center[2] + q[2] * b->unit[2];
+		out->s[o] = qc->s[c];
+	}
+	return OKAY;
+}
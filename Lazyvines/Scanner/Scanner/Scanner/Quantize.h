@@ -0,0 +1,55 @@
+/************************************************************************************************************************
+
+Quantized Point Blocks: Compact copies of point clouds for drawing.
+Points are cut into blocks of QBLOCK_POINTS consecutive points. Each block stores its bounding box, every point
+becomes three signed 16-bit offsets from the box centre plus a QSTEP step index: 7 bytes per point instead of 16.
+The offsets are interleaved so that the GL pipeline can decode a whole block with one translate and scale, which
+halves the vertex data sent per frame, while decodeQPoints expands any range back to floats on demand.
+The blocks are a copy: the float cloud stays the storage of record, so they add memory rather than save it.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "Calibrations.h"
+#include "PointCloud.h"
+
+#define QBLOCK_POINTS			4096
+#define QRANGE					32767
+
+// Step Index: A byte is enough unless a revolution has more than 256 steps. 
+#if REV_STEPS <= 256
+typedef unsigned char QSTEP;
+#else
+typedef unsigned short QSTEP;
+#endif
+
+// Structures
+typedef struct {
+	float center[3];			// Bounding box centre
+	float unit[3];				// World size of one quantization step per axis
+	int first;					// Index of the block's first point
+	int count;
+}QBLOCK;
+
+typedef struct {
+	int used;
+	int max;
+	int blocks;
+	short* q;					// Interleaved x, y, z offsets
+	QSTEP* s;
+	QBLOCK* bl;
+}QCLOUD;
+
+// Returns OKAY on success, ERR otherwise (nothing is left allocated).
+int allocQCloud(QCLOUD* qc, int max);
+void freeQCloud(QCLOUD* qc);
+
+// Quantizes the next block of points of pc not yet held by qc (pc must only grow). Returns the number of points
+// added. Partial blocks are only taken with allow_partial, which closes the block for good.
+int quantizeBlock(QCLOUD* qc, const PCLOUD* pc, int allow_partial);
+
+// Appends points [first, first+count) to out. Returns ERR if the range is invalid or out is too small.
+int decodeQPoints(const QCLOUD* qc, int first, int count, PCLOUD* out);
+void decodeQPoint(const QCLOUD* qc, int idx, PT3D* pt);
@@ -0,0 +1,448 @@
+/************************************************************************************************************************
+
+Raster: Software point splatting for previews rendered without a GPU or a display.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Raster.h"
+#include "Parallel.h"
+#include "Codec.h"
+
+int allocRaster(RASTER* r, int width, int height){
+	memset(r, 0, sizeof(RASTER));
+	r->width = width;
+	r->height = height;
+	r->rgb = (unsigned char*)malloc(3 * (size_t)width * height);
+	r->depth = (float*)malloc((size_t)width * height * sizeof(float));
+	if (width <= 0 || height <= 0 || !r->rgb || !r->depth){
+		freeRaster(r);
+		return ERR;
+	}
+	return OKAY;
+}
+
+void freeRaster(RASTER* r){
+	free(r->rgb);
+	free(r->depth);
+	memset(r, 0, sizeof(RASTER));
+}
+
+void clearRaster(RASTER* r, const float* bg){
+	unsigned char c[3];
+	int i, n = r->width * r->height;
+	for (i = 0; i < 3; i++) c[i] = (unsigned char)(MIN(MAX(bg[i], 0.0f), 1.0f) * 255 + 0.5f);
+	for (i = 0; i < n; i++){
+		memcpy(r->rgb + 3 * i, c, 3);
+		r->depth[i] = -2.0f;
+	}
+}
+
+void viewMatrix(float* mv, float tip, float view, float zoom){
+
+	// glRotatef(tip, 1, 0, 0) * glRotatef(view, 0, 0, 1) * glScalef(zoom, zoom, zoom)
+	float ct = cosf(tip * (float)PI / 180), st = sinf(tip * (float)PI / 180);
+	float cv = cosf(view * (float)PI / 180), sv = sinf(view * (float)PI / 180);
+	memset(mv, 0, 16 * sizeof(float));
+	mv[0] = cv * zoom;
+	mv[1] = ct * sv * zoom;
+	mv[2] = st * sv * zoom;
+	mv[4] = -sv * zoom;
+	mv[5] = ct * cv * zoom;
+	mv[6] = st * cv * zoom;
+	mv[9] = -st * zoom;
+	mv[10] = ct * zoom;
+	mv[15] = 1;
+}
+
+/*********** SPLATTING ***********/
+
+typedef struct {
+	short x;					// Square corner in image pixels (top row 0)
+	short y;
+	float z;					// View depth, SPLAT_CLIPPED if the point is not drawn
+}SPLAT;
+
+#define SPLAT_CLIPPED			-2.0f
+
+static int floorInt(float v){
+	int i = (int)v;
+	return (i > v) ? i - 1 : i;
+}
+
+typedef struct {
+	RASTER* r;
+	const float* mv;
+	const PCLOUD* pc;
+	unsigned char color[3];
+	int size;
+	int tiles_x;
+	int tiles;
+	int chunks;
+	SPLAT* sp;					// One per point
+	int* bin_count;				// [chunk * tiles + tile], turned into write offsets by the prefix sum
+	int* bin_first;				// Start of every tile's bin (tiles + 1 entries)
+	SPLAT* bins;				// Copies of the splats touching each tile, each bin in point order
+}SPLAT_JOB;
+
+static void transformChunk(void* prm, int idx){
+	SPLAT_JOB* job = (SPLAT_JOB*)prm;
+	const PCLOUD* pc = job->pc;
+	const float* mv = job->mv;
+	int first = idx * RASTER_CHUNK;
+	int last = MIN(first + RASTER_CHUNK, pc->used);
+	int* count = job->bin_count + idx * job->tiles;
+	float half = job->size * 0.5f;
+	int i;
+	memset(count, 0, job->tiles * sizeof(int));
+	for (i = first; i < last; i++){
+		float x = pc->x[i], y = pc->y[i], z = pc->z[i];
+		float ex = mv[0] * x + mv[4] * y + mv[8] * z + mv[12];
+		float ey = mv[1] * x + mv[5] * y + mv[9] * z + mv[13];
+		float ez = mv[2] * x + mv[6] * y + mv[10] * z + mv[14];
+		job->sp[i].z = SPLAT_CLIPPED;
+		if (ex < -1 || ex > 1 || ey < -1 || ey > 1 || ez < -1 || ez > 1) continue;
+
+		// Window coordinates as GL maps the viewport, then the square of pixel centres the point covers.
+		float wx = (ex + 1) * 0.5f * job->r->width;
+		float wy = (1 - ey) * 0.5f * job->r->height;
+		int x0 = floorInt(wx - half + 0.5f);
+		int y0 = floorInt(wy - half + 0.5f);
+		if (x0 + job->size <= 0 || y0 + job->size <= 0 || x0 >= job->r->width || y0 >= job->r->height) continue;
+		job->sp[i].x = (short)x0;
+		job->sp[i].y = (short)y0;
+		job->sp[i].z = ez;
+
+		int tx0 = MAX(x0, 0) / RASTER_TILE, tx1 = MIN(x0 + job->size - 1, job->r->width - 1) / RASTER_TILE;
+		int ty0 = MAX(y0, 0) / RASTER_TILE, ty1 = MIN(y0 + job->size - 1, job->r->height - 1) / RASTER_TILE;
+		int tx, ty;
+		for (ty = ty0; ty <= ty1; ty++){
+			for (tx = tx0; tx <= tx1; tx++) count[ty * job->tiles_x + tx]++;
+		}
+	}
+}
+
+static void binChunk(void* prm, int idx){
+	SPLAT_JOB* job = (SPLAT_JOB*)prm;
+	int first = idx * RASTER_CHUNK;
+	int last = MIN(first + RASTER_CHUNK, job->pc->used);
+	int* offset = job->bin_count + idx * job->tiles;
+	int i;
+	for (i = first; i < last; i++){
+		const SPLAT* sp = &job->sp[i];
+		if (sp->z == SPLAT_CLIPPED) continue;
+		int x0 = sp->x, y0 = sp->y;
+		int tx0 = MAX(x0, 0) / RASTER_TILE, tx1 = MIN(x0 + job->size - 1, job->r->width - 1) / RASTER_TILE;
+		int ty0 = MAX(y0, 0) / RASTER_TILE, ty1 = MIN(y0 + job->size - 1, job->r->height - 1) / RASTER_TILE;
+		int tx, ty;
+		for (ty = ty0; ty <= ty1; ty++){
+			for (tx = tx0; tx <= tx1; tx++) job->bins[offset[ty * job->tiles_x + tx]++] = *sp;
+		}
+	}
+}
+
+static void drawTile(void* prm, int tile){
+	SPLAT_JOB* job = (SPLAT_JOB*)prm;
+	RASTER* r = job->r;
+	int tx_lo = (tile % job->tiles_x) * RASTER_TILE, ty_lo = (tile / job->tiles_x) * RASTER_TILE;
+	int tx_hi = MIN(tx_lo + RASTER_TILE, r->width), ty_hi = MIN(ty_lo + RASTER_TILE, r->height);
+	int b;
+	for (b = job->bin_first[tile]; b < job->bin_first[tile + 1]; b++){
+		const SPLAT* sp = &job->bins[b];
+		int x0 = MAX(sp->x, tx_lo), x1 = MIN(sp->x + job->size, tx_hi);
+		int y0 = MAX(sp->y, ty_lo), y1 = MIN(sp->y + job->size, ty_hi);
+		float z = sp->z;
+		int x, y;
+		for (y = y0; y < y1; y++){
+			float* depth = r->depth + y * r->width;
+			unsigned char* rgb = r->rgb + 3 * y * r->width;
+			for (x = x0; x < x1; x++){
+				if (z <= depth[x]) continue;
+				depth[x] = z;
+				rgb[3 * x + 0] = job->color[0];
+				rgb[3 * x + 1] = job->color[1];
+				rgb[3 * x + 2] = job->color[2];
+			}
+		}
+	}
+}
+
+int rasterPoints(RASTER* r, const float* mv, const PCLOUD* pc, const float* color, int size){
+
+	if (pc->used <= 0) return OKAY;
+
+	SPLAT_JOB job;
+	memset(&job, 0, sizeof(SPLAT_JOB));
+	job.r = r;
+	job.mv = mv;
+	job.pc = pc;
+	job.size = MIN(MAX(size, 1), RASTER_TILE);
+	int c;
+	for (c = 0; c < 3; c++) job.color[c] = (unsigned char)(MIN(MAX(color[c], 0.0f), 1.0f) * 255 + 0.5f);
+	job.tiles_x = (r->width + RASTER_TILE - 1) / RASTER_TILE;
+	job.tiles = job.tiles_x * ((r->height + RASTER_TILE - 1) / RASTER_TILE);
+	job.chunks = (pc->used + RASTER_CHUNK - 1) / RASTER_CHUNK;
+	job.sp = (SPLAT*)malloc(pc->used * sizeof(SPLAT));
+	job.bin_count = (int*)malloc((size_t)job.chunks * job.tiles * sizeof(int));
+	job.bin_first = (int*)malloc((job.tiles + 1) * sizeof(int));
+	int ok = job.sp && job.bin_count && job.bin_first;
+
+	if (ok){
+		parallelFor(job.chunks, transformChunk, &job);
+
+		// Prefix Sum: Bins are laid out tile by tile, each tile's entries chunk by chunk, so that scattering
+		// keeps every bin in point order.
+		int t, sum = 0;
+		for (t = 0; t < job.tiles; t++){
+			job.bin_first[t] = sum;
+			for (c = 0; c < job.chunks; c++){
+				int n = job.bin_count[c * job.tiles + t];
+				job.bin_count[c * job.tiles + t] = sum;
+				sum += n;
+			}
+		}
+		job.bin_first[job.tiles] = sum;
+		job.bins = (SPLAT*)malloc(MAX(sum, 1) * sizeof(SPLAT));
+		ok = job.bins != NULL;
+	}
+	if (ok){
+		parallelFor(job.chunks, binChunk, &job);
+		parallelFor(job.tiles, drawTile, &job);
+	}
+
+	free(job.sp);
+	free(job.bin_count);
+	free(job.bin_first);
+	free(job.bins);
+	return ok ? OKAY : ERR;
+}
+
+/*********** BMP ***********/
+
+static void putLE(unsigned char* p, unsigned int v, int bytes){
+	int i;
+	for (i = 0; i < bytes; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+int writeBMP(const char* fname, const RASTER* r){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "wb") || !fptr){
+		printf("Cannot open %s for writing. \n", fname);
+		return ERR;
+	}
+
+	// 24-bit BGR rows, bottom row first, padded to 4 bytes.
+	int stride = (3 * r->width + 3) / 4 * 4;
+	unsigned char header[54];
+	memset(header, 0, sizeof(header));
+	header[0] = 'B';
+	header[1] = 'M';
+	putLE(header + 2, 54 + stride * r->height, 4);
+	putLE(header + 10, 54, 4);
+	putLE(header + 14, 40, 4);
+	putLE(header + 18, r->width, 4);
+	putLE(header + 22, r->height, 4);
+	putLE(header + 26, 1, 2);
+	putLE(header + 28, 24, 2);
+	putLE(header + 34, stride * r->height, 4);
+	int ok = fwrite(header, 1, 54, fptr) == 54;
+
+	unsigned char* row = (unsigned char*)calloc(stride, 1);
+	ok = ok && row;
+	int x, y;
+	for (y = r->height - 1; ok && y >= 0; y--){
+		const unsigned char* src = r->rgb + 3 * y * r->width;
+		for (x = 0; x < r->width; x++){
+			row[3 * x + 0] = src[3 * x + 2];
+			row[3 * x + 1] = src[3 * x + 1];
+			row[3 * x + 2] = src[3 * x + 0];
+		}
+		ok = fwrite(row, 1, stride, fptr) == (size_t)stride;
+	}
+	free(row);
+	if (fclose(fptr)) ok = 0;
+	if (!ok) printf("Error occured while writing %s. \n", fname);
+	return ok ? OKAY : ERR;
+}
+
+/*********** PNG ***********/
+
+// Deflate: One block of fixed Huffman codes with greedy LZ77 matching. Previews are mostly background, which
+// this squeezes well without the code tables of a full encoder.
+#define DEFL_WINDOW				32768
+#define DEFL_HASH_BITS			15
+#define DEFL_MAX_MATCH			258
+
+static const unsigned short LEN_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+	67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char LEN_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+	5, 5, 5, 5, 0 };
+static const unsigned short DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+	513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+	10, 11, 11, 12, 12, 13, 13 };
+
+typedef struct {
+	unsigned char* out;
+	int n;
+	unsigned int bits;
+	int nbits;
+}BIT_WRITER;
+
+static void putBits(BIT_WRITER* w, unsigned int v, int n){
+	w->bits |= v << w->nbits;
+	w->nbits += n;
+	while (w->nbits >= 8){
+		w->out[w->n++] = (unsigned char)w->bits;
+		w->bits >>= 8;
+		w->nbits -= 8;
+	}
+}
+
+// Huffman codes go out most significant bit first.
+static void putCode(BIT_WRITER* w, unsigned int code, int n){
+	unsigned int rev = 0;
+	int i;
+	for (i = 0; i < n; i++) rev |= ((code >> i) & 1) << (n - 1 - i);
+	putBits(w, rev, n);
+}
+
+static void putSymbol(BIT_WRITER* w, int sym){
+	if (sym < 144) putCode(w, 0x30 + sym, 8);
+	else if (sym < 256) putCode(w, 0x190 + sym - 144, 9);
+	else if (sym < 280) putCode(w, sym - 256, 7);
+	else putCode(w, 0xC0 + sym - 280, 8);
+}
+
+static void putMatch(BIT_WRITER* w, int len, int dist){
+	int c = 28;
+	while (LEN_BASE[c] > len) c--;
+	putSymbol(w, 257 + c);
+	putBits(w, len - LEN_BASE[c], LEN_EXTRA[c]);
+	c = 29;
+	while (DIST_BASE[c] > dist) c--;
+	putCode(w, c, 5);
+	putBits(w, dist - DIST_BASE[c], DIST_EXTRA[c]);
+}
+
+// zlib stream of src into out (at least n + n / 8 + 64 bytes). Returns its length or UNINIT if out of memory.
+static int zlibCompress(const unsigned char* src, int n, unsigned char* out){
+
+	int* head = (int*)malloc((1 << DEFL_HASH_BITS) * sizeof(int));
+	if (!head) return UNINIT;
+	int i;
+	for (i = 0; i < (1 << DEFL_HASH_BITS); i++) head[i] = UNINIT;
+
+	BIT_WRITER w;
+	w.out = out;
+	w.n = 0;
+	w.bits = 0;
+	w.nbits = 0;
+	putBits(&w, 0x78, 8);
+	putBits(&w, 0x01, 8);
+	putBits(&w, 1, 1);			// Final block
+	putBits(&w, 1, 2);			// Fixed Huffman codes
+
+	i = 0;
+	while (i < n){
+		int len = 0, dist = 0;
+		if (i + 3 <= n){
+			unsigned int h = ((src[i] << 16) | (src[i + 1] << 8) | src[i + 2]) * 2654435761U >> (32 - DEFL_HASH_BITS);
+			int cand = head[h];
+			head[h] = i;
+			if (cand != UNINIT && i - cand <= DEFL_WINDOW){
+				int max = MIN(DEFL_MAX_MATCH, n - i);
+				while (len < max && src[cand + len] == src[i + len]) len++;
+				dist = i - cand;
+			}
+		}
+		if (len < 3){
+			putSymbol(&w, src[i]);
+			i++;
+			continue;
+		}
+		putMatch(&w, len, dist);
+
+		// Keep the hash current over the match so that runs chain into each other.
+		int end = i + len;
+		for (i++; i < end && i + 3 <= n; i++){
+			head[((src[i] << 16) | (src[i + 1] << 8) | src[i + 2]) * 2654435761U >> (32 - DEFL_HASH_BITS)] = i;
+		}
+		i = end;
+	}
+	putSymbol(&w, 256);
+	if (w.nbits) putBits(&w, 0, 8 - w.nbits);
+	free(head);
+
+	// Adler-32, big-endian
+	unsigned int a = 1, b = 0;
+	for (i = 0; i < n; i++){
+		a = (a + src[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	unsigned int adler = (b << 16) | a;
+	for (i = 3; i >= 0; i--) out[w.n++] = (unsigned char)(adler >> (8 * i));
+	return w.n;
+}
+
+static int putChunk(FILE* fptr, const char* type, const unsigned char* data, int n){
+	unsigned char len[4] = { (unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n };
+	unsigned int crc = crc32(crc32(0, type, 4), data, n);
+	unsigned char crc_be[4] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc };
+	return fwrite(len, 1, 4, fptr) == 4 && fwrite(type, 1, 4, fptr) == 4 &&
+		(!n || fwrite(data, 1, n, fptr) == (size_t)n) && fwrite(crc_be, 1, 4, fptr) == 4;
+}
+
+int writePNG(const char* fname, const RASTER* r){
+
+	// Scanlines: filter type 0 (none), then the RGB row.
+	int stride = 1 + 3 * r->width;
+	int raw_size = stride * r->height;
+	unsigned char* raw = (unsigned char*)malloc(raw_size);
+	unsigned char* z = (unsigned char*)malloc(raw_size + raw_size / 8 + 64);
+	if (!raw || !z){
+		free(raw);
+		free(z);
+		return ERR;
+	}
+	int y;
+	for (y = 0; y < r->height; y++){
+		raw[y * stride] = 0;
+		memcpy(raw + y * stride + 1, r->rgb + 3 * y * r->width, 3 * r->width);
+	}
+	int zn = zlibCompress(raw, raw_size, z);
+	free(raw);
+
+	FILE* fptr = NULL;
+	if (zn < 0 || fopen_s(&fptr, fname, "wb") || !fptr){
+		printf("Cannot open %s for writing. \n", fname);
+		free(z);
+		return ERR;
+	}
+
+	static const unsigned char SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	unsigned char ihdr[13];
+	ihdr[0] = (unsigned char)(r->width >> 24);
+	ihdr[1] = (unsigned char)(r->width >> 16);
+	ihdr[2] = (unsigned char)(r->width >> 8);
+	ihdr[3] = (unsigned char)r->width;
+	ihdr[4] = (unsigned char)(r->height >> 24);
+	ihdr[5] = (unsigned char)(r->height >> 16);
+	ihdr[6] = (unsigned char)(r->height >> 8);
+	ihdr[7] = (unsigned char)r->height;
+	ihdr[8] = 8;				// Bit depth
+	ihdr[9] = 2;				// RGB
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	int ok = fwrite(SIGNATURE, 1, 8, fptr) == 8 && putChunk(fptr, "IHDR", ihdr, 13) &&
+		putChunk(fptr, "IDAT", z, zn) && putChunk(fptr, "IEND", NULL, 0);
+	free(z);
+	if (fclose(fptr)) ok = 0;
+	if (!ok) printf("Error occured while writing %s. \n", fname);
+	return ok ? OKAY : ERR;
+}
@@ -0,0 +1,44 @@
+/************************************************************************************************************************
+
+Raster: Software point splatting for previews rendered without a GPU or a display.
+Points are drawn as size x size squares into an RGB image with a depth buffer, using the illustrator's view:
+tip about x, then view about z, then a uniform zoom, projected orthographically with the [-1,1] cube filling the
+image. Points outside the cube are clipped as GL would, the point nearest the viewer (largest view z) wins.
+
+The image is cut into RASTER_TILE x RASTER_TILE tiles. Points are transformed and binned by tile in parallel,
+then every tile is rasterized by one thread on its own, so no two threads ever write the same pixel.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include "Config.h"
+#include "PointCloud.h"
+
+#define RASTER_TILE				64			// Tile edge in pixels; point sizes are clamped to it
+#define RASTER_CHUNK			65536		// Points per parallel transform and binning task
+
+// Structures
+typedef struct {
+	int width;
+	int height;
+	unsigned char* rgb;			// Top row first, 3 bytes per pixel
+	float* depth;
+}RASTER;
+
+// Returns OKAY on success, ERR otherwise (nothing is left allocated).
+int allocRaster(RASTER* r, int width, int height);
+void freeRaster(RASTER* r);
+
+// Fills the image with bg (RGB in [0,1]) and resets the depth buffer.
+void clearRaster(RASTER* r, const float* bg);
+
+// Column-major modelview matrix of the illustrator's view (angles in degrees).
+void viewMatrix(float* mv, float tip, float view, float zoom);
+
+// Splats every point of pc in color (RGB in [0,1]). Returns ERR if out of memory.
+int rasterPoints(RASTER* r, const float* mv, const PCLOUD* pc, const float* color, int size);
+
+// Image Files: Both return OKAY on success, ERR otherwise.
+int writeBMP(const char* fname, const RASTER* r);
+int writePNG(const char* fname, const RASTER* r);
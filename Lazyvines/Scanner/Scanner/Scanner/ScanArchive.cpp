@@ -0,0 +1,195 @@
+/************************************************************************************************************************
+
+Scan Archive: Stores every raw frame of a scan in one compressed file (.scan) for later reprocessing.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "ScanArchive.h"
+
+#define ARC_VERSION				1
+#define ARC_RECORD_MAGIC		0x4D415246		// "FRAM"
+
+// Whether a payload of csize bytes can hold a frame stored by method.
+static int validPayload(int method, int csize){
+	if (method == ARC_RAW) return csize == ARCHIVE_FRAME_BYTES;
+	if (method == ARC_LZ) return csize >= 0 && csize <= ARCHIVE_SCRATCH_BYTES;
+	return 0;
+}
+
+static SCAN_ARCHIVE* allocArchive(FILE* fptr, int cams, int steps){
+	SCAN_ARCHIVE* arc = (SCAN_ARCHIVE*)calloc(1, sizeof(SCAN_ARCHIVE));
+	arc->index = (ARC_ENTRY*)calloc(cams * steps, sizeof(ARC_ENTRY));
+	if (!arc->index){ errorExit("Cannot allocate scan archive index"); }
+	arc->fptr = fptr;
+	InitializeCriticalSection(&arc->lock);
+	return arc;
+}
+
+// Creates an empty archive for cams x steps frames.
+SCAN_ARCHIVE* createScanArchive(const char* fname, int cams, int steps){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "wb") || !fptr){
+		printf("Cannot create scan archive %s. \n", fname);
+		return NULL;
+	}
+
+	SCAN_ARCHIVE* arc = allocArchive(fptr, cams, steps);
+	arc->writing = 1;
+	memcpy(arc->hdr.magic, "SEGA", 4);
+	arc->hdr.version = ARC_VERSION;
+	arc->hdr.width = WIDTH;
+	arc->hdr.height = HEIGHT;
+	arc->hdr.cams = cams;
+	arc->hdr.steps = steps;
+	arc->hdr.index_offset = 0;
+
+	fwrite(&arc->hdr, sizeof(ARC_HEADER), 1, fptr);
+	fflush(fptr);
+	arc->end = sizeof(ARC_HEADER);
+	return arc;
+}
+
+// Recovers the index of an archive that was not closed by walking its frame records.
+static void rebuildIndex(SCAN_ARCHIVE* arc){
+	ARC_RECORD rec;
+	long long pos = sizeof(ARC_HEADER);
+	_fseeki64(arc->fptr, pos, SEEK_SET);
+
+	while (fread(&rec, sizeof(ARC_RECORD), 1, arc->fptr) == 1 && rec.magic == ARC_RECORD_MAGIC){
+		if (rec.cam < 0 || rec.cam >= arc->hdr.cams || rec.step < 0 || rec.step >= arc->hdr.steps || !validPayload(rec.method, rec.csize)) break;
+		pos += sizeof(ARC_RECORD);
+		if (_fseeki64(arc->fptr, rec.csize, SEEK_CUR)) break;
+
+		ARC_ENTRY* e = &arc->index[rec.cam * arc->hdr.steps + rec.step];
+		e->offset = pos;
+		e->csize = rec.csize;
+		e->method = rec.method;
+		pos += rec.csize;
+	}
+
+	// Drop a torn last record.
+	_fseeki64(arc->fptr, 0, SEEK_END);
+	long long size = _ftelli64(arc->fptr);
+	int i;
+	for (i = 0; i < arc->hdr.cams * arc->hdr.steps; i++){
+		if (arc->index[i].method != ARC_EMPTY && arc->index[i].offset + arc->index[i].csize > size) arc->index[i].method = ARC_EMPTY;
+	}
+	if (DBG_LOG) printf("Scan archive index rebuilt from frame records. \n");
+}
+
+// Opens an archive for reading.
+SCAN_ARCHIVE* openScanArchive(const char* fname){
+
+	FILE* fptr = NULL;
+	if (fopen_s(&fptr, fname, "rb") || !fptr){
+		printf("Scan archive %s does not exist. \n", fname);
+		return NULL;
+	}
+
+	ARC_HEADER hdr;
+	if (fread(&hdr, sizeof(ARC_HEADER), 1, fptr) != 1 || memcmp(hdr.magic, "SEGA", 4) || hdr.version != ARC_VERSION){
+		printf("%s is not a scan archive. \n", fname);
+		fclose(fptr);
+		return NULL;
+	}
+	if (hdr.width != WIDTH || hdr.height != HEIGHT || hdr.cams <= 0 || hdr.steps <= 0){
+		printf("Scan archive %s is inconsistent with calibration settings. \n", fname);
+		fclose(fptr);
+		return NULL;
+	}
+
+	SCAN_ARCHIVE* arc = allocArchive(fptr, hdr.cams, hdr.steps);
+	arc->hdr = hdr;
+
+	if (hdr.index_offset){
+		_fseeki64(fptr, hdr.index_offset, SEEK_SET);
+		if (fread(arc->index, sizeof(ARC_ENTRY), hdr.cams * hdr.steps, fptr) != (size_t)(hdr.cams * hdr.steps)){
+			memset(arc->index, 0, hdr.cams * hdr.steps * sizeof(ARC_ENTRY));
+			rebuildIndex(arc);
+		}
+	}
+	else {
+		rebuildIndex(arc);
+	}
+	return arc;
+}
+
+// Compresses one frame outside the lock, then appends its record under the lock.
+int appendArchiveFrame(SCAN_ARCHIVE* arc, int cam, int step, const unsigned char* frame, unsigned char* scratch){
+
+	if (!arc->writing || cam < 0 || cam >= arc->hdr.cams || step < 0 || step >= arc->hdr.steps) return ERR;
+
+	ARC_RECORD rec;
+	rec.magic = ARC_RECORD_MAGIC;
+	rec.cam = (short)cam;
+	rec.step = (short)step;
+	rec.csize = lzCompress(frame, ARCHIVE_FRAME_BYTES, scratch);
+	rec.method = ARC_LZ;
+
+	// Incompressible frames are stored as they are.
+	const unsigned char* payload = scratch;
+	if (rec.csize >= ARCHIVE_FRAME_BYTES){
+		rec.csize = ARCHIVE_FRAME_BYTES;
+		rec.method = ARC_RAW;
+		payload = frame;
+	}
+
+	EnterCriticalSection(&arc->lock);
+	int ok = fwrite(&rec, sizeof(ARC_RECORD), 1, arc->fptr) == 1 && fwrite(payload, 1, rec.csize, arc->fptr) == (size_t)rec.csize;
+	if (ok){
+		ARC_ENTRY* e = &arc->index[cam * arc->hdr.steps + step];
+		e->offset = arc->end + sizeof(ARC_RECORD);
+		e->csize = rec.csize;
+		e->method = rec.method;
+		arc->end += sizeof(ARC_RECORD) + rec.csize;
+	}
+	LeaveCriticalSection(&arc->lock);
+
+	return ok ? OKAY : ERR;
+}
+
+// Reads one frame under the lock, then decompresses it outside the lock straight into the frame buffer.
+int readArchiveFrame(SCAN_ARCHIVE* arc, int cam, int step, unsigned char* frame, unsigned char* scratch){
+
+	if (cam < 0 || cam >= arc->hdr.cams || step < 0 || step >= arc->hdr.steps) return ERR;
+	ARC_ENTRY e = arc->index[cam * arc->hdr.steps + step];
+	if (!validPayload(e.method, e.csize)) return ERR;
+
+	unsigned char* dst = (e.method == ARC_RAW) ? frame : scratch;
+	EnterCriticalSection(&arc->lock);
+	int ok = !_fseeki64(arc->fptr, e.offset, SEEK_SET) && fread(dst, 1, e.csize, arc->fptr) == (size_t)e.csize;
+	LeaveCriticalSection(&arc->lock);
+	if (!ok) return ERR;
+
+	if (e.method == ARC_LZ && lzDecompress(scratch, e.csize, frame, ARCHIVE_FRAME_BYTES) != ARCHIVE_FRAME_BYTES) return ERR;
+	return OKAY;
+}
+
+int archiveHasStep(const SCAN_ARCHIVE* arc, int step){
+	if (step < 0 || step >= arc->hdr.steps) return 0;
+	int cam;
+	for (cam = 0; cam < arc->hdr.cams; cam++){
+		if (arc->index[cam * arc->hdr.steps + step].method == ARC_EMPTY) return 0;
+	}
+	return 1;
+}
+
+void closeScanArchive(SCAN_ARCHIVE* arc){
+	if (!arc) return;
+	if (arc->writing){
+		arc->hdr.index_offset = arc->end;
+		fwrite(arc->index, sizeof(ARC_ENTRY), arc->hdr.cams * arc->hdr.steps, arc->fptr);
+		_fseeki64(arc->fptr, 0, SEEK_SET);
+		fwrite(&arc->hdr, sizeof(ARC_HEADER), 1, arc->fptr);
+	}
+	fclose(arc->fptr);
+	DeleteCriticalSection(&arc->lock);
+	free(arc->index);
+	free(arc);
+}
@@ -0,0 +1,76 @@
+/************************************************************************************************************************
+
+Scan Archive: Stores every raw frame of a scan in one compressed file (.scan) for later reprocessing.
+Frames are compressed independently and indexed by (camera, step), so any frame can be read back directly.
+
+File Layout:	ARC_HEADER | ARC_RECORD + payload (per frame, in arrival order) | ARC_ENTRY index (cams x steps)
+An archive that was never closed has no index; openScanArchive then rebuilds it from the frame records.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "Config.h"
+#include "Calibrations.h"
+#include "Codec.h"
+
+// Frame Sizes
+#define ARCHIVE_FRAME_BYTES		(WIDTH * HEIGHT * 3)
+#define ARCHIVE_SCRATCH_BYTES	LZ_BOUND(ARCHIVE_FRAME_BYTES)
+
+// Frame Payload Encodings
+#define ARC_EMPTY				0
+#define ARC_RAW					1
+#define ARC_LZ					2
+
+// Structures
+typedef struct {
+	char magic[4];				// "SEGA"
+	int version;
+	int width;
+	int height;
+	int cams;
+	int steps;
+	long long index_offset;		// 0 until the archive is closed
+}ARC_HEADER;
+
+typedef struct {
+	unsigned int magic;			// ARC_RECORD_MAGIC
+	short cam;
+	short step;
+	int csize;
+	int method;
+}ARC_RECORD;
+
+typedef struct {
+	long long offset;			// Payload offset
+	int csize;
+	int method;
+}ARC_ENTRY;
+
+typedef struct {
+	FILE* fptr;
+	int writing;
+	ARC_HEADER hdr;
+	ARC_ENTRY* index;
+	long long end;
+	CRITICAL_SECTION lock;
+}SCAN_ARCHIVE;
+
+// Returns NULL if the file cannot be created / opened.
+SCAN_ARCHIVE* createScanArchive(const char* fname, int cams, int steps);
+SCAN_ARCHIVE* openScanArchive(const char* fname);
+
+// Frames are unpadded WIDTH x HEIGHT BGR image bodies, as held in CAMERA::frame. scratch: ARCHIVE_SCRATCH_BYTES.
+// Safe to call concurrently from the camera workers. Both return OKAY on success, ERR otherwise.
+int appendArchiveFrame(SCAN_ARCHIVE* arc, int cam, int step, const unsigned char* frame, unsigned char* scratch);
+int readArchiveFrame(SCAN_ARCHIVE* arc, int cam, int step, unsigned char* frame, unsigned char* scratch);
+
+// Whether every camera's frame of step is stored. Scans stopped early, or taken out of sequence, leave gaps.
+int archiveHasStep(const SCAN_ARCHIVE* arc, int step);
+
+// Writes the index (when writing) and releases the archive.
+void closeScanArchive(SCAN_ARCHIVE* arc);
@@ -7,6 +7,15 @@ S. Yang, E. Miao, G. Guan.
 This program is the main executable for the 3D Scanner Project. Includes:
 * Config.h:			Software configurations, toggle output messages, user interfaces. etc.
 * Calibration.h:	Hardware configurations and calibration data. Image resolutions, ports. etc. 
+* Camera.h:			Camera array. Per-camera calibration, buffers, extractor, mapper and worker threads. 
+* StepOrder.h:		Sequential or progressive order of the steps taken in a turn. 
+* Align.h:			ICP refinement of the cameras' relative pose. 
+* Merge.h:			Spatial hash fusion of the cameras' clouds. 
+* Normals.h:			Per point normals from the scan lattice or fitted planes. 
+* Tsdf.h:			Volumetric fusion of the scanned steps into one mesh. 
+* Decimate.h:		Quadric error simplification of the fused mesh. 
+* PointIO.h:		Non-interactive readers and writers of scanned data. 
+* Quantize.h:		16-bit point blocks the illustrator draws from. 
 
 *************************************************************************************************************************/
 
@@ -20,6 +29,7 @@ This program is the main executable for the 3D Scanner Project. Includes:
 #include <windows.h>
 #include <math.h>
 #include <process.h>
+#include <conio.h>
 
 // Include Graphical Support Libraries
 #include <GL/glew.h>
@@ -28,21 +38,27 @@ This program is the main executable for the 3D Scanner Project. Includes:
 // Include Support Headers and Functions
 #include "Config.h"
 #include "Calibrations.h"
+#include "Camera.h"
+#include "StepOrder.h"
+#include "Align.h"
+#include "Merge.h"
+#include "Normals.h"
+#include "Tsdf.h"
+#include "Decimate.h"
+#include "Export.h"
+#include "PointIO.h"
+#include "Quantize.h"
+#include "LodOctree.h"
+#include "PointCodec.h"
 
 /********************************************** Global Variables **********************************************/
 float tip_angle  =	TIP_DEFAULT;
 float view_angle =	VIEW_DEFAULT;
 float zoomfactor =  SCALE_BASE;
 double xc, yc;
-int DISP_A = 1; 
-int DISP_B = 1; 
 
 int LOAD_MODE = 0;
-double FPS = 0; 
-
-CAM_CB CB_A, CB_B; 
-PIXELS PX_A, PX_B; 
-PT3DS P3D_A, P3D_B;
+TSDF* FUSION = NULL; 
 
 /********************************************** Basic Functions **********************************************/
 
@@ -57,238 +73,89 @@ void errorExit(const char* prompt){
 // Rotates the Motorized Dish for Constant Angular Slices
 // Takes picture(s) and stores it in image directory(s) 
 
+// Waits for the Arduino to acknowledge the last command, up to MOTOR_TIMEOUT_MS. 
+void waitMotor(HANDLE hSerial){
+	unsigned long start = GetTickCount(); 
+	unsigned long got; 
+	char ack; 
+	while (GetTickCount() - start < MOTOR_TIMEOUT_MS){
+		if (!ReadFile(hSerial, &ack, 1, &got, NULL)) break; 
+		if (got != 1) continue; 
+		if (ack != '0') errorExit("Arduino rejected the motor command."); 
+		return; 
+	}
+	errorExit("Arduino did not acknowledge the motor command.");
+}
+
+// Sends a command followed by a step (low byte first) to the Arduino and waits until it is done. 
+// Acknowledgements of earlier moves nobody waited for are dropped first. 
+void motorCommand(HANDLE hSerial, char cmd, int step){
+	char msg[3] = { cmd, (char)(step & 0xFF), (char)(step >> 8) }; 
+	PurgeComm(hSerial, PURGE_RXCLEAR); 
+	if (!WriteFile(hSerial, msg, 3, NULL, NULL)){
+		errorExit("Error sending motor command to Arduino.");
+	}
+	waitMotor(hSerial); 
+}
+
 // Initializes the framer function. 
-void framer(int step_count, HANDLE hSerial){
+// Step s is captured with the disk s + 1 moves on from where the scan started. total_moves counts the moves as if 
+// all were forward, so the disk stands at total_moves % REV_STEPS. 
+void framer(int step_count, HANDLE hSerial, int* total_moves){
 
 	// Capture and Store Images 
 	// TODO: Alter Open-source code to make picture capture go faster for our application. 
-	char    cmd1[CMD_MAXLEN] = "";
-	char    cmd2[CMD_MAXLEN] = "";
-	char    buffer[ANG_STRD_DIGIT];
-	char*   cmd_prefix_1 = "CommCam /devnum 1 /filename Images_A\\";
-	char*   cmd_prefix_2 = "CommCam /devnum 2 /filename Images_B\\";
+	char    cmd[CMD_MAXLEN] = "";
+	char*   cmd_prefix = "CommCam /devnum %d /filename %s\\%d";
 	char*   cmd_postfix = ".bmp 2> nul";
 
-	// Rotates the object disk. 
+	// Rotates the object disk: one move per step in sequence, more to catch up when resuming an interrupted scan, 
+	// which the disk must have finished before the capture. Steps out of sequence take one absolute move. 
 	if (DBG_LOG) printf("Rotating Disk %d/%d... \n", step_count, REV_STEPS);
-	char MOTOR_MV_CMD = '1';
-	if (!WriteFile(hSerial, &MOTOR_MV_CMD, 1, NULL, NULL)){
-		errorExit("Error sending motor move command to Arduino.");
-	}
-
-	// Takes a picture of the object. 
-	sprintf_s(buffer, "%d", step_count);
-	cmd1[0] = '\0';
-	cmd2[0] = '\0';
-	strcat_s(cmd1, cmd_prefix_1);
-	strcat_s(cmd2, cmd_prefix_2);
-	strcat_s(cmd1, buffer);
-	strcat_s(cmd2, buffer);
-	strcat_s(cmd1, cmd_postfix);
-	strcat_s(cmd2, cmd_postfix);
-
-	// Calling CommandCam Application
-	if (DBG_LOG) printf("Calling: %s\n", cmd1);
-	system(cmd1);
-	if (DBG_LOG) printf("Calling: %s\n", cmd2);
-	system(cmd2);
-}
-
-/********************************************** EXTRACTOR **********************************************/
-
-// Extraction of 2D Points from BMP Images (Frames)
-void ExtractPoints(int step, int CAM_ID){
-
-	// Open image file and access images
-	char fname1[CMD_MAXLEN]; 
-	char fname2[CMD_MAXLEN]; 
-	char fbuffer[CMD_MAXLEN];
-	sprintf_s(fbuffer, "%d.bmp", step);
-	fname1[0] = '\0';
-	fname2[0] = '\0'; 
-	strcat_s(fname1, "Images_A\\");
-	strcat_s(fname2, "Images_B\\");
-	strcat_s(fname1, fbuffer); 
-	strcat_s(fname2, fbuffer);
-
-	char* fname; 
-	fname = (CAM_ID == 1) ? fname1 : fname2; 
-
-	// Extract Image Corresponding to CAM1
-	if (DBG_LOG)printf("Extracting Points from: %s...\n", fname);
-	FILE* fptr;
-	fopen_s(&fptr, fname, "rb");
-	if (!fptr){ errorExit("Error occured while opening image file."); }
-
-	// Access File +BMP Headers
-	unsigned char header[54];
-	fread(header, sizeof(unsigned char), 54, fptr);
-
-	// Object image object's width, height, and image body offset value. 
-	int w = *(int*)&header[18];
-	int h = *(int*)&header[22];
-	if (w != WIDTH || h != HEIGHT){ errorExit("Image dimensions inconsistent with calibration settings."); }
-
-	int data_offset = *(int*)&header[10];
-	int offset_max = 3 * w*h;
-	unsigned char* data = (unsigned char*)malloc(offset_max*sizeof(unsigned char));
-
-	// Advance to image body and load image, close file when done. 
-	// Create temporary buffer to ignore data padding when loading. 
-	fseek(fptr, data_offset, 0);
-
-	int rc, cc;
-	double wd = w;
-	int row_padding = ceil(wd * 3 / 4) * 4 - w * 3;
-
-	unsigned char* buffer = (unsigned char*)malloc(row_padding*sizeof(unsigned char));
-	for (rc = 0; rc<h; rc++){
-		fread(data + rc * 3 * w, sizeof(unsigned char), w * 3, fptr);
-		fread(buffer, sizeof(unsigned char), row_padding, fptr);
+	int target = (step_count + 1) % REV_STEPS; 
+	int moves = (target - *total_moves % REV_STEPS + REV_STEPS) % REV_STEPS; 
+	if (MOTOR_ABSOLUTE && moves > 1){
+		motorCommand(hSerial, 'P', target); 
+		*total_moves += moves; 
 	}
-	fclose(fptr);
-
-	// Goes through each ROW_PIXEL_STRD rows and get the average of the EVERY laser segment spotted.
-	// The generated result is then written back to results array.  
-
-	int B, G, R;
-	PIXEL* pxl_ptr = (CAM_ID == 1) ? PX_A.pl : PX_B.pl; 
-	int* used_ptr = (CAM_ID == 1) ? &PX_A.used : &PX_B.used; 
-	int* max_ptr = (CAM_ID == 1) ? &PX_A.max : &PX_B.max; 
-	pxl_ptr += *used_ptr; 
-
-	for (rc = 0; rc<h; rc += ROW_PIXEL_STRD){
-		int begin_track_idx = UNINIT;
-		int end_track_idx = UNINIT;
-		for (cc = 0; cc<w * 3; cc += 3){
-			// Look at each pixel whether they satisfy colour intensity requirements. 
-			B = (unsigned char)data[rc*w * 3 + cc + 0] > LASER_THRESHOLD_B;
-			G = (unsigned char)data[rc*w * 3 + cc + 1] > LASER_THRESHOLD_G;
-			R = (unsigned char)data[rc*w * 3 + cc + 2] > LASER_THRESHOLD_R;
-
-			if ((begin_track_idx == UNINIT) && B&&G&&R)       { begin_track_idx = cc / 3; }
-			else if (begin_track_idx != UNINIT && !(B&&G&&R)) { 
-				end_track_idx = cc / 3; 
-				int avg_pxl = (begin_track_idx + end_track_idx) / 2; 
-
-				// Dynamic Heap Management (Simple Implementation)
-				if (*used_ptr == *max_ptr){
-					errorExit("Point Quantity Overloaded - CONFIG: \'MAX_POINTS\'\n"); 
-				}
-
-				// Add this point into dataset 
-				pxl_ptr->x = avg_pxl; 
-				pxl_ptr->y = rc; 
-				if (DBG_VIGOROUS)printf("Adding 2D Point: %d, %d\n", pxl_ptr->x, pxl_ptr->y);
-				pxl_ptr++; 
-				(*used_ptr)++; 
-
-				// Ready next segment
-				begin_track_idx = UNINIT;
-				end_track_idx = UNINIT;
+	else {
+		char MOTOR_MV_CMD = '1';
+		int settle = moves > 1; 
+		for (; moves > 0; moves--){
+			if (settle) PurgeComm(hSerial, PURGE_RXCLEAR); 
+			if (!WriteFile(hSerial, &MOTOR_MV_CMD, 1, NULL, NULL)){
+				errorExit("Error sending motor move command to Arduino.");
 			}
+			if (settle) waitMotor(hSerial); 
+			(*total_moves)++;
 		}
 	}
+	if (CAMS[0].jrn && journalMoves(CAMS[0].jrn, *total_moves) != OKAY) printf("Cannot journal motor moves. \n");
 
-	free(data);
-	free(buffer);
-}
+	// Takes a picture of the object with every camera. 
+	int c; 
+	for (c = 0; c < NUM_CAMS; c++){
+		sprintf_s(cmd, cmd_prefix, CAMS[c].id, CAMS[c].img_dir, step_count);
+		strcat_s(cmd, cmd_postfix);
 
-// Sanity Function: Dumps the scanned coordinates onto the screen 
-void dump2D(int CAM_ID){
-	int counter = 0; 
-	PIXEL* curr = (CAM_ID==1)?PX_A.pl:PX_B.pl; 
-	int used = (CAM_ID == 1) ? PX_A.used : PX_B.used;
-	printf("\nCam %d has %d coord. \n", CAM_ID, used); 
-	for (; counter < used; counter++){
-		printf("\tX: %d, Y: %d\n", curr->x, curr->y);
-		curr++; 
+		// Calling CommandCam Application
+		if (DBG_LOG) printf("Calling: %s\n", cmd);
+		system(cmd);
 	}
 }
 
-/********************************************** MAPPER **********************************************/
-
-// Translation of 2D Image Pixels to 3D Coordinates using planar anti-projection algorithm 
-void TranslatePoints(int step, int CAM_ID){
+/********************************************** DATA STORAGE **********************************************/
 
-	// Assigning Parameters
-	int* used2d = (CAM_ID == 1) ? &PX_A.used : &PX_B.used; 
-	int* parsed3d = (CAM_ID == 1) ? &P3D_A.used : &P3D_B.used; 
-	PIXEL* ptr_2d = (CAM_ID == 1) ? PX_A.pl : PX_B.pl; 
-	PT3D* ptr_3d = (CAM_ID == 1) ? P3D_A.pl : P3D_B.pl; 
-	CAM_CB* calib = (CAM_ID == 1) ? &CB_A : &CB_B; 
-	
-	ptr_2d += *parsed3d;
-	ptr_3d += *parsed3d; 
-
-	// Angular Arithmetics 
-	float angle = 2 * PI * step / (REV_STEPS);
-	if (CAM_ID != 1) angle += CB_RAO; 
-
-	// Data Conversion
-	int counter = 0; 
-	for (; counter < *used2d - *parsed3d; counter++){
-		float IMG_X = (float)ptr_2d->x; 
-		float IMG_Y = (float)ptr_2d->y; 
-
-		// Set Default Values for Error Exceptions
-		ptr_3d->x = 0;
-		ptr_3d->y = 0;
-		ptr_3d->z = 0;
-
-		// Compute Z: Applying VP (Vanishing Point) Assumption 
-		float slope = (float)(calib->VP_Y - IMG_Y) / (calib->VP_X - IMG_X);
-		float IMG_INT = (float)(calib->VP_Y - calib->VP_X *slope);
-		float Z_INT = (float)(calib->BX *slope + IMG_INT);
-
-		// Skip Computation if point is out of bounds 
-		if ((Z_INT <= calib->BY + BASE_SAFE_HEIGHT) || ((IMG_X >= calib->WALL_EDGE) && calib->ORIENT > 0) ||
-			((IMG_X <= calib->WALL_EDGE) && calib->ORIENT < 0) || calib->VP_X == IMG_X || calib->VVP_X == IMG_X ){
-			ptr_2d++;
-			ptr_3d++;
-			continue; 
-		}
-
-		// Compute Drop Point: Do NOT Apply Vertical VP Assumption
-		float y_dropped = (float)(calib->BM*IMG_X + calib->BB); 
-		float hyp = (float)(sqrt(pow((float)(calib->BX - IMG_X), 2) + pow((calib->BY - y_dropped), 2)));
-		float XNA = (IMG_X>calib->BX) ? hyp*sin(angle)*-1 : hyp*sin(angle);
-		float YNA = (IMG_X>calib->BX) ? hyp*cos(angle)*-1 : hyp*cos(angle);
-
-		// Scale X & Y: Applying Geometric Scaling Assumption 
-		// Note: LOGb(x) = LOGc(x) / LOGc(b) 
-		// For now we don't scale, see how it looks like. 
-
-		// Before writing to the memory the list of points, we need to normalize the points from 0..1 for OPGL. 
-		ptr_3d->x = XNA / (WIDTH / 2);
-		ptr_3d->y = YNA / (WIDTH / 2);
-		ptr_3d->z = (Z_INT - calib->BY) / (WIDTH / 2);
-		
-		ptr_3d->x = checkFloatSanity(ptr_3d->x);
-		ptr_3d->y = checkFloatSanity(ptr_3d->y);
-		ptr_3d->z = checkFloatSanity(ptr_3d->z);
-		ptr_3d->s = step; 
-
-		// Advance element counters
-		ptr_2d++;
-		ptr_3d++;
-	}
-
-	// Epilogue
-	*parsed3d = *used2d; 
-
-}
-
-// Sanity Function: Dumps the calculated results onto the screen. 
-void dump3D(int CAM_ID){
-	int counter = 0; 
-	PT3D* curr = (CAM_ID == 1) ? P3D_A.pl : P3D_B.pl; 
-	int used = (CAM_ID == 1) ? P3D_A.used : P3D_B.used; 
-	printf("\nCam %d has %d points. \n", CAM_ID, used);
-	for (; counter < used; counter++){
-		printf("X: %f, Y: %f, Z:%f\n", curr->x, curr->y, curr->z); 
-		curr++; 
+// Fusion Mesh: Meshes the fusion volume as it stands into an STL file, decimated for keeps. 
+int saveFusionMesh(const char* fname, int decimate){
+	MESH mesh; 
+	if (extractMesh(FUSION, &mesh) != OKAY) return ERR; 
+	if (decimate && decimateMesh(&mesh, FUSE_DECIMATE_TRIS, (float)(FUSE_DECIMATE_PIXELS * 2 / WIDTH)) != OKAY){
+		printf("Cannot decimate mesh, saved in full. \n"); 
 	}
+	int saved = exportMeshSTL(fname, &mesh); 
+	freeMesh(&mesh); 
+	return saved; 
 }
 
 // Save Points: Saves all 3D points into a prescribed file 
@@ -309,7 +176,7 @@ void save3DPoints(){
 			char uinput[CMD_MAXLEN - 5];
 			gets_s(uinput);
 			strcat_s(fsname, uinput);
-			strcat_s(fsname, ".3dps");
+			strcat_s(fsname, SAVE_COMPRESSED ? ".3dpz" : ".3dps");
 
 			FILE* dfile = NULL;
 			if (!fopen_s(&dfile, fsname, "r")){
@@ -326,27 +193,20 @@ void save3DPoints(){
 			file_savable = 1;
 		} while (!file_savable);
 
-		FILE* dfile = NULL; 
-		fopen_s(&dfile, fsname, "w");
-		fprintf(dfile, "%d\n", P3D_A.used);
-		fprintf(dfile, "%d\n", P3D_B.used);
-		
-		int c; 
-		PT3D* p1 = P3D_A.pl; 
-		PT3D* p2 = P3D_B.pl; 
+		int saved = SAVE_COMPRESSED ? write3DPZ(fsname, OCT_DEPTH_DEFAULT) : write3DPS(fsname);
+		if (saved != OKAY) printf("Save Unsucessful. \n");
 
-		for (c = 0; c < P3D_A.used; c++){
-			fprintf(dfile, "%f\n%f\n%f\n%d\n", p1->x, p1->y, p1->z, p1->s);
-			p1++; 
+		// Standard copy next to it: same name, .ply extension. 
+		if (EXPORT_PLY){
+			strcpy_s(fsname + strlen(fsname) - 5, 6, ".ply");
+			if (exportPoints(fsname) != OKAY) printf("Export Unsucessful. \n");
 		}
 
-		for (c = 0; c < P3D_B.used; c++){
-			fprintf(dfile, "%f\n%f\n%f\n%d\n", p2->x, p2->y, p2->z, p2->s);
-			p2++;
+		// Fused mesh next to it: same name, .stl extension. 
+		if (FUSION){
+			strcpy_s(strrchr(fsname, '.'), 5, ".stl");
+			if (saveFusionMesh(fsname, 1) != OKAY) printf("Mesh Export Unsucessful. \n");
 		}
-
-		fclose(dfile); 
-		if (DBG_LOG) printf("Data Save Completed. \n");
 		
 	}
 }
@@ -364,43 +224,72 @@ int load3DPoints(){
 		FILE* fptr; 
 
 		int file_loadable = 0; 
+		int compressed = 0; 
 		do {
-			printf("*** Enter a *.3dps (no extension) file from Data directory to load: "); 
+			printf("*** Enter a *.3dpz or *.3dps (no extension) file from Data directory to load: "); 
 			gets_s(usr_input); 
-			fname[0] = '\0'; 
-			strcat_s(fname, "Data\\"); 
-			strcat_s(fname, usr_input); 
-			strcat_s(fname, ".3dps"); 
 
-			if (!fopen_s(&fptr, fname, "r")){
-				file_loadable = 1; 
-			}
-			else {
-				printf("File specified does not exist. Please try again. \n"); 
+			// Compressed sessions take precedence over text ones of the same name. 
+			for (compressed = 1; compressed >= 0; compressed--){
+				sprintf_s(fname, "Data\\%s%s", usr_input, compressed ? ".3dpz" : ".3dps");
+				if (!fopen_s(&fptr, fname, "r")){
+					file_loadable = 1; 
+					fclose(fptr);
+					break; 
+				}
 			}
+			if (!file_loadable) printf("File specified does not exist. Please try again. \n"); 
 
 		} while (!file_loadable); 
 
-		fscanf_s(fptr, "%d", &(P3D_A.used)); 
-		fscanf_s(fptr, "%d", &(P3D_B.used));
-		
-		int c; 
-		PT3D* p1 = P3D_A.pl;
-		PT3D* p2 = P3D_B.pl; 
+		int loaded = compressed ? read3DPZ(fname) : read3DPS(fname);
+		if (loaded != OKAY) errorExit("Error occured while loading 3D data points.");
+		return 1; 
+}
 
-		for (c = 0; c < P3D_A.used; c++){
-			fscanf_s(fptr, "%f\n%f\n%f\n%d\n", &(p1->x), &(p1->y), &(p1->z), &(p1->s));
-			p1++;
-		}
+// Align Cameras: Refines the cameras' relative pose on the finished scan and offers to keep it for later scans. 
+void alignSession(){
 
-		for (c = 0; c < P3D_B.used; c++){
-			fscanf_s(fptr, "%f\n%f\n%f\n%d\n", &(p2->x), &(p2->y), &(p2->z), &(p2->s));
-			p2++;
-		}
+	if (alignCameras() != OKAY) printf("Some cameras could not be aligned. \n");
+	printf("Save the refined alignment to %s? (y/n): ", CALIB_FILE);
+	char response = getchar();
+	getchar(); 
+	if (response != 'y' && response != 'Y') return;
+	system("if not exist \"Data\" mkdir Data");
+	if (saveCalibration(CALIB_FILE) != OKAY) printf("Calibration Save Unsucessful. \n");
+}
 
-		fclose(fptr);
-		if (DBG_LOG) printf("File Load Completed. \n");
-		return 1; 
+// Resume Scan: Offers to continue the scan recorded in JOURNAL_FILE if it stopped short of STEP_TARGET steps. 
+// Returns how many steps in STEP_ORDER are already taken (0 for a new scan) and the motor moves already sent. 
+int resumeScan(int* moves){
+
+	*moves = 0;
+	unsigned int calib_crc = calibrationCRC();
+	int next = journalProgress(JOURNAL_FILE, NUM_CAMS, REV_STEPS, STEP_ORDER, calib_crc);
+	if (next < 0 || next >= MIN(STEP_TARGET, REV_STEPS)) return 0;
+
+	printf("An interrupted scan stopped after %d/%d steps. Resume it? (y/n): ", next, MIN(STEP_TARGET, REV_STEPS));
+	char response = getchar();
+	getchar(); 
+	if (response != 'y' && response != 'Y') return 0;
+
+	PCLOUD* clouds[NUM_CAMS];
+	int cam;
+	for (cam = 0; cam < NUM_CAMS; cam++) clouds[cam] = &CAMS[cam].p3d;
+	JOURNAL* jrn = resumeJournal(JOURNAL_FILE, clouds, NUM_CAMS, REV_STEPS, STEP_ORDER, calib_crc, &next, moves);
+	if (!jrn) errorExit("Error occured while resuming the scan journal.");
+
+	// Extraction continues behind the restored points, whose pixels are unknown. 
+	for (cam = 0; cam < NUM_CAMS; cam++){
+		int i;
+		for (i = 0; i < CAMS[cam].p3d.used; i++){
+			CAMS[cam].px.pl[i].y = UNINIT;
+			CAMS[cam].px.pl[i].plane = 0;
+		}
+		CAMS[cam].px.used = CAMS[cam].p3d.used;
+		CAMS[cam].jrn = jrn;
+	}
+	return next;
 }
 
 /********************************************** ILLUSTRATOR **********************************************/
@@ -429,9 +318,11 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 	if (key == GLFW_KEY_Z){ zoomfactor += ZOOM_DELTA; }
 	if (key == GLFW_KEY_X){ zoomfactor -= ZOOM_DELTA; }
 
-	// Toggle Camera
-	if (key == GLFW_KEY_1 && action == GLFW_PRESS){ DISP_A = (DISP_A == 1) ? 0 : 1; }
-	if (key == GLFW_KEY_2 && action == GLFW_PRESS){ DISP_B = (DISP_B == 1) ? 0 : 1; }
+	// Toggle Camera (Keys 1..9)
+	if (key >= GLFW_KEY_1 && key < GLFW_KEY_1 + NUM_CAMS && action == GLFW_PRESS){ 
+		CAMERA* cam = &CAMS[key - GLFW_KEY_1]; 
+		cam->disp = (cam->disp == 1) ? 0 : 1; 
+	}
 
 }
 
@@ -459,6 +350,117 @@ static void mouse_callback(GLFWwindow* window, double xpos, double ypos){
 
 }
 
+// Draws one quantized block: the modelview scale and translate turn its 16-bit offsets back into coordinates. 
+static void drawQBlock(const QCLOUD* qc, const QBLOCK* b){
+	glPushMatrix();
+	glTranslatef(b->center[0], b->center[1], b->center[2]);
+	glScalef(b->unit[0], b->unit[1], b->unit[2]);
+	glVertexPointer(3, GL_SHORT, 0, qc->q + 3 * b->first);
+	glDrawArrays(GL_POINTS, 0, b->count);
+	glPopMatrix();
+}
+
+// Level-of-Detail Display: The tree on display keeps its nodes here and its samples in a vertex buffer. 
+typedef struct {
+	LOD_BUILD build;
+	int building;
+	LOD_TREE tree;
+	GLuint vbo;
+	double built_at;
+}LOD_VIEW;
+
+// Swaps in a finished build and starts the next one once the cloud has grown and the last build has aged. 
+// Returns 1 if the tree on display has changed. 
+static int updateLod(LOD_VIEW* lv, const PCLOUD* pc, double now){
+	int swapped = 0;
+	if (lv->building && lodBuildDone(&lv->build)){
+		lv->building = 0;
+		if (lv->build.status == OKAY){
+			if (!lv->vbo) glGenBuffers(1, &lv->vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, lv->vbo);
+			glBufferData(GL_ARRAY_BUFFER, 3 * (size_t)lv->build.tree.verts * sizeof(float), lv->build.tree.xyz, GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			freeLodTree(&lv->tree);
+			lv->tree = lv->build.tree;
+			free(lv->tree.xyz);
+			lv->tree.xyz = NULL;
+			lv->built_at = now;
+			swapped = 1;
+		}
+	}
+	if (pc->used < lv->tree.points){
+		freeLodTree(&lv->tree);
+		swapped = 1;
+	}
+	if (!lv->building && pc->used > lv->tree.points && now - lv->built_at >= LOD_REBUILD_SECONDS){
+		lv->building = (startLodBuild(&lv->build, pc, pc->used) == OKAY);
+	}
+	return swapped;
+}
+
+// Draws the nodes chosen for the current modelview, each with the point size of its sample spacing. 
+static void drawLod(LOD_VIEW* lv, int view_h, int budget){
+	if (!lv->tree.nodes) return;
+	LOD_DRAW* sel = (LOD_DRAW*)malloc(lv->tree.nodes * sizeof(LOD_DRAW));
+	if (!sel) return;
+	float mv[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+	int n = selectLodNodes(&lv->tree, mv, view_h, budget, sel, lv->tree.nodes);
+
+	glBindBuffer(GL_ARRAY_BUFFER, lv->vbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, 0);
+	int i;
+	for (i = 0; i < n; i++){
+		const LOD_NODE* node = &lv->tree.node[sel[i].node];
+		glPointSize(sel[i].size);
+		glDrawArrays(GL_POINTS, node->first, node->count);
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glPointSize(3.0f);
+	free(sel);
+}
+
+static void freeLod(LOD_VIEW* lv){
+	if (lv->building){
+		WaitForSingleObject(lv->build.thread, INFINITE);
+		lodBuildDone(&lv->build);
+		if (lv->build.status == OKAY) freeLodTree(&lv->build.tree);
+	}
+	freeLodTree(&lv->tree);
+	if (lv->vbo) glDeleteBuffers(1, &lv->vbo);
+	memset(lv, 0, sizeof(LOD_VIEW));
+}
+
+// Redraw Triggers: Window damage, and points published by the camera workers (called on their threads). 
+static volatile int REDRAW = 1;
+static volatile int ILLS_AWAKE = 0;
+static CRITICAL_SECTION WAKE_LOCK;
+
+static void refresh_callback(GLFWwindow* window){
+	REDRAW = 1;
+}
+
+static void wakeIllustrator(int cam){
+	EnterCriticalSection(&WAKE_LOCK);
+	if (ILLS_AWAKE) glfwPostEmptyEvent();
+	LeaveCriticalSection(&WAKE_LOCK);
+}
+
+static int compareMs(const void* a, const void* b){
+	double d = *(const double*)a - *(const double*)b;
+	return (d > 0) - (d < 0);
+}
+
+// Prints the frame time percentiles of n redraws (sorts ms). 
+static void reportFrameTimes(double* ms, int n){
+	qsort(ms, n, sizeof(double), compareMs);
+	printf("Frame Times (%d redraws): p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+		n, ms[n / 2], ms[n * 95 / 100], ms[n * 99 / 100], ms[n - 1]);
+}
+
 // This is the function OPGL calls when it enconters an error. 
 static void error_callback(int error, const char* description)
 {
@@ -499,24 +501,77 @@ void Illustrator(void* prm_data){
 	glColor3f(1.0f, 1.0f, 1.0f);
 	glPointSize(3.0f);
 	glLineWidth(3.0f);
-	glfwSwapInterval(10);
+	glfwSwapInterval(1);
+
+	// Quantized display copies, grown block by block as the scan progresses
+	static QCLOUD QPTS[NUM_CAMS];
+	int cam, pc;
+	if (QUANTIZE_DISPLAY){
+		for (cam = 0; cam < NUM_CAMS; cam++){
+			if (allocQCloud(&QPTS[cam], MAX_POINTS) != OKAY) errorExit("Cannot allocate display buffers.");
+		}
+	}
 
-	// Initialize FPS Counter
-	double ct = glfwGetTime(); 
-	double pt = glfwGetTime();
+	// Level-of-detail trees, rebuilt in the background as the clouds grow
+	static LOD_VIEW LODS[NUM_CAMS];
+	int budget = LOD_BUDGET;
+
+	// Redraw State: Frames are only drawn when the view, the displayed cameras or the clouds change. 
+	float last_view[3] = { 0, 0, 0 };
+	int last_disp = UNINIT, last_used = UNINIT;
+	double frame_ms[FRAME_STATS_FRAMES];
+	int frames = 0;
+	InitializeCriticalSection(&WAKE_LOCK);
+	ILLS_AWAKE = 1;
+	CAM_PUBLISHED = wakeIllustrator;
+	glfwSetWindowRefreshCallback(window, refresh_callback);
 
 	do {
-		
-		// Update Frame Counter Data
-		FPS++;
-		ct = glfwGetTime(); 
-		if (ct - pt >= 1.0){
-			// printf and reset timer
-			if (DBG_LOG) printf("FPS: %f\n", double(FPS));
-			FPS = 0;
-			pt += 1.0;
+		double ct = glfwGetTime(); 
+
+		// Background Trees: Swapping one in changes the picture; outstanding builds need polling. 
+		int swapped = 0, pending = 0; 
+		if (LOD_DISPLAY){
+			for (cam = 0; cam < NUM_CAMS; cam++){
+				swapped |= updateLod(&LODS[cam], &CAMS[cam].p3d, ct); 
+				pending |= LODS[cam].building || CAMS[cam].p3d.used > LODS[cam].tree.points; 
+			}
 		}
 
+		// Point Budget: Back to LOD_BUDGET while the view moves, doubling every frame it stays still. 
+		int disp = 0, used = 0, shown = 0; 
+		for (cam = 0; cam < NUM_CAMS; cam++){
+			disp |= CAMS[cam].disp << cam; 
+			shown += CAMS[cam].disp; 
+			used += CAMS[cam].p3d.used; 
+		}
+		int moved = (tip_angle != last_view[0] || view_angle != last_view[1] || zoomfactor != last_view[2]); 
+		int refining = (LOD_DISPLAY && !moved && budget < LOD_BUDGET_MAX); 
+		if (!moved && !refining && !swapped && !REDRAW && disp == last_disp && used == last_used){
+			// Idle: Sleep until input or new points arrive. 
+			if (pending){
+				Sleep(IDLE_POLL_MS); 
+				glfwPollEvents(); 
+			}
+			else glfwWaitEvents(); 
+			continue; 
+		}
+		budget = moved ? LOD_BUDGET : MIN(2 * budget, LOD_BUDGET_MAX); 
+		last_view[0] = tip_angle; 
+		last_view[1] = view_angle; 
+		last_view[2] = zoomfactor; 
+		last_disp = disp; 
+		last_used = used; 
+		REDRAW = 0; 
+		int view_w, view_h; 
+		glfwGetFramebufferSize(window, &view_w, &view_h); 
+
+		// Do Verical THEN Horizontal Translations 
+		glLoadIdentity();
+		glRotatef(tip_angle, 1.0, 0.0, 0.0);
+		glRotatef(view_angle, 0.0, 0.0, 1.0);
+		glScalef(zoomfactor, zoomfactor, zoomfactor);
+
 		// Clear color buffer
 		glClear(GL_COLOR_BUFFER_BIT);
 
@@ -536,49 +591,68 @@ void Illustrator(void* prm_data){
 		glVertex3f(0, 0, 0);
 		glEnd();
 
-		PT3D* V1 = P3D_A.pl;
-		PT3D* V2 = P3D_B.pl;
-		int pc = 0;
-
-		// Input all points into panel (CAM1) 
-		if (DISP_A){
-			glColor3f(0.0f, 1.0f, 1.0f);
-			glBegin(GL_POINTS);
-			pc = 0;
-			for (pc = 0; pc < P3D_A.used; pc++){
-				glVertex3f(V1->x, V1->y, V1->z);
-				V1++;
+		// Input all points into panel (Per Camera) 
+		for (cam = 0; cam < NUM_CAMS; cam++){
+			if (!CAMS[cam].disp) continue; 
+			glColor3fv(CAMS[cam].color);
+
+			// Points in the tree are drawn by level of detail, completed blocks from the quantized copy, 
+			// the rest straight from the cloud. 
+			int first = 0; 
+			if (LOD_DISPLAY && LODS[cam].tree.nodes){
+				drawLod(&LODS[cam], view_h, budget / MAX(shown, 1)); 
+				first = LODS[cam].tree.points; 
+			}
+			else if (QUANTIZE_DISPLAY){
+				QCLOUD* qc = &QPTS[cam];
+				if (CAMS[cam].p3d.used < qc->used) qc->used = qc->blocks = 0; 
+				while (quantizeBlock(qc, &CAMS[cam].p3d, 0));
+
+				glEnableClientState(GL_VERTEX_ARRAY);
+				int b; 
+				for (b = 0; b < qc->blocks; b++) drawQBlock(qc, &qc->bl[b]);
+				glDisableClientState(GL_VERTEX_ARRAY);
+				first = qc->used; 
 			}
-			glEnd();
-		}
 
-		// Input all points into panel (CAM2) 
-		if (DISP_B){
-			glColor3f(1.0f, 0.0f, 1.0f);
+			PCVIEW V = cloudView(&CAMS[cam].p3d, first, CAMS[cam].p3d.used - first);
 			glBegin(GL_POINTS);
-			for (pc = 0; pc < P3D_B.used; pc++){
-				glVertex3f(V2->x, V2->y, V2->z);
-				V2++;
+			for (pc = 0; pc < V.n; pc++){
+				glVertex3f(V.x[pc], V.y[pc], V.z[pc]);
 			}
 			glEnd();
 		}
 
-		// Do Verical THEN Horizontal Translations 
-		glLoadIdentity();
-		glRotatef(tip_angle, 1.0, 0.0, 0.0);
-		glRotatef(view_angle, 0.0, 0.0, 1.0);
-		glScalef(zoomfactor, zoomfactor, zoomfactor);
-
 		// Swap buffers
 		glfwSwapBuffers(window);
+
+		// Frame Time Statistics 
+		frame_ms[frames++] = 1000 * (glfwGetTime() - ct); 
+		if (frames == FRAME_STATS_FRAMES){
+			if (DBG_LOG) reportFrameTimes(frame_ms, frames); 
+			frames = 0; 
+		}
+
 		// Listen for user inputs
 		glfwPollEvents();
 
 	} while (!glfwWindowShouldClose(window));
 
+	// No more wake-ups once GLFW is gone. 
+	EnterCriticalSection(&WAKE_LOCK);
+	ILLS_AWAKE = 0;
+	CAM_PUBLISHED = NULL;
+	LeaveCriticalSection(&WAKE_LOCK);
+
 	//Finalize and clean up GLFW
+	if (LOD_DISPLAY){
+		for (cam = 0; cam < NUM_CAMS; cam++) freeLod(&LODS[cam]);
+	}
 	glfwDestroyWindow(window);
 	glfwTerminate();
+	if (QUANTIZE_DISPLAY){
+		for (cam = 0; cam < NUM_CAMS; cam++) freeQCloud(&QPTS[cam]);
+	}
 
 }
 
@@ -590,17 +664,20 @@ int main(void)
 	// Initialize Serial Communication Channels
 	HANDLE hSerial;
 
-	// Initialize 3D Scanner Data Structures
-	P3D_A.used = 0;
-	P3D_A.max = MAX_POINTS;
-	P3D_A.pl = (PT3D*)malloc(MAX_POINTS*sizeof(PT3D));
+	// Initialize Camera Array: Calibrations and Data Structures
+	initCameras(); 
 
-	P3D_B.used = 0;
-	P3D_B.max = MAX_POINTS;
-	P3D_B.pl = (PT3D*)malloc(MAX_POINTS*sizeof(PT3D));
+	// Calibration Update: A refinement saved by an earlier session takes precedence over Calibrations.h. 
+	FILE* cfile = NULL; 
+	if (!fopen_s(&cfile, CALIB_FILE, "r") && cfile){
+		fclose(cfile); 
+		if (loadCalibration(CALIB_FILE) != OKAY) errorExit("Error occured while loading the calibration file.");
+	}
 
 	// Program Load Options
 	LOAD_MODE = load3DPoints(); 
+	int first_step = 0, moves = 0; 
+	if (!LOAD_MODE && JOURNAL_SCANS) first_step = resumeScan(&moves); 
 
 	/********************************************* FORK CHILD: ILLUSTRATOR *********************************************/
 	//HANDLE ILLUSTRATOR_PRM = CreateThread(NULL, 0, Illustrator, 0, 0, NULL);
@@ -641,79 +718,122 @@ int main(void)
 		if (!SetCommTimeouts(hSerial, &timeouts)){ errorExit("Error while setting device I/O timeouts."); }
 
 		// Reset Image Data from Previous Run
-		system("rmdir Images_A /s /q");
-		system("mkdir Images_A");
-
-		system("rmdir Images_B /s /q");
-		system("mkdir Images_B");
-
-		// Initialize Hardware Calibration Data
-		CB_A.BB = CB_1_BASE_B;
-		CB_A.BM = CB_1_BASE_M;
-		CB_A.BX = CB_1_CENTER_X;
-		CB_A.BY = CB_1_CENTER_Y;
-		CB_A.VP_X = CB_1_VP_X;
-		CB_A.VP_Y = CB_1_VP_Y;
-		CB_A.VVP_X = CB_1_VVP_X;
-		CB_A.VVP_Y = CB_1_VVP_Y;
-		CB_A.Scale = CB_1_SCALE_BASE;
-		CB_A.WALL_EDGE = CB_1_WALL_EDGE;
-		CB_A.ORIENT = CB_1_ORIENTATION; 
-
-		CB_B.BB = CB_2_BASE_B;
-		CB_B.BM = CB_2_BASE_M;
-		CB_B.BX = CB_2_CENTER_X;
-		CB_B.BY = CB_2_CENTER_Y;
-		CB_B.VP_X = CB_2_VP_X;
-		CB_B.VP_Y = CB_2_VP_Y;
-		CB_B.VVP_X = CB_2_VVP_X;
-		CB_B.VVP_Y = CB_2_VVP_Y;
-		CB_B.Scale = CB_2_SCALE_BASE;
-		CB_B.WALL_EDGE = CB_2_WALL_EDGE;
-		CB_B.ORIENT = CB_2_ORIENTATION; 
-
-		// Initialize 2D Scanner Data Structures  
-		PX_A.used = 0;
-		PX_A.max = MAX_POINTS;
-		PX_A.pl = (PIXEL*)malloc(MAX_POINTS*sizeof(PIXEL));
-
-		PX_B.used = 0;
-		PX_B.max = MAX_POINTS;
-		PX_B.pl = (PIXEL*)malloc(MAX_POINTS*sizeof(PIXEL));
+		int cam; 
+		char cmd[CMD_MAXLEN]; 
+		for (cam = 0; cam < NUM_CAMS; cam++){
+			sprintf_s(cmd, "rmdir %s /s /q", CAMS[cam].img_dir);
+			system(cmd);
+			sprintf_s(cmd, "mkdir %s", CAMS[cam].img_dir);
+			system(cmd);
+		}
+
+		// Frame Archive: All raw frames of this scan are packed into one compressed file. 
+		SCAN_ARCHIVE* archive = NULL; 
+		char arcname[CMD_MAXLEN]; 
+		if (ARCHIVE_FRAMES){
+			SYSTEMTIME lt; 
+			GetLocalTime(&lt); 
+			system("if not exist \"Data\" mkdir Data");
+			sprintf_s(arcname, "Data\\scan_%04d%02d%02d_%02d%02d%02d.scan", lt.wYear, lt.wMonth, lt.wDay, lt.wHour, lt.wMinute, lt.wSecond);
+			archive = createScanArchive(arcname, NUM_CAMS, REV_STEPS); 
+			if (!archive) errorExit("Cannot create scan archive."); 
+			for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].dst = archive; 
+		}
+
+		// Scan Journal: Every translated step is on disk before the next one is processed. 
+		JOURNAL* jrn = CAMS[0].jrn; 
+		if (JOURNAL_SCANS && !jrn){
+			system("if not exist \"Data\" mkdir Data");
+			jrn = createJournal(JOURNAL_FILE, NUM_CAMS, REV_STEPS, STEP_ORDER, calibrationCRC()); 
+			if (!jrn) errorExit("Cannot create scan journal."); 
+			for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].jrn = jrn; 
+		}
+
+		// Volumetric Fusion: Workers fuse every step as they translate it, the steps of a resumed scan are fused here. 
+		if (FUSE_SCANS){
+			system("if not exist \"Data\" mkdir Data");
+			FUSION = createTsdf((float)(TSDF_VOXEL_PIXELS * 2 / WIDTH)); 
+			if (!FUSION) errorExit("Cannot create fusion volume."); 
+			for (cam = 0; cam < NUM_CAMS; cam++){
+				if (integrateSteps(FUSION, &CAMS[cam].p3d, 0, CAMS[cam].p3d.used) != OKAY) errorExit("Cannot fuse resumed steps."); 
+				CAMS[cam].tsdf = FUSION; 
+			}
+		}
+
+		// Start Per-Camera Worker Threads 
+		startCameraWorkers(); 
 
 		/********************************************* IMAGE AQUISITION *********************************************/
 	
-		int step = 0; //REV_STEPS instead of s.  
+		// Steps are taken in STEP_ORDER, seq[i] being the i-th. A resumed scan first turns the disk from wherever it 
+		// stopped, which an Arduino taking absolute moves is told first. 
+		int seq[REV_STEPS]; 
+		if (stepOrder(STEP_ORDER, REV_STEPS, seq) != OKAY) errorExit("Unknown step order in STEP_ORDER."); 
+		if (MOTOR_ABSOLUTE) motorCommand(hSerial, 'H', moves % REV_STEPS); 
+		int taken = first_step; 
+		int target = MIN(STEP_TARGET, REV_STEPS); 
 		SYSTEMTIME st;
 		GetSystemTime(&st);
-		for (; step < REV_STEPS; step++){
-			framer(step, hSerial);
-			// Extract 2D Points from Pictures Taken
-			ExtractPoints(step, 1);
-			ExtractPoints(step, 2);
-			// Convert 2D to 3D points. 
-			TranslatePoints(step, 1);
-			TranslatePoints(step, 2);
+		while (taken < target){
+			int step = seq[taken++]; 
+			framer(step, hSerial, &moves);
+			// Extract 2D Points from Pictures Taken and Convert 2D to 3D points. 
+			// Cameras process this step concurrently while the disk rotates for the next one. 
+			dispatchCameras(step);
+
+			// Preview of the steps fused so far, the one just dispatched may still be in flight. 
+			if (FUSION && FUSE_PREVIEW_STEPS && taken % FUSE_PREVIEW_STEPS == 0){
+				if (saveFusionMesh(FUSE_PREVIEW_FILE, 0) != OKAY) printf("Cannot write mesh preview. \n"); 
+			}
+
+			// Pressing ESC stops the scan after this step, what is taken so far is kept. 
+			if (_kbhit() && _getch() == 27 && taken < target){
+				printf("Scan stopped after %d/%d steps. \n", taken, target); 
+				break; 
+			}
+		}
+		stopCameraWorkers(); 
+		for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].tsdf = NULL; 
+		if (jrn){
+			closeJournal(jrn); 
+			for (cam = 0; cam < NUM_CAMS; cam++) CAMS[cam].jrn = NULL; 
+		}
+
+		// Raw frames live on in the archive only. 
+		if (archive){
+			closeScanArchive(archive); 
+			printf("Raw frames archived to %s\n", arcname); 
+			for (cam = 0; cam < NUM_CAMS; cam++){
+				CAMS[cam].dst = NULL; 
+				if (!KEEP_RAW_FRAMES){
+					sprintf_s(cmd, "rmdir %s /s /q", CAMS[cam].img_dir);
+					system(cmd);
+				}
+			}
 		}
 		SYSTEMTIME et; 
 		GetSystemTime(&et); 
 		int timediff = (int)et.wSecond - (int)st.wSecond; 
-		printf("The Scanner has completed operations in %d seconds. At %d steps. %d points are recorded. ", timediff, REV_STEPS, P3D_A.used); 
+		printf("The Scanner has completed operations in %d seconds. At %d steps. %d points are recorded. ", timediff, taken, CAMS[0].p3d.used); 
 
 	}
 
 	// Stats: Display number of points processed. 
-	printf("Apts: %d, Bpts: %d \n", P3D_A.used, P3D_B.used);
+	int cam; 
+	for (cam = 0; cam < NUM_CAMS; cam++){
+		printf("Cam %d pts: %d \n", CAMS[cam].id, CAMS[cam].p3d.used);
+	}
 	WaitForSingleObject(ILLS_HDL, INFINITE);
 
 	/********************************************* Option: Save Session *********************************************/
+	if (!LOAD_MODE && ALIGN_SCANS) alignSession(); 
+	if (!LOAD_MODE && MERGE_SCANS) mergeCameras(MERGE_CELL_PIXELS); 
+	if (!LOAD_MODE && NORMAL_SCANS) estimateNormals(NRM_AUTO); 
 	if (!LOAD_MODE) save3DPoints(); 
 
 	/********************************************* EPILOGUE *********************************************/
-	free(P3D_A.pl); 
-	free(P3D_B.pl); 
-	free(PX_A.pl);
-	free(PX_B.pl); 
+	freeCameras(); 
+	if (FUSION) freeTsdf(FUSION); 
 
 	printf("Program Completed Successfully. Enter any key to exit: ");
 	getchar();
@@ -0,0 +1,50 @@
+/************************************************************************************************************************
+
+Step Order: The order in which the steps of a turn are acquired.
+
+*************************************************************************************************************************/
+
+#include <windows.h>
+
+#include "Config.h"
+#include "StepOrder.h"
+
+#define GOLDEN_FRACTION			0.38196601125	// 1 / phi^2: the golden angle as a fraction of the turn
+
+static int gcd(int a, int b){
+	while (b){
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+int stepOrder(int mode, int steps, int* seq){
+	int i, n = 0;
+	switch (mode){
+	case ORDER_SEQUENTIAL:
+		for (i = 0; i < steps; i++) seq[i] = i;
+		return OKAY;
+
+	case ORDER_BITREV: {
+		int bits = 0;
+		while ((1 << bits) < steps) bits++;
+		for (i = 0; i < (1 << bits); i++){
+			int r = 0, b;
+			for (b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+			if (r < steps) seq[n++] = r;
+		}
+		return OKAY;
+	}
+
+	case ORDER_GOLDEN: {
+		// Nearest stride to the golden angle that still reaches every step.
+		int stride = MAX((int)(steps * GOLDEN_FRACTION + 0.5), 1);
+		while (gcd(stride, steps) != 1) stride++;
+		for (i = 0; i < steps; i++) seq[i] = (int)((long long)i * stride % steps);
+		return OKAY;
+	}
+	}
+	return ERR;
+}
@@ -0,0 +1,23 @@
+/************************************************************************************************************************
+
+Step Order: The order in which the steps of a turn are acquired.
+Sequential order turns the disk one step at a time, so the object fills in as a growing wedge. Progressive orders
+spread the first steps over the whole turn and fill the gaps between them as the scan goes on, so a preview shows the
+full object coarsely after a fraction of the scan and a scan stopped early still covers it evenly:
+	Bit-reversed: Steps by the bit-reversed count over the next power of two (0, 1/2, 1/4, 3/4, 1/8, ...), those past
+				  the turn skipped. The steps taken so far are spread nearly evenly at every point of the scan.
+	Golden:		  Every next step a golden angle (turn / phi^2) further, rounded to a stride that reaches every step.
+				  Gaps stay within a small ratio of each other whenever the scan stops.
+Every order visits each step exactly once.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#define ORDER_SEQUENTIAL		0
+#define ORDER_BITREV			1
+#define ORDER_GOLDEN			2
+
+// Fills seq[0..steps) with the steps 0..steps-1 in the order mode acquires them.
+// Returns OKAY on success, ERR if mode is unknown.
+int stepOrder(int mode, int steps, int* seq);
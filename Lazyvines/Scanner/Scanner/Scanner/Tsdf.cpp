@@ -0,0 +1,586 @@
+/************************************************************************************************************************
+
+TSDF Volume: Sparse truncated signed distance fusion and parallel marching cubes.
+
+*************************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+
+#include "Tsdf.h"
+#include "Normals.h"
+#include "Parallel.h"
+
+#if 2 * TSDF_TRUNC_VOXELS > TSDF_BLOCK_DIM
+#error "TSDF_TRUNC_VOXELS: a sample must not reach into more than two blocks per axis"
+#endif
+
+#define TSDF_VOXELS				(TSDF_BLOCK_DIM * TSDF_BLOCK_DIM * TSDF_BLOCK_DIM)
+#define TSDF_BIAS				(1 << 20)		// Added to voxel coordinates to keep them positive
+#define TSDF_INIT_SLOTS			1024
+#define TSDF_CASE_MAX			5				// Triangles per cube case at most
+#define TSDF_NO_VERTEX			0xFFFF
+
+// Structures
+typedef struct {
+	TSDF* vol;
+	const float* xyz;			// Samples and their unit normals, interleaved
+	const float* nrm;
+	int* touched;				// Blocks the samples reach
+	int* first;					// Per touched block: first entry of order
+	int* order;					// Samples grouped by touched block
+}FUSE_CTX;
+
+typedef struct {
+	const TSDF* vol;
+	unsigned short* vid;		// Per block, voxel and axis: vertex on the edge towards the next voxel, block local
+	int* vfirst;				// Per block: first vertex, then first triangle
+	int* tfirst;
+	MESH* mesh;
+}MC_CTX;
+
+// Marching cubes cases: corner c sits at (c & 1, c >> 1 & 1, c >> 2 & 1), edge e runs from EDGE_CORNER[e] along
+// EDGE_AXIS[e]. A case is the mask of the corners inside (negative distance).
+static int EDGE_CORNER[12];
+static int EDGE_AXIS[12];
+static int CASE_COUNT[256];
+static signed char CASE_EDGES[256][3 * TSDF_CASE_MAX];
+static int CASES_BUILT = 0;
+
+/*********** CASE TABLE ***********/
+
+static int edgeBetween(int c0, int c1){
+	int e;
+	for (e = 0; e < 12; e++){
+		int lo = EDGE_CORNER[e], hi = lo | (1 << EDGE_AXIS[e]);
+		if ((lo == c0 && hi == c1) || (lo == c1 && hi == c0)) return e;
+	}
+	return UNINIT;
+}
+
+// On every face, walked counter-clockwise from outside the cube, each run of inside corners gets one segment from
+// the edge entering it to the edge leaving it. A crossed edge enters on one of its faces and leaves on the other, so
+// the segments chain into closed loops, which are fanned into triangles facing the outside.
+static void buildCases(){
+
+	int a, c, e, k = 0;
+	for (a = 0; a < 3; a++){
+		for (c = 0; c < 8; c++){
+			if (c & (1 << a)) continue;
+			EDGE_CORNER[k] = c;
+			EDGE_AXIS[k] = a;
+			k++;
+		}
+	}
+
+	int mask;
+	for (mask = 0; mask < 256; mask++){
+		int next[12];
+		for (e = 0; e < 12; e++) next[e] = UNINIT;
+
+		int side;
+		for (a = 0; a < 3; a++){
+			for (side = 0; side < 2; side++){
+				int b = (a + 1) % 3, d = (a + 2) % 3;
+				int q[4];
+				q[0] = side << a;
+				q[1] = q[0] | (1 << b);
+				q[2] = q[1] | (1 << d);
+				q[3] = q[0] | (1 << d);
+				if (!side){
+					int t = q[1];
+					q[1] = q[3];
+					q[3] = t;
+				}
+				for (k = 0; k < 4; k++){
+					int prev = q[(k + 3) % 4];
+					if (!(mask >> q[k] & 1) || (mask >> prev & 1)) continue;
+					int m = k;
+					while (mask >> q[(m + 1) % 4] & 1) m = (m + 1) % 4;
+					next[edgeBetween(prev, q[k])] = edgeBetween(q[m], q[(m + 1) % 4]);
+				}
+			}
+		}
+
+		int seen[12] = { 0 };
+		int count = 0;
+		for (e = 0; e < 12; e++){
+			if (next[e] == UNINIT || seen[e]) continue;
+			int loop[12], len = 0, f = e;
+			do {
+				seen[f] = 1;
+				loop[len++] = f;
+				f = next[f];
+			} while (f != e);
+			for (k = 1; k + 1 < len && count < TSDF_CASE_MAX; k++){
+				CASE_EDGES[mask][3 * count + 0] = (signed char)loop[0];
+				CASE_EDGES[mask][3 * count + 1] = (signed char)loop[k];
+				CASE_EDGES[mask][3 * count + 2] = (signed char)loop[k + 1];
+				count++;
+			}
+		}
+		CASE_COUNT[mask] = count;
+	}
+	CASES_BUILT = 1;
+}
+
+/*********** BLOCKS ***********/
+
+static unsigned int blockHash(const int* b){
+	unsigned long long key = ((unsigned long long)b[0] << 42) | ((unsigned long long)b[1] << 21) | (unsigned long long)b[2];
+	return (unsigned int)((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Index of the block holding biased voxel g, UNINIT if it was never allocated.
+static int findBlock(const TSDF* vol, const int* g){
+	int b[3] = { g[0] >> TSDF_BLOCK_BITS, g[1] >> TSDF_BLOCK_BITS, g[2] >> TSDF_BLOCK_BITS };
+	int slot = (int)(blockHash(b) & (vol->slots - 1));
+	while (vol->table[slot] != UNINIT){
+		const int* o = vol->block[vol->table[slot]]->origin;
+		if ((o[0] >> TSDF_BLOCK_BITS) == b[0] && (o[1] >> TSDF_BLOCK_BITS) == b[1] && (o[2] >> TSDF_BLOCK_BITS) == b[2]){
+			return vol->table[slot];
+		}
+		slot = (slot + 1) & (vol->slots - 1);
+	}
+	return UNINIT;
+}
+
+static void insertBlock(TSDF* vol, int idx){
+	const int* o = vol->block[idx]->origin;
+	int b[3] = { o[0] >> TSDF_BLOCK_BITS, o[1] >> TSDF_BLOCK_BITS, o[2] >> TSDF_BLOCK_BITS };
+	int slot = (int)(blockHash(b) & (vol->slots - 1));
+	while (vol->table[slot] != UNINIT) slot = (slot + 1) & (vol->slots - 1);
+	vol->table[slot] = idx;
+}
+
+// Index of the block holding biased voxel g, allocated if needed. UNINIT if out of memory.
+static int addBlock(TSDF* vol, const int* g){
+	int idx = findBlock(vol, g);
+	if (idx != UNINIT) return idx;
+
+	// Keep the table at most half full.
+	if (2 * (vol->used + 1) > vol->slots){
+		int* table = (int*)malloc(2 * vol->slots * sizeof(int));
+		if (!table) return UNINIT;
+		free(vol->table);
+		vol->table = table;
+		vol->slots *= 2;
+		memset(vol->table, 0xFF, vol->slots * sizeof(int));
+		int i;
+		for (i = 0; i < vol->used; i++) insertBlock(vol, i);
+	}
+	if (vol->used == vol->max){
+		int max = MAX(2 * vol->max, 64);
+		TSDF_BLOCK** block = (TSDF_BLOCK**)realloc(vol->block, max * sizeof(TSDF_BLOCK*));
+		if (!block) return UNINIT;
+		vol->block = block;
+		vol->max = max;
+	}
+
+	TSDF_BLOCK* blk = (TSDF_BLOCK*)malloc(sizeof(TSDF_BLOCK));
+	if (!blk) return UNINIT;
+	int a, v;
+	for (a = 0; a < 3; a++) blk->origin[a] = g[a] & ~(TSDF_BLOCK_DIM - 1);
+	for (v = 0; v < TSDF_VOXELS; v++){
+		blk->d[v] = 1;
+		blk->w[v] = 0;
+	}
+	idx = vol->used++;
+	vol->block[idx] = blk;
+	insertBlock(vol, idx);
+	return idx;
+}
+
+TSDF* createTsdf(float voxel){
+
+	if (!CASES_BUILT) buildCases();
+
+	TSDF* vol = (TSDF*)calloc(1, sizeof(TSDF));
+	if (!vol) return NULL;
+	vol->voxel = voxel;
+	vol->trunc = TSDF_TRUNC_VOXELS * voxel;
+	vol->slots = TSDF_INIT_SLOTS;
+	vol->table = (int*)malloc(vol->slots * sizeof(int));
+	if (!vol->table){
+		free(vol);
+		return NULL;
+	}
+	memset(vol->table, 0xFF, vol->slots * sizeof(int));
+	InitializeCriticalSection(&vol->lock);
+	return vol;
+}
+
+void resetTsdf(TSDF* vol){
+	EnterCriticalSection(&vol->lock);
+	int i;
+	for (i = 0; i < vol->used; i++) free(vol->block[i]);
+	vol->used = 0;
+	memset(vol->table, 0xFF, vol->slots * sizeof(int));
+	LeaveCriticalSection(&vol->lock);
+}
+
+void freeTsdf(TSDF* vol){
+	if (!vol) return;
+	resetTsdf(vol);
+	DeleteCriticalSection(&vol->lock);
+	free(vol->block);
+	free(vol->table);
+	free(vol);
+}
+
+/*********** INTEGRATION ***********/
+
+// Biased voxels whose centres lie within the truncation distance of p, per axis.
+static void sampleRange(const TSDF* vol, const float* p, int* lo, int* hi){
+	int a;
+	for (a = 0; a < 3; a++){
+		lo[a] = (int)ceilf((p[a] - vol->trunc) / vol->voxel - 0.5f) + TSDF_BIAS;
+		hi[a] = (int)floorf((p[a] + vol->trunc) / vol->voxel - 0.5f) + TSDF_BIAS;
+	}
+}
+
+static void fuseTask(void* prm, int idx){
+	FUSE_CTX* ctx = (FUSE_CTX*)prm;
+	const TSDF* vol = ctx->vol;
+	TSDF_BLOCK* blk = vol->block[ctx->touched[idx]];
+	const int* o = blk->origin;
+	float trunc2 = vol->trunc * vol->trunc;
+	int j;
+	for (j = ctx->first[idx]; j < ctx->first[idx + 1]; j++){
+		const float* p = ctx->xyz + 3 * ctx->order[j];
+		const float* n = ctx->nrm + 3 * ctx->order[j];
+		int lo[3], hi[3], a, x, y, z;
+		sampleRange(vol, p, lo, hi);
+		for (a = 0; a < 3; a++){
+			lo[a] = MAX(lo[a], o[a]);
+			hi[a] = MIN(hi[a], o[a] + TSDF_BLOCK_DIM - 1);
+		}
+		for (z = lo[2]; z <= hi[2]; z++){
+			float dz = (z - TSDF_BIAS + 0.5f) * vol->voxel - p[2];
+			for (y = lo[1]; y <= hi[1]; y++){
+				float dy = (y - TSDF_BIAS + 0.5f) * vol->voxel - p[1];
+				for (x = lo[0]; x <= hi[0]; x++){
+					float dx = (x - TSDF_BIAS + 0.5f) * vol->voxel - p[0];
+
+					// Signed distance along the normal, weighted down away from the normal's line.
+					float sd = dx * n[0] + dy * n[1] + dz * n[2];
+					float wt = 1 - (dx * dx + dy * dy + dz * dz - sd * sd) / trunc2;
+					if (sd > vol->trunc || sd < -vol->trunc || wt <= 0) continue;
+
+					int v = ((z - o[2]) * TSDF_BLOCK_DIM + (y - o[1])) * TSDF_BLOCK_DIM + (x - o[0]);
+					float w = blk->w[v];
+					blk->d[v] = (blk->d[v] * w + sd / vol->trunc * wt) / (w + wt);
+					blk->w[v] = (float)MIN(w + wt, TSDF_MAX_WEIGHT);
+				}
+			}
+		}
+	}
+}
+
+// Fuses n samples with unit normals, both interleaved.
+static int fuseSamples(TSDF* vol, const float* xyz, const float* nrm, int n){
+
+	if (n <= 0) return OKAY;
+	EnterCriticalSection(&vol->lock);
+
+	// Blocks: allocated here, at most two per axis and sample.
+	int* pair_block = (int*)malloc(8 * (size_t)n * sizeof(int));
+	int* pair_sample = (int*)malloc(8 * (size_t)n * sizeof(int));
+	int ok = pair_block && pair_sample;
+	int pairs = 0, i;
+	for (i = 0; ok && i < n; i++){
+		int lo[3], hi[3], g[3];
+		sampleRange(vol, xyz + 3 * i, lo, hi);
+		for (g[2] = lo[2] >> TSDF_BLOCK_BITS; ok && g[2] <= hi[2] >> TSDF_BLOCK_BITS; g[2]++){
+			for (g[1] = lo[1] >> TSDF_BLOCK_BITS; ok && g[1] <= hi[1] >> TSDF_BLOCK_BITS; g[1]++){
+				for (g[0] = lo[0] >> TSDF_BLOCK_BITS; ok && g[0] <= hi[0] >> TSDF_BLOCK_BITS; g[0]++){
+					int v[3] = { g[0] << TSDF_BLOCK_BITS, g[1] << TSDF_BLOCK_BITS, g[2] << TSDF_BLOCK_BITS };
+					int b = addBlock(vol, v);
+					ok = b != UNINIT;
+					pair_block[pairs] = b;
+					pair_sample[pairs] = i;
+					pairs++;
+				}
+			}
+		}
+	}
+
+	// Group the samples by block, then update every block on its own.
+	FUSE_CTX ctx;
+	ctx.vol = vol;
+	ctx.xyz = xyz;
+	ctx.nrm = nrm;
+	int* count = ok ? (int*)calloc(vol->used + 1, sizeof(int)) : NULL;
+	ctx.touched = ok ? (int*)malloc((vol->used + 1) * sizeof(int)) : NULL;
+	ctx.first = ok ? (int*)malloc((vol->used + 1) * sizeof(int)) : NULL;
+	ctx.order = ok ? (int*)malloc(MAX(pairs, 1) * sizeof(int)) : NULL;
+	ok = ok && count && ctx.touched && ctx.first && ctx.order;
+	if (ok){
+		int b, ntouched = 0, at = 0;
+		for (i = 0; i < pairs; i++) count[pair_block[i]]++;
+		for (b = 0; b < vol->used; b++){
+			if (!count[b]) continue;
+			ctx.touched[ntouched] = b;
+			ctx.first[ntouched++] = at;
+			at += count[b];
+			count[b] = ctx.first[ntouched - 1];
+		}
+		ctx.first[ntouched] = at;
+		for (i = 0; i < pairs; i++) ctx.order[count[pair_block[i]]++] = pair_sample[i];
+		parallelFor(ntouched, fuseTask, &ctx);
+	}
+
+	LeaveCriticalSection(&vol->lock);
+	free(pair_block);
+	free(pair_sample);
+	free(count);
+	free(ctx.touched);
+	free(ctx.first);
+	free(ctx.order);
+	return ok ? OKAY : ERR;
+}
+
+// Nearest of the TSDF_PROFILE_REACH points before (dir -1) or after (dir 1) entry k of run within the gap, UNINIT if none.
+static int profileNeighbour(const PCLOUD* pc, const int* run, int len, int k, int dir){
+	int i = run[k], best = UNINIT, j;
+	float best_d2 = (float)(NRM_MAX_GAP * NRM_MAX_GAP);
+	for (j = k + dir; j >= 0 && j < len && abs(j - k) <= TSDF_PROFILE_REACH; j += dir){
+		float dx = pc->x[run[j]] - pc->x[i], dy = pc->y[run[j]] - pc->y[i], dz = pc->z[run[j]] - pc->z[i];
+		float d2 = dx * dx + dy * dy + dz * dz;
+		if (d2 <= best_d2){
+			best = run[j];
+			best_d2 = d2;
+		}
+	}
+	return best;
+}
+
+int integrateSteps(TSDF* vol, const PCLOUD* pc, int first, int last){
+
+	int n = last - first;
+	if (n <= 0) return OKAY;
+	int* run = (int*)malloc(n * sizeof(int));
+	float* xyz = (float*)malloc(3 * (size_t)n * sizeof(float));
+	float* nrm = (float*)malloc(3 * (size_t)n * sizeof(float));
+	int ok = run && xyz && nrm;
+
+	// Runs of one step, points at the origin left out.
+	int samples = 0, i = first;
+	while (ok && i < last){
+		int len = 0, step = UNINIT;
+		for (; i < last; i++){
+			if (pc->x[i] == 0 && pc->y[i] == 0 && pc->z[i] == 0) continue;
+			if (len && pc->s[i] != step) break;
+			step = pc->s[i];
+			run[len++] = i;
+		}
+
+		// Laser plane: through the axis and the run's point farthest from it.
+		float h[2] = { 0, 0 }, r2 = 0;
+		int k;
+		for (k = 0; k < len; k++){
+			float x = pc->x[run[k]], y = pc->y[run[k]];
+			if (x * x + y * y <= r2) continue;
+			r2 = x * x + y * y;
+			h[0] = x;
+			h[1] = y;
+		}
+		if (r2 <= 0) continue;
+		float pn[3] = { -h[1] / sqrtf(r2), h[0] / sqrtf(r2), 0 };
+
+		// Profile normal: in the plane, across the profile's tangent.
+		for (k = 0; k < len; k++){
+			int a = profileNeighbour(pc, run, len, k, -1);
+			int b = profileNeighbour(pc, run, len, k, 1);
+			if (a == UNINIT && b == UNINIT) continue;
+			if (a == UNINIT) a = run[k];
+			if (b == UNINIT) b = run[k];
+			float t[3] = { pc->x[b] - pc->x[a], pc->y[b] - pc->y[a], pc->z[b] - pc->z[a] };
+			float* p = xyz + 3 * samples;
+			float* m = nrm + 3 * samples;
+			m[0] = pn[1] * t[2] - pn[2] * t[1];
+			m[1] = pn[2] * t[0] - pn[0] * t[2];
+			m[2] = pn[0] * t[1] - pn[1] * t[0];
+			float len_m = sqrtf(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+			if (len_m <= 0) continue;
+			m[0] /= len_m;
+			m[1] /= len_m;
+			m[2] /= len_m;
+			p[0] = pc->x[run[k]];
+			p[1] = pc->y[run[k]];
+			p[2] = pc->z[run[k]];
+			orientNormal(p, m);
+			samples++;
+		}
+	}
+
+	ok = ok && fuseSamples(vol, xyz, nrm, samples) == OKAY;
+	free(run);
+	free(xyz);
+	free(nrm);
+	return ok ? OKAY : ERR;
+}
+
+int integrateCloud(TSDF* vol, const PCLOUD* pc){
+
+	if (!pc->nx) return ERR;
+	float* xyz = (float*)malloc(3 * (size_t)MAX(pc->used, 1) * sizeof(float));
+	float* nrm = (float*)malloc(3 * (size_t)MAX(pc->used, 1) * sizeof(float));
+	int ok = xyz && nrm;
+	int i, n = 0;
+	for (i = 0; ok && i < pc->used; i++){
+		if (pc->nx[i] == 0 && pc->ny[i] == 0 && pc->nz[i] == 0) continue;
+		xyz[3 * n + 0] = pc->x[i];
+		xyz[3 * n + 1] = pc->y[i];
+		xyz[3 * n + 2] = pc->z[i];
+		nrm[3 * n + 0] = pc->nx[i];
+		nrm[3 * n + 1] = pc->ny[i];
+		nrm[3 * n + 2] = pc->nz[i];
+		n++;
+	}
+	ok = ok && fuseSamples(vol, xyz, nrm, n) == OKAY;
+	free(xyz);
+	free(nrm);
+	return ok ? OKAY : ERR;
+}
+
+/*********** MARCHING CUBES ***********/
+
+// Distance at biased voxel g, found from block bi first. Returns 0 if the voxel was never observed.
+static int voxelAt(const TSDF* vol, int bi, const int* g, float* d, int* block, int* v){
+	const int* o = vol->block[bi]->origin;
+	if (g[0] - o[0] >= TSDF_BLOCK_DIM || g[1] - o[1] >= TSDF_BLOCK_DIM || g[2] - o[2] >= TSDF_BLOCK_DIM){
+		bi = findBlock(vol, g);
+		if (bi == UNINIT) return 0;
+		o = vol->block[bi]->origin;
+	}
+	int k = ((g[2] - o[2]) * TSDF_BLOCK_DIM + (g[1] - o[1])) * TSDF_BLOCK_DIM + (g[0] - o[0]);
+	if (vol->block[bi]->w[k] <= 0) return 0;
+	*d = vol->block[bi]->d[k];
+	if (block) *block = bi;
+	if (v) *v = k;
+	return 1;
+}
+
+// Case of the cube whose lowest corner is g, UNINIT unless all its corners were observed.
+static int cubeCase(const TSDF* vol, int bi, const int* g){
+	int c, mask = 0;
+	for (c = 0; c < 8; c++){
+		int h[3] = { g[0] + (c & 1), g[1] + (c >> 1 & 1), g[2] + (c >> 2 & 1) };
+		float d;
+		if (!voxelAt(vol, bi, h, &d, NULL, NULL)) return UNINIT;
+		if (d < 0) mask |= 1 << c;
+	}
+	return mask;
+}
+
+static void countTask(void* prm, int idx){
+	MC_CTX* ctx = (MC_CTX*)prm;
+	const TSDF* vol = ctx->vol;
+	const TSDF_BLOCK* blk = vol->block[idx];
+	unsigned short* vid = ctx->vid + (size_t)idx * TSDF_VOXELS * 3;
+	int verts = 0, tris = 0, v, a;
+	for (v = 0; v < TSDF_VOXELS; v++){
+		int g[3] = { blk->origin[0] + v % TSDF_BLOCK_DIM, blk->origin[1] + v / TSDF_BLOCK_DIM % TSDF_BLOCK_DIM, blk->origin[2] + v / (TSDF_BLOCK_DIM * TSDF_BLOCK_DIM) };
+		for (a = 0; a < 3; a++){
+			vid[3 * v + a] = TSDF_NO_VERTEX;
+			if (blk->w[v] <= 0) continue;
+			int h[3] = { g[0], g[1], g[2] };
+			h[a]++;
+			float d;
+			if (voxelAt(vol, idx, h, &d, NULL, NULL) && (d < 0) != (blk->d[v] < 0)) vid[3 * v + a] = (unsigned short)verts++;
+		}
+		int mask = (blk->w[v] > 0) ? cubeCase(vol, idx, g) : UNINIT;
+		if (mask != UNINIT) tris += CASE_COUNT[mask];
+	}
+	ctx->vfirst[idx] = verts;
+	ctx->tfirst[idx] = tris;
+}
+
+static void writeTask(void* prm, int idx){
+	MC_CTX* ctx = (MC_CTX*)prm;
+	const TSDF* vol = ctx->vol;
+	const TSDF_BLOCK* blk = vol->block[idx];
+	const unsigned short* vid = ctx->vid + (size_t)idx * TSDF_VOXELS * 3;
+	PCLOUD* out = &ctx->mesh->v;
+	int* tri = ctx->mesh->tri + 3 * (size_t)ctx->tfirst[idx];
+	int v, a, t, e;
+	for (v = 0; v < TSDF_VOXELS; v++){
+		int g[3] = { blk->origin[0] + v % TSDF_BLOCK_DIM, blk->origin[1] + v / TSDF_BLOCK_DIM % TSDF_BLOCK_DIM, blk->origin[2] + v / (TSDF_BLOCK_DIM * TSDF_BLOCK_DIM) };
+
+		// Vertices on this voxel's edges, where the distance crosses zero.
+		for (a = 0; a < 3; a++){
+			if (vid[3 * v + a] == TSDF_NO_VERTEX) continue;
+			int h[3] = { g[0], g[1], g[2] };
+			h[a]++;
+			float d;
+			voxelAt(vol, idx, h, &d, NULL, NULL);
+			float f = blk->d[v] / (blk->d[v] - d);
+			float p[3] = { (g[0] - TSDF_BIAS + 0.5f) * vol->voxel, (g[1] - TSDF_BIAS + 0.5f) * vol->voxel, (g[2] - TSDF_BIAS + 0.5f) * vol->voxel };
+			p[a] += f * vol->voxel;
+			int o = ctx->vfirst[idx] + vid[3 * v + a];
+			out->x[o] = p[0];
+			out->y[o] = p[1];
+			out->z[o] = p[2];
+			out->s[o] = UNINIT;
+		}
+
+		// Triangles of the cube above it, referring to the vertices of whichever voxels own their edges.
+		int mask = (blk->w[v] > 0) ? cubeCase(vol, idx, g) : UNINIT;
+		if (mask == UNINIT) continue;
+		for (t = 0; t < CASE_COUNT[mask]; t++){
+			for (e = 0; e < 3; e++){
+				int edge = CASE_EDGES[mask][3 * t + e];
+				int c = EDGE_CORNER[edge];
+				int h[3] = { g[0] + (c & 1), g[1] + (c >> 1 & 1), g[2] + (c >> 2 & 1) };
+				int ob = idx, ov = 0;
+				float d;
+				voxelAt(vol, idx, h, &d, &ob, &ov);
+				*tri++ = ctx->vfirst[ob] + ctx->vid[((size_t)ob * TSDF_VOXELS + ov) * 3 + EDGE_AXIS[edge]];
+			}
+		}
+	}
+}
+
+int extractMesh(TSDF* vol, MESH* mesh){
+
+	memset(mesh, 0, sizeof(MESH));
+	EnterCriticalSection(&vol->lock);
+
+	MC_CTX ctx;
+	ctx.vol = vol;
+	ctx.mesh = mesh;
+	ctx.vid = (unsigned short*)malloc((size_t)MAX(vol->used, 1) * TSDF_VOXELS * 3 * sizeof(unsigned short));
+	ctx.vfirst = (int*)malloc((vol->used + 1) * sizeof(int));
+	ctx.tfirst = (int*)malloc((vol->used + 1) * sizeof(int));
+	int ok = ctx.vid && ctx.vfirst && ctx.tfirst;
+
+	if (ok){
+		// Count per block, then place every block's vertices and triangles after those of the blocks before it.
+		parallelFor(vol->used, countTask, &ctx);
+		int b, verts = 0, tris = 0;
+		for (b = 0; b < vol->used; b++){
+			int nv = ctx.vfirst[b], nt = ctx.tfirst[b];
+			ctx.vfirst[b] = verts;
+			ctx.tfirst[b] = tris;
+			verts += nv;
+			tris += nt;
+		}
+		ok = allocMesh(mesh, MAX(verts, 1), MAX(tris, 1), 0) == OKAY;
+		if (ok){
+			parallelFor(vol->used, writeTask, &ctx);
+			mesh->v.used = verts;
+			mesh->used = tris;
+		}
+		if (DBG_LOG) printf("Meshed %d blocks into %d vertices and %d triangles. \n", vol->used, verts, tris);
+	}
+
+	LeaveCriticalSection(&vol->lock);
+	free(ctx.vid);
+	free(ctx.vfirst);
+	free(ctx.tfirst);
+	return ok ? OKAY : ERR;
+}
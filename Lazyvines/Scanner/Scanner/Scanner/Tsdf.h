@@ -0,0 +1,72 @@
+/************************************************************************************************************************
+
+TSDF Volume: Volumetric fusion of every camera's points into one watertight mesh.
+Points are integrated into a sparse grid of truncated signed distances: voxels live in blocks of TSDF_BLOCK_DIM^3,
+allocated on demand and found through a hash map, so only the shell around the surface costs memory. Each sample
+updates the voxels within TSDF_TRUNC_VOXELS of it with its distance along its normal, weighted by how close they lie
+to the normal's line, as a running average. Overlapping cameras and steps average out instead of stacking shells,
+and concave regions seen from several sides close up where the direct lattice leaves holes.
+
+Integration: A sample's blocks are allocated first, then the samples are grouped by block and every block is
+updated on its own thread, so no two threads ever touch one voxel.
+* integrateSteps fuses the points of some steps of one camera as soon as they are translated (see CAMERA.tsdf),
+  with the normal of the laser profile within the laser plane (its tangent across the plane is not known yet).
+* integrateCloud fuses a finished cloud with its estimated normals (Normals.h).
+Both are safe to call concurrently and may interleave with extractMesh, e.g. for a preview during the scan.
+
+Extraction: Marching cubes over the observed voxels, in parallel per block. Vertices sit on voxel edges and are shared
+by all cubes around them. The case table is derived from one face rule (the inside corners of a face are kept
+apart), so neighbouring cubes always agree on their common face and the mesh has no cracks.
+
+*************************************************************************************************************************/
+
+#pragma once
+
+#include <windows.h>
+
+#include "Config.h"
+#include "PointCloud.h"
+#include "Mesh.h"
+
+#define TSDF_VOXEL_PIXELS		2.0			// Default voxel edge in image pixels
+#define TSDF_BLOCK_BITS			3			// Blocks of 2^TSDF_BLOCK_BITS voxels per axis
+#define TSDF_BLOCK_DIM			(1 << TSDF_BLOCK_BITS)
+#define TSDF_TRUNC_VOXELS		4			// Truncation distance in voxels, at most half a block
+#define TSDF_MAX_WEIGHT			64.0		// Weight a voxel saturates at, so late samples still count
+#define TSDF_PROFILE_REACH		4			// Points searched either way along a profile for its tangent
+
+// Structures
+typedef struct {
+	int origin[3];				// Biased voxel coordinates of the block's first voxel
+	float d[TSDF_BLOCK_DIM * TSDF_BLOCK_DIM * TSDF_BLOCK_DIM];		// Signed distance / truncation, x fastest
+	float w[TSDF_BLOCK_DIM * TSDF_BLOCK_DIM * TSDF_BLOCK_DIM];		// Weight, 0 if never observed
+}TSDF_BLOCK;
+
+typedef struct {
+	float voxel;				// Voxel edge in point units
+	float trunc;
+	TSDF_BLOCK** block;
+	int used;					// Blocks
+	int max;
+	int* table;					// Block index per slot, UNINIT if free
+	int slots;					// Power of two
+	CRITICAL_SECTION lock;
+}TSDF;
+
+// Empty volume with voxels of the given edge in point units. Returns NULL if out of memory.
+TSDF* createTsdf(float voxel);
+void freeTsdf(TSDF* vol);
+
+// Drops every block, e.g. before the next scan.
+void resetTsdf(TSDF* vol);
+
+// Fuses points [first, last) of pc, in extraction order: steps ascending, rows ascending within a step.
+// Returns OKAY, ERR if out of memory (the volume keeps what was fused before).
+int integrateSteps(TSDF* vol, const PCLOUD* pc, int first, int last);
+
+// Fuses every point of pc with a non-zero normal. Returns ERR if pc has no normals or out of memory.
+int integrateCloud(TSDF* vol, const PCLOUD* pc);
+
+// Marching cubes mesh of the volume's zero crossing into mesh, which is allocated here (vertex steps UNINIT).
+// Returns OKAY on success, ERR otherwise (mesh is left empty).
+int extractMesh(TSDF* vol, MESH* mesh);